@@ -0,0 +1,608 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "scanbd_dbus.h"
+#include "action.h"
+#include "launch.h"
+#include "metrics.h"
+#include <stdint.h>
+
+// the executor mutex protects the ready list, all queues and the
+// counters
+// the scripts are always run without this mutex held
+static pthread_mutex_t exec_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signaled if a queue gets ready or the executor should stop
+static pthread_cond_t exec_cv = PTHREAD_COND_INITIALIZER;
+
+// the queues with pending jobs and no running job (FIFO), one list
+// for each priority class
+static action_queue_t* exec_ready_head[CFG_PRIORITIES];
+static action_queue_t* exec_ready_tail[CFG_PRIORITIES];
+// the (not removed) queues of each priority class
+static int exec_queues[CFG_PRIORITIES];
+// the workers of the actual executor running a script
+static int exec_busy = 0;
+
+// the running jobs of removed queues (see action_queue_remove())
+static action_job_t* exec_detached = NULL;
+
+static pthread_t* exec_workers = NULL;
+static int exec_num_workers = 0;
+static int exec_depth = 1;
+// the cpus of the workers (see C_SCRIPT_CPUS)
+static cpu_policy_t exec_policy;
+static bool exec_running = false;
+// each start begins a new generation: a worker of a stopped executor
+// ends after its running script, even if the executor was restarted
+// meanwhile
+static unsigned long exec_generation = 0;
+
+static action_stats_t exec_stats = {0, 0, 0, 0};
+
+static void action_job_free(action_job_t* job) {
+    assert(job != NULL);
+    if (job->env != NULL) {
+        // a single block (see script_env_build())
+        free(job->env);
+    }
+    free(job->script);
+    free(job->device);
+    stats_device_put(job->stats);
+    free(job);
+}
+
+// appends q to the ready list of its class
+// must be called with the exec_mutex held
+static void ready_push(action_queue_t* q) {
+    assert(!q->ready);
+    q->next = NULL;
+    if (exec_ready_tail[q->priority] != NULL) {
+        exec_ready_tail[q->priority]->next = q;
+    }
+    else {
+        exec_ready_head[q->priority] = q;
+    }
+    exec_ready_tail[q->priority] = q;
+    q->ready = true;
+}
+
+// must be called with the exec_mutex held
+static action_queue_t* ready_pop(int priority) {
+    action_queue_t* q = exec_ready_head[priority];
+    if (q == NULL) {
+        return NULL;
+    }
+    exec_ready_head[priority] = q->next;
+    if (exec_ready_head[priority] == NULL) {
+        exec_ready_tail[priority] = NULL;
+    }
+    q->next = NULL;
+    q->ready = false;
+    return q;
+}
+
+// the number of workers the scripts of the class priority may
+// occupy: each more urgent class with queues keeps one worker free,
+// the last worker is shared by the remaining classes
+// must be called with the exec_mutex held
+static int exec_slots(int priority) {
+    int slots = exec_num_workers;
+    for(int p = 0; p < priority; p += 1) {
+        if (exec_queues[p] > 0) {
+            slots -= 1;
+        }
+    }
+    return (slots > 1) ? slots : 1;
+}
+
+// the ready queue to run next: the first one of the most urgent class
+// with a free worker, NULL if there is none
+// must be called with the exec_mutex held
+static action_queue_t* ready_next(void) {
+    for(int p = 0; p < CFG_PRIORITIES; p += 1) {
+        if ((exec_ready_head[p] != NULL) && (exec_busy < exec_slots(p))) {
+            return ready_pop(p);
+        }
+    }
+    return NULL;
+}
+
+// must be called with the exec_mutex held
+static void ready_remove(action_queue_t* q) {
+    action_queue_t** p = &exec_ready_head[q->priority];
+    action_queue_t* prev = NULL;
+    while(*p != NULL) {
+        if (*p == q) {
+            *p = q->next;
+            if (exec_ready_tail[q->priority] == q) {
+                exec_ready_tail[q->priority] = prev;
+            }
+            q->next = NULL;
+            q->ready = false;
+            return;
+        }
+        prev = *p;
+        p = &((*p)->next);
+    }
+}
+
+// must be called with the exec_mutex held
+static void detached_remove(action_job_t* job) {
+    action_job_t** p = &exec_detached;
+    while(*p != NULL) {
+        if (*p == job) {
+            *p = job->next;
+            job->next = NULL;
+            return;
+        }
+        p = &((*p)->next);
+    }
+}
+
+// true, if the script of a removed queue of device still runs
+// must be called with the exec_mutex held
+static bool detached_running(const char* device) {
+    for(const action_job_t* job = exec_detached; job != NULL; job = job->next) {
+        if (strcmp(job->device, device) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// must be called with the exec_mutex held
+static action_job_t* queue_pop(action_queue_t* q) {
+    action_job_t* job = q->head;
+    if (job == NULL) {
+        return NULL;
+    }
+    q->head = job->next;
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+    job->next = NULL;
+    q->depth -= 1;
+    exec_stats.queued -= 1;
+    return job;
+}
+
+// runs the script of the job and waits for it
+// called without the exec_mutex held, the job may be detached
+// meanwhile: only the job itself is used
+static void action_job_run(action_job_t* job) {
+    // sleep the timeout to settle devices
+    usleep(job->settle * 1000); //ms
+
+    if (strcmp(job->script, SCANBD_NULL_STRING) != 0) {
+        stats_record(job->stats, STATS_LATENCY, stats_since(&job->detected));
+        struct timespec start;
+        stats_now(&start);
+        pid_t cpid = launch_script(job->script, job->env, &job->policy);
+        if (cpid > 0) {
+            int status = launch_wait(cpid, job->script);
+            stats_record(job->stats, STATS_RUNTIME, stats_since(&start));
+            if (status >= 0) {
+                metrics_script_exit(job->device, status);
+            }
+        }
+    } // script == SCANBD_NULL_STRING
+
+    // sleep the timeout to settle devices, necessary?
+    usleep(job->settle * 1000); //ms
+
+    // send out the debus signal
+    dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_END, job->device);
+}
+
+static void* action_worker(void* arg) {
+    unsigned long generation = (unsigned long)(uintptr_t)arg;
+    slog(SLOG_DEBUG, "action_worker");
+    // we only expect the main thread to handle signals
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return NULL;
+    }
+    // off the cpus of the pollers, the scripts inherit the cpus
+    cpu_policy_thread(&exec_policy, "action worker");
+    while(exec_running && (generation == exec_generation)) {
+        action_queue_t* q = ready_next();
+        if (q == NULL) {
+            if (pthread_cond_wait(&exec_cv, &exec_mutex) < 0) {
+                slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(errno));
+            }
+            continue;
+        }
+        action_job_t* job = queue_pop(q);
+        assert(job != NULL);
+        job->policy = q->policy;
+        q->running = true;
+        q->active = job;
+        exec_stats.running += 1;
+        exec_busy += 1;
+        if (pthread_mutex_unlock(&exec_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+
+        slog(SLOG_DEBUG, "action_worker: running %s for device %s", job->script, job->device);
+        action_job_run(job);
+
+        if (pthread_mutex_lock(&exec_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+            return NULL;
+        }
+        exec_stats.running -= 1;
+        exec_stats.executed += 1;
+        if (generation == exec_generation) {
+            exec_busy -= 1;
+        }
+        q = job->queue;
+        if (q != NULL) {
+            q->running = false;
+            q->active = NULL;
+            q->executed += 1;
+            if ((q->head != NULL) && !q->removed) {
+                // the next job of this device
+                ready_push(q);
+            }
+        }
+        else {
+            // the queue was removed meanwhile
+            detached_remove(job);
+        }
+        action_job_free(job);
+        // a worker got free for the other classes
+        if (pthread_cond_broadcast(&exec_cv)) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+    }
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return NULL;
+}
+
+// starts workers threads executing the action scripts, each device
+// can have up to depth pending jobs
+void action_executor_start(int workers, int depth, const cpu_policy_t* policy) {
+    slog(SLOG_DEBUG, "action_executor_start");
+    assert(policy != NULL);
+    if (workers < 1) {
+        workers = 1;
+    }
+    if (depth < 1) {
+        depth = 1;
+    }
+
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (exec_running) {
+        slog(SLOG_DEBUG, "action executor already running");
+        goto cleanup;
+    }
+    exec_workers = (pthread_t*) calloc(workers, sizeof(pthread_t));
+    if (exec_workers == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for action workers");
+        exit(EXIT_FAILURE);
+    }
+    exec_running = true;
+    exec_num_workers = workers;
+    exec_depth = depth;
+    exec_policy = *policy;
+    exec_busy = 0;
+    exec_generation += 1;
+    for(int i = 0; i < workers; i += 1) {
+        if (pthread_create(&exec_workers[i], NULL, action_worker,
+                           (void*)(uintptr_t)exec_generation) < 0) {
+            slog(SLOG_ERROR, "Can't start action worker: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    slog(SLOG_INFO, "action executor started with %d workers, queue depth %d",
+         workers, depth);
+cleanup:
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// the queues should be removed before, otherwise the pending jobs
+// are not executed
+// the workers are detached: an idle worker ends at once, a worker
+// running a script after the script
+void action_executor_stop(void) {
+    slog(SLOG_DEBUG, "action_executor_stop");
+
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (!exec_running) {
+        if (pthread_mutex_unlock(&exec_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+        return;
+    }
+    exec_running = false;
+    if (pthread_cond_broadcast(&exec_cv)) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+    for(int p = 0; p < CFG_PRIORITIES; p += 1) {
+        while(exec_ready_head[p] != NULL) {
+            slog(SLOG_WARN, "action executor: queue of device %s not removed",
+                 exec_ready_head[p]->device);
+            ready_pop(p);
+        }
+    }
+    unsigned int running = exec_stats.running;
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+
+    for(int i = 0; i < exec_num_workers; i += 1) {
+        if (pthread_detach(exec_workers[i]) != 0) {
+            slog(SLOG_ERROR, "pthread_detach: %s", strerror(errno));
+        }
+    }
+    free(exec_workers);
+    exec_workers = NULL;
+    exec_num_workers = 0;
+    slog(SLOG_INFO, "action executor stopped (%u scripts still running)", running);
+}
+
+void action_executor_stats(action_stats_t* stats) {
+    assert(stats != NULL);
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    *stats = exec_stats;
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void action_queue_init(action_queue_t* q, const char* device) {
+    assert(q != NULL);
+    assert(device != NULL);
+    q->device = device;
+    q->head = NULL;
+    q->tail = NULL;
+    q->depth = 0;
+    q->active = NULL;
+    q->running = false;
+    q->ready = false;
+    q->removed = false;
+    q->priority = CFG_PRIORITY_NORMAL;
+    cpu_policy_init(&q->policy);
+    q->executed = 0;
+    q->dropped = 0;
+    q->stats = stats_device(device);
+    q->next = NULL;
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    exec_queues[q->priority] += 1;
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// moves the queue to the class priority (all queues start as
+// CFG_PRIORITY_NORMAL)
+void action_queue_priority(action_queue_t* q, cfg_priority_t priority) {
+    assert(q != NULL);
+    assert((priority >= 0) && (priority < CFG_PRIORITIES));
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (q->removed || (q->priority == priority)) {
+        goto cleanup;
+    }
+    bool ready = q->ready;
+    if (ready) {
+        ready_remove(q);
+    }
+    exec_queues[q->priority] -= 1;
+    q->priority = priority;
+    exec_queues[q->priority] += 1;
+    if (ready) {
+        ready_push(q);
+    }
+    // the free workers of the classes have changed
+    if (pthread_cond_broadcast(&exec_cv)) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+cleanup:
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void action_queue_policy(action_queue_t* q, const cpu_policy_t* policy) {
+    assert(q != NULL);
+    assert(policy != NULL);
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    q->policy = *policy;
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// queues the script with the environment env (the job takes over
+// env, a dropped job frees it). The script is copied, the rule it
+// comes from may be replaced by a reload while the job is pending
+// returns false, if the job was dropped
+bool action_queue_submit(action_queue_t* q, const char* script, char** env, int settle) {
+    assert(q != NULL);
+    assert(script != NULL);
+
+    action_job_t* job = (action_job_t*) calloc(1, sizeof(action_job_t));
+    if (job == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for action job");
+        exit(EXIT_FAILURE);
+    }
+    job->script = strdup(script);
+    if (job->script == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for action job");
+        exit(EXIT_FAILURE);
+    }
+    job->env = env;
+    job->settle = settle;
+    stats_now(&job->detected);
+    job->device = strdup(q->device);
+    if (job->device == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for action job");
+        exit(EXIT_FAILURE);
+    }
+    job->queue = q;
+    job->next = NULL;
+
+    bool queued = false;
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_END, job->device);
+        action_job_free(job);
+        return false;
+    }
+    if (!exec_running || q->removed) {
+        slog(SLOG_WARN, "action executor not running, dropping %s for device %s",
+             script, q->device);
+        goto cleanup;
+    }
+    if (q->depth >= exec_depth) {
+        slog(SLOG_WARN, "action queue of device %s full (%d), dropping %s",
+             q->device, q->depth, script);
+        q->dropped += 1;
+        exec_stats.dropped += 1;
+        goto cleanup;
+    }
+    // a detached job records after its queue is removed
+    job->stats = stats_device_get(q->stats);
+    if (q->tail != NULL) {
+        q->tail->next = job;
+    }
+    else {
+        q->head = job;
+    }
+    q->tail = job;
+    q->depth += 1;
+    exec_stats.queued += 1;
+    queued = true;
+    if (!q->running && !q->ready) {
+        ready_push(q);
+        // a signaled worker may not serve the class of q, all check
+        if (pthread_cond_broadcast(&exec_cv)) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+    }
+    slog(SLOG_DEBUG, "queued %s for device %s (%d pending)", script, q->device, q->depth);
+cleanup:
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (!queued) {
+        // the poller has sent scan_begin: the dropped job ends the scan
+        dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_END, job->device);
+        action_job_free(job);
+    }
+    return queued;
+}
+
+// true, if a job of the queue is pending or running, or the script of
+// a removed queue of the same device still runs: the device is in use
+// by a script
+bool action_queue_busy(action_queue_t* q) {
+    assert(q != NULL);
+    bool busy = false;
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    busy = q->running || (q->head != NULL) || detached_running(q->device);
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return busy;
+}
+
+// drops the pending jobs of the queue, a running job is detached:
+// its script goes on, the queue can be freed right after the call
+void action_queue_remove(action_queue_t* q) {
+    assert(q != NULL);
+    if (pthread_mutex_lock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (!q->removed) {
+        q->removed = true;
+        exec_queues[q->priority] -= 1;
+        // the jobs hold the statistics on their own
+        stats_device_put(q->stats);
+        q->stats = NULL;
+    }
+    if (q->ready) {
+        ready_remove(q);
+    }
+    // the dropped jobs end their scans after the unlock
+    action_job_t* dropped = NULL;
+    action_job_t* job = NULL;
+    while((job = queue_pop(q)) != NULL) {
+        slog(SLOG_WARN, "dropping pending %s for device %s", job->script, q->device);
+        q->dropped += 1;
+        exec_stats.dropped += 1;
+        job->next = dropped;
+        dropped = job;
+    }
+    if (q->running) {
+        action_job_t* active = q->active;
+        assert(active != NULL);
+        slog(SLOG_INFO, "script %s of device %s keeps running", active->script, q->device);
+        active->queue = NULL;
+        active->next = exec_detached;
+        exec_detached = active;
+        q->active = NULL;
+        q->running = false;
+    }
+    slog(SLOG_DEBUG, "action queue of device %s removed: %lu executed, %lu dropped",
+         q->device, q->executed, q->dropped);
+    if (pthread_mutex_unlock(&exec_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    while((job = dropped) != NULL) {
+        dropped = job->next;
+        // the poller has sent scan_begin for each dropped job
+        dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_END, job->device);
+        action_job_free(job);
+    }
+}
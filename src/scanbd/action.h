@@ -0,0 +1,104 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef ACTION_H
+#define ACTION_H
+
+#include "common.h"
+#include "config.h"
+#include "stats.h"
+
+// the action executor: the action scripts of all devices are run by a
+// small pool of worker threads, the polling threads only queue the
+// jobs and never wait for a script. The jobs of one device run one
+// after the other (the script uses the device), the jobs of different
+// devices run concurrently up to the number of workers: the ready
+// queues of a more urgent priority class go first, and the scripts of
+// a class leave one worker free for each more urgent class with queues
+// (see action_queue_priority()).
+// Neither the removal of a queue nor a stop of the executor waits for
+// a running script: the job is detached and its script goes on, the
+// device stays busy (see action_queue_busy()) until the script ends.
+
+struct action_job {
+    char* script;              // absolute path or SCANBD_NULL_STRING (a copy)
+    char** env;                // the environment (NULL terminated, owned,
+                               // a single block from script_env_build())
+    int settle;                // ms to sleep before and after the script
+    struct timespec detected;  // the trigger was detected (queued) at
+    char* device;              // the device name (a copy, the queue may
+                               // be removed while the script runs)
+    stats_device_t* stats;     // the latency statistics of the device (held)
+    struct action_queue* queue;// the queue of the job, NULL if the queue
+                               // was removed while the job runs (detached)
+    cpu_policy_t policy;       // the cpus and nice value of the script
+                               // (of the queue when the job started)
+    struct action_job* next;
+};
+typedef struct action_job action_job_t;
+
+// the job queue of one device
+struct action_queue {
+    const char* device;        // the device name (for the scan_end signal)
+    action_job_t* head;        // the pending jobs
+    action_job_t* tail;
+    int depth;                 // the number of pending jobs
+    action_job_t* active;      // the running job
+    bool running;              // a job of this queue is executed
+    bool ready;                // this queue is in the ready list
+    bool removed;              // no more jobs are accepted
+    cfg_priority_t priority;   // the class (and ready list) of the queue
+    cpu_policy_t policy;       // the cpus and nice value of the scripts
+    unsigned long executed;    // the number of executed jobs
+    unsigned long dropped;     // the number of dropped jobs
+    stats_device_t* stats;     // the latency statistics of the device
+    struct action_queue* next; // the ready list
+};
+typedef struct action_queue action_queue_t;
+
+struct action_stats {
+    unsigned int running;      // the number of running scripts
+    unsigned int queued;       // the number of pending jobs
+    unsigned int executed;     // the number of executed jobs
+    unsigned int dropped;      // the number of dropped jobs (queue full)
+};
+typedef struct action_stats action_stats_t;
+
+// policy: the cpus of the workers, the scripts inherit them (see
+// C_SCRIPT_CPUS)
+extern void action_executor_start(int workers, int depth, const cpu_policy_t* policy);
+extern void action_executor_stop(void);
+extern void action_executor_stats(action_stats_t* stats);
+
+extern void action_queue_init(action_queue_t* q, const char* device);
+// queues the script of a triggered action (the job takes over env),
+// returns false if the job is dropped (the queue is full or removed):
+// its scan_end signal is sent at once
+extern bool action_queue_submit(action_queue_t* q, const char* script, char** env, int settle);
+extern bool action_queue_busy(action_queue_t* q);
+extern void action_queue_remove(action_queue_t* q);
+extern void action_queue_priority(action_queue_t* q, cfg_priority_t priority);
+// the cpus and nice value of the scripts of the queue (see
+// cfg_device_policy()), applied to each script after its spawn
+extern void action_queue_policy(action_queue_t* q, const cpu_policy_t* policy);
+
+#endif // ACTION_H
@@ -52,6 +52,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pwd.h>
 #include <grp.h>
 #include <string.h>
@@ -61,6 +62,7 @@
 #include <sys/select.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <spawn.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
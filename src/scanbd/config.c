@@ -21,15 +21,385 @@
  */
 
 #include "scanbd.h"
+#include "config_snapshot.h"
+#include "launch.h"
 #include <libgen.h>
 
-// parsing the config-file via libconfuse
-void cfg_do_parse(const char *config_file_name) {
+// the compiled rule set of the actual config
+static cfg_rules_t* rules = NULL;
+const cfg_rules_t* cfg_rules = NULL;
+
+// the scripts are checked with the ids they run with: the first parse
+// is done before the privilege drop, its scripts are checked by
+// cfg_check_scripts() afterwards
+static bool cfg_scripts_checked = false;
+
+// the hash of the generation of the rule set (see cfg_rules_t), with
+// the terminating NUL: "ab" "c" and "a" "bc" differ
+static uint64_t cfg_hash_str(const char* s, uint64_t h) {
+    return config_snapshot_hash(s, strlen(s) + 1, h);
+}
+
+// compiles the regex, on error a warning is logged and false returned
+static bool cfg_regcomp(regex_t* reg, const char* regex) {
+    assert(reg != NULL);
+    assert(regex != NULL);
+    int ret = regcomp(reg, regex, REG_EXTENDED | REG_NOSUB);
+    if (ret != 0) {
+        char err_text[1024];
+        regerror(ret, reg, err_text, 1024);
+        slog(SLOG_WARN, "Can't compile regex: %s : %s", regex, err_text);
+        return false;
+    }
+    return true;
+}
+
+static void cfg_rule_section_free(cfg_rule_section_t* rs, bool has_filter) {
+    for(int i = 0; i < rs->num_actions; i += 1) {
+        cfg_rule_action_t* a = &rs->actions[i];
+        regfree(&a->filter_reg);
+        if (a->pred.str_valid) {
+            predicate_match_free(&a->pred.str_from);
+            predicate_match_free(&a->pred.str_to);
+        }
+        free(a->script);
+    }
+    free(rs->actions);
+    rs->actions = NULL;
+    rs->num_actions = 0;
+    for(int i = 0; i < rs->num_functions; i += 1) {
+        regfree(&rs->functions[i].filter_reg);
+    }
+    free(rs->functions);
+    rs->functions = NULL;
+    rs->num_functions = 0;
+    if (has_filter) {
+        regfree(&rs->filter_reg);
+    }
+}
+
+static void cfg_rules_free(cfg_rules_t* r) {
+    if (r == NULL) {
+        return;
+    }
+    cfg_rule_section_free(&r->global, false);
+    for(int i = 0; i < r->num_devices; i += 1) {
+        cfg_rule_section_free(&r->devices[i], true);
+    }
+    free(r->devices);
+    free(r->insert_script);
+    free(r->remove_script);
+    free(r);
+}
+
+// the priority class of the section sec, -1 if it doesn't set one
+static int cfg_priority_build(cfg_t* sec, const char* title) {
+    if (cfg_size(sec, C_PRIORITY) == 0) {
+        return -1;
+    }
+    const char* priority = cfg_getstr(sec, C_PRIORITY);
+    if (priority == NULL) {
+        return -1;
+    }
+    if (strcmp(priority, C_PRIORITY_INTERACTIVE) == 0) {
+        return CFG_PRIORITY_INTERACTIVE;
+    }
+    if (strcmp(priority, C_PRIORITY_BACKGROUND) == 0) {
+        return CFG_PRIORITY_BACKGROUND;
+    }
+    if (strcmp(priority, C_PRIORITY_NORMAL) != 0) {
+        slog(SLOG_WARN, "unknown priority %s of section %s, using %s", priority, title,
+             C_PRIORITY_NORMAL);
+    }
+    return CFG_PRIORITY_NORMAL;
+}
+
+// the cpus param of the section sec into p, an empty list or an
+// invalid one leaves them unset
+static void cfg_cpus_build(cpu_policy_t* p, cfg_t* sec, const char* param, const char* title) {
+    if (cfg_size(sec, param) == 0) {
+        return;
+    }
+    const char* list = cfg_getstr(sec, param);
+    if ((list == NULL) || (strlen(list) == 0)) {
+        return;
+    }
+    if (!cpu_policy_parse_cpus(p, list)) {
+        slog(SLOG_WARN, "invalid cpu list %s of %s in section %s, ignored", list, param, title);
+    }
+}
+
+// the int param of the section sec in [0, max], CPU_POLICY_UNSET if
+// the section doesn't set it
+static int cfg_policy_int_build(cfg_t* sec, const char* param, int max, const char* title) {
+    if (cfg_size(sec, param) == 0) {
+        return CPU_POLICY_UNSET;
+    }
+    int value = cfg_getint(sec, param);
+    if ((value < 0) || (value > max)) {
+        int clamped = (value < 0) ? 0 : max;
+        slog(SLOG_WARN, "%s %d of section %s out of range, using %d", param, value, title, clamped);
+        value = clamped;
+    }
+    return value;
+}
+
+// the cpu policies of the pollers and scripts of the section sec
+static void cfg_policy_build(cfg_rule_section_t* rs, cfg_t* sec, const char* title) {
+    cpu_policy_init(&rs->poll);
+    cpu_policy_init(&rs->script);
+    cfg_cpus_build(&rs->poll, sec, C_POLL_CPUS, title);
+    cfg_cpus_build(&rs->script, sec, C_SCRIPT_CPUS, title);
+    rs->poll.rtprio = cfg_policy_int_build(sec, C_POLL_RTPRIO, C_POLL_RTPRIO_MAX, title);
+    rs->script.nice = cfg_policy_int_build(sec, C_SCRIPT_NICE, C_SCRIPT_NICE_MAX, title);
+}
+
+// the unset fields of a global policy get the defaults: all cpus of
+// the daemon, the scheduling of the priority class and no nice value
+static void cfg_policy_complete(cpu_policy_t* p) {
+    if (!p->has_cpus) {
+        p->has_cpus = true;
+        p->cpus = 0;
+    }
+    if (p->rtprio == CPU_POLICY_UNSET) {
+        p->rtprio = 0;
+    }
+    if (p->nice == CPU_POLICY_UNSET) {
+        p->nice = 0;
+    }
+}
+
+// compiles the functions and actions of the section sec
+static void cfg_rule_section_build(cfg_rule_section_t* rs, cfg_t* sec, const char* title) {
+    rs->title = title;
+    rs->sec = sec;
+    rs->priority = cfg_priority_build(sec, title);
+    cfg_policy_build(rs, sec, title);
+    rules->generation = cfg_hash_str(title, rules->generation);
+
+    int functions = cfg_size(sec, C_FUNCTION);
+    rs->num_functions = 0;
+    rs->functions = NULL;
+    if (functions > 0) {
+        rs->functions = calloc(functions, sizeof(cfg_rule_function_t));
+        assert(rs->functions != NULL);
+    }
+    for(int i = 0; i < functions; i += 1) {
+        cfg_t* function_i = cfg_getnsec(sec, C_FUNCTION, i);
+        assert(function_i != NULL);
+        cfg_rule_function_t* f = &rs->functions[rs->num_functions];
+
+        f->title = cfg_title(function_i);
+        if (f->title == NULL) {
+            f->title = "(none)";
+        }
+        f->filter = cfg_getstr(function_i, C_FILTER);
+        assert(f->filter != NULL);
+        f->env = cfg_getstr(function_i, C_ENV);
+        assert(f->env != NULL);
+        if (!cfg_regcomp(&f->filter_reg, f->filter)) {
+            continue;
+        }
+        rs->num_functions += 1;
+    }
+
+    int actions = cfg_size(sec, C_ACTION);
+    rs->num_actions = 0;
+    rs->actions = NULL;
+    if (actions > 0) {
+        rs->actions = calloc(actions, sizeof(cfg_rule_action_t));
+        assert(rs->actions != NULL);
+    }
+    for(int i = 0; i < actions; i += 1) {
+        cfg_t* action_i = cfg_getnsec(sec, C_ACTION, i);
+        assert(action_i != NULL);
+        cfg_rule_action_t* a = &rs->actions[rs->num_actions];
+
+        a->title = cfg_title(action_i);
+        if (a->title == NULL) {
+            a->title = "(none)";
+        }
+        a->filter = cfg_getstr(action_i, C_FILTER);
+        assert(a->filter != NULL);
+        if (!cfg_regcomp(&a->filter_reg, a->filter)) {
+            continue;
+        }
+
+        cfg_t* num_trigger = cfg_getsec(action_i, C_NUMERICAL_TRIGGER);
+        assert(num_trigger);
+        predicate_set_ranges(&a->pred,
+                             cfg_getint(num_trigger, C_FROM_VALUE),
+                             cfg_getint(num_trigger, C_FROM_MAX),
+                             cfg_getint(num_trigger, C_TO_VALUE),
+                             cfg_getint(num_trigger, C_TO_MAX));
+
+        cfg_t* str_trigger = cfg_getsec(action_i, C_STRING_TRIGGER);
+        assert(str_trigger);
+        const char* str_from = cfg_getstr(str_trigger, C_FROM_VALUE);
+        const char* str_to = cfg_getstr(str_trigger, C_TO_VALUE);
+        assert(str_from != NULL);
+        assert(str_to != NULL);
+        a->pred.str_valid = false;
+        if (predicate_match_compile(&a->pred.str_from, str_from)) {
+            if (predicate_match_compile(&a->pred.str_to, str_to)) {
+                a->pred.str_valid = true;
+            }
+            else {
+                predicate_match_free(&a->pred.str_from);
+            }
+        }
+
+        const char* mode = cfg_getstr(action_i, C_MODE);
+        a->pred.level = (mode != NULL) && (strcmp(mode, C_MODE_LEVEL) == 0);
+        if ((mode != NULL) && !a->pred.level && (strcmp(mode, C_MODE_EDGE) != 0)) {
+            slog(SLOG_WARN, "unknown mode %s of action %s, using %s", mode, a->title, C_MODE_EDGE);
+        }
+        a->pred.debounce = cfg_getint(action_i, C_DEBOUNCE);
+        a->pred.hold = cfg_getint(action_i, C_HOLD);
+
+        const char* script = cfg_getstr(action_i, C_SCRIPT);
+        if (!script || (strlen(script) == 0)) {
+            script = SCANBD_NULL_STRING;
+        }
+        a->script = make_script_path_abs(script);
+        if (cfg_scripts_checked && (strcmp(a->script, SCANBD_NULL_STRING) != 0)) {
+            // a broken script shows up now, not at the first trigger
+            launch_check(a->script);
+        }
+        slog(SLOG_DEBUG, "compiled action %s in section %s: filter %s, script %s",
+             a->title, title, a->filter, a->script);
+        uint64_t h = rules->generation;
+        h = cfg_hash_str(a->title, h);
+        h = cfg_hash_str(a->filter, h);
+        h = cfg_hash_str(a->script, h);
+        h = cfg_hash_str(str_from, h);
+        h = cfg_hash_str(str_to, h);
+        long trigger[] = {a->pred.from_min, a->pred.from_max,
+                          a->pred.to_min, a->pred.to_max,
+                          a->pred.level, a->pred.debounce, a->pred.hold};
+        rules->generation = config_snapshot_hash(trigger, sizeof(trigger), h);
+        rs->num_actions += 1;
+    }
+}
+
+// the absolute path of the hook script param of the global section
+// sec (checked), NULL if it isn't set
+static char* cfg_hook_build(cfg_t* sec, const char* param) {
+    const char* script = cfg_getstr(sec, param);
+    if (!script || (strlen(script) == 0)) {
+        return NULL;
+    }
+    char* script_abs = make_script_path_abs(script);
+    assert(script_abs != NULL);
+    slog(SLOG_DEBUG, "hook script %s: %s", param, script_abs);
+    if (cfg_scripts_checked) {
+        launch_check(script_abs);
+    }
+    return script_abs;
+}
+
+// checks the action scripts of the section rs
+static void cfg_check_section(const cfg_rule_section_t* rs) {
+    for(int i = 0; i < rs->num_actions; i += 1) {
+        if (strcmp(rs->actions[i].script, SCANBD_NULL_STRING) != 0) {
+            launch_check(rs->actions[i].script);
+        }
+    }
+}
+
+void cfg_check_scripts(void) {
+    assert(rules != NULL);
+    cfg_scripts_checked = true;
+    cfg_check_section(&rules->global);
+    for(int i = 0; i < rules->num_devices; i += 1) {
+        cfg_check_section(&rules->devices[i]);
+    }
+    if (rules->insert_script != NULL) {
+        launch_check(rules->insert_script);
+    }
+    if (rules->remove_script != NULL) {
+        launch_check(rules->remove_script);
+    }
+}
+
+// builds the compiled rule set from the actual config
+static void cfg_rules_build(void) {
+    assert(cfg != NULL);
+    assert(rules == NULL);
+
+    rules = calloc(1, sizeof(cfg_rules_t));
+    assert(rules != NULL);
+
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    rules->multiple_actions = cfg_getbool(cfg_sec_global, C_MULTIPLE_ACTIONS);
+    rules->generation = config_snapshot_hash(&rules->multiple_actions, sizeof(rules->multiple_actions),
+                                 CONFIG_SNAPSHOT_HASH_INIT);
+
+    const char* title = cfg_title(cfg_sec_global);
+    if (title == NULL) {
+        title = SCANBD_NULL_STRING;
+    }
+    cfg_rule_section_build(&rules->global, cfg_sec_global, title);
+    if (rules->global.priority < 0) {
+        rules->global.priority = CFG_PRIORITY_NORMAL;
+    }
+    cfg_policy_complete(&rules->global.poll);
+    cfg_policy_complete(&rules->global.script);
+    cpu_policy_init(&rules->reactor);
+    cfg_cpus_build(&rules->reactor, cfg_sec_global, C_REACTOR_CPUS, title);
+    cfg_policy_complete(&rules->reactor);
+
+    int local_sections = cfg_size(cfg, C_DEVICE);
+    rules->num_devices = 0;
+    rules->devices = NULL;
+    if (local_sections > 0) {
+        rules->devices = calloc(local_sections, sizeof(cfg_rule_section_t));
+        assert(rules->devices != NULL);
+    }
+    for(int loc = 0; loc < local_sections; loc += 1) {
+        cfg_t* loc_i = cfg_getnsec(cfg, C_DEVICE, loc);
+        assert(loc_i != NULL);
+        cfg_rule_section_t* rs = &rules->devices[rules->num_devices];
+
+        title = cfg_title(loc_i);
+        if (title == NULL) {
+            title = "(none)";
+        }
+        rs->filter = cfg_getstr(loc_i, C_FILTER);
+        assert(rs->filter != NULL);
+        if (!cfg_regcomp(&rs->filter_reg, rs->filter)) {
+            continue;
+        }
+        rules->generation = cfg_hash_str(rs->filter, rules->generation);
+        cfg_rule_section_build(rs, loc_i, title);
+        rules->num_devices += 1;
+    }
+    rules->insert_script = cfg_hook_build(cfg_sec_global, C_DEVICE_INSERT_SCRIPT);
+    rules->remove_script = cfg_hook_build(cfg_sec_global, C_DEVICE_REMOVE_SCRIPT);
+    slog(SLOG_INFO, "compiled %d global actions, %d global functions and %d device sections",
+         rules->global.num_actions, rules->global.num_functions, rules->num_devices);
+    cfg_rules = rules;
+}
+
+// the config snapshot file (see config_snapshot.h), NULL: always parse
+static const char* cfg_snapshot = NULL;
+
+void cfg_set_snapshot(const char* file) {
+    cfg_snapshot = ((file != NULL) && (strlen(file) > 0)) ? file : NULL;
+}
+
+// parsing the config-file via libconfuse into a new config (or
+// loading its snapshot if it is still valid), on error NULL is
+// returned and the actual config is untouched
+cfg_t* cfg_do_load(const char *config_file_name) {
     slog(SLOG_INFO, "reading config file %s", config_file_name);
 
     cfg_opt_t cfg_numtrigger[] = {
         CFG_INT(C_FROM_VALUE, C_FROM_VALUE_DEF_INT, CFGF_NONE),
+        CFG_INT(C_FROM_MAX, C_RANGE_MAX_DEF, CFGF_NONE),
         CFG_INT(C_TO_VALUE, C_TO_VALUE_DEF_INT, CFGF_NONE),
+        CFG_INT(C_TO_MAX, C_RANGE_MAX_DEF, CFGF_NONE),
         CFG_END()
     };
 
@@ -43,6 +413,9 @@ void cfg_do_parse(const char *config_file_name) {
         CFG_STR(C_FILTER, C_ACTION_DEF, CFGF_NONE),
         CFG_SEC(C_NUMERICAL_TRIGGER, cfg_numtrigger, CFGF_NONE),
         CFG_SEC(C_STRING_TRIGGER, cfg_strtrigger, CFGF_NONE),
+        CFG_STR(C_MODE, C_MODE_DEF, CFGF_NONE),
+        CFG_INT(C_DEBOUNCE, C_DEBOUNCE_DEF, CFGF_NONE),
+        CFG_INT(C_HOLD, C_HOLD_DEF, CFGF_NONE),
         CFG_STR(C_DESC, C_DESC_DEF, CFGF_NONE),
         CFG_STR(C_SCRIPT, C_SCRIPT_DEF, CFGF_NONE),
         CFG_END()
@@ -70,12 +443,45 @@ void cfg_do_parse(const char *config_file_name) {
         CFG_STR(C_SANED, C_SANED_DEF, CFGF_NONE),
         CFG_STR_LIST(C_SANED_OPTS, C_SANED_OPTS_DEF, CFGF_NONE),
         CFG_STR_LIST(C_SANED_ENVS, C_SANED_ENVS_DEF, CFGF_NONE),
+        CFG_STR_LIST(C_SANED_DEVICES, C_SANED_DEVICES_DEF, CFGF_NONE),
+        CFG_INT(C_SANED_POOL, C_SANED_POOL_DEF, CFGF_NONE),
         CFG_STR(C_SCRIPTDIR, C_SCRIPTDIR_DEF, CFGF_NONE),
         CFG_STR(C_DEVICE_INSERT_SCRIPT, C_DEVICE_INSERT_SCRIPT_DEF, CFGF_NONE),
         CFG_STR(C_DEVICE_REMOVE_SCRIPT, C_DEVICE_REMOVE_SCRIPT_DEF, CFGF_NONE),
         CFG_STR(C_SCANBUTTONS_BACKENDS_DIR, C_SCANBUTTONS_BACKENDS_DIR_DEF, CFGF_NONE),
         CFG_INT(C_TIMEOUT, C_TIMEOUT_DEF, CFGF_NONE),
+        CFG_INT(C_TIMEOUT_MAX, C_TIMEOUT_MAX_DEF, CFGF_NONE),
+        CFG_INT(C_BURST_TIMEOUT, C_BURST_TIMEOUT_DEF, CFGF_NONE),
+        CFG_INT(C_BURST_DURATION, C_BURST_DURATION_DEF, CFGF_NONE),
+        CFG_INT(C_PARK_IDLE, C_PARK_IDLE_DEF, CFGF_NONE),
+        CFG_INT(C_PARK_HEARTBEAT, C_PARK_HEARTBEAT_DEF, CFGF_NONE),
+        CFG_INT(C_POLL_WORKERS, C_POLL_WORKERS_DEF, CFGF_NONE),
+        CFG_INT(C_ACTION_WORKERS, C_ACTION_WORKERS_DEF, CFGF_NONE),
+        CFG_INT(C_ACTION_QUEUE, C_ACTION_QUEUE_DEF, CFGF_NONE),
+        CFG_INT(C_STOP_TIMEOUT, C_STOP_TIMEOUT_DEF, CFGF_NONE),
+        CFG_INT(C_SLOW_POLL, C_SLOW_POLL_DEF, CFGF_NONE),
+        CFG_BOOL(C_POLL_HELPER, C_POLL_HELPER_DEF, CFGF_NONE),
+        CFG_INT(C_POLL_HELPER_TIMEOUT, C_POLL_HELPER_TIMEOUT_DEF, CFGF_NONE),
+        CFG_INT(C_DBUS_COALESCE, C_DBUS_COALESCE_DEF, CFGF_NONE),
+        CFG_STR(C_PRIORITY, C_PRIORITY_DEF, CFGF_NONE),
+        CFG_STR(C_REACTOR_CPUS, C_REACTOR_CPUS_DEF, CFGF_NONE),
+        CFG_STR(C_POLL_CPUS, C_POLL_CPUS_DEF, CFGF_NONE),
+        CFG_INT(C_POLL_RTPRIO, C_POLL_RTPRIO_DEF, CFGF_NONE),
+        CFG_STR(C_SCRIPT_CPUS, C_SCRIPT_CPUS_DEF, CFGF_NONE),
+        CFG_INT(C_SCRIPT_NICE, C_SCRIPT_NICE_DEF, CFGF_NONE),
+        CFG_BOOL(C_KEEP_OPEN, C_KEEP_OPEN_DEF, CFGF_NONE),
+        CFG_BOOL(C_INTERRUPT_WAKEUP, C_INTERRUPT_WAKEUP_DEF, CFGF_NONE),
+        CFG_BOOL(C_READ_RESETS, C_READ_RESETS_DEF, CFGF_NONE),
+        CFG_INT(C_POLL_RATE, C_POLL_RATE_DEF, CFGF_NONE),
+        CFG_INT(C_HOTPLUG_SETTLE, C_HOTPLUG_SETTLE_DEF, CFGF_NONE),
+        CFG_BOOL(C_UDEV_FILTER, C_UDEV_FILTER_DEF, CFGF_NONE),
+        CFG_STR(C_UDEV_TAG, C_UDEV_TAG_DEF, CFGF_NONE),
         CFG_STR(C_PIDFILE, C_PIDFILE_DEF, CFGF_NONE),
+        CFG_STR(C_STATS_FILE, C_STATS_FILE_DEF, CFGF_NONE),
+        CFG_STR(C_DEVICE_CACHE, C_DEVICE_CACHE_DEF, CFGF_NONE),
+        CFG_STR(C_POLL_STATE, C_POLL_STATE_DEF, CFGF_NONE),
+        CFG_STR(C_STATUS_PAGE, C_STATUS_PAGE_DEF, CFGF_NONE),
+        CFG_STR(C_METRICS, C_METRICS_DEF, CFGF_NONE),
         CFG_SEC(C_ENVIRONMENT, cfg_environment, CFGF_NONE),
         CFG_SEC(C_FUNCTION, cfg_function, CFGF_MULTI | CFGF_TITLE),
         CFG_SEC(C_ACTION, cfg_action, CFGF_MULTI | CFGF_TITLE),
@@ -85,6 +491,21 @@ void cfg_do_parse(const char *config_file_name) {
     cfg_opt_t cfg_device[] = {
         CFG_STR(C_FILTER, "^fujitsu.*", CFGF_NONE),
         CFG_STR(C_DESC, C_DESC_DEF, CFGF_NONE),
+        CFG_INT(C_TIMEOUT, C_INHERIT_INT, CFGF_NONE),
+        CFG_INT(C_TIMEOUT_MAX, C_INHERIT_INT, CFGF_NONE),
+        CFG_INT(C_BURST_TIMEOUT, C_INHERIT_INT, CFGF_NONE),
+        CFG_INT(C_BURST_DURATION, C_INHERIT_INT, CFGF_NONE),
+        CFG_INT(C_PARK_IDLE, C_INHERIT_INT, CFGF_NONE),
+        CFG_INT(C_PARK_HEARTBEAT, C_INHERIT_INT, CFGF_NONE),
+        CFG_STR(C_PRIORITY, C_PRIORITY_DEF, CFGF_NODEFAULT),
+        CFG_STR(C_POLL_CPUS, C_POLL_CPUS_DEF, CFGF_NODEFAULT),
+        CFG_INT(C_POLL_RTPRIO, C_POLL_RTPRIO_DEF, CFGF_NODEFAULT),
+        CFG_STR(C_SCRIPT_CPUS, C_SCRIPT_CPUS_DEF, CFGF_NODEFAULT),
+        CFG_INT(C_SCRIPT_NICE, C_SCRIPT_NICE_DEF, CFGF_NODEFAULT),
+        CFG_BOOL(C_KEEP_OPEN, C_KEEP_OPEN_DEF, CFGF_NODEFAULT),
+        CFG_BOOL(C_INTERRUPT_WAKEUP, C_INTERRUPT_WAKEUP_DEF, CFGF_NODEFAULT),
+        CFG_BOOL(C_READ_RESETS, C_READ_RESETS_DEF, CFGF_NODEFAULT),
+        CFG_INT(C_POLL_RATE, C_POLL_RATE_DEF, CFGF_NODEFAULT),
         CFG_SEC(C_FUNCTION, cfg_function, CFGF_MULTI | CFGF_TITLE),
         CFG_SEC(C_ACTION, cfg_action, CFGF_MULTI | CFGF_TITLE),
         CFG_END()
@@ -93,15 +514,10 @@ void cfg_do_parse(const char *config_file_name) {
     cfg_opt_t cfg_options[] = {
         CFG_SEC(C_GLOBAL, cfg_global, CFGF_NONE),
         CFG_SEC(C_DEVICE, cfg_device, CFGF_MULTI | CFGF_TITLE),
-        CFG_FUNC(C_INCLUDE, cfg_include),
+        CFG_FUNC(C_INCLUDE, config_snapshot_include),
         CFG_END()
     };
 
-    if (cfg) {
-        cfg_free(cfg);
-        cfg = NULL;
-    }
-
     char wd[PATH_MAX+1] = {};
     char config_file[PATH_MAX+1] = {};
     char* scanbd_conf_dir = NULL;
@@ -109,7 +525,7 @@ void cfg_do_parse(const char *config_file_name) {
     // get current directory
     if (getcwd(wd, PATH_MAX) == NULL) {
         slog(SLOG_ERROR, "can't get working directory");
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
     // cd into directory where scanbd.conf lives
@@ -121,22 +537,39 @@ void cfg_do_parse(const char *config_file_name) {
 
     if (chdir(scanbd_conf_dir) != 0) {
         slog(SLOG_ERROR, "can't access the directory for: %s", config_file_name);
-        exit(EXIT_FAILURE);
+        return NULL;
     }
 
-    cfg = cfg_init(cfg_options, CFGF_NONE);
+    cfg_t* new_cfg = cfg_init(cfg_options, CFGF_NONE);
+    config_snapshot_begin(new_cfg, config_file_name);
+
+    if ((cfg_snapshot != NULL) && config_snapshot_load(cfg_snapshot, new_cfg)) {
+        if (chdir(wd) < 0) {
+            slog(SLOG_ERROR, "can't cd back to: %s", wd);
+            exit(EXIT_FAILURE);
+        }
+        return new_cfg;
+    }
+    if (cfg_snapshot != NULL) {
+        // a failed load may have left values
+        cfg_free(new_cfg);
+        new_cfg = cfg_init(cfg_options, CFGF_NONE);
+        config_snapshot_parse();
+    }
 
     int ret = 0;
-    if ((ret = cfg_parse(cfg, config_file_name)) != CFG_SUCCESS) {
+    if ((ret = cfg_parse(new_cfg, config_file_name)) != CFG_SUCCESS) {
         if (CFG_FILE_ERROR == ret) {
             slog(SLOG_ERROR, "can't open config file: %s", config_file_name);
-            exit(EXIT_FAILURE);
         }
         else {
             slog(SLOG_ERROR, "parse error in config file");
-            exit(EXIT_FAILURE);
         }
-        exit(EXIT_FAILURE); // not reached
+        cfg_free(new_cfg);
+        new_cfg = NULL;
+    }
+    else if (cfg_snapshot != NULL) {
+        config_snapshot_save(cfg_snapshot, new_cfg);
     }
 
     // cd back to original
@@ -144,6 +577,102 @@ void cfg_do_parse(const char *config_file_name) {
         slog(SLOG_ERROR, "can't cd back to: %s", wd);
         exit(EXIT_FAILURE);
     }
+    return new_cfg;
+}
+
+// makes new_cfg the actual config and compiles its rule set, the
+// previous config and rules are handed out in old: they stay valid
+// until cfg_retired_free() so that pollers can be rebound first
+void cfg_do_install(cfg_t* new_cfg, cfg_retired_t* old) {
+    assert(new_cfg != NULL);
+    assert(old != NULL);
+
+    old->cfg = cfg;
+    old->rules = rules;
+    cfg = new_cfg;
+    rules = NULL;
+    cfg_rules = NULL;
+    cfg_rules_build();
+}
+
+void cfg_retired_free(cfg_retired_t* old) {
+    assert(old != NULL);
+    cfg_rules_free(old->rules);
+    old->rules = NULL;
+    if (old->cfg) {
+        cfg_free(old->cfg);
+        old->cfg = NULL;
+    }
+}
+
+// parses the config-file and replaces the actual config, exits on error
+void cfg_do_parse(const char *config_file_name) {
+    cfg_t* new_cfg = cfg_do_load(config_file_name);
+    if (new_cfg == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    cfg_retired_t old = {};
+    cfg_do_install(new_cfg, &old);
+    cfg_retired_free(&old);
+}
+
+static bool cfg_str_equal(const char* a, const char* b) {
+    if ((a == NULL) || (b == NULL)) {
+        return a == b;
+    }
+    return strcmp(a, b) == 0;
+}
+
+// true if both actions match the same options and run the same script
+bool cfg_rule_action_equal(const cfg_rule_action_t* a, const cfg_rule_action_t* b) {
+    assert(a != NULL);
+    assert(b != NULL);
+    return cfg_str_equal(a->title, b->title) &&
+        cfg_str_equal(a->filter, b->filter) &&
+        cfg_str_equal(a->script, b->script) &&
+        predicate_equal(&a->pred, &b->pred);
+}
+
+// true if both functions match the same options and use the same env-var
+bool cfg_rule_function_equal(const cfg_rule_function_t* a, const cfg_rule_function_t* b) {
+    assert(a != NULL);
+    assert(b != NULL);
+    return cfg_str_equal(a->title, b->title) &&
+        cfg_str_equal(a->filter, b->filter) &&
+        cfg_str_equal(a->env, b->env);
+}
+
+// the priority class of the device name: the last matching device
+// section setting one overrides the global section
+cfg_priority_t cfg_device_priority(const char* name) {
+    assert(name != NULL);
+    assert(cfg_rules != NULL);
+    int priority = cfg_rules->global.priority;
+    for(int loc = 0; loc < cfg_rules->num_devices; loc += 1) {
+        const cfg_rule_section_t* loc_i = &cfg_rules->devices[loc];
+        if ((loc_i->priority >= 0) && (regexec(&loc_i->filter_reg, name, 0, NULL, 0) == 0)) {
+            priority = loc_i->priority;
+        }
+    }
+    return (cfg_priority_t)priority;
+}
+
+// the cpu policies of the pollers and the scripts of the device name:
+// the global ones, overridden by each matching device section
+void cfg_device_policy(const char* name, cpu_policy_t* poll, cpu_policy_t* script) {
+    assert(name != NULL);
+    assert(poll != NULL);
+    assert(script != NULL);
+    assert(cfg_rules != NULL);
+    *poll = cfg_rules->global.poll;
+    *script = cfg_rules->global.script;
+    for(int loc = 0; loc < cfg_rules->num_devices; loc += 1) {
+        const cfg_rule_section_t* loc_i = &cfg_rules->devices[loc];
+        if (regexec(&loc_i->filter_reg, name, 0, NULL, 0) == 0) {
+            cpu_policy_merge(poll, &loc_i->poll);
+            cpu_policy_merge(script, &loc_i->script);
+        }
+    }
 }
 
 char *make_script_path_abs(const char *script) {
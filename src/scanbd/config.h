@@ -23,7 +23,97 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include "predicate.h"
+#include "cpu_policy.h"
+
+// the compiled rule set: built once by cfg_do_parse() from the
+// global and device sections, all regexes are compiled and all
+// script paths are absolute and checked (see cfg_check_scripts()).
+// It is immutable until the next cfg_do_parse() or cfg_do_install(),
+// the polling threads only reference it.
+
+// the priority class of a device (see C_PRIORITY): the pollers and
+// the scripts of a class go ahead of the less urgent classes, each
+// class leaves workers free for the more urgent ones (see
+// poll_scheduler_priority() and action_queue_priority())
+enum cfg_priority {
+    CFG_PRIORITY_INTERACTIVE = 0,
+    CFG_PRIORITY_NORMAL,
+    CFG_PRIORITY_BACKGROUND,
+    CFG_PRIORITIES               // the number of classes
+};
+typedef enum cfg_priority cfg_priority_t;
+
+struct cfg_rule_function {
+    const char* title;           // the name of the function
+    const char* filter;          // the option name regex
+    regex_t filter_reg;          // and compiled
+    const char* env;             // the name of the env-var
+};
+typedef struct cfg_rule_function cfg_rule_function_t;
+
+struct cfg_rule_action {
+    const char* title;           // the name of the action
+    const char* filter;          // the option name regex
+    regex_t filter_reg;          // and compiled
+    char* script;                // absolute path or SCANBD_NULL_STRING
+    predicate_t pred;            // the compiled numerical- and
+    // string-trigger, mode, debounce and hold
+};
+typedef struct cfg_rule_action cfg_rule_action_t;
+
+struct cfg_rule_section {
+    const char* title;           // the name of the section
+    cfg_t* sec;                  // the config section itself
+    const char* filter;          // the device name regex (device sections)
+    regex_t filter_reg;          // and compiled
+    int priority;                // the cfg_priority_t, -1 if the
+    // device section doesn't set one
+    cpu_policy_t poll;           // the pollers (see C_POLL_CPUS), a
+    // device section leaves the fields it doesn't set unset
+    cpu_policy_t script;         // the scripts (see C_SCRIPT_CPUS)
+    int num_actions;
+    cfg_rule_action_t* actions;
+    int num_functions;
+    cfg_rule_function_t* functions;
+};
+typedef struct cfg_rule_section cfg_rule_section_t;
+
+struct cfg_rules {
+    bool multiple_actions;       // see C_MULTIPLE_ACTIONS
+    cfg_rule_section_t global;   // the global section
+    int num_devices;             // the device sections (with valid filter)
+    cfg_rule_section_t* devices;
+    char* insert_script;         // the device insert hook: absolute path
+    // or NULL if not set (see C_DEVICE_INSERT_SCRIPT)
+    char* remove_script;         // the device remove hook
+    cpu_policy_t reactor;        // the reactor (see C_REACTOR_CPUS)
+    uint64_t generation;         // the hash of the sections and actions:
+    // a checkpoint of another rule set isn't restored (see poll_state.h)
+};
+typedef struct cfg_rules cfg_rules_t;
+
+extern const cfg_rules_t* cfg_rules;
+
+// a config and its rule set replaced by cfg_do_install()
+struct cfg_retired {
+    cfg_t* cfg;
+    cfg_rules_t* rules;
+};
+typedef struct cfg_retired cfg_retired_t;
+
 void cfg_do_parse(const char *config_file_name);
+void cfg_set_snapshot(const char* file);
+cfg_t* cfg_do_load(const char *config_file_name);
+void cfg_do_install(cfg_t* new_cfg, cfg_retired_t* old);
+// checks the scripts of the actual rule set with the (dropped) ids of
+// the daemon, each later rule set is checked when it is built
+void cfg_check_scripts(void);
+void cfg_retired_free(cfg_retired_t* old);
+bool cfg_rule_action_equal(const cfg_rule_action_t* a, const cfg_rule_action_t* b);
+cfg_priority_t cfg_device_priority(const char* name);
+void cfg_device_policy(const char* name, cpu_policy_t* poll, cpu_policy_t* script);
+bool cfg_rule_function_equal(const cfg_rule_function_t* a, const cfg_rule_function_t* b);
 char *make_script_path_abs(const char *script);
 
 #endif
@@ -0,0 +1,549 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "config_snapshot.h"
+
+#include <sys/mman.h>
+#include <stdint.h>
+#include <libgen.h>
+
+// an input of the config: the config file or an included file
+struct config_snapshot_input {
+    char* path;                      // the real path
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t hash;                   // of the contents
+};
+typedef struct config_snapshot_input config_snapshot_input_t;
+
+struct config_snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_inputs;
+    uint64_t schema;                 // the hash of the option table
+};
+typedef struct config_snapshot_header config_snapshot_header_t;
+
+// the inputs of the actual parse, inputs[0] is the config file, used
+// in the main thread only (startup and reconfiguration)
+static config_snapshot_input_t* inputs = NULL;
+static int num_inputs = 0;
+static bool inputs_valid = false;
+// the inputs are parsed for a snapshot (see config_snapshot_parse()):
+// each one is hashed before the parser reads it
+static bool inputs_captured = false;
+static uint64_t schema = 0;
+// the snapshot can't be written by this process (e.g. a daemon after
+// the privilege drop, see config_snapshot_writable()): no further try
+static bool unwritable = false;
+
+uint64_t config_snapshot_hash(const void* data, size_t size, uint64_t h) {
+    const unsigned char* p = data;
+    for(size_t i = 0; i < size; i += 1) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// the hash of the contents of path, false on error
+static bool config_snapshot_hash_file(const char* path, uint64_t* hash) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    uint64_t h = CONFIG_SNAPSHOT_HASH_INIT;
+    char buf[4096];
+    ssize_t n = 0;
+    while((n = read(fd, buf, sizeof(buf))) > 0) {
+        h = config_snapshot_hash(buf, (size_t)n, h);
+    }
+    close(fd);
+    if (n < 0) {
+        return false;
+    }
+    *hash = h;
+    return true;
+}
+
+static bool config_snapshot_stat(config_snapshot_input_t* in) {
+    struct stat st;
+    if (stat(in->path, &st) < 0) {
+        return false;
+    }
+    in->mtime_sec = st.st_mtim.tv_sec;
+    in->mtime_nsec = st.st_mtim.tv_nsec;
+    in->size = st.st_size;
+    return config_snapshot_hash_file(in->path, &in->hash);
+}
+
+static void config_snapshot_inputs_free(void) {
+    for(int i = 0; i < num_inputs; i += 1) {
+        free(inputs[i].path);
+    }
+    free(inputs);
+    inputs = NULL;
+    num_inputs = 0;
+}
+
+// records the input path (relative to the working directory)
+static void config_snapshot_input(const char* path) {
+    if (!inputs_valid) {
+        return;
+    }
+    config_snapshot_input_t* n = realloc(inputs, (num_inputs + 1) * sizeof(config_snapshot_input_t));
+    if (n == NULL) {
+        inputs_valid = false;
+        return;
+    }
+    inputs = n;
+    config_snapshot_input_t* in = &inputs[num_inputs];
+    memset(in, 0, sizeof(config_snapshot_input_t));
+    if ((in->path = realpath(path, NULL)) == NULL) {
+        slog(SLOG_DEBUG, "config snapshot: no input %s: %s", path, strerror(errno));
+        inputs_valid = false;
+        return;
+    }
+    num_inputs += 1;
+    // a file changed during the parse doesn't match the snapshot
+    if (inputs_captured && !config_snapshot_stat(in)) {
+        slog(SLOG_DEBUG, "config snapshot: can't read %s", in->path);
+        inputs_valid = false;
+    }
+}
+
+static void config_snapshot_put_str(FILE* f, const char* s) {
+    uint32_t len = (uint32_t)strlen(s);
+    fwrite(&len, sizeof(len), 1, f);
+    fwrite(s, 1, len + 1, f);
+}
+
+// writes the records of the values of sec, false if sec has an option
+// type the snapshot can't hold
+static bool config_snapshot_put_section(FILE* f, cfg_t* sec) {
+    for(cfg_opt_t* opt = sec->opts; opt->name != NULL; opt += 1) {
+        unsigned int size = cfg_opt_size(opt);
+        switch(opt->type) {
+        case CFGT_SEC:
+            for(unsigned int i = 0; i < size; i += 1) {
+                cfg_t* sub = cfg_opt_getnsec(opt, i);
+                const char* title = cfg_title(sub);
+                fputc((title != NULL) ? 'S' : 'U', f);
+                config_snapshot_put_str(f, opt->name);
+                if (title != NULL) {
+                    config_snapshot_put_str(f, title);
+                }
+                if (!config_snapshot_put_section(f, sub)) {
+                    return false;
+                }
+                fputc('E', f);
+            }
+            break;
+        case CFGT_INT:
+        case CFGT_STR:
+        case CFGT_BOOL:
+            if (opt->flags & CFGF_LIST) {
+                fputc('R', f);
+                config_snapshot_put_str(f, opt->name);
+            }
+            else if (size > 1) {
+                size = 1;
+            }
+            for(unsigned int i = 0; i < size; i += 1) {
+                char number[32];
+                const char* value = NULL;
+                if (opt->type == CFGT_INT) {
+                    snprintf(number, sizeof(number), "%ld", cfg_opt_getnint(opt, i));
+                    value = number;
+                }
+                else if (opt->type == CFGT_BOOL) {
+                    value = cfg_opt_getnbool(opt, i) ? "true" : "false";
+                }
+                else {
+                    value = cfg_opt_getnstr(opt, i);
+                }
+                if (value == NULL) {
+                    // an unset string keeps its default
+                    continue;
+                }
+                fputc('V', f);
+                config_snapshot_put_str(f, opt->name);
+                config_snapshot_put_str(f, value);
+            }
+            break;
+        case CFGT_FUNC:
+            break;
+        default:
+            slog(SLOG_DEBUG, "config snapshot: option %s has an unsupported type", opt->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns the records of the values of cfg (must be freed), NULL on error
+static char* config_snapshot_records(cfg_t* cfg, size_t* size) {
+    char* records = NULL;
+    FILE* f = NULL;
+    if ((f = open_memstream(&records, size)) == NULL) {
+        slog(SLOG_WARN, "config snapshot: %s", strerror(errno));
+        return NULL;
+    }
+    bool ok = config_snapshot_put_section(f, cfg);
+    if ((fclose(f) != 0) || !ok) {
+        free(records);
+        return NULL;
+    }
+    return records;
+}
+
+void config_snapshot_begin(cfg_t* fresh_cfg, const char* config_file) {
+    assert(fresh_cfg != NULL);
+    assert(config_file != NULL);
+    config_snapshot_inputs_free();
+    inputs_valid = true;
+    inputs_captured = false;
+    config_snapshot_input(config_file);
+
+    // the defaults of the option table
+    schema = 0;
+    size_t size = 0;
+    char* records = config_snapshot_records(fresh_cfg, &size);
+    if (records == NULL) {
+        inputs_valid = false;
+        return;
+    }
+    schema = config_snapshot_hash(records, size, CONFIG_SNAPSHOT_HASH_INIT);
+    free(records);
+}
+
+void config_snapshot_parse(void) {
+    // the inputs aren't hashed for a snapshot that can't be written
+    if (!inputs_valid || (num_inputs < 1) || unwritable) {
+        return;
+    }
+    inputs_captured = true;
+    if (!config_snapshot_stat(&inputs[0])) {
+        slog(SLOG_DEBUG, "config snapshot: can't read %s", inputs[0].path);
+        inputs_valid = false;
+    }
+}
+
+int config_snapshot_include(cfg_t* cfg, cfg_opt_t* opt, int argc, const char** argv) {
+    if (argc == 1) {
+        config_snapshot_input(argv[0]);
+    }
+    return cfg_include(cfg, opt, argc, argv);
+}
+
+// the reader of the mapped snapshot
+struct config_snapshot_reader {
+    const char* p;
+    const char* end;
+};
+typedef struct config_snapshot_reader config_snapshot_reader_t;
+
+static bool config_snapshot_get(config_snapshot_reader_t* r, void* v, size_t size) {
+    if ((size_t)(r->end - r->p) < size) {
+        return false;
+    }
+    memcpy(v, r->p, size);
+    r->p += size;
+    return true;
+}
+
+// the string points into the mapping
+static const char* config_snapshot_get_str(config_snapshot_reader_t* r) {
+    uint32_t len = 0;
+    if (!config_snapshot_get(r, &len, sizeof(len)) ||
+        ((size_t)(r->end - r->p) < (size_t)len + 1) || (r->p[len] != '\0')) {
+        return NULL;
+    }
+    const char* s = r->p;
+    r->p += len + 1;
+    return s;
+}
+
+// is the recorded input still the one of the actual config?
+static bool config_snapshot_current(config_snapshot_reader_t* r, int index) {
+    config_snapshot_input_t in;
+    memset(&in, 0, sizeof(in));
+    const char* path = NULL;
+    if (!config_snapshot_get(r, &in.mtime_sec, sizeof(in.mtime_sec)) ||
+        !config_snapshot_get(r, &in.mtime_nsec, sizeof(in.mtime_nsec)) ||
+        !config_snapshot_get(r, &in.size, sizeof(in.size)) ||
+        !config_snapshot_get(r, &in.hash, sizeof(in.hash)) ||
+        ((path = config_snapshot_get_str(r)) == NULL)) {
+        return false;
+    }
+    // the config file itself must be the same
+    if ((index == 0) && (strcmp(path, inputs[0].path) != 0)) {
+        slog(SLOG_DEBUG, "config snapshot of another config file %s", path);
+        return false;
+    }
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        return false;
+    }
+    if ((st.st_mtim.tv_sec == in.mtime_sec) && (st.st_mtim.tv_nsec == in.mtime_nsec) &&
+        (st.st_size == in.size)) {
+        return true;
+    }
+    // touched, but maybe not changed
+    uint64_t hash = 0;
+    if ((st.st_size != in.size) || !config_snapshot_hash_file(path, &hash) ||
+        (hash != in.hash)) {
+        slog(SLOG_DEBUG, "config snapshot: %s has changed", path);
+        return false;
+    }
+    return true;
+}
+
+// sets the values of the records into cfg
+static bool config_snapshot_apply(config_snapshot_reader_t* r, cfg_t* cfg) {
+    cfg_t* stack[CONFIG_SNAPSHOT_DEPTH];
+    int depth = 0;
+    stack[0] = cfg;
+    while(r->p < r->end) {
+        char kind = *r->p;
+        r->p += 1;
+        if (kind == 'E') {
+            if (depth == 0) {
+                return false;
+            }
+            depth -= 1;
+            continue;
+        }
+        const char* name = config_snapshot_get_str(r);
+        if (name == NULL) {
+            return false;
+        }
+        cfg_opt_t* opt = cfg_getopt(stack[depth], name);
+        if (opt == NULL) {
+            return false;
+        }
+        switch(kind) {
+        case 'S':
+        case 'U': {
+            const char* title = NULL;
+            if ((kind == 'S') && ((title = config_snapshot_get_str(r)) == NULL)) {
+                return false;
+            }
+            if ((opt->type != CFGT_SEC) || (depth + 1 >= CONFIG_SNAPSHOT_DEPTH)) {
+                return false;
+            }
+            cfg_value_t* val = cfg_setopt(stack[depth], opt, title);
+            if ((val == NULL) || (val->section == NULL)) {
+                return false;
+            }
+            depth += 1;
+            stack[depth] = val->section;
+            break;
+        }
+        case 'R':
+            if (!(opt->flags & CFGF_LIST)) {
+                return false;
+            }
+            cfg_free_value(opt);
+            break;
+        case 'V': {
+            const char* value = config_snapshot_get_str(r);
+            if ((value == NULL) || (opt->type == CFGT_SEC) ||
+                (cfg_setopt(stack[depth], opt, value) == NULL)) {
+                return false;
+            }
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return depth == 0;
+}
+
+bool config_snapshot_load(const char* file, cfg_t* fresh_cfg) {
+    assert(file != NULL);
+    assert(fresh_cfg != NULL);
+    if (!inputs_valid || (num_inputs < 1)) {
+        return false;
+    }
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        slog(SLOG_DEBUG, "no config snapshot %s: %s", file, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(config_snapshot_header_t))) {
+        close(fd);
+        return false;
+    }
+    // the values replace the config (scripts included): only a file of
+    // root or of this user, which nobody else can change, is trusted
+    if (!S_ISREG(st.st_mode) || ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+        (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        slog(SLOG_WARN, "config snapshot %s isn't trusted (owner %d, mode %o), parsing",
+             file, (int)st.st_uid, (unsigned int)(st.st_mode & 07777));
+        close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        slog(SLOG_DEBUG, "Can't map config snapshot %s: %s", file, strerror(errno));
+        return false;
+    }
+    config_snapshot_reader_t r = {map, (const char*)map + st.st_size};
+    config_snapshot_header_t h;
+    bool ok = config_snapshot_get(&r, &h, sizeof(h)) &&
+        (memcmp(h.magic, CONFIG_SNAPSHOT_MAGIC, sizeof(h.magic)) == 0) &&
+        (h.version == CONFIG_SNAPSHOT_VERSION) && (h.schema == schema) &&
+        (h.num_inputs >= 1);
+    for(uint32_t i = 0; ok && (i < h.num_inputs); i += 1) {
+        ok = config_snapshot_current(&r, (int)i);
+    }
+    if (ok) {
+        ok = config_snapshot_apply(&r, fresh_cfg);
+        if (!ok) {
+            slog(SLOG_WARN, "config snapshot %s doesn't fit the config, parsing", file);
+        }
+    }
+    munmap(map, st.st_size);
+    if (ok) {
+        slog(SLOG_INFO, "config loaded from snapshot %s (%u files)", file, h.num_inputs);
+    }
+    return ok;
+}
+
+// false if this process can't replace the snapshot file: the
+// directory isn't writable (a missing directory is created by the
+// save) or an earlier save was refused
+static bool config_snapshot_writable(const char* file) {
+    if (unwritable) {
+        return false;
+    }
+    char* dir = strdup(file);
+    if (dir == NULL) {
+        return false;
+    }
+    if ((faccessat(AT_FDCWD, dirname(dir), W_OK | X_OK, AT_EACCESS) < 0) &&
+        (errno != ENOENT)) {
+        slog(SLOG_INFO, "config snapshot %s can't be written: %s, not updated",
+             file, strerror(errno));
+        unwritable = true;
+    }
+    free(dir);
+    return !unwritable;
+}
+
+// a failed write of the snapshot: a refused one isn't tried again
+static void config_snapshot_refused(int error) {
+    if ((error == EACCES) || (error == EPERM) || (error == EROFS)) {
+        unwritable = true;
+    }
+}
+
+void config_snapshot_save(const char* file, cfg_t* parsed_cfg) {
+    assert(file != NULL);
+    assert(parsed_cfg != NULL);
+    if (!config_snapshot_writable(file)) {
+        return;
+    }
+    // the inputs as they were read by the parser
+    if (!inputs_valid || !inputs_captured || (num_inputs < 1)) {
+        slog(SLOG_DEBUG, "config snapshot: inputs unknown, not written");
+        return;
+    }
+    size_t size = 0;
+    char* records = config_snapshot_records(parsed_cfg, &size);
+    if (records == NULL) {
+        return;
+    }
+
+    // written under a temporary name and renamed, a reader never
+    // maps a partial snapshot
+    size_t len = strlen(file) + 8;
+    char* tmp = malloc(len);
+    if (tmp == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the config snapshot");
+        free(records);
+        return;
+    }
+    snprintf(tmp, len, "%s", file);
+    if ((mkdir(dirname(tmp), S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) < 0) &&
+        (errno != EEXIST)) {
+        slog(SLOG_DEBUG, "Can't create the directory of %s: %s", file, strerror(errno));
+    }
+    snprintf(tmp, len, "%s.XXXXXX", file);
+    int fd = mkstemp(tmp);
+    FILE* f = NULL;
+    if ((fd < 0) || ((f = fdopen(fd, "w")) == NULL)) {
+        slog(SLOG_DEBUG, "Can't write config snapshot %s: %s", file, strerror(errno));
+        config_snapshot_refused(errno);
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        free(records);
+        return;
+    }
+    config_snapshot_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CONFIG_SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = CONFIG_SNAPSHOT_VERSION;
+    h.num_inputs = (uint32_t)num_inputs;
+    h.schema = schema;
+    fwrite(&h, sizeof(h), 1, f);
+    for(int i = 0; i < num_inputs; i += 1) {
+        fwrite(&inputs[i].mtime_sec, sizeof(inputs[i].mtime_sec), 1, f);
+        fwrite(&inputs[i].mtime_nsec, sizeof(inputs[i].mtime_nsec), 1, f);
+        fwrite(&inputs[i].size, sizeof(inputs[i].size), 1, f);
+        fwrite(&inputs[i].hash, sizeof(inputs[i].hash), 1, f);
+        config_snapshot_put_str(f, inputs[i].path);
+    }
+    fwrite(records, 1, size, f);
+    free(records);
+    // readable by scanbm running as another user
+    int error = 0;
+    if (fchmod(fileno(f), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) < 0) {
+        error = errno;
+    }
+    // the stream is closed in any case
+    if ((fclose(f) != 0) && (error == 0)) {
+        error = errno;
+    }
+    if ((error == 0) && (rename(tmp, file) < 0)) {
+        error = errno;
+    }
+    if (error != 0) {
+        slog(SLOG_WARN, "Can't write config snapshot %s: %s", file, strerror(error));
+        config_snapshot_refused(error);
+        unlink(tmp);
+    }
+    else {
+        slog(SLOG_INFO, "config snapshot %s written (%d files)", file, num_inputs);
+    }
+    free(tmp);
+}
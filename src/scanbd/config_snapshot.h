@@ -0,0 +1,83 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CONFIG_SNAPSHOT_H
+#define CONFIG_SNAPSHOT_H
+
+#include "common.h"
+#include <confuse.h>
+#include <stdint.h>
+
+// the config snapshot: the values of a parsed config (scanbd.conf
+// with all its includes) in a binary file, loaded by scanbd and by
+// each scanbm with a single mmap instead of running the parser. The
+// snapshot is keyed by the config file and the included files (path,
+// mtime, size and a hash of the contents, a file with another mtime
+// but the same contents is still valid) and by the option table of
+// the program (its defaults included). A stale or unreadable snapshot
+// is ignored: the config is parsed and the snapshot is rewritten. A
+// snapshot owned by another user than root (or the actual one) or
+// writable by the group or others isn't trusted, a process that can't
+// replace the snapshot (e.g. after the privilege drop) doesn't try again.
+// The regexes are compiled from the loaded values (see
+// cfg_do_install()), the snapshot only skips the parser.
+//
+// the layout (native byte order, a cache only): the header, the
+// inputs, then the records of the values, depth first:
+//   'S' name title / 'U' name   a (titled / untitled) section begins
+//   'E'                         the section ends
+//   'R' name                    the list name is emptied
+//   'V' name value              a value (appended to a list)
+// strings are a uint32 length and the NUL terminated bytes
+
+#define CONFIG_SNAPSHOT_MAGIC "SCANBDCS"
+#define CONFIG_SNAPSHOT_VERSION 1
+
+// the nesting of the sections
+#define CONFIG_SNAPSHOT_DEPTH 8
+
+// FNV-1a of size bytes of data continuing h (CONFIG_SNAPSHOT_HASH_INIT
+// to start), the keys of the snapshot and the generation of the rule
+// set (see cfg_rules_t)
+#define CONFIG_SNAPSHOT_HASH_INIT 0xcbf29ce484222325ULL
+extern uint64_t config_snapshot_hash(const void* data, size_t size, uint64_t h);
+
+// starts the parse of config_file into fresh_cfg (just initialized,
+// only the defaults): records the option table and the config file,
+// the included files are recorded by config_snapshot_include()
+extern void config_snapshot_begin(cfg_t* fresh_cfg, const char* config_file);
+// the config is parsed for the snapshot (after a failed
+// config_snapshot_load()): the mtime, size and hash of each input are
+// taken before the parser reads it, so a file changed meanwhile doesn't
+// match the saved snapshot
+extern void config_snapshot_parse(void);
+// the include function of the config (see cfg_include())
+extern int config_snapshot_include(cfg_t* cfg, cfg_opt_t* opt, int argc, const char** argv);
+
+// loads the snapshot file into fresh_cfg (see config_snapshot_begin()),
+// returns false if it doesn't match the actual config files (the values
+// of fresh_cfg are undefined then)
+extern bool config_snapshot_load(const char* file, cfg_t* fresh_cfg);
+// writes parsed_cfg parsed since config_snapshot_parse() to the snapshot file
+extern void config_snapshot_save(const char* file, cfg_t* parsed_cfg);
+
+#endif // CONFIG_SNAPSHOT_H
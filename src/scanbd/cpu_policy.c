@@ -0,0 +1,183 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "cpu_policy.h"
+#include <sched.h>
+#include <sys/resource.h>
+
+// the cpus of a policy are a 64 bit mask
+#define CPU_POLICY_MAX_CPU 63
+
+#ifdef __linux__
+// the cpus of the daemon, taken before the first thread was placed:
+// a policy without cpus gets these (and not the cpus of the creator
+// of the thread)
+static cpu_set_t cpu_policy_all;
+static bool cpu_policy_all_valid = false;
+static pthread_once_t cpu_policy_once = PTHREAD_ONCE_INIT;
+
+static void cpu_policy_capture(void) {
+    CPU_ZERO(&cpu_policy_all);
+    if (sched_getaffinity(0, sizeof(cpu_policy_all), &cpu_policy_all) < 0) {
+        slog(SLOG_WARN, "sched_getaffinity: %s", strerror(errno));
+        return;
+    }
+    cpu_policy_all_valid = true;
+}
+
+// the cpu set of p, false if it can't be determined
+static bool cpu_policy_set(const cpu_policy_t* p, cpu_set_t* set) {
+    pthread_once(&cpu_policy_once, cpu_policy_capture);
+    if (p->cpus == 0) {
+        *set = cpu_policy_all;
+        return cpu_policy_all_valid;
+    }
+    CPU_ZERO(set);
+    for(int cpu = 0; cpu <= CPU_POLICY_MAX_CPU; cpu += 1) {
+        if (p->cpus & ((uint64_t)1 << cpu)) {
+            CPU_SET(cpu, set);
+        }
+    }
+    return true;
+}
+#endif
+
+void cpu_policy_init(cpu_policy_t* p) {
+    assert(p != NULL);
+    p->has_cpus = false;
+    p->cpus = 0;
+    p->rtprio = CPU_POLICY_UNSET;
+    p->nice = CPU_POLICY_UNSET;
+}
+
+bool cpu_policy_parse_cpus(cpu_policy_t* p, const char* list) {
+    assert(p != NULL);
+    assert(list != NULL);
+    uint64_t cpus = 0;
+    const char* s = list;
+    while(*s != '\0') {
+        char* end = NULL;
+        if (!isdigit((unsigned char)*s)) {
+            return false;
+        }
+        unsigned long first = strtoul(s, &end, 10);
+        unsigned long last = first;
+        s = end;
+        if (*s == '-') {
+            s += 1;
+            if (!isdigit((unsigned char)*s)) {
+                return false;
+            }
+            last = strtoul(s, &end, 10);
+            s = end;
+        }
+        if ((last < first) || (last > CPU_POLICY_MAX_CPU)) {
+            return false;
+        }
+        for(unsigned long cpu = first; cpu <= last; cpu += 1) {
+            cpus |= (uint64_t)1 << cpu;
+        }
+        if (*s == ',') {
+            s += 1;
+            if (*s == '\0') {
+                return false;
+            }
+        }
+        else if (*s != '\0') {
+            return false;
+        }
+    }
+    p->has_cpus = true;
+    p->cpus = cpus;
+    return true;
+}
+
+void cpu_policy_merge(cpu_policy_t* p, const cpu_policy_t* over) {
+    assert(p != NULL);
+    assert(over != NULL);
+    if (over->has_cpus) {
+        p->has_cpus = true;
+        p->cpus = over->cpus;
+    }
+    if (over->rtprio != CPU_POLICY_UNSET) {
+        p->rtprio = over->rtprio;
+    }
+    if (over->nice != CPU_POLICY_UNSET) {
+        p->nice = over->nice;
+    }
+}
+
+bool cpu_policy_equal(const cpu_policy_t* a, const cpu_policy_t* b) {
+    assert(a != NULL);
+    assert(b != NULL);
+    return (a->has_cpus == b->has_cpus) && (a->cpus == b->cpus) &&
+        (a->rtprio == b->rtprio) && (a->nice == b->nice);
+}
+
+void cpu_policy_thread(const cpu_policy_t* p, const char* who) {
+    assert(p != NULL);
+    assert(who != NULL);
+#ifdef __linux__
+    cpu_set_t set;
+    if (cpu_policy_set(p, &set)) {
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (ret != 0) {
+            slog(SLOG_WARN, "Can't set the cpus of the %s: %s", who, strerror(ret));
+        }
+    }
+#else
+    if (p->cpus != 0) {
+        slog(SLOG_WARN, "Can't set the cpus of the %s: not supported", who);
+    }
+#endif
+    if (p->rtprio > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        int max = sched_get_priority_max(SCHED_FIFO);
+        param.sched_priority = (p->rtprio < max) ? p->rtprio : max;
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0) {
+            slog(SLOG_WARN, "Can't set SCHED_FIFO %d for the %s: %s",
+                 param.sched_priority, who, strerror(ret));
+        }
+    }
+}
+
+void cpu_policy_child(const cpu_policy_t* p) {
+#ifdef __linux__
+    if (p->cpus != 0) {
+        // not cpu_policy_set(): no pthread_once() in the child
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(int cpu = 0; cpu <= CPU_POLICY_MAX_CPU; cpu += 1) {
+            if (p->cpus & ((uint64_t)1 << cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+    if (p->nice > 0) {
+        setpriority(PRIO_PROCESS, 0, p->nice);
+    }
+}
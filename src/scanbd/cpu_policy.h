@@ -0,0 +1,69 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef CPU_POLICY_H
+#define CPU_POLICY_H
+
+#include "common.h"
+#include <stdint.h>
+
+// the placement of the threads and scripts of the daemon on a
+// multi-core machine: the reactor (dbus, udev), the pollers and the
+// scripts can be restricted to disjoint sets of cpus, the pollers can
+// run with SCHED_FIFO and the scripts with a nice value, so that a
+// heavy script (OCR, pdf) doesn't delay the detection of a button
+// (see C_REACTOR_CPUS, C_POLL_CPUS, C_POLL_RTPRIO, C_SCRIPT_CPUS and
+// C_SCRIPT_NICE). The affinity is only supported on linux.
+
+// a field of a device section which isn't set (inherited)
+#define CPU_POLICY_UNSET -1
+
+struct cpu_policy {
+    bool has_cpus;          // the section sets the cpus
+    uint64_t cpus;          // bit n: cpu n, 0: all cpus of the daemon
+    int rtprio;             // > 0: SCHED_FIFO with this priority, 0:
+    // the policy of the priority class (pollers only)
+    int nice;               // > 0: the nice value (scripts only)
+};
+typedef struct cpu_policy cpu_policy_t;
+
+// an empty policy: all fields unset
+extern void cpu_policy_init(cpu_policy_t* p);
+// parses the cpu list (e.g. "0-1,3", empty: all cpus) into p, returns
+// false on a syntax error or a cpu above 63
+extern bool cpu_policy_parse_cpus(cpu_policy_t* p, const char* list);
+// the fields set in over replace those of p
+extern void cpu_policy_merge(cpu_policy_t* p, const cpu_policy_t* over);
+extern bool cpu_policy_equal(const cpu_policy_t* a, const cpu_policy_t* b);
+
+// applies the policy to the calling thread (the threads inherit the
+// affinity of their creator, so the cpus are always set), who names
+// the thread in the warnings
+extern void cpu_policy_thread(const cpu_policy_t* p, const char* who);
+// applies the cpus and the nice value of a script policy to the
+// calling process, the child of a fork before the exec (see
+// launch_script()): only async-signal-safe calls, a failure is
+// ignored, unset fields are left alone
+extern void cpu_policy_child(const cpu_policy_t* p);
+
+#endif // CPU_POLICY_H
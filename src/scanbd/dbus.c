@@ -23,9 +23,20 @@
 #include "scanbd.h"
 #include "scanbd_dbus.h"
 #include "scanbuttond_wrapper.h"
+#include "action.h"
+#include "script_env.h"
+#include "launch.h"
+#include "evloop.h"
+#include "stats.h"
+#include "metrics.h"
+#include "probe.h"
+#include "trigger_batch.h"
+
+#include <stdatomic.h>
 
 static DBusConnection* conn = NULL;
-static pthread_t dbus_tid = 0;
+// the connection is served by the reactor (see evloop.h)
+static bool dbus_in_evloop = false;
 
 #ifdef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
 // this is non-portable
@@ -34,30 +45,55 @@ static pthread_mutex_t dbus_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 static pthread_mutex_t dbus_mutex;
 #endif
 
-void dbus_send_signal_argv(const char* signal_name, char** argv) {
-    // TODO: we need a better dbus mainloop integrations, so that we
-    // can wakeup the main thread to sendout the messages we generate here
-
+// a trigger event queued by a poller (see dbus_send_trigger()), the
+// strings are copied into the event in one block
+struct dbus_trigger_event {
+    struct dbus_trigger_event* next;
+    const char* device;
+    const char* action;
+    dbus_uint32_t count;         // the coalesced events
+    char* env[];                 // NULL terminated, then the strings
+};
+typedef struct dbus_trigger_event dbus_trigger_event_t;
+
+// guards the queue: the pollers append, the reactor sends
+static pthread_mutex_t dbus_trigger_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dbus_trigger_event_t* dbus_trigger_head = NULL;
+static dbus_trigger_event_t* dbus_trigger_tail = NULL;
+// the reactor sends the queue (see dbus_start_dbus_thread())
+static bool dbus_trigger_live = false;
+// the queue is sent this many ms after its first event (0: at once),
+// the timer is identified by the address of dbus_trigger_coalesce
+static int dbus_trigger_coalesce = 0;
+
+// a subscriber of the button_state signals
+struct dbus_subscriber {
+    struct dbus_subscriber* next;
+    char* name;                  // the unique bus name of the client
+    char* device;                // only the states of this device, or
+    // NULL for all devices
+};
+typedef struct dbus_subscriber dbus_subscriber_t;
+
+// guards the subscribers: the reactor adds and removes them, the
+// pollers send to them
+static pthread_mutex_t dbus_state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dbus_subscriber_t* dbus_subscribers = NULL;
+// the number of subscribers, read by the pollers without the mutex
+static atomic_uint dbus_num_subscribers = 0;
+// bumped by each subscribe (never 0)
+static atomic_uint dbus_subscribe_gen = 1;
+
+// builds the signal with the strings of argv (NULL terminated) as an
+// array of strings
+static DBusMessage* dbus_signal_argv_new(const char* signal_name, char** argv) {
     DBusMessage* signal = NULL;
-
-    if (conn == NULL) {
-        if (!dbus_init()) {
-            return;
-        }
-    }
-    assert(conn);
-
-    if (!conn) {
-        slog(SLOG_DEBUG, "No dbus connection");
-        return;
-    }
-
     assert(signal_name != NULL);
     if ((signal = dbus_message_new_signal(SCANBD_DBUS_OBJECTPATH,
                                           SCANBD_DBUS_INTERFACE,
                                           signal_name)) == NULL) {
         slog(SLOG_ERROR, "Can't create signal");
-        return;
+        return NULL;
     }
 
     if (argv != NULL) {
@@ -85,20 +121,232 @@ void dbus_send_signal_argv(const char* signal_name, char** argv) {
             slog(SLOG_ERROR, "Can't close dbus container");
         }
     }
+    return signal;
+}
+
+void dbus_send_signal_argv(const char* signal_name, char** argv) {
+    if (conn == NULL) {
+        if (!dbus_init()) {
+            return;
+        }
+    }
+    assert(conn);
 
+    if (!conn) {
+        slog(SLOG_DEBUG, "No dbus connection");
+        return;
+    }
+
+    DBusMessage* signal = dbus_signal_argv_new(signal_name, argv);
+    if (signal == NULL) {
+        return;
+    }
     slog(SLOG_DEBUG, "now sending signal %s", signal_name);
     dbus_uint32_t serial = 0;
     if (dbus_connection_send(conn, signal, &serial) != TRUE) {
         slog(SLOG_ERROR, "Can't send signal");
     }
     slog(SLOG_DEBUG, "now flushing the dbus");
-    // TODO: with the standard-main loop this would block without
-    // using a timeout
+    // without the reactor nobody else writes the message out
     dbus_connection_flush(conn);
     slog(SLOG_DEBUG, "unref the signal");
     dbus_message_unref(signal);
 }
 
+// appends the event as (device, action, count, {name: value}) to the
+// array of the batch signal, the environment entries are split at the
+// '=' in place, so the strings are marshalled without a copy
+// must be called after the legacy signal of the event was built
+static bool dbus_trigger_append(DBusMessageIter* array, dbus_trigger_event_t* ev) {
+#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
+    DBusMessageIter item;
+    DBusMessageIter dict;
+    DBusMessageIter entry;
+#else
+    DBusMessageIter item = {};
+    DBusMessageIter dict = {};
+    DBusMessageIter entry = {};
+#endif
+    bool ok = dbus_message_iter_open_container(array, DBUS_TYPE_STRUCT, NULL, &item);
+    ok = ok && dbus_message_iter_append_basic(&item, DBUS_TYPE_STRING, &ev->device);
+    ok = ok && dbus_message_iter_append_basic(&item, DBUS_TYPE_STRING, &ev->action);
+    ok = ok && dbus_message_iter_append_basic(&item, DBUS_TYPE_UINT32, &ev->count);
+    ok = ok && dbus_message_iter_open_container(&item, DBUS_TYPE_ARRAY, "{ss}", &dict);
+    for(char** e = ev->env; ok && (*e != NULL); e += 1) {
+        char* sep = strchr(*e, '=');
+        if (sep == NULL) {
+            continue;
+        }
+        *sep = '\0';
+        const char* key = *e;
+        const char* value = sep + 1;
+        ok = dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+        ok = ok && dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+        ok = ok && dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &value);
+        ok = ok && dbus_message_iter_close_container(&dict, &entry);
+    }
+    ok = ok && dbus_message_iter_close_container(&item, &dict);
+    ok = ok && dbus_message_iter_close_container(array, &item);
+    return ok;
+}
+
+// sends the queued events: the legacy trigger signal of each event and
+// one trigger_events signal with all of them, the reactor writes them
+// out (no flush)
+// runs in the reactor
+static void dbus_trigger_send(void) {
+    if (pthread_mutex_lock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    dbus_trigger_event_t* events = dbus_trigger_head;
+    dbus_trigger_head = NULL;
+    dbus_trigger_tail = NULL;
+    if (pthread_mutex_unlock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (events == NULL) {
+        return;
+    }
+
+    dbus_uint32_t serial = 0;
+    DBusMessage* batch = dbus_message_new_signal(SCANBD_DBUS_OBJECTPATH,
+                                                 SCANBD_DBUS_INTERFACE,
+                                                 SCANBD_DBUS_SIGNAL_TRIGGER_EVENTS);
+#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
+    DBusMessageIter args;
+    DBusMessageIter array;
+#else
+    DBusMessageIter args = {};
+    DBusMessageIter array = {};
+#endif
+    bool ok = (batch != NULL);
+    if (ok) {
+        dbus_message_iter_init_append(batch, &args);
+        ok = dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(ssua{ss})", &array);
+    }
+    while(events != NULL) {
+        dbus_trigger_event_t* ev = events;
+        events = ev->next;
+        DBusMessage* signal = dbus_signal_argv_new(SCANBD_DBUS_SIGNAL_TRIGGER, ev->env);
+        if (signal != NULL) {
+            if (dbus_connection_send(conn, signal, &serial) != TRUE) {
+                slog(SLOG_ERROR, "Can't send signal");
+            }
+            dbus_message_unref(signal);
+        }
+        ok = ok && dbus_trigger_append(&array, ev);
+        free(ev);
+    }
+    ok = ok && dbus_message_iter_close_container(&args, &array);
+    if (!ok) {
+        slog(SLOG_ERROR, "Can't create signal %s", SCANBD_DBUS_SIGNAL_TRIGGER_EVENTS);
+    }
+    else if (dbus_connection_send(conn, batch, &serial) != TRUE) {
+        slog(SLOG_ERROR, "Can't send signal");
+    }
+    if (batch != NULL) {
+        dbus_message_unref(batch);
+    }
+}
+
+static void dbus_trigger_timer(void* arg) {
+    // one-shot: armed again by the next first event
+    evloop_set_timer(arg, dbus_trigger_coalesce, false);
+    dbus_trigger_send();
+}
+
+// the trigger signals of an action of the device: queued to the reactor
+// (the poller doesn't wait for the bus), an event of the same device
+// and action still queued is replaced and counted
+// without the reactor the legacy signal is sent at once
+void dbus_send_trigger(const char* device, const char* action, char** env) {
+    assert(device != NULL);
+    assert(action != NULL);
+    assert(env != NULL);
+
+    int n = 0;
+    size_t size = strlen(device) + strlen(action) + 2;
+    for(char** e = env; *e != NULL; e += 1) {
+        size += strlen(*e) + 1;
+        n += 1;
+    }
+    dbus_trigger_event_t* ev = malloc(sizeof(dbus_trigger_event_t) +
+                                      (n + 1) * sizeof(char*) + size);
+    if (ev == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the trigger signal");
+        return;
+    }
+    char* p = (char*)&ev->env[n + 1];
+    for(int i = 0; i < n; i += 1) {
+        size_t len = strlen(env[i]) + 1;
+        ev->env[i] = memcpy(p, env[i], len);
+        p += len;
+    }
+    ev->env[n] = NULL;
+    ev->device = strcpy(p, device);
+    p += strlen(device) + 1;
+    ev->action = strcpy(p, action);
+    ev->count = 1;
+    ev->next = NULL;
+
+    if (pthread_mutex_lock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        free(ev);
+        return;
+    }
+    if (!dbus_trigger_live) {
+        if (pthread_mutex_unlock(&dbus_trigger_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+        dbus_send_signal_argv(SCANBD_DBUS_SIGNAL_TRIGGER, ev->env);
+        free(ev);
+        return;
+    }
+    bool first = (dbus_trigger_head == NULL);
+    // without a coalescing window each event keeps its own signal (the
+    // queue only moves the sending to the reactor)
+    dbus_trigger_event_t** link = NULL;
+    if (dbus_trigger_coalesce > 0) {
+        for(link = &dbus_trigger_head; *link != NULL; link = &(*link)->next) {
+            if ((strcmp((*link)->device, ev->device) == 0) &&
+                (strcmp((*link)->action, ev->action) == 0)) {
+                break;
+            }
+        }
+    }
+    if ((link != NULL) && (*link != NULL)) {
+        // the latest values, the place of the first event
+        dbus_trigger_event_t* old = *link;
+        ev->count = old->count + 1;
+        ev->next = old->next;
+        *link = ev;
+        if (dbus_trigger_tail == old) {
+            dbus_trigger_tail = ev;
+        }
+        free(old);
+    }
+    else {
+        if (dbus_trigger_tail != NULL) {
+            dbus_trigger_tail->next = ev;
+        }
+        else {
+            dbus_trigger_head = ev;
+        }
+        dbus_trigger_tail = ev;
+    }
+    if (first && (dbus_trigger_coalesce > 0)) {
+        evloop_set_timer(&dbus_trigger_coalesce, dbus_trigger_coalesce, true);
+    }
+    if (pthread_mutex_unlock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (first && (dbus_trigger_coalesce <= 0)) {
+        // sent by the idle function of the next round
+        evloop_wakeup();
+    }
+}
+
 void dbus_send_signal(const char* signal_name, const char* arg) {
     DBusMessage* signal = NULL;
 
@@ -140,161 +388,61 @@ void dbus_send_signal(const char* signal_name, const char* arg) {
     if (dbus_connection_send(conn, signal, &serial) != TRUE) {
         slog(SLOG_ERROR, "Can't send signal");
     }
-    dbus_connection_flush(conn);
+    // the reactor writes the message out, the sender doesn't wait for
+    // the bus
+    if (!dbus_in_evloop) {
+        dbus_connection_flush(conn);
+    }
     dbus_message_unref(signal);
 }
 
-static void hook_device_ex(const char *param, const char *action_name, const char *dev_name) {
+// the hook scripts are resolved and checked with the config (see
+// cfg_rules_build()), script is NULL if the hook isn't set
+static void hook_device_ex(const char *script, const char *action_name, const char *dev_name) {
     slog(SLOG_DEBUG, "hook_device_ex");
     assert(dev_name);
-    assert(param);
     assert(action_name);
 
-    slog(SLOG_DEBUG, "hook_device_ex: parameter: %s", param);
     slog(SLOG_DEBUG, "hook_device_ex: action: %s", action_name);
     slog(SLOG_DEBUG, "hook_device_ex: device: %s", dev_name);
 
-    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
-    assert(cfg_sec_global);
-    const char* script = cfg_getstr(cfg_sec_global, param);
-
-    if (!script || (strlen(script) == 0)) {
-        slog(SLOG_INFO, "No hook script for inserting device: %s", dev_name);
-        //script = SCANBD_NULL_STRING;
+    if (script == NULL) {
+        slog(SLOG_INFO, "No hook script for %s device: %s", action_name, dev_name);
         return; // No hook script, nothing for us to do here.
     }
-    slog(SLOG_INFO, "Using hook script %s for inserting device: %s", script, dev_name);
-
-    cfg_t* global_envs = cfg_getsec(cfg_sec_global, C_ENVIRONMENT);
-    // number of env-vars =
-    // the values in the environment-section (2):
-    // device, action
-    // plus those 4:
-    // PATH, PWD, USER, HOME
-    // plus the sentinel
-    const int number_of_envs = 4 + 2 + 1;
-    char** env = calloc(number_of_envs, sizeof(char*));
-    for(int e = 0; e < number_of_envs; e += 1) {
-        env[e] = calloc(NAME_MAX + 1, sizeof(char));
-    }
-    int e = 0;
-    const char* ev = "PATH";
-    if (getenv(ev) != NULL) {
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-        e += 1;
-    }
-    else {
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, "/usr/sbin:/usr/bin:/sbin:/bin");
-        slog(SLOG_DEBUG, "No PATH, setting env: %s", env[e]);
-        e += 1;
-    }
-    ev = "PWD";
-    if (getenv(ev) != NULL) {
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-        e += 1;
+    slog(SLOG_INFO, "Using hook script %s for %s device: %s", script, action_name, dev_name);
+
+    // the environment of the hook: the static entries for this
+    // device and the action
+    script_env_t se;
+    script_env_init(&se, dev_name, 0);
+    char** env = script_env_build(&se, action_name);
+    script_env_free(&se);
+    if (env == NULL) {
+        return;
     }
-    else {
-        char buf[PATH_MAX+1];
-        char* ptr = getcwd(buf, PATH_MAX);
-        if (!ptr) {
-            slog(SLOG_ERROR, "can't get pwd");
-        }
-        else {
-            assert(ptr);
-            snprintf(env[e], NAME_MAX, "%s=%s", ev, ptr);
-            slog(SLOG_DEBUG, "No PWD, setting env: %s", env[e]);
-            e += 1;
+
+    // the hooks run in the reactor, with the nice value (and the
+    // cpus, if set) of the scripts
+    pid_t cpid = launch_script(script, env, &cfg_rules->global.script);
+    if (cpid > 0) {
+        int status = launch_wait(cpid, script);
+        if (status >= 0) {
+            metrics_script_exit(dev_name, status);
         }
     }
-    ev = "USER";
-    if (getenv(ev) != NULL) {
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-        e += 1;
-    }
-    else {
-        struct passwd* pwd = NULL;
-        pwd = getpwuid(geteuid());
-        assert(pwd);
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, pwd->pw_name);
-        slog(SLOG_DEBUG, "No USER, setting env: %s", env[e]);
-        e += 1;
-    }
-    ev = "HOME";
-    if (getenv(ev) != NULL) {
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-        e += 1;
-    }
-    else {
-        struct passwd* pwd = 0;
-        pwd = getpwuid(geteuid());
-        assert(pwd);
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, pwd->pw_dir);
-        slog(SLOG_DEBUG, "No HOME, setting env: %s", env[e]);
-        e += 1;
-    }
-    ev = cfg_getstr(global_envs, C_DEVICE);
-    if (ev != NULL) {
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, dev_name);
-        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-        e += 1;
-    }
-    ev = cfg_getstr(global_envs, C_ACTION);
-    if (ev != NULL) {
-        snprintf(env[e], NAME_MAX, "%s=%s", ev, action_name);
-        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-        e += 1;
-    }
-    env[e] = NULL;
-    assert(e == number_of_envs-1);
-
-    char *script_abs = make_script_path_abs(script);
-    assert(script_abs);
-    slog(SLOG_DEBUG, "Hook script path: %s for inserting device: %s", script_abs, dev_name);
-
-    if (strcmp(script_abs, SCANBD_NULL_STRING) != 0) {
-        pid_t cpid = -1;
-        if ((cpid = fork()) < 0) {
-            slog(SLOG_ERROR, "Can't fork: %s", strerror(errno));
-        }
-        else if (cpid > 0) { // parent
-            slog(SLOG_INFO, "waiting for child: %s", script_abs);
-            int status;
-            if (waitpid(cpid, &status, 0) < 0) {
-                slog(SLOG_ERROR, "waitpid: %s", strerror(errno));
-            }
-            if (WIFEXITED(status)) {
-                slog(SLOG_INFO, "child %s exited with status: %d",
-                     script_abs, WEXITSTATUS(status));
-            }
-            if (WIFSIGNALED(status)) {
-                slog(SLOG_INFO, "child %s signaled with signal: %d",
-                     script_abs, WTERMSIG(status));
-            }
-        }
-        else { // child
-            slog(SLOG_DEBUG, "exec for %s", script_abs);
-            if (execle(script_abs, script_abs, NULL, env) < 0) {
-                slog(SLOG_ERROR, "execlp: %s", strerror(errno));
-            }
-            exit(EXIT_FAILURE); // not reached
-        }
-    } // script_abs == SCANBD_NULL_STRING
-
-    assert(script_abs != NULL);
-    free(script_abs);
+    free(env);
 }
 
 static void hook_device_insert(const char *dev_name) {
     slog(SLOG_DEBUG, "hook_device_insert");
-    hook_device_ex(C_DEVICE_INSERT_SCRIPT, "insert", dev_name);
+    assert(cfg_rules != NULL);
+    hook_device_ex(cfg_rules->insert_script, "insert", dev_name);
 }
 
 static void hook_device_remove(const char *dev_name) {
-    hook_device_ex(C_DEVICE_REMOVE_SCRIPT, "remove", dev_name);
+    assert(cfg_rules != NULL);
+    hook_device_ex(cfg_rules->remove_script, "remove", dev_name);
 }
 
 #ifdef USE_HAL
@@ -309,18 +457,30 @@ static void hal_device_added(LibHalContext* ctx, const char *udi) {
                                        HAL_SCANNER_CAPABILITY, &dbus_error) == TRUE) {
         // found new scanner
         slog(SLOG_INFO, "New Scanner: %s", udi);
+        // a poller stuck in a backend call still uses the backends: they
+        // aren't reinitialized then
+        int stuck = 0;
 #ifdef USE_SANE
-        stop_sane_threads();
-#else
-        stop_scbtn_threads();
+        stuck += stop_sane_threads();
+#endif
+#ifdef USE_SCANBUTTOND
+        stuck += stop_scbtn_threads();
 #endif
+        if (stuck > 0) {
+            slog(SLOG_WARN, "%d pollers are stuck, the backends stay initialized", stuck);
+        }
 #ifdef USE_SANE
 # ifdef SANE_REINIT
-        slog(SLOG_DEBUG, "sane_exit");
-        sane_exit();
+        if (stuck == 0) {
+            slog(SLOG_DEBUG, "sane_exit");
+            sane_exit();
+        }
 # endif
-#else
-        scbtn_shutdown();
+#endif
+#ifdef USE_SCANBUTTOND
+        if (stuck == 0) {
+            scbtn_shutdown();
+        }
 #endif
 
 #ifdef SANE_REINIT_TIMEOUT
@@ -331,14 +491,8 @@ static void hal_device_added(LibHalContext* ctx, const char *udi) {
         hook_device_insert(udi);
 
         slog(SLOG_DEBUG, "sane_init");
-#ifdef USE_SANE
-# ifdef SANE_REINIT        
-        sane_init(NULL, NULL);
-# endif
-        get_sane_devices();
-        start_sane_threads();
-#else
-        if (scanbtnd_init() < 0) {
+#ifdef USE_SCANBUTTOND
+        if ((stuck == 0) && (scanbtnd_init() < 0)) {
             slog(SLOG_INFO, "Could not initialize scanbuttond modules!\n");
             exit(EXIT_FAILURE);
         }
@@ -346,6 +500,15 @@ static void hal_device_added(LibHalContext* ctx, const char *udi) {
 
         get_scbtn_devices();
         start_scbtn_threads();
+#endif
+#ifdef USE_SANE
+# ifdef SANE_REINIT
+        if (stuck == 0) {
+            sane_init(NULL, NULL);
+        }
+# endif
+        get_sane_devices();
+        start_sane_threads();
 #endif
     }
 }
@@ -365,19 +528,31 @@ static void hal_device_removed(LibHalContext* ctx, const char *udi) {
                                        HAL_SCANNER_CAPABILITY, &dbus_error) == TRUE) {
         slog(SLOG_INFO, "Removed Scanner: %s", udi);
     }
+    // a poller stuck in a backend call still uses the backends: they
+    // aren't reinitialized then
+    int stuck = 0;
 #ifdef USE_SANE
-    stop_sane_threads();
-#else
-    stop_scbtn_threads();
+    stuck += stop_sane_threads();
+#endif
+#ifdef USE_SCANBUTTOND
+    stuck += stop_scbtn_threads();
 #endif
+    if (stuck > 0) {
+        slog(SLOG_WARN, "%d pollers are stuck, the backends stay initialized", stuck);
+    }
 
 #ifdef USE_SANE
 # ifdef SANE_REINIT
-    slog(SLOG_DEBUG, "sane_exit");
-    sane_exit();
+    if (stuck == 0) {
+        slog(SLOG_DEBUG, "sane_exit");
+        sane_exit();
+    }
 # endif
-#else
-    scbtn_shutdown();
+#endif
+#ifdef USE_SCANBUTTOND
+    if (stuck == 0) {
+        scbtn_shutdown();
+    }
 #endif
 
 #ifdef SANE_REINIT_TIMEOUT
@@ -387,14 +562,8 @@ static void hal_device_removed(LibHalContext* ctx, const char *udi) {
     hook_device_remove(udi);
 
     slog(SLOG_DEBUG, "sane_init");
-#ifdef USE_SANE
-# ifdef SANE_REINIT
-    sane_init(NULL, NULL);
-# endif
-    get_sane_devices();
-    start_sane_threads();
-#else
-    if (scanbtnd_init() < 0) {
+#ifdef USE_SCANBUTTOND
+    if ((stuck == 0) && (scanbtnd_init() < 0)) {
         slog(SLOG_INFO, "Could not initialize scanbuttond modules!\n");
         exit(EXIT_FAILURE);
     }
@@ -403,48 +572,86 @@ static void hal_device_removed(LibHalContext* ctx, const char *udi) {
     get_scbtn_devices();
     start_scbtn_threads();
 #endif
+#ifdef USE_SANE
+# ifdef SANE_REINIT
+    if (stuck == 0) {
+        sane_init(NULL, NULL);
+    }
+# endif
+    get_sane_devices();
+    start_sane_threads();
+#endif
 }
 #endif
 
-// this function is used from dbus_thread and udev_thread
-void dbus_signal_device_added(void) {
+// applies the added and removed devices (the coalesced hotplug
+// events of udev, see hotplug.h, or a single dbus signal): the hooks
+// are called once, the pollers are updated once
+// this function is used from the dbus and the udev handlers of the reactor
+void dbus_signal_devices_changed(int added, int removed) {
     if (pthread_mutex_lock(&dbus_mutex)) {
         slog(SLOG_ERROR, "Can't lock mutex");
     }
 #ifndef USE_HAL
-    slog(SLOG_DEBUG, "dbus_signal_device_added");
-    // look for new scanner
-#ifdef USE_SANE
-    stop_sane_threads();
-#else
+    slog(SLOG_DEBUG, "dbus_signal_devices_changed: %d added, %d removed", added, removed);
+    // look for new and removed scanners
+#if defined(USE_SANE) && !defined(SANE_REINIT)
+    if (removed > 0) {
+        hook_device_remove("dbus device");
+    }
+    if (added > 0) {
+        hook_device_insert("dbus device");
+    }
+    // only the pollers of the new and removed devices are started /
+    // stopped, all other devices keep on polling
+#ifdef SCANBD_HYBRID
+    // the scanbuttond devices first: they are left out by sane
     stop_scbtn_threads();
-#endif // USE_SANE
+    get_scbtn_devices();
+    start_scbtn_threads();
+#endif
+    update_sane_threads();
+#else
+    // a poller stuck in a backend call still uses the backends: they
+    // aren't reinitialized then
+    int stuck = 0;
+#ifdef USE_SANE
+    stuck += stop_sane_threads();
+#endif
+#ifdef USE_SCANBUTTOND
+    stuck += stop_scbtn_threads();
+#endif
+    if (stuck > 0) {
+        slog(SLOG_WARN, "%d pollers are stuck, the backends stay initialized", stuck);
+    }
 #ifdef USE_SANE
 # ifdef SANE_REINIT
-    slog(SLOG_DEBUG, "sane_exit");
-    sane_exit();
+    if (stuck == 0) {
+        slog(SLOG_DEBUG, "sane_exit");
+        sane_exit();
+    }
 # endif
-#else
-    scbtn_shutdown();
-#endif // USE_SANE
+#endif
+#ifdef USE_SCANBUTTOND
+    if (stuck == 0) {
+        scbtn_shutdown();
+    }
+#endif
 
 #ifdef SANE_REINIT_TIMEOUT
     sleep(SANE_REINIT_TIMEOUT); // TODO: don't know if this is
     // really neccessary
 #endif
 
-    hook_device_insert("dbus device");
+    if (removed > 0) {
+        hook_device_remove("dbus device");
+    }
+    if (added > 0) {
+        hook_device_insert("dbus device");
+    }
 
-#ifdef USE_SANE
-# ifdef SANE_REINIT
-    slog(SLOG_DEBUG, "sane_init");
-    sane_init(NULL, NULL);
-# endif
-    slog(SLOG_DEBUG, "get new devices");
-    get_sane_devices();
-    start_sane_threads();
-#else
-    if (scanbtnd_init() < 0) {
+#ifdef USE_SCANBUTTOND
+    if ((stuck == 0) && (scanbtnd_init() < 0)) {
         slog(SLOG_INFO, "Could not initialize scanbuttond modules!\n");
         exit(EXIT_FAILURE);
     }
@@ -452,152 +659,546 @@ void dbus_signal_device_added(void) {
 
     get_scbtn_devices();
     start_scbtn_threads();
-#endif // USE_SANE
+#endif
+#ifdef USE_SANE
+# ifdef SANE_REINIT
+    if (stuck == 0) {
+        slog(SLOG_DEBUG, "sane_init");
+        sane_init(NULL, NULL);
+    }
+# endif
+    slog(SLOG_DEBUG, "get new devices");
+    get_sane_devices();
+    start_sane_threads();
+#endif
+#endif // USE_SANE && !SANE_REINIT
+#else
+    (void)added;
+    (void)removed;
 #endif // USE_HAL
     if (pthread_mutex_unlock(&dbus_mutex)) {
         slog(SLOG_ERROR, "Can't unlock mutex");
     }
 }
 
+void dbus_signal_device_added(void) {
+    dbus_signal_devices_changed(1, 0);
+}
+
 void dbus_signal_device_removed(void) {
-    if (pthread_mutex_lock(&dbus_mutex)) {
-        slog(SLOG_ERROR, "Can't lock mutex");
+    dbus_signal_devices_changed(0, 1);
+}
+
+// returns the (optional) device name argument of acquire / release,
+// NULL if there is none
+static const char* dbus_method_device(DBusMessage *message) {
+#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
+    DBusMessageIter args;
+#else
+    DBusMessageIter args = {};
+#endif
+    const char* device = NULL;
+    if (!dbus_message_iter_init(message, &args)) {
+        return NULL;
     }
-#ifndef USE_HAL
-    slog(SLOG_DEBUG, "dbus_signal_device_removed");
-    // look for removed scanner
+    if (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_STRING) {
+        slog(SLOG_WARN, "device argument has wrong type");
+        return NULL;
+    }
+    dbus_message_iter_get_basic(&args, &device);
+    return device;
+}
+
+// the error reply of acquire / release: a poller is stuck in a backend
+// call and still holds its device
+static DBusMessage* dbus_method_stuck(DBusMessage *message) {
+    DBusMessage* error = NULL;
+    if ((error = dbus_message_new_error(message, DBUS_ERROR_FAILED,
+                                        "a poller is stuck")) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+    }
+    return error;
+}
+
+// is called after saned has finished: with a device name argument only
+// the poller of this device resumes (with the matched options kept),
+// otherwise all polling threads are restarted
+static DBusMessage* dbus_method_release(DBusMessage *message) {
+    slog(SLOG_DEBUG, "dbus_method_release");
+    const char* device = dbus_method_device(message);
+    if (device != NULL) {
+        registry_park_t park = REGISTRY_PARK_NONE;
 #ifdef USE_SANE
-    stop_sane_threads();
-#else
-    stop_scbtn_threads();
+        park = sane_release_device(device);
+#endif
+#ifdef USE_SCANBUTTOND
+        if (park == REGISTRY_PARK_NONE) {
+            park = scbtn_release_device(device);
+        }
 #endif
+        if (park == REGISTRY_PARK_NONE) {
+            slog(SLOG_WARN, "release: no poller for device %s", device);
+        }
+        if (park == REGISTRY_PARK_STUCK) {
+            return dbus_method_stuck(message);
+        }
+    }
+    else {
+        // start all threads
+#ifdef USE_SCANBUTTOND
+        start_scbtn_threads();
+#endif
+#ifdef USE_SANE
+        start_sane_threads();
+#endif
+    }
+    DBusMessage* reply = NULL;
+    if ((reply = dbus_message_new_method_return(message)) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+    }
+    return reply;
+}
 
+// is called before saned started
+// the (empty) reply acknowledges the release: it is sent after the
+// polling threads have closed their devices, so saned can start at
+// once. With a device name argument only the poller of this device is
+// parked, all other devices keep on polling
+static DBusMessage* dbus_method_acquire(DBusMessage *message) {
+    slog(SLOG_DEBUG, "dbus_method_acquire");
+    const char* device = dbus_method_device(message);
+    if (device != NULL) {
+        registry_park_t park = REGISTRY_PARK_NONE;
 #ifdef USE_SANE
-# ifdef SANE_REINIT
-    slog(SLOG_DEBUG, "sane_exit");
-    sane_exit();
-# endif
-#else
-    scbtn_shutdown();
+        park = sane_acquire_device(device);
 #endif
+#ifdef USE_SCANBUTTOND
+        if (park == REGISTRY_PARK_NONE) {
+            park = scbtn_acquire_device(device);
+        }
+#endif
+        if (park == REGISTRY_PARK_NONE) {
+            slog(SLOG_WARN, "acquire: no poller for device %s", device);
+        }
+        if (park == REGISTRY_PARK_STUCK) {
+            // the poller still holds the device, saned can't use it
+            return dbus_method_stuck(message);
+        }
+    }
+    else {
+        // stop all threads
+        int stuck = 0;
+#ifdef USE_SANE
+        stuck += stop_sane_threads();
+#endif
+#ifdef USE_SCANBUTTOND
+        stuck += stop_scbtn_threads();
+#endif
+        if (stuck > 0) {
+            // a poller stuck in a backend call still holds its device
+            slog(SLOG_WARN, "%d pollers are stuck, the release isn't acknowledged", stuck);
+            return dbus_method_stuck(message);
+        }
+    }
+    DBusMessage* reply = NULL;
+    if ((reply = dbus_message_new_method_return(message)) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+    }
+    return reply;
+}
 
-#ifdef SANE_REINIT_TIMEOUT
-    sleep(SANE_REINIT_TIMEOUT); // TODO: don't know if this is
-    // really neccessary
+static void dbus_method_trigger(DBusMessage *message) {
+#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
+        DBusMessageIter args;
+#else
+        DBusMessageIter args = {};
 #endif
 
-    hook_device_remove("dbus device");
+    dbus_uint32_t device = -1;
+    dbus_uint32_t action = -1;
+    const char* name = NULL;
 
+    if (!dbus_message_iter_init(message, &args)) {
+        slog(SLOG_WARN, "trigger has no arguments");
+        return;
+    }
+    // the device number or (stable across rediscoveries) the device name
+    if (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_UINT32) {
+        dbus_message_iter_get_basic(&args, &device);
+        slog(SLOG_INFO, "trigger device %d", device);
+    }
+    else if (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_STRING) {
+        dbus_message_iter_get_basic(&args, &name);
+        slog(SLOG_INFO, "trigger device %s", name);
+    }
+    else {
+        slog(SLOG_WARN, "trigger has wrong argument type");
+        return;
+    }
+    if (!dbus_message_iter_next(&args)) {
+        slog(SLOG_WARN, "trigger has too few arguments");
+        return;
+    }
+    if (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_UINT32) {
+        dbus_message_iter_get_basic(&args, &action);
+        slog(SLOG_INFO, "trigger action %d", action);
+    }
+    else {
+        slog(SLOG_WARN, "trigger has wrong argument type");
+        return;
+    }
+    // posting to the trigger mailbox never waits for a poll cycle, in
+    // hybrid mode the registry wakes the pollers of scanbuttond as well
 #ifdef USE_SANE
-# ifdef SANE_REINIT
-    slog(SLOG_DEBUG, "sane_init");
-    sane_init(NULL, NULL);
-# endif
-    slog(SLOG_DEBUG, "get new devices");
-    get_sane_devices();
-    start_sane_threads();
+    if (name != NULL) {
+        sane_trigger_device(name, action);
+        return;
+    }
+    sane_trigger_action(device, action);
 #else
-    if (scanbtnd_init() < 0) {
-        slog(SLOG_INFO, "Could not initialize scanbuttond modules!\n");
-        exit(EXIT_FAILURE);
+    if (name != NULL) {
+        scbtn_trigger_device(name, action);
+        return;
     }
-    assert(backend);
+    scbtn_trigger_action(device, action);
 #endif
+}
 
+// starts the batch of one (device, action, count, rate) struct of a
+// trigger_batch call
+static bool dbus_trigger_batch_entry(DBusMessageIter* entry) {
+    const char* device = NULL;
+    dbus_uint32_t values[3] = {0, 0, 0}; // action, count, rate
+    if (dbus_message_iter_get_arg_type(entry) != DBUS_TYPE_STRING) {
+        slog(SLOG_WARN, "trigger_batch has wrong argument type");
+        return false;
+    }
+    dbus_message_iter_get_basic(entry, &device);
+    for(int i = 0; i < 3; i += 1) {
+        if (!dbus_message_iter_next(entry) ||
+            (dbus_message_iter_get_arg_type(entry) != DBUS_TYPE_UINT32)) {
+            slog(SLOG_WARN, "trigger_batch has wrong argument type");
+            return false;
+        }
+        dbus_message_iter_get_basic(entry, &values[i]);
+    }
+    if (values[0] > INT_MAX) {
+        slog(SLOG_WARN, "trigger_batch: no such action %u", values[0]);
+        return false;
+    }
+    return trigger_batch_add(device, (int)values[0], values[1], values[2]);
+}
+
+// starts the batch triggers of the array of (device, action, count,
+// rate) structs (see trigger_batch.h) and replies the number of
+// batches started (uint32)
+static DBusMessage* dbus_method_trigger_batch(DBusMessage *message) {
+    slog(SLOG_DEBUG, "dbus_method_trigger_batch");
+#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
+    DBusMessageIter args;
+    DBusMessageIter array;
+    DBusMessageIter entry;
+#else
+    DBusMessageIter args = {};
+    DBusMessageIter array = {};
+    DBusMessageIter entry = {};
 #endif
-    if (pthread_mutex_unlock(&dbus_mutex)) {
-        slog(SLOG_ERROR, "Can't unlock mutex");
+    dbus_uint32_t started = 0;
+    if (!dbus_message_iter_init(message, &args) ||
+        (dbus_message_iter_get_arg_type(&args) != DBUS_TYPE_ARRAY) ||
+        (dbus_message_iter_get_element_type(&args) != DBUS_TYPE_STRUCT)) {
+        slog(SLOG_WARN, "trigger_batch has wrong argument type");
+    }
+    else {
+        dbus_message_iter_recurse(&args, &array);
+        while(dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT) {
+            dbus_message_iter_recurse(&array, &entry);
+            if (dbus_trigger_batch_entry(&entry)) {
+                started += 1;
+            }
+            dbus_message_iter_next(&array);
+        }
+    }
+
+    DBusMessage* reply = NULL;
+    if ((reply = dbus_message_new_method_return(message)) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+        return NULL;
+    }
+    if (!dbus_message_append_args(reply, DBUS_TYPE_UINT32, &started, DBUS_TYPE_INVALID)) {
+        slog(SLOG_ERROR, "Can't compose reply");
+        dbus_message_unref(reply);
+        return NULL;
+    }
+    return reply;
+}
+
+// replies the counters of the action executor:
+// running, queued, executed, dropped (all uint32)
+static DBusMessage* dbus_method_action_stats(DBusMessage *message) {
+    slog(SLOG_DEBUG, "dbus_method_action_stats");
+    action_stats_t stats = {0, 0, 0, 0};
+    action_executor_stats(&stats);
+
+    DBusMessage* reply = NULL;
+    if ((reply = dbus_message_new_method_return(message)) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+        return NULL;
+    }
+    dbus_uint32_t running = stats.running;
+    dbus_uint32_t queued = stats.queued;
+    dbus_uint32_t executed = stats.executed;
+    dbus_uint32_t dropped = stats.dropped;
+    if (!dbus_message_append_args(reply,
+                                  DBUS_TYPE_UINT32, &running,
+                                  DBUS_TYPE_UINT32, &queued,
+                                  DBUS_TYPE_UINT32, &executed,
+                                  DBUS_TYPE_UINT32, &dropped,
+                                  DBUS_TYPE_INVALID)) {
+        slog(SLOG_ERROR, "Can't append args");
+        dbus_message_unref(reply);
+        return NULL;
+    }
+    return reply;
+}
+
+// replies the latency statistics of all devices (see stats_report())
+// as one string
+static DBusMessage* dbus_method_stats(DBusMessage *message) {
+    slog(SLOG_DEBUG, "dbus_method_stats");
+    char* report = stats_report();
+    if (report == NULL) {
+        return NULL;
+    }
+    DBusMessage* reply = NULL;
+    if ((reply = dbus_message_new_method_return(message)) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+        free(report);
+        return NULL;
+    }
+    if (!dbus_message_append_args(reply,
+                                  DBUS_TYPE_STRING, &report,
+                                  DBUS_TYPE_INVALID)) {
+        slog(SLOG_ERROR, "Can't append args");
+        dbus_message_unref(reply);
+        reply = NULL;
     }
+    free(report);
+    return reply;
 }
 
-// is called when saned exited
-static void dbus_method_release(void) {
-    slog(SLOG_DEBUG, "dbus_method_release");
-    // start all threads
-#ifdef USE_SANE
-    start_sane_threads();
-#else
-    start_scbtn_threads();
-#endif
+// the match of the bus signal telling the client name has gone
+static void dbus_subscriber_match(const char* name, bool add) {
+    char match[PATH_MAX+1] = {};
+    snprintf(match, PATH_MAX,
+             "type='signal',sender='%s',interface='%s',member='%s',arg0='%s'",
+             DBUS_SERVICE_DBUS, DBUS_INTERFACE_DBUS, DBUS_BUS_SIGNAL_NAME_OWNER, name);
+    // without an error the call doesn't wait for the bus
+    if (add) {
+        dbus_bus_add_match(conn, match, NULL);
+    }
+    else {
+        dbus_bus_remove_match(conn, match, NULL);
+    }
 }
 
-// is called before saned started
-static void dbus_method_acquire(void) {
-    slog(SLOG_DEBUG, "dbus_method_acquire");
-    // stop all threads
-#ifdef USE_SANE
-    stop_sane_threads();
-#else
-    stop_scbtn_threads();
-#endif
+// removes the subscriptions of the client name (of the device, or all
+// if device is NULL), returns if the client has subscriptions left
+// the dbus_state_mutex must be held by the caller
+static bool dbus_subscriber_remove(const char* name, const char* device) {
+    bool left = false;
+    dbus_subscriber_t** link = &dbus_subscribers;
+    while(*link != NULL) {
+        dbus_subscriber_t* s = *link;
+        if ((strcmp(s->name, name) == 0) &&
+            ((device == NULL) || ((s->device != NULL) && (strcmp(s->device, device) == 0)))) {
+            *link = s->next;
+            free(s->name);
+            free(s->device);
+            free(s);
+            atomic_fetch_sub(&dbus_num_subscribers, 1);
+            continue;
+        }
+        left = left || (strcmp(s->name, name) == 0);
+        link = &s->next;
+    }
+    return left;
 }
 
-struct sane_trigger_arg {
-    void (*f)(void*);
-    int device;
-    int action;
-};
-typedef struct sane_trigger_arg sane_trigger_arg_t;
+// subscribes the caller to the button_state signals, with a (non
+// empty) device name argument to the states of this device only
+// the pollers send all their values once to a new subscriber
+static DBusMessage* dbus_method_subscribe(DBusMessage *message) {
+    slog(SLOG_DEBUG, "dbus_method_subscribe");
+    const char* sender = dbus_message_get_sender(message);
+    if (sender == NULL) {
+        slog(SLOG_WARN, "subscribe without a sender");
+        return NULL;
+    }
+    const char* device = dbus_method_device(message);
+    if ((device != NULL) && (strlen(device) == 0)) {
+        device = NULL;
+    }
+    dbus_subscriber_t* s = calloc(1, sizeof(dbus_subscriber_t));
+    if (s != NULL) {
+        s->name = strdup(sender);
+        s->device = (device != NULL) ? strdup(device) : NULL;
+    }
+    if ((s == NULL) || (s->name == NULL) || ((device != NULL) && (s->device == NULL))) {
+        slog(SLOG_ERROR, "Can't allocate memory for the subscriber");
+        if (s != NULL) {
+            free(s->name);
+            free(s->device);
+            free(s);
+        }
+        return NULL;
+    }
+    if (pthread_mutex_lock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+    // a repeated subscription replaces the old one
+    bool known = dbus_subscriber_remove(sender, device);
+    if (device == NULL) {
+        known = dbus_subscriber_remove(sender, NULL) || known;
+    }
+    s->next = dbus_subscribers;
+    dbus_subscribers = s;
+    atomic_fetch_add(&dbus_num_subscribers, 1);
+    unsigned int gen = atomic_load(&dbus_subscribe_gen) + 1;
+    atomic_store(&dbus_subscribe_gen, (gen == 0) ? 1 : gen);
+    if (pthread_mutex_unlock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (!known) {
+        dbus_subscriber_match(sender, true);
+    }
+    slog(SLOG_INFO, "%s subscribed to the states of %s", sender,
+         (device != NULL) ? device : "all devices");
 
-void* dbus_call_sane_trigger_action_thread(void* arg) {
-    sane_trigger_arg_t* a = (sane_trigger_arg_t*) arg;
-    assert(a != NULL);
-#ifdef USE_SANE
-    sane_trigger_action(a->device, a->action);
-#else
-    scbtn_trigger_action(a->device, a->action);
-#endif
-    return NULL;
+    DBusMessage* reply = NULL;
+    if ((reply = dbus_message_new_method_return(message)) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+    }
+    return reply;
 }
 
-void sane_trigger_action_async(int device, int action) {
-    sane_trigger_arg_t* arg = calloc(1, sizeof(sane_trigger_arg_t));
-    assert(arg != NULL);
-
-    arg->device = device;
-    arg->action = action;
-
-    pthread_t tid;
-    if (pthread_create(&tid, NULL, dbus_call_sane_trigger_action_thread, arg) < 0) {
-        slog(SLOG_WARN, "pthread_create: %s", strerror(errno));
+// ends the subscription of the caller (of the device argument, or all)
+static DBusMessage* dbus_method_unsubscribe(DBusMessage *message) {
+    slog(SLOG_DEBUG, "dbus_method_unsubscribe");
+    const char* sender = dbus_message_get_sender(message);
+    if (sender == NULL) {
+        slog(SLOG_WARN, "unsubscribe without a sender");
+        return NULL;
     }
+    const char* device = dbus_method_device(message);
+    if ((device != NULL) && (strlen(device) == 0)) {
+        device = NULL;
+    }
+    if (pthread_mutex_lock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+    bool left = dbus_subscriber_remove(sender, device);
+    if (pthread_mutex_unlock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (!left) {
+        dbus_subscriber_match(sender, false);
+    }
+    DBusMessage* reply = NULL;
+    if ((reply = dbus_message_new_method_return(message)) == NULL) {
+        slog(SLOG_ERROR, "Can't create reply");
+    }
+    return reply;
 }
 
-static void dbus_method_trigger(DBusMessage *message) {
-#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
-        DBusMessageIter args;
-#else
-        DBusMessageIter args = {};
-#endif
+// a client has left the bus: its subscriptions end
+// the bus signals aren't sent to our object path, so this is a filter
+// of the connection
+static DBusHandlerResult dbus_signal_name_owner(DBusConnection *connection, DBusMessage *message,
+                                                void *user_data) {
+    (void)connection;
+    (void)user_data;
+    if (!dbus_message_is_signal(message, DBUS_INTERFACE_DBUS, DBUS_BUS_SIGNAL_NAME_OWNER)) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    const char* name = NULL;
+    const char* old_owner = NULL;
+    const char* new_owner = NULL;
+    if (!dbus_message_get_args(message, NULL,
+                               DBUS_TYPE_STRING, &name,
+                               DBUS_TYPE_STRING, &old_owner,
+                               DBUS_TYPE_STRING, &new_owner,
+                               DBUS_TYPE_INVALID)) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    if (strlen(new_owner) > 0) {
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    }
+    if (pthread_mutex_lock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+    dbus_subscriber_remove(name, NULL);
+    if (pthread_mutex_unlock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    dbus_subscriber_match(name, false);
+    slog(SLOG_INFO, "subscriber %s has gone", name);
+    // other filters may want the signal too
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
 
-    dbus_uint32_t device = -1;
-    dbus_uint32_t action = -1;
+unsigned int dbus_state_generation(void) {
+    if (atomic_load(&dbus_num_subscribers) == 0) {
+        return 0;
+    }
+    return atomic_load(&dbus_subscribe_gen);
+}
 
-    if (!dbus_message_iter_init(message, &args)) {
-        slog(SLOG_WARN, "trigger has no arguments");
+// sends the option value to the subscribers of the device (the
+// pollers call this with their snapshot values), the reactor writes
+// the signals out
+void dbus_send_state(const char* device, const char* option, long value, const char* str) {
+    assert(device != NULL);
+    assert(option != NULL);
+    if ((conn == NULL) || (atomic_load(&dbus_num_subscribers) == 0)) {
         return;
     }
-    if (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_UINT32) {
-        dbus_message_iter_get_basic(&args, &device);
-        slog(SLOG_INFO, "trigger device %d", device);
-    }
-    else {
-        slog(SLOG_WARN, "trigger has wrong argument type");
-        return;
+    dbus_int32_t num = (dbus_int32_t)value;
+    if (str == NULL) {
+        str = "";
     }
-    if (!dbus_message_iter_next(&args)) {
-        slog(SLOG_WARN, "trigger has too few arguments");
+    if (pthread_mutex_lock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
         return;
     }
-    if (dbus_message_iter_get_arg_type(&args) == DBUS_TYPE_UINT32) {
-        dbus_message_iter_get_basic(&args, &action);
-        slog(SLOG_INFO, "trigger action %d", action);
+    for(dbus_subscriber_t* s = dbus_subscribers; s != NULL; s = s->next) {
+        if ((s->device != NULL) && (strcmp(s->device, device) != 0)) {
+            continue;
+        }
+        DBusMessage* signal = dbus_message_new_signal(SCANBD_DBUS_OBJECTPATH,
+                                                      SCANBD_DBUS_INTERFACE,
+                                                      SCANBD_DBUS_SIGNAL_BUTTON_STATE);
+        if (signal == NULL) {
+            slog(SLOG_ERROR, "Can't create signal");
+            break;
+        }
+        if (!dbus_message_set_destination(signal, s->name) ||
+            !dbus_message_append_args(signal,
+                                      DBUS_TYPE_STRING, &device,
+                                      DBUS_TYPE_STRING, &option,
+                                      DBUS_TYPE_INT32, &num,
+                                      DBUS_TYPE_STRING, &str,
+                                      DBUS_TYPE_INVALID)) {
+            slog(SLOG_ERROR, "Can't append args");
+        }
+        else if (dbus_connection_send(conn, signal, NULL) != TRUE) {
+            slog(SLOG_ERROR, "Can't send signal");
+        }
+        dbus_message_unref(signal);
     }
-    else {
-        slog(SLOG_WARN, "trigger has wrong argument type");
-        return;
+    if (pthread_mutex_unlock(&dbus_state_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
     }
-    sane_trigger_action_async(device, action);
 }
 
 static void unregister_func(DBusConnection* connection, void* user_data) {
@@ -612,22 +1213,49 @@ static DBusHandlerResult message_func(DBusConnection *connection, DBusMessage *m
     (void)user_data;
 
     slog(SLOG_DEBUG, "message_func");
+    SCANBD_PROBE2(dbus__message, dbus_message_get_interface(message),
+                  dbus_message_get_member(message));
     DBusMessage* reply = NULL;
     if (dbus_message_is_method_call(message,
                                     SCANBD_DBUS_INTERFACE,
                                     SCANBD_DBUS_METHOD_ACQUIRE)) {
-        dbus_method_acquire();
+        reply = dbus_method_acquire(message);
     }
     else if (dbus_message_is_method_call(message,
                                          SCANBD_DBUS_INTERFACE,
                                          SCANBD_DBUS_METHOD_RELEASE)) {
-        dbus_method_release();
+        reply = dbus_method_release(message);
     }
     else if (dbus_message_is_method_call(message,
                                          SCANBD_DBUS_INTERFACE,
                                          SCANBD_DBUS_METHOD_TRIGGER)) {
         dbus_method_trigger(message);
     }
+    else if (dbus_message_is_method_call(message,
+                                         SCANBD_DBUS_INTERFACE,
+                                         SCANBD_DBUS_METHOD_TRIGGER_BATCH)) {
+        reply = dbus_method_trigger_batch(message);
+    }
+    else if (dbus_message_is_method_call(message,
+                                         SCANBD_DBUS_INTERFACE,
+                                         SCANBD_DBUS_METHOD_ACTION_STATS)) {
+        reply = dbus_method_action_stats(message);
+    }
+    else if (dbus_message_is_method_call(message,
+                                         SCANBD_DBUS_INTERFACE,
+                                         SCANBD_DBUS_METHOD_STATS)) {
+        reply = dbus_method_stats(message);
+    }
+    else if (dbus_message_is_method_call(message,
+                                         SCANBD_DBUS_INTERFACE,
+                                         SCANBD_DBUS_METHOD_SUBSCRIBE)) {
+        reply = dbus_method_subscribe(message);
+    }
+    else if (dbus_message_is_method_call(message,
+                                         SCANBD_DBUS_INTERFACE,
+                                         SCANBD_DBUS_METHOD_UNSUBSCRIBE)) {
+        reply = dbus_method_unsubscribe(message);
+    }
     else if (dbus_message_is_signal(message,
                                     DBUS_HAL_INTERFACE,
                                     DBUS_HAL_SIGNAL_DEV_ADDED)) {
@@ -656,53 +1284,135 @@ static DBusObjectPathVTable dbus_vtable = {
     NULL
 };
 
-void dbus_thread_cleanup(void* arg) {
-    assert(arg);
-    slog(SLOG_DEBUG, "dbus_thread_cleanup");
-    (void)arg;
+// the dbus connection in the reactor: the watches are the file
+// descriptors of the connection, the timeouts are timers, after each
+// round all queued messages are dispatched
+
+static short dbus_watch_events(DBusWatch* watch) {
+    unsigned int flags = dbus_watch_get_flags(watch);
+    short events = 0;
+    if (flags & DBUS_WATCH_READABLE) {
+        events |= POLLIN;
+    }
+    if (flags & DBUS_WATCH_WRITABLE) {
+        events |= POLLOUT;
+    }
+    return events;
 }
 
-static void* dbus_thread(void* arg) {
-    (void)arg;
-    // we only expect the main thread to handle signals
-    sigset_t mask;
-    sigfillset(&mask);
-    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+static void dbus_watch_io(int fd, short revents, void* arg) {
+    (void)fd;
+    DBusWatch* watch = (DBusWatch*)arg;
+    assert(watch != NULL);
+    unsigned int flags = 0;
+    if (revents & POLLIN) {
+        flags |= DBUS_WATCH_READABLE;
+    }
+    if (revents & POLLOUT) {
+        flags |= DBUS_WATCH_WRITABLE;
+    }
+    if (revents & POLLERR) {
+        flags |= DBUS_WATCH_ERROR;
+    }
+    if (revents & POLLHUP) {
+        flags |= DBUS_WATCH_HANGUP;
+    }
+    if (!dbus_watch_handle(watch, flags)) {
+        slog(SLOG_WARN, "dbus_watch_handle: out of memory");
+    }
+}
 
-    cfg_t* cfg_sec_global = NULL;
-    cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
-    assert(cfg_sec_global);
+static dbus_bool_t dbus_add_watch(DBusWatch* watch, void* data) {
+    (void)data;
+    int fd = dbus_watch_get_unix_fd(watch);
+    slog(SLOG_DEBUG, "dbus add watch fd=%d", fd);
+    return evloop_add_io(fd, dbus_watch_events(watch), dbus_watch_get_enabled(watch),
+                         dbus_watch_io, watch) ? TRUE : FALSE;
+}
 
-    int timeout = cfg_getint(cfg_sec_global, C_TIMEOUT);
-    if (timeout <= 0) {
-        timeout = C_TIMEOUT_DEF;
-    }
-    slog(SLOG_DEBUG, "timeout: %d ms", timeout);
+static void dbus_remove_watch(DBusWatch* watch, void* data) {
+    (void)data;
+    evloop_remove_io(watch);
+}
 
-    while(dbus_connection_read_write_dispatch(conn, timeout)) {
-        slog(SLOG_DEBUG, "Iteration on dbus call");
-        usleep(timeout * 1000);
+static void dbus_toggle_watch(DBusWatch* watch, void* data) {
+    (void)data;
+    evloop_set_io(watch, dbus_watch_events(watch), dbus_watch_get_enabled(watch));
+}
+
+static void dbus_timeout_fire(void* arg) {
+    DBusTimeout* timeout = (DBusTimeout*)arg;
+    assert(timeout != NULL);
+    if (!dbus_timeout_handle(timeout)) {
+        slog(SLOG_WARN, "dbus_timeout_handle: out of memory");
     }
-    return NULL;
 }
 
-bool dbus_init(void) {
-    slog(SLOG_DEBUG, "dbus_init");
+static dbus_bool_t dbus_add_timeout(DBusTimeout* timeout, void* data) {
+    (void)data;
+    return evloop_add_timer(dbus_timeout_get_interval(timeout),
+                            dbus_timeout_get_enabled(timeout),
+                            dbus_timeout_fire, timeout) ? TRUE : FALSE;
+}
 
-#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
-    slog(SLOG_INFO, "dbus init mutex");
-    pthread_mutexattr_t mutexattr;
-    if (pthread_mutexattr_init(&mutexattr) < 0) {
-        slog(SLOG_ERROR, "Can't initialize mutex attr");
-        exit(EXIT_FAILURE);
+static void dbus_remove_timeout(DBusTimeout* timeout, void* data) {
+    (void)data;
+    evloop_remove_timer(timeout);
+}
+
+static void dbus_toggle_timeout(DBusTimeout* timeout, void* data) {
+    (void)data;
+    evloop_set_timer(timeout, dbus_timeout_get_interval(timeout),
+                     dbus_timeout_get_enabled(timeout));
+}
+
+// messages were queued (maybe by another thread): wake up the loop
+static void dbus_wakeup_main(void* data) {
+    (void)data;
+    evloop_wakeup();
+}
+
+static void dbus_dispatch_status(DBusConnection* connection,
+                                 DBusDispatchStatus new_status, void* data) {
+    (void)connection;
+    (void)data;
+    if (new_status == DBUS_DISPATCH_DATA_REMAINS) {
+        evloop_wakeup();
     }
-    if (pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE) < 0) {
-        slog(SLOG_ERROR, "Can't set mutex attr");
-        exit(EXIT_FAILURE);
+}
+
+// idle function of the event loop
+static void dbus_dispatch_all(void* arg) {
+    (void)arg;
+    assert(conn);
+    while(dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS) {
+        slog(SLOG_DEBUG, "Iteration on dbus call");
     }
-    if (pthread_mutex_init(&dbus_mutex, &mutexattr) < 0) {
-        slog(SLOG_ERROR, "Can't init mutex");
-        exit(EXIT_FAILURE);
+    if (dbus_trigger_coalesce <= 0) {
+        dbus_trigger_send();
+    }
+}
+
+// the connection to the system bus, shared by the daemon and scanbm
+static bool dbus_connect(void) {
+#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+    static bool mutex_init = false;
+    if (!mutex_init) {
+        slog(SLOG_INFO, "dbus init mutex");
+        pthread_mutexattr_t mutexattr;
+        if (pthread_mutexattr_init(&mutexattr) < 0) {
+            slog(SLOG_ERROR, "Can't initialize mutex attr");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_mutexattr_settype(&mutexattr, PTHREAD_MUTEX_RECURSIVE) < 0) {
+            slog(SLOG_ERROR, "Can't set mutex attr");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_mutex_init(&dbus_mutex, &mutexattr) < 0) {
+            slog(SLOG_ERROR, "Can't init mutex");
+            exit(EXIT_FAILURE);
+        }
+        mutex_init = true;
     }
 #endif
 
@@ -729,9 +1439,32 @@ bool dbus_init(void) {
         slog(SLOG_DEBUG, "No dbus connection");
         return false;
     }
+    return true;
+}
+
+// scanbm only calls the methods of scanbd and sends signals: no HAL
+// context and no match rule (a round trip to the bus less), the
+// object path isn't registered
+bool dbus_init_client(void) {
+    slog(SLOG_DEBUG, "dbus_init_client");
+    if (conn != NULL) {
+        // a pool worker connects before the client (see scanbm_warmup())
+        return true;
+    }
+    return dbus_connect();
+}
+
+bool dbus_init(void) {
+    slog(SLOG_DEBUG, "dbus_init");
 
+    if (!dbus_connect()) {
+        return false;
+    }
     assert(conn);
 
+    DBusError dbus_error;
+    dbus_error_init(&dbus_error);
+
 #ifdef USE_HAL
     LibHalContext *hal_ctx = NULL;
 
@@ -770,8 +1503,9 @@ bool dbus_init(void) {
     return true;
 }
 
+// attaches the connection to the reactor of the main thread
 void dbus_start_dbus_thread(void) {
-    slog(SLOG_DEBUG, "start dbus thread");
+    slog(SLOG_DEBUG, "start dbus handling");
     if (conn == NULL) {
         if (!dbus_init()) {
             return;
@@ -792,6 +1526,9 @@ void dbus_start_dbus_thread(void) {
         slog(SLOG_ERROR, "Can't register object path: %s", SCANBD_DBUS_OBJECTPATH);
         return;
     }
+    if (dbus_connection_add_filter(conn, dbus_signal_name_owner, NULL, NULL) == FALSE) {
+        slog(SLOG_WARN, "Can't add the filter of the subscribers");
+    }
 
     dbus_error_init(&dbus_error);
     int ret = dbus_bus_request_name(conn, SCANBD_DBUS_ADDRESS,
@@ -805,58 +1542,90 @@ void dbus_start_dbus_thread(void) {
             return;
         }
     }
-    if (dbus_tid != 0) {
-        slog(SLOG_DEBUG, "dbus thread already running");
+    if (dbus_in_evloop) {
+        slog(SLOG_DEBUG, "dbus handling already running");
         dbus_stop_dbus_thread();
     }
-    if (pthread_create(&dbus_tid, NULL, dbus_thread, NULL) < 0){
-        slog(SLOG_ERROR, "Can't create dbus thread: %s", strerror(errno));
+    // the messages are handled by the reactor as soon as they arrive
+    if (!dbus_connection_set_watch_functions(conn, dbus_add_watch, dbus_remove_watch,
+                                             dbus_toggle_watch, NULL, NULL)) {
+        slog(SLOG_ERROR, "Can't set the dbus watch functions");
         return;
     }
-    return;
-}
-
-void dbus_stop_dbus_thread(void) {
-    slog(SLOG_DEBUG, "stop dbus thread");
-    if (dbus_tid == 0) {
+    if (!dbus_connection_set_timeout_functions(conn, dbus_add_timeout, dbus_remove_timeout,
+                                               dbus_toggle_timeout, NULL, NULL)) {
+        slog(SLOG_ERROR, "Can't set the dbus timeout functions");
         return;
     }
-    if (pthread_cancel(dbus_tid) < 0) {
-        if (errno == ESRCH) {
-            slog(SLOG_WARN, "dbus thread was already cancelled");
-        }
-        else {
-            slog(SLOG_WARN, "unknown error from pthread_cancel: %s", strerror(errno));
-        }
+    dbus_connection_set_wakeup_main_function(conn, dbus_wakeup_main, NULL, NULL);
+    dbus_connection_set_dispatch_status_function(conn, dbus_dispatch_status, NULL, NULL);
+    evloop_set_idle(dbus_dispatch_all, NULL);
+    dbus_in_evloop = true;
+    // from now on the trigger signals are queued to the reactor
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    int coalesce = cfg_getint(cfg_sec_global, C_DBUS_COALESCE);
+    if ((coalesce > 0) &&
+        !evloop_add_timer(coalesce, false, dbus_trigger_timer, &dbus_trigger_coalesce)) {
+        slog(SLOG_WARN, "Can't add the timer of the trigger signals, sending at once");
+        coalesce = 0;
+    }
+    if (pthread_mutex_lock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
     }
-    slog(SLOG_DEBUG, "join dbus thread");
-    if (pthread_join(dbus_tid, NULL) < 0) {
-        slog(SLOG_ERROR, "pthread_join: %s", strerror(errno));
+    dbus_trigger_coalesce = (coalesce > 0) ? coalesce : 0;
+    dbus_trigger_live = true;
+    if (pthread_mutex_unlock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
     }
-    dbus_tid = 0;
+    // messages received before the watches were set
+    evloop_wakeup();
+    return;
 }
 
-void dbus_call_method(const char* method, const char* value) {
-    slog(SLOG_DEBUG, "dbus_call_method");
-    if (conn == NULL) {
-        if (!dbus_init()) {
-            return;
-        }
-    }
-    assert(conn);
-
-    if (!conn) {
-        slog(SLOG_DEBUG, "No dbus connection");
+void dbus_stop_dbus_thread(void) {
+    slog(SLOG_DEBUG, "stop dbus handling");
+    if (!dbus_in_evloop) {
         return;
     }
+    if (pthread_mutex_lock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+    dbus_trigger_live = false;
+    if (pthread_mutex_unlock(&dbus_trigger_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    // the batches post through the registry of the pollers being stopped
+    trigger_batch_exit();
+    // the queued events go out now
+    dbus_trigger_send();
+    if (dbus_trigger_coalesce > 0) {
+        evloop_remove_timer(&dbus_trigger_coalesce);
+        dbus_trigger_coalesce = 0;
+    }
+    dbus_connection_remove_filter(conn, dbus_signal_name_owner, NULL);
+    // removes all watches and timeouts from the reactor
+    evloop_set_idle(NULL, NULL);
+    dbus_connection_set_watch_functions(conn, NULL, NULL, NULL, NULL, NULL);
+    dbus_connection_set_timeout_functions(conn, NULL, NULL, NULL, NULL, NULL);
+    dbus_connection_set_wakeup_main_function(conn, NULL, NULL, NULL);
+    dbus_connection_set_dispatch_status_function(conn, NULL, NULL, NULL);
+    dbus_in_evloop = false;
+}
 
+// calls method of the running scanbd and waits for the reply
+// returns false if there is no (or an error) reply
+// sends the call of method (with the string argument value if not
+// NULL) to scanbd, returns the handle of the reply, NULL on error
+static DBusPendingCall* dbus_method_send(const char* method, const char* value) {
     DBusMessage* msg = NULL;
     if ((msg = dbus_message_new_method_call(SCANBD_DBUS_ADDRESS,
                                             SCANBD_DBUS_OBJECTPATH,
                                             SCANBD_DBUS_INTERFACE,
                                             method)) == NULL) {
         slog(SLOG_ERROR, "Can't compose message");
-        return;
+        return NULL;
     }
     assert(msg);
 
@@ -867,9 +1636,10 @@ void dbus_call_method(const char* method, const char* value) {
         DBusMessageIter args = {};
 #endif
         dbus_message_iter_init_append(msg, &args);
-        if (dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, value) != TRUE) {
+        if (dbus_message_iter_append_basic(&args, DBUS_TYPE_STRING, &value) != TRUE) {
             slog(SLOG_ERROR, "Can't compose message");
-            return;
+            dbus_message_unref(msg);
+            return NULL;
         }
     }
 
@@ -878,17 +1648,20 @@ void dbus_call_method(const char* method, const char* value) {
     // send message and get a handle for a reply
     if (!dbus_connection_send_with_reply (conn, msg, &pending, -1)) {
         slog(SLOG_WARN, "Can't send message");
-        return;
+        dbus_message_unref(msg);
+        return NULL;
     }
     if (NULL == pending) {
         slog(SLOG_ERROR, "Disconnected from bus");
-        return;
+        dbus_message_unref(msg);
+        return NULL;
     }
-    dbus_connection_flush(conn);
-
-    assert(msg);
     dbus_message_unref(msg);
+    return pending;
+}
 
+// waits for the reply of the call of method, false on an error reply
+static bool dbus_method_reply(const char* method, DBusPendingCall* pending) {
     slog(SLOG_DEBUG, "waiting for reply");
     assert(pending);
     dbus_pending_call_block(pending);
@@ -897,26 +1670,91 @@ void dbus_call_method(const char* method, const char* value) {
     DBusMessage* reply = NULL;
     if ((reply = dbus_pending_call_steal_reply(pending)) == NULL) {
         slog(SLOG_DEBUG, "Reply Null\n");
-        return;
+        dbus_pending_call_unref(pending);
+        return false;
     }
     dbus_pending_call_unref(pending);
 
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
+        slog(SLOG_WARN, "Error reply to %s: %s", method,
+             dbus_message_get_error_name(reply) ? dbus_message_get_error_name(reply) : "");
+        dbus_message_unref(reply);
+        return false;
+    }
+
 #if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
         DBusMessageIter args;
 #else
         DBusMessageIter args = {};
 #endif
     if (!dbus_message_iter_init(reply, &args)) {
-        slog(SLOG_INFO, "Reply has no arguments");
+        slog(SLOG_DEBUG, "Reply has no arguments");
     }
+    dbus_message_unref(reply);
+    return true;
+}
 
-    return;
+bool dbus_call_method(const char* method, const char* value) {
+    slog(SLOG_DEBUG, "dbus_call_method");
+    if (conn == NULL) {
+        if (!dbus_init_client()) {
+            return false;
+        }
+    }
+    assert(conn);
+
+    if (!conn) {
+        slog(SLOG_DEBUG, "No dbus connection");
+        return false;
+    }
+
+    DBusPendingCall* pending = NULL;
+    if ((pending = dbus_method_send(method, value)) == NULL) {
+        return false;
+    }
+    dbus_connection_flush(conn);
+    return dbus_method_reply(method, pending);
+}
+
+bool dbus_call_methods(const char* method, const char** values, size_t num_values) {
+    slog(SLOG_DEBUG, "dbus_call_methods: %zu calls of %s", num_values, method);
+    if (num_values == 0) {
+        return dbus_call_method(method, NULL);
+    }
+    if (conn == NULL) {
+        if (!dbus_init_client()) {
+            return false;
+        }
+    }
+    assert(conn);
+
+    DBusPendingCall** pending = NULL;
+    if ((pending = calloc(num_values, sizeof(DBusPendingCall*))) == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the pending calls");
+        return false;
+    }
+    // all calls go out in one write, scanbd answers them in order
+    for(size_t i = 0; i < num_values; i += 1) {
+        assert(values[i]);
+        pending[i] = dbus_method_send(method, values[i]);
+    }
+    dbus_connection_flush(conn);
+
+    bool ok = true;
+    for(size_t i = 0; i < num_values; i += 1) {
+        if ((pending[i] == NULL) || !dbus_method_reply(method, pending[i])) {
+            slog(SLOG_WARN, "call of %s for device %s failed", method, values[i]);
+            ok = false;
+        }
+    }
+    free(pending);
+    return ok;
 }
 
 void dbus_call_trigger(unsigned int device, unsigned int action) {
     slog(SLOG_DEBUG, "dbus_call_trigger for dev %d, action %d", device, action);
     if (conn == NULL) {
-        if (!dbus_init()) {
+        if (!dbus_init_client()) {
             return;
         }
     }
@@ -988,3 +1826,75 @@ void dbus_call_trigger(unsigned int device, unsigned int action) {
 
     return;
 }
+
+// starts a batch of count triggers of the action for the device number
+// at rate triggers per second (see trigger_batch.h) in the running
+// scanbd, returns false if it wasn't started
+bool dbus_call_trigger_batch(unsigned int device, unsigned int action,
+                             unsigned int count, unsigned int rate) {
+    slog(SLOG_DEBUG, "dbus_call_trigger_batch for dev %u, action %u, count %u, rate %u",
+         device, action, count, rate);
+    if (conn == NULL) {
+        if (!dbus_init_client()) {
+            return false;
+        }
+    }
+    assert(conn);
+
+    DBusMessage* msg = NULL;
+    if ((msg = dbus_message_new_method_call(SCANBD_DBUS_ADDRESS,
+                                            SCANBD_DBUS_OBJECTPATH,
+                                            SCANBD_DBUS_INTERFACE,
+                                            SCANBD_DBUS_METHOD_TRIGGER_BATCH)) == NULL) {
+        slog(SLOG_ERROR, "Can't compose message");
+        return false;
+    }
+
+    char number[16];
+    snprintf(number, sizeof(number), "%u", device);
+    const char* name = number;
+    dbus_uint32_t act = action;
+    dbus_uint32_t cnt = count;
+    dbus_uint32_t rt = rate;
+#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
+    DBusMessageIter args;
+    DBusMessageIter array;
+    DBusMessageIter item;
+#else
+    DBusMessageIter args = {};
+    DBusMessageIter array = {};
+    DBusMessageIter item = {};
+#endif
+    dbus_message_iter_init_append(msg, &args);
+    bool ok = dbus_message_iter_open_container(&args, DBUS_TYPE_ARRAY, "(suuu)", &array);
+    ok = ok && dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, NULL, &item);
+    ok = ok && dbus_message_iter_append_basic(&item, DBUS_TYPE_STRING, &name);
+    ok = ok && dbus_message_iter_append_basic(&item, DBUS_TYPE_UINT32, &act);
+    ok = ok && dbus_message_iter_append_basic(&item, DBUS_TYPE_UINT32, &cnt);
+    ok = ok && dbus_message_iter_append_basic(&item, DBUS_TYPE_UINT32, &rt);
+    ok = ok && dbus_message_iter_close_container(&array, &item);
+    ok = ok && dbus_message_iter_close_container(&args, &array);
+    if (!ok) {
+        slog(SLOG_ERROR, "Can't compose message");
+        dbus_message_unref(msg);
+        return false;
+    }
+
+    DBusMessage* reply = NULL;
+    DBusError dbus_error;
+    dbus_error_init(&dbus_error);
+    reply = dbus_connection_send_with_reply_and_block(conn, msg, -1, &dbus_error);
+    dbus_message_unref(msg);
+    if (reply == NULL) {
+        slog(SLOG_WARN, "trigger_batch failed: %s", dbus_error_is_set(&dbus_error) ? dbus_error.message : "");
+        dbus_error_free(&dbus_error);
+        return false;
+    }
+    dbus_uint32_t started = 0;
+    if (!dbus_message_get_args(reply, &dbus_error, DBUS_TYPE_UINT32, &started, DBUS_TYPE_INVALID)) {
+        slog(SLOG_WARN, "trigger_batch has a wrong reply: %s", dbus_error.message);
+        dbus_error_free(&dbus_error);
+    }
+    dbus_message_unref(reply);
+    return started > 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "device_cache.h"
+
+#include <sys/mman.h>
+#include <stdint.h>
+
+struct device_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;                  // the number of records
+};
+
+struct device_cache_record {
+    char name[DEVICE_CACHE_NAME_MAX];
+    char vendor[DEVICE_CACHE_FIELD_MAX];
+    char model[DEVICE_CACHE_FIELD_MAX];
+    char type[DEVICE_CACHE_FIELD_MAX];
+};
+
+// the loaded list: the pointers, the devices and the strings in one
+// allocation
+struct device_cache_list {
+    const SANE_Device** list;
+    SANE_Device* devices;
+    struct device_cache_record* records;
+};
+
+static bool device_cache_terminated(const char* field, size_t size) {
+    return memchr(field, '\0', size) != NULL;
+}
+
+const SANE_Device** device_cache_load(const char* path, int* num_devices) {
+    assert(path != NULL);
+    assert(num_devices != NULL);
+    *num_devices = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            slog(SLOG_WARN, "Can't open device cache %s: %s", path, strerror(errno));
+        }
+        return NULL;
+    }
+    struct stat sb;
+    if ((fstat(fd, &sb) < 0) || ((size_t)sb.st_size < sizeof(struct device_cache_header))) {
+        slog(SLOG_WARN, "device cache %s is invalid", path);
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)sb.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        slog(SLOG_WARN, "Can't map device cache %s: %s", path, strerror(errno));
+        return NULL;
+    }
+
+    const SANE_Device** list = NULL;
+    const struct device_cache_header* header = (const struct device_cache_header*)map;
+    if ((memcmp(header->magic, DEVICE_CACHE_MAGIC, sizeof(header->magic)) != 0) ||
+        (header->version != DEVICE_CACHE_VERSION) ||
+        (size != sizeof(struct device_cache_header) +
+         (size_t)header->count * sizeof(struct device_cache_record))) {
+        slog(SLOG_WARN, "device cache %s is invalid", path);
+        goto cleanup;
+    }
+    int count = (int)header->count;
+    const struct device_cache_record* records =
+        (const struct device_cache_record*)((const char*)map + sizeof(struct device_cache_header));
+    for(int i = 0; i < count; i += 1) {
+        if (!device_cache_terminated(records[i].name, sizeof(records[i].name)) ||
+            !device_cache_terminated(records[i].vendor, sizeof(records[i].vendor)) ||
+            !device_cache_terminated(records[i].model, sizeof(records[i].model)) ||
+            !device_cache_terminated(records[i].type, sizeof(records[i].type))) {
+            slog(SLOG_WARN, "device cache %s is invalid", path);
+            goto cleanup;
+        }
+    }
+
+    struct device_cache_list l;
+    size_t psize = (count + 1) * sizeof(SANE_Device*);
+    size_t dsize = count * sizeof(SANE_Device);
+    char* block = calloc(1, psize + dsize + count * sizeof(struct device_cache_record));
+    if (block == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the device cache");
+        goto cleanup;
+    }
+    l.list = (const SANE_Device**)block;
+    l.devices = (SANE_Device*)(block + psize);
+    l.records = (struct device_cache_record*)(block + psize + dsize);
+    memcpy(l.records, records, count * sizeof(struct device_cache_record));
+    for(int i = 0; i < count; i += 1) {
+        l.devices[i].name = l.records[i].name;
+        l.devices[i].vendor = l.records[i].vendor;
+        l.devices[i].model = l.records[i].model;
+        l.devices[i].type = l.records[i].type;
+        l.list[i] = &l.devices[i];
+    }
+    l.list[count] = NULL;
+    list = l.list;
+    *num_devices = count;
+cleanup:
+    munmap(map, size);
+    return list;
+}
+
+void device_cache_free(const SANE_Device** list) {
+    free((void*)list);
+}
+
+// copies src into the field, returns false if it doesn't fit
+static bool device_cache_field(char* field, size_t size, const char* src) {
+    if (src == NULL) {
+        src = SCANBD_NULL_STRING;
+    }
+    if (strlen(src) >= size) {
+        return false;
+    }
+    strcpy(field, src);
+    return true;
+}
+
+bool device_cache_store(const char* path, const SANE_Device** list) {
+    assert(path != NULL);
+
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        slog(SLOG_WARN, "device cache path %s too long", path);
+        return false;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        slog(SLOG_WARN, "Can't create device cache %s: %s", tmp, strerror(errno));
+        return false;
+    }
+    FILE* file = fdopen(fd, "w");
+    if (file == NULL) {
+        slog(SLOG_WARN, "Can't create device cache %s: %s", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return false;
+    }
+
+    struct device_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DEVICE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = DEVICE_CACHE_VERSION;
+    header.count = 0;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(int i = 0; ok && (list != NULL) && (list[i] != NULL); i += 1) {
+        struct device_cache_record record;
+        memset(&record, 0, sizeof(record));
+        if (!device_cache_field(record.name, sizeof(record.name), list[i]->name) ||
+            !device_cache_field(record.vendor, sizeof(record.vendor), list[i]->vendor) ||
+            !device_cache_field(record.model, sizeof(record.model), list[i]->model) ||
+            !device_cache_field(record.type, sizeof(record.type), list[i]->type)) {
+            slog(SLOG_INFO, "device %s not cached, description too long", list[i]->name);
+            continue;
+        }
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+        header.count += 1;
+    }
+    // the header with the final count
+    if (ok) {
+        ok = (fseek(file, 0, SEEK_SET) == 0) && (fwrite(&header, sizeof(header), 1, file) == 1);
+    }
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        slog(SLOG_WARN, "Can't write device cache %s: %s", tmp, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+    if (rename(tmp, path) < 0) {
+        slog(SLOG_WARN, "Can't replace device cache %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return false;
+    }
+    slog(SLOG_DEBUG, "stored %d devices in the device cache %s", header.count, path);
+    return true;
+}
@@ -0,0 +1,53 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef DEVICE_CACHE_H
+#define DEVICE_CACHE_H
+
+#include "common.h"
+
+#include <sane/sane.h>
+
+// the warm-start cache of the sane device discovery: the local devices
+// found by the last sane_get_devices() are stored in a small file of
+// fixed size records, so the pollers can be started at once from the
+// cached list while the (slow) discovery runs afterwards and updates it
+
+#define DEVICE_CACHE_MAGIC "SCANBDDC"
+#define DEVICE_CACHE_VERSION 1
+
+#define DEVICE_CACHE_NAME_MAX 256
+#define DEVICE_CACHE_FIELD_MAX 64
+
+// returns the NULL terminated device list stored in the file path (one
+// allocation, see device_cache_free()) or NULL if there is no valid
+// cache
+extern const SANE_Device** device_cache_load(const char* path, int* num_devices);
+
+extern void device_cache_free(const SANE_Device** list);
+
+// replaces the file path with the devices of the NULL terminated list
+// returns false on errors
+extern bool device_cache_store(const char* path, const SANE_Device** list);
+
+#endif // DEVICE_CACHE_H
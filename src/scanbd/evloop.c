@@ -0,0 +1,419 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "evloop.h"
+
+struct evloop_io {
+    int fd;
+    short events;
+    bool enabled;
+    evloop_io_func_t func;
+    void* arg;
+};
+
+struct evloop_timer {
+    int interval;         // ms
+    bool enabled;
+    struct timespec due;  // CLOCK_MONOTONIC
+    evloop_func_t func;
+    void* arg;
+};
+
+static pthread_mutex_t evloop_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct evloop_io* ios = NULL;
+static int num_ios = 0;
+static struct evloop_timer* timers = NULL;
+static int num_timers = 0;
+
+static evloop_func_t idle_func = NULL;
+static void* idle_arg = NULL;
+
+// the self-pipe to interrupt poll()
+static int wakeup_fds[2] = {-1, -1};
+
+// the self-pipe of the signal handlers: the number of the signal is
+// written by the handler, the reactor calls the registered function
+static int signal_fds[2] = {-1, -1};
+static evloop_signal_func_t signal_funcs[NSIG];
+static bool signal_io = false;
+// the sender and value of the last signal queued by sigqueue()
+static volatile sig_atomic_t signal_senders[NSIG];
+static volatile sig_atomic_t signal_values[NSIG];
+
+static pthread_once_t evloop_once = PTHREAD_ONCE_INIT;
+
+static void evloop_pipe(int fds[2]) {
+    if (pipe(fds) < 0) {
+        slog(SLOG_ERROR, "Can't create the event loop pipe: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for(int i = 0; i < 2; i += 1) {
+        int flags = fcntl(fds[i], F_GETFL, 0);
+        if ((flags < 0) || (fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) < 0)) {
+            slog(SLOG_WARN, "Can't set the event loop pipe to non-blocking mode: %s",
+                 strerror(errno));
+        }
+        if (fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0) {
+            slog(SLOG_WARN, "Can't set close-on-exec for the event loop pipe: %s",
+                 strerror(errno));
+        }
+    }
+}
+
+static void evloop_init(void) {
+    evloop_pipe(wakeup_fds);
+    evloop_pipe(signal_fds);
+}
+
+static void evloop_due(struct timespec* due, int interval) {
+    clock_gettime(CLOCK_MONOTONIC, due);
+    due->tv_sec += interval / 1000;
+    due->tv_nsec += (long)(interval % 1000) * 1000000L;
+    if (due->tv_nsec >= 1000000000L) {
+        due->tv_sec += 1;
+        due->tv_nsec -= 1000000000L;
+    }
+}
+
+// ms until due (<= 0 if elapsed)
+static long evloop_ms_until(const struct timespec* due, const struct timespec* now) {
+    return (due->tv_sec - now->tv_sec) * 1000L + (due->tv_nsec - now->tv_nsec) / 1000000L;
+}
+
+static void evloop_lock(void) {
+    if (pthread_mutex_lock(&evloop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+}
+
+static void evloop_unlock(void) {
+    if (pthread_mutex_unlock(&evloop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void evloop_wakeup(void) {
+    pthread_once(&evloop_once, evloop_init);
+    if (wakeup_fds[1] >= 0) {
+        char c = 0;
+        // a full pipe wakes up as well
+        if (write(wakeup_fds[1], &c, 1) < 0) {
+            if (errno != EAGAIN) {
+                slog(SLOG_WARN, "evloop wakeup: %s", strerror(errno));
+            }
+        }
+    }
+}
+
+bool evloop_add_io(int fd, short events, bool enabled, evloop_io_func_t func, void* arg) {
+    assert(func != NULL);
+    evloop_lock();
+    struct evloop_io* n = realloc(ios, (num_ios + 1) * sizeof(struct evloop_io));
+    if (n == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the event loop");
+        evloop_unlock();
+        return false;
+    }
+    ios = n;
+    ios[num_ios].fd = fd;
+    ios[num_ios].events = events;
+    ios[num_ios].enabled = enabled;
+    ios[num_ios].func = func;
+    ios[num_ios].arg = arg;
+    num_ios += 1;
+    evloop_unlock();
+    evloop_wakeup();
+    return true;
+}
+
+void evloop_set_io(void* arg, short events, bool enabled) {
+    evloop_lock();
+    for(int i = 0; i < num_ios; i += 1) {
+        if (ios[i].arg == arg) {
+            ios[i].events = events;
+            ios[i].enabled = enabled;
+        }
+    }
+    evloop_unlock();
+    evloop_wakeup();
+}
+
+void evloop_remove_io(void* arg) {
+    evloop_lock();
+    for(int i = 0; i < num_ios; i += 1) {
+        if (ios[i].arg == arg) {
+            ios[i] = ios[num_ios - 1];
+            num_ios -= 1;
+            break;
+        }
+    }
+    evloop_unlock();
+    evloop_wakeup();
+}
+
+bool evloop_add_timer(int interval, bool enabled, evloop_func_t func, void* arg) {
+    assert(func != NULL);
+    evloop_lock();
+    struct evloop_timer* n = realloc(timers, (num_timers + 1) * sizeof(struct evloop_timer));
+    if (n == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the event loop");
+        evloop_unlock();
+        return false;
+    }
+    timers = n;
+    timers[num_timers].interval = interval;
+    timers[num_timers].enabled = enabled;
+    evloop_due(&timers[num_timers].due, interval);
+    timers[num_timers].func = func;
+    timers[num_timers].arg = arg;
+    num_timers += 1;
+    evloop_unlock();
+    evloop_wakeup();
+    return true;
+}
+
+void evloop_set_timer(void* arg, int interval, bool enabled) {
+    evloop_lock();
+    for(int i = 0; i < num_timers; i += 1) {
+        if (timers[i].arg == arg) {
+            timers[i].interval = interval;
+            timers[i].enabled = enabled;
+            evloop_due(&timers[i].due, interval);
+        }
+    }
+    evloop_unlock();
+    evloop_wakeup();
+}
+
+void evloop_remove_timer(void* arg) {
+    evloop_lock();
+    for(int i = 0; i < num_timers; i += 1) {
+        if (timers[i].arg == arg) {
+            timers[i] = timers[num_timers - 1];
+            num_timers -= 1;
+            break;
+        }
+    }
+    evloop_unlock();
+    evloop_wakeup();
+}
+
+void evloop_set_idle(evloop_func_t func, void* arg) {
+    evloop_lock();
+    idle_func = func;
+    idle_arg = arg;
+    evloop_unlock();
+}
+
+// the async-signal-safe part: only queue the signal
+static void evloop_signal_handler(int signo, siginfo_t* info, void* context) {
+    (void)context;
+    int saved_errno = errno;
+#ifdef SI_QUEUE
+    if ((info != NULL) && (info->si_code == SI_QUEUE)) {
+        signal_senders[signo] = info->si_pid;
+        signal_values[signo] = info->si_value.sival_int;
+    }
+    else {
+        signal_senders[signo] = 0;
+    }
+#else
+    (void)info;
+#endif
+    unsigned char c = (unsigned char)signo;
+    if (write(signal_fds[1], &c, 1) < 0) {
+        // full: the signal is lost, as a pending signal would be
+    }
+    errno = saved_errno;
+}
+
+static void evloop_signal_io(int fd, short revents, void* arg) {
+    (void)revents;
+    (void)arg;
+    unsigned char c = 0;
+    while(read(fd, &c, 1) > 0) {
+        if ((c < NSIG) && (signal_funcs[c] != NULL)) {
+            signal_funcs[c](c);
+        }
+    }
+}
+
+bool evloop_add_signal(int signo, evloop_signal_func_t func) {
+    assert(func != NULL);
+    assert((signo > 0) && (signo < NSIG));
+    pthread_once(&evloop_once, evloop_init);
+    if (!signal_io) {
+        if (!evloop_add_io(signal_fds[0], POLLIN, true, evloop_signal_io, signal_fds)) {
+            return false;
+        }
+        signal_io = true;
+    }
+    signal_funcs[signo] = func;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(struct sigaction));
+    sa.sa_sigaction = evloop_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    if (sigaction(signo, &sa, NULL) < 0) {
+        slog(SLOG_ERROR, "Can't install signalhandler for signal %d: %s", signo, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+pid_t evloop_signal_queued(int signo, int* value) {
+    assert((signo > 0) && (signo < NSIG));
+    pid_t sender = (pid_t)signal_senders[signo];
+    if ((sender > 0) && (value != NULL)) {
+        *value = (int)signal_values[signo];
+    }
+    return sender;
+}
+
+// the poll set of the reactor
+struct evloop_set {
+    struct pollfd* fds;    // fds[0] is the wakeup pipe
+    struct evloop_io* ios; // ios[k] belongs to fds[k + 1]
+    int size;              // the allocated entries of ios
+};
+
+// is the io source still registered (and enabled)?
+static bool evloop_io_valid(const struct evloop_io* io) {
+    bool valid = false;
+    evloop_lock();
+    for(int i = 0; i < num_ios; i += 1) {
+        if ((ios[i].arg == io->arg) && (ios[i].func == io->func)) {
+            valid = ios[i].enabled;
+            break;
+        }
+    }
+    evloop_unlock();
+    return valid;
+}
+
+void evloop_run(void) {
+    slog(SLOG_DEBUG, "evloop_run");
+    pthread_once(&evloop_once, evloop_init);
+
+    struct evloop_set set = {NULL, NULL, 0};
+    while(true) {
+        // take a snapshot of the sources
+        evloop_lock();
+        int nios = num_ios;
+        if (nios + 1 > set.size) {
+            struct pollfd* fds = realloc(set.fds, (nios + 1) * sizeof(struct pollfd));
+            if (fds != NULL) {
+                set.fds = fds;
+            }
+            struct evloop_io* sios = realloc(set.ios, (nios + 1) * sizeof(struct evloop_io));
+            if (sios != NULL) {
+                set.ios = sios;
+            }
+            if ((fds == NULL) || (sios == NULL)) {
+                evloop_unlock();
+                slog(SLOG_ERROR, "Can't allocate memory for the event loop");
+                usleep(1000 * 1000);
+                continue;
+            }
+            set.size = nios + 1;
+        }
+        set.fds[0].fd = wakeup_fds[0];
+        set.fds[0].events = POLLIN;
+        set.fds[0].revents = 0;
+        for(int i = 0; i < nios; i += 1) {
+            set.ios[i] = ios[i];
+            set.fds[i + 1].fd = ios[i].enabled ? ios[i].fd : -1;
+            set.fds[i + 1].events = ios[i].events;
+            set.fds[i + 1].revents = 0;
+        }
+        long timeout = -1;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for(int i = 0; i < num_timers; i += 1) {
+            if (timers[i].enabled) {
+                long ms = evloop_ms_until(&timers[i].due, &now);
+                if (ms < 0) {
+                    ms = 0;
+                }
+                if ((timeout < 0) || (ms < timeout)) {
+                    timeout = ms;
+                }
+            }
+        }
+        evloop_unlock();
+
+        // no sources and no timers: sleeps until a signal arrives
+        if (poll(set.fds, nios + 1, (int)timeout) < 0) {
+            if (errno != EINTR) {
+                slog(SLOG_ERROR, "poll: %s", strerror(errno));
+            }
+            continue;
+        }
+        if (set.fds[0].revents & POLLIN) {
+            char buf[64];
+            while(read(wakeup_fds[0], buf, sizeof(buf)) > 0) {
+                // drain
+            }
+        }
+        // run the handlers of the ready sources, a source removed or
+        // disabled by a previous handler is skipped
+        for(int i = 0; i < nios; i += 1) {
+            if ((set.fds[i + 1].fd < 0) || (set.fds[i + 1].revents == 0)) {
+                continue;
+            }
+            if (evloop_io_valid(&set.ios[i])) {
+                set.ios[i].func(set.fds[i + 1].fd, set.fds[i + 1].revents, set.ios[i].arg);
+            }
+        }
+        // the elapsed timers (one at a time, a handler may change them)
+        while(true) {
+            evloop_func_t func = NULL;
+            void* targ = NULL;
+            evloop_lock();
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            for(int i = 0; i < num_timers; i += 1) {
+                if (timers[i].enabled && (evloop_ms_until(&timers[i].due, &now) <= 0)) {
+                    evloop_due(&timers[i].due, timers[i].interval);
+                    func = timers[i].func;
+                    targ = timers[i].arg;
+                    break;
+                }
+            }
+            evloop_unlock();
+            if (func == NULL) {
+                break;
+            }
+            func(targ);
+        }
+
+        evloop_lock();
+        evloop_func_t ifunc = idle_func;
+        void* iarg = idle_arg;
+        evloop_unlock();
+        if (ifunc != NULL) {
+            ifunc(iarg);
+        }
+    }
+}
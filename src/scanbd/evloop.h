@@ -0,0 +1,63 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include "common.h"
+
+// the reactor of the main thread: waits with poll() on the registered
+// file descriptors (the dbus watches, the udev monitor, the self-pipe
+// of the signal handlers) and runs the handlers as soon as an event
+// arrives, the timers are the dbus timeouts. The sources are
+// identified by their arg pointer and may be changed from any thread.
+// All handlers (including the reconfiguration on signals) run in the
+// reactor, one after the other and outside of the signal context.
+
+typedef void (*evloop_io_func_t)(int fd, short revents, void* arg);
+typedef void (*evloop_func_t)(void* arg);
+typedef void (*evloop_signal_func_t)(int signo);
+
+extern bool evloop_add_io(int fd, short events, bool enabled,
+                          evloop_io_func_t func, void* arg);
+extern void evloop_set_io(void* arg, short events, bool enabled);
+extern void evloop_remove_io(void* arg);
+
+extern bool evloop_add_timer(int interval, bool enabled, evloop_func_t func, void* arg);
+extern void evloop_set_timer(void* arg, int interval, bool enabled);
+extern void evloop_remove_timer(void* arg);
+
+// func(arg) is called after each round of handlers
+extern void evloop_set_idle(evloop_func_t func, void* arg);
+// interrupts a waiting poll()
+extern void evloop_wakeup(void);
+
+// the signal signo calls func(signo) in the reactor
+extern bool evloop_add_signal(int signo, evloop_signal_func_t func);
+// returns the sender of the signal signo handled at the moment if it
+// was queued by sigqueue() (value: the int value of it), otherwise 0
+extern pid_t evloop_signal_queued(int signo, int* value);
+
+// runs the reactor in the calling thread, never returns
+extern void evloop_run(void);
+
+#endif // EVLOOP_H
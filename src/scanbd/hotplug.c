@@ -0,0 +1,178 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "hotplug.h"
+#include "evloop.h"
+#include "metrics.h"
+
+static pthread_mutex_t hotplug_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int hotplug_settle = 0;
+static hotplug_func_t hotplug_func = NULL;
+static bool hotplug_timer = false;
+
+// the events of the actual window
+static int hotplug_added = 0;
+static int hotplug_removed = 0;
+static struct timespec hotplug_first;
+
+static void hotplug_lock(void) {
+    if (pthread_mutex_lock(&hotplug_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+}
+
+static void hotplug_unlock(void) {
+    if (pthread_mutex_unlock(&hotplug_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// ms since the first event of the window
+static long hotplug_elapsed(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - hotplug_first.tv_sec) * 1000L +
+        (now.tv_nsec - hotplug_first.tv_nsec) / 1000000L;
+}
+
+// takes the events of the window and applies them
+static void hotplug_flush(void) {
+    hotplug_lock();
+    int added = hotplug_added;
+    int removed = hotplug_removed;
+    hotplug_func_t func = hotplug_func;
+    hotplug_added = 0;
+    hotplug_removed = 0;
+    if (hotplug_timer) {
+        evloop_set_timer(&hotplug_timer, hotplug_settle, false);
+    }
+    hotplug_unlock();
+
+    if (((added > 0) || (removed > 0)) && (func != NULL)) {
+        slog(SLOG_INFO, "hotplug: applying %d add and %d remove events", added, removed);
+        func(added, removed);
+    }
+}
+
+// the timer of the window in the reactor
+static void hotplug_settled(void* arg) {
+    (void)arg;
+    hotplug_flush();
+}
+
+// must be called with the hotplug_mutex held
+// returns true if events are pending but not coalesced anymore
+static bool hotplug_set_settle(int settle) {
+    hotplug_settle = (settle > 0) ? settle : 0;
+    if (hotplug_timer && (hotplug_settle == 0)) {
+        evloop_remove_timer(&hotplug_timer);
+        hotplug_timer = false;
+    }
+    if (!hotplug_timer && (hotplug_settle > 0)) {
+        hotplug_timer = evloop_add_timer(hotplug_settle, false, hotplug_settled, &hotplug_timer);
+        if (!hotplug_timer) {
+            slog(SLOG_WARN, "hotplug: can't add the timer, the events aren't coalesced");
+        }
+    }
+    return !hotplug_timer && ((hotplug_added > 0) || (hotplug_removed > 0));
+}
+
+void hotplug_init(int settle, hotplug_func_t func) {
+    assert(func != NULL);
+    hotplug_lock();
+    hotplug_func = func;
+    hotplug_added = 0;
+    hotplug_removed = 0;
+    hotplug_set_settle(settle);
+    hotplug_unlock();
+    slog(SLOG_DEBUG, "hotplug: settle time %d ms", hotplug_settle);
+}
+
+void hotplug_reload(int settle) {
+    hotplug_lock();
+    if (hotplug_func == NULL) {
+        hotplug_unlock();
+        return;
+    }
+    // the actual window keeps its end, the next one uses settle
+    bool flush = hotplug_set_settle(settle);
+    hotplug_unlock();
+    slog(SLOG_DEBUG, "hotplug: settle time %d ms", settle);
+    if (flush) {
+        hotplug_flush();
+    }
+}
+
+void hotplug_exit(void) {
+    hotplug_lock();
+    if ((hotplug_added > 0) || (hotplug_removed > 0)) {
+        slog(SLOG_INFO, "hotplug: dropping %d add and %d remove events",
+             hotplug_added, hotplug_removed);
+    }
+    hotplug_added = 0;
+    hotplug_removed = 0;
+    if (hotplug_timer) {
+        evloop_remove_timer(&hotplug_timer);
+        hotplug_timer = false;
+    }
+    hotplug_func = NULL;
+    hotplug_unlock();
+}
+
+void hotplug_event(bool added) {
+    metrics_hotplug(added);
+    hotplug_lock();
+    if (hotplug_func == NULL) {
+        hotplug_unlock();
+        slog(SLOG_DEBUG, "hotplug: not initialized, event dropped");
+        return;
+    }
+    bool first = (hotplug_added == 0) && (hotplug_removed == 0);
+    if (added) {
+        hotplug_added += 1;
+    }
+    else {
+        hotplug_removed += 1;
+    }
+    if (!hotplug_timer) {
+        // no coalescing
+        hotplug_unlock();
+        hotplug_flush();
+        return;
+    }
+    if (first) {
+        clock_gettime(CLOCK_MONOTONIC, &hotplug_first);
+    }
+    // each event restarts the window, but the window ends at last
+    // HOTPLUG_SETTLE_SPAN settle times after its first event
+    long left = (long)hotplug_settle * HOTPLUG_SETTLE_SPAN - hotplug_elapsed();
+    int delay = hotplug_settle;
+    if (left < delay) {
+        delay = (left > 0) ? (int)left : 0;
+    }
+    evloop_set_timer(&hotplug_timer, delay, true);
+    hotplug_unlock();
+    slog(SLOG_DEBUG, "hotplug: %s event, window ends in %d ms", added ? "add" : "remove", delay);
+}
@@ -0,0 +1,52 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef HOTPLUG_H
+#define HOTPLUG_H
+
+#include "common.h"
+
+// the coalescing of hotplug events: a hub reset reports a burst of
+// add / remove events, the device set is updated once after the
+// events have settled (no event for settle ms, at most
+// HOTPLUG_SETTLE_SPAN times settle after the first one) instead of
+// once per event. The events may be reported by any thread, the
+// update runs in the reactor (see evloop.h).
+
+// the longest coalescing window in multiples of the settle time
+#define HOTPLUG_SETTLE_SPAN 4
+
+// applies the coalesced events: the numbers of add and remove events
+typedef void (*hotplug_func_t)(int added, int removed);
+
+// starts the coalescing with the settle time (ms, 0: every event is
+// applied at once) and the function applying the events
+extern void hotplug_init(int settle, hotplug_func_t func);
+// the settle time changed (reload), pending events are kept
+extern void hotplug_reload(int settle);
+// stops the coalescing, pending events are dropped
+extern void hotplug_exit(void);
+// reports an add (added == true) or remove event of a device
+extern void hotplug_event(bool added);
+
+#endif // HOTPLUG_H
@@ -0,0 +1,169 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "launch.h"
+#include "probe.h"
+
+// the pollers and workers block all signals, the script must not
+// inherit this mask, nor the SIG_IGN of SIGPIPE from libdbus
+
+// the daemon runs with the real uid root and the effective uid of the
+// configured user (see scanbd.c): if the ids differ, the child has to
+// switch to the effective ids before the exec, which posix_spawn
+// can't do. The cpus and the nice value of a script policy (NULL:
+// none) have to be set before the exec as well, a script forking at
+// once would escape them otherwise. Only in these cases fork() is
+// used, the child makes only async-signal-safe calls.
+static pid_t launch_fork(const char* script, char* const argv[], char** env,
+                         const cpu_policy_t* policy) {
+    uid_t euid = geteuid();
+    gid_t egid = getegid();
+    bool switch_ids = (getuid() != euid) || (getgid() != egid);
+    sigset_t empty;
+    sigemptyset(&empty);
+
+    pid_t cpid = fork();
+    if (cpid != 0) {
+        // parent or error
+        return cpid;
+    }
+    // child
+    if (switch_ids) {
+        if (seteuid(0) < 0) {
+            _exit(126);
+        }
+        if (setegid(0) < 0) {
+            _exit(126);
+        }
+        if (setgid(egid) < 0) {
+            _exit(126);
+        }
+        if (setuid(euid) < 0) {
+            _exit(126);
+        }
+    }
+    if (policy != NULL) {
+        cpu_policy_child(policy);
+    }
+    signal(SIGPIPE, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &empty, NULL);
+    execve(script, argv, env);
+    _exit(127);
+}
+
+static pid_t launch_spawn(const char* script, char* const argv[], char** env) {
+    posix_spawnattr_t attr;
+    if (posix_spawnattr_init(&attr) != 0) {
+        slog(SLOG_ERROR, "posix_spawnattr_init: should not happen");
+        return -1;
+    }
+    sigset_t empty;
+    sigemptyset(&empty);
+    sigset_t def;
+    sigemptyset(&def);
+    sigaddset(&def, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t cpid = -1;
+    int ret = posix_spawn(&cpid, script, NULL, &attr, argv, env);
+    posix_spawnattr_destroy(&attr);
+    if (ret != 0) {
+        errno = ret;
+        return -1;
+    }
+    return cpid;
+}
+
+bool launch_check(const char* script) {
+    assert(script != NULL);
+    struct stat stat_buf;
+    if (stat(script, &stat_buf) < 0) {
+        slog(SLOG_ERROR, "script %s: %s", script, strerror(errno));
+        return false;
+    }
+    slog(SLOG_DEBUG, "octal mode for %s: %lo", script, (unsigned long)stat_buf.st_mode);
+    slog(SLOG_DEBUG, "file uid: %ld, file gid: %ld", (long)stat_buf.st_uid, (long)stat_buf.st_gid);
+    if (!S_ISREG(stat_buf.st_mode)) {
+        slog(SLOG_ERROR, "script %s is not a regular file", script);
+        return false;
+    }
+    // the child runs with the effective ids of the daemon
+    if (faccessat(AT_FDCWD, script, X_OK, AT_EACCESS) < 0) {
+        slog(SLOG_ERROR, "script %s is not executable: %s", script, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+pid_t launch_script(const char* script, char** env, const cpu_policy_t* policy) {
+    assert(script != NULL);
+    assert(env != NULL);
+
+    // the script was checked when the config was loaded (see
+    // launch_check()), an exec failure is reported below
+    slog(SLOG_DEBUG, "exec for %s", script);
+
+    char* const argv[] = {(char*)script, NULL};
+    if ((policy != NULL) && (policy->cpus == 0) && (policy->nice <= 0)) {
+        // nothing to set in the child
+        policy = NULL;
+    }
+    pid_t cpid = -1;
+    if ((getuid() == geteuid()) && (getgid() == getegid()) && (policy == NULL)) {
+        cpid = launch_spawn(script, argv, env);
+    }
+    else {
+        slog(SLOG_DEBUG, "fork for %s: uid=%d, gid=%d", script, geteuid(), getegid());
+        cpid = launch_fork(script, argv, env, policy);
+    }
+    SCANBD_PROBE2(spawn, script, cpid);
+    if (cpid < 0) {
+        slog(SLOG_ERROR, "Can't start %s: %s", script, strerror(errno));
+    }
+    return cpid;
+}
+
+int launch_wait(pid_t pid, const char* script) {
+    assert(pid > 0);
+    assert(script != NULL);
+    slog(SLOG_INFO, "waiting for child: %s", script);
+    int status = 0;
+    while(waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            slog(SLOG_ERROR, "waitpid: %s", strerror(errno));
+            return -1;
+        }
+    }
+    SCANBD_PROBE2(wait, pid, status);
+    if (WIFEXITED(status)) {
+        slog(SLOG_INFO, "child %s exited with status: %d",
+             script, WEXITSTATUS(status));
+    }
+    if (WIFSIGNALED(status)) {
+        slog(SLOG_INFO, "child %s signaled with signal: %d",
+             script, WTERMSIG(status));
+    }
+    return status;
+}
@@ -0,0 +1,53 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include "common.h"
+#include "cpu_policy.h"
+
+// starts the scripts (actions and device insert/remove hooks) as
+// child processes: the script runs with the effective uid/gid of the
+// daemon as real and effective ids, with an empty signal mask and the
+// default SIGPIPE disposition
+
+// checks that script (an absolute path) is an executable regular file
+// for the daemon: the scripts are checked once when the config is
+// loaded (see cfg_rules_build()), a missing or broken script is
+// reported then and not at each trigger
+// returns false (and logs why) if the script can't be started
+extern bool launch_check(const char* script);
+
+// starts script with the environment env (NULL terminated), a script
+// that can't be started is reported by the failed spawn (or the exit
+// status 127 of the child)
+// the cpus and the nice value of policy (NULL: none) are applied in
+// the child before the exec, the processes of the script inherit them
+// returns the pid of the child or -1
+extern pid_t launch_script(const char* script, char** env, const cpu_policy_t* policy);
+
+// waits for the child pid running script and logs its exit status
+// returns the wait status or -1
+extern int launch_wait(pid_t pid, const char* script);
+
+#endif // LAUNCH_H
@@ -0,0 +1,159 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "mailbox.h"
+#include <stdatomic.h>
+
+// a bounded ring with a sequence number per slot: a slot is free for
+// the producer at position pos if seq == pos, and holds the trigger for
+// the consumer at position pos if seq == pos + 1
+struct trigger_slot {
+    atomic_uint seq;
+    unsigned int generation;
+    int action;
+};
+
+struct trigger_mailbox {
+    struct trigger_slot slots[SCANBD_MAILBOX_SLOTS];
+    atomic_uint head;  // the next position to post to
+    atomic_uint tail;  // the next position to take from
+};
+typedef struct trigger_mailbox trigger_mailbox_t;
+
+static trigger_mailbox_t mailboxes[SCANBD_MAILBOX_DEVICES];
+
+static pthread_once_t mailbox_once = PTHREAD_ONCE_INIT;
+
+static void trigger_mailbox_init(void) {
+    for(int d = 0; d < SCANBD_MAILBOX_DEVICES; d += 1) {
+        for(unsigned int i = 0; i < SCANBD_MAILBOX_SLOTS; i += 1) {
+            atomic_init(&mailboxes[d].slots[i].seq, i);
+            mailboxes[d].slots[i].action = -1;
+        }
+        atomic_init(&mailboxes[d].head, 0);
+        atomic_init(&mailboxes[d].tail, 0);
+    }
+}
+
+bool trigger_mailbox_post(int id, unsigned int generation, int action) {
+    pthread_once(&mailbox_once, trigger_mailbox_init);
+    if (action < 0) {
+        slog(SLOG_WARN, "No such action %d", action);
+        return false;
+    }
+    if ((id < 0) || (id >= SCANBD_MAILBOX_DEVICES)) {
+        slog(SLOG_WARN, "No mailbox for the device");
+        return false;
+    }
+    trigger_mailbox_t* mb = &mailboxes[id];
+    unsigned int pos = atomic_load_explicit(&mb->head, memory_order_relaxed);
+    struct trigger_slot* slot = NULL;
+    while(true) {
+        slot = &mb->slots[pos % SCANBD_MAILBOX_SLOTS];
+        unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int diff = (int)(seq - pos);
+        if (diff == 0) {
+            // the slot is free, claim it
+            if (atomic_compare_exchange_weak_explicit(&mb->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+            // pos was reloaded by the failed exchange
+        }
+        else if (diff < 0) {
+            // the ring is full
+            slog(SLOG_WARN, "Too many pending triggers for mailbox %d, dropping action %d",
+                 id, action);
+            return false;
+        }
+        else {
+            // another producer claimed the slot
+            pos = atomic_load_explicit(&mb->head, memory_order_relaxed);
+        }
+    }
+    slot->generation = generation;
+    slot->action = action;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+// takes the next trigger out of mb: returns its action (or -1 if
+// none) and generation
+static int trigger_mailbox_take_slot(trigger_mailbox_t* mb, unsigned int* generation) {
+    unsigned int pos = atomic_load_explicit(&mb->tail, memory_order_relaxed);
+    struct trigger_slot* slot = NULL;
+    while(true) {
+        slot = &mb->slots[pos % SCANBD_MAILBOX_SLOTS];
+        unsigned int seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int diff = (int)(seq - (pos + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&mb->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            // empty (or the producer hasn't finished the post)
+            return -1;
+        }
+        else {
+            pos = atomic_load_explicit(&mb->tail, memory_order_relaxed);
+        }
+    }
+    int action = slot->action;
+    *generation = slot->generation;
+    // free the slot for the next round
+    atomic_store_explicit(&slot->seq, pos + SCANBD_MAILBOX_SLOTS, memory_order_release);
+    return action;
+}
+
+int trigger_mailbox_take(int id, unsigned int generation) {
+    pthread_once(&mailbox_once, trigger_mailbox_init);
+    if ((id < 0) || (id >= SCANBD_MAILBOX_DEVICES)) {
+        return -1;
+    }
+    while(true) {
+        unsigned int posted = 0;
+        int action = trigger_mailbox_take_slot(&mailboxes[id], &posted);
+        if ((action < 0) || (posted == generation)) {
+            return action;
+        }
+        // posted for the previous device with this mailbox id
+        slog(SLOG_DEBUG, "dropping action %d of a removed device (mailbox %d)", action, id);
+    }
+}
+
+unsigned int trigger_mailbox_pending(int id) {
+    pthread_once(&mailbox_once, trigger_mailbox_init);
+    if ((id < 0) || (id >= SCANBD_MAILBOX_DEVICES)) {
+        return 0;
+    }
+    unsigned int tail = atomic_load_explicit(&mailboxes[id].tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&mailboxes[id].head, memory_order_relaxed);
+    unsigned int pending = head - tail;
+    // the head loaded after the tail may count triggers posted after
+    // takes in between
+    return (pending > SCANBD_MAILBOX_SLOTS) ? SCANBD_MAILBOX_SLOTS : pending;
+}
@@ -0,0 +1,54 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include "common.h"
+
+// the trigger mailboxes: remote triggers (dbus, scanbd -t) are posted
+// lock-free to the mailbox of the device, the poller of that device
+// takes them out in its next poll cycle. Any thread may post, normally
+// only the poller of the device takes (taking is safe for concurrent
+// consumers as well).
+// The mailboxes are indexed by the mailbox id of the device registry
+// (see registry.h), which doesn't change if a rediscovery renumbers
+// the devices. A trigger carries the generation of the registration it
+// was posted for, the poller of a later registration with the same id
+// drops it.
+
+// the number of devices reachable by remote triggers
+#define SCANBD_MAILBOX_DEVICES 64
+// the number of pending triggers per device (a power of 2)
+#define SCANBD_MAILBOX_SLOTS 16
+
+// posts action for the mailbox id and generation, returns false if
+// rejected / full
+extern bool trigger_mailbox_post(int id, unsigned int generation, int action);
+// takes the next action posted for the mailbox id and generation, or
+// -1 if none
+extern int trigger_mailbox_take(int id, unsigned int generation);
+// the number of triggers pending in the mailbox id (a snapshot, posts
+// and takes may happen meanwhile)
+extern unsigned int trigger_mailbox_pending(int id);
+
+#endif // MAILBOX_H
@@ -0,0 +1,485 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "metrics.h"
+#include "evloop.h"
+#include "stats.h"
+#include <stdatomic.h>
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+enum metrics_family {
+    METRICS_TRIGGERS = 0,  // label: the action
+    METRICS_EXITS          // label: exited / signaled, code
+};
+typedef enum metrics_family metrics_family_t;
+
+struct metrics_counter {
+    metrics_family_t family;
+    char* device;          // a copy, freed on reuse
+    char* label;           // a copy, freed on reuse
+    int code;
+    unsigned long count;
+    unsigned long used;    // the event number of the last count
+};
+typedef struct metrics_counter metrics_counter_t;
+
+// the counters are rare events (triggers, script ends): a mutex is
+// good enough
+static metrics_counter_t metrics_counters[METRICS_COUNTERS];
+static int metrics_num_counters = 0;
+// the counted events, orders the counters by their last use
+static unsigned long metrics_events = 0;
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_ulong metrics_hotplug_added = 0;
+static atomic_ulong metrics_hotplug_removed = 0;
+
+// a connection: the request is read, then the response is written
+struct metrics_conn {
+    int fd;
+    char request[METRICS_REQUEST];
+    size_t received;
+    char* response;        // NULL while the request is read
+    size_t size;
+    size_t sent;
+};
+typedef struct metrics_conn metrics_conn_t;
+
+// the listener and the connections, used in the reactor only
+static int metrics_fd = -1;
+static char* metrics_path = NULL;
+static metrics_conn_t* metrics_conns[METRICS_CLIENTS];
+
+static void metrics_lock(void) {
+    if (pthread_mutex_lock(&metrics_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+}
+
+static void metrics_unlock(void) {
+    if (pthread_mutex_unlock(&metrics_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// counts an event of the counter (family, device, label, code)
+static void metrics_count(metrics_family_t family, const char* device,
+                          const char* label, int code) {
+    if (device == NULL) {
+        device = "";
+    }
+    if (label == NULL) {
+        label = "";
+    }
+    metrics_lock();
+    metrics_events += 1;
+    for(int c = 0; c < metrics_num_counters; c += 1) {
+        metrics_counter_t* mc = &metrics_counters[c];
+        if ((mc->family == family) && (mc->code == code) &&
+            (strcmp(mc->device, device) == 0) && (strcmp(mc->label, label) == 0)) {
+            mc->count += 1;
+            mc->used = metrics_events;
+            metrics_unlock();
+            return;
+        }
+    }
+    char* dev_copy = strdup(device);
+    char* label_copy = strdup(label);
+    if ((dev_copy == NULL) || (label_copy == NULL)) {
+        free(dev_copy);
+        free(label_copy);
+        metrics_unlock();
+        slog(SLOG_ERROR, "Can't allocate memory for the metrics");
+        return;
+    }
+    metrics_counter_t* mc = NULL;
+    if (metrics_num_counters < METRICS_COUNTERS) {
+        mc = &metrics_counters[metrics_num_counters];
+        metrics_num_counters += 1;
+    }
+    else {
+        // all counters are taken (e.g. a USB device replugged at new
+        // bus addresses): the least recently counted one is reused, a
+        // scraper sees its series end
+        mc = &metrics_counters[0];
+        for(int c = 1; c < metrics_num_counters; c += 1) {
+            if (metrics_counters[c].used < mc->used) {
+                mc = &metrics_counters[c];
+            }
+        }
+        slog(SLOG_DEBUG, "metrics counter of device %s reused for device %s",
+             mc->device, device);
+        free(mc->device);
+        free(mc->label);
+    }
+    mc->device = dev_copy;
+    mc->label = label_copy;
+    mc->family = family;
+    mc->code = code;
+    mc->count = 1;
+    mc->used = metrics_events;
+    metrics_unlock();
+}
+
+void metrics_trigger(const char* device, const char* action) {
+    metrics_count(METRICS_TRIGGERS, device, action, 0);
+}
+
+void metrics_script_exit(const char* device, int status) {
+    if (WIFEXITED(status)) {
+        metrics_count(METRICS_EXITS, device, "exited", WEXITSTATUS(status));
+    }
+    else if (WIFSIGNALED(status)) {
+        metrics_count(METRICS_EXITS, device, "signaled", WTERMSIG(status));
+    }
+}
+
+void metrics_hotplug(bool added) {
+    atomic_fetch_add_explicit(added ? &metrics_hotplug_added : &metrics_hotplug_removed,
+                              1, memory_order_relaxed);
+}
+
+static void metrics_report_counters(FILE* f) {
+    fputs("# TYPE scanbd_triggers counter\n", f);
+    fputs("# HELP scanbd_triggers The triggered actions.\n", f);
+    metrics_lock();
+    for(int c = 0; c < metrics_num_counters; c += 1) {
+        const metrics_counter_t* mc = &metrics_counters[c];
+        if (mc->family != METRICS_TRIGGERS) {
+            continue;
+        }
+        fputs("scanbd_triggers_total{device=", f);
+        stats_label(f, mc->device);
+        fputs(",action=", f);
+        stats_label(f, mc->label);
+        fprintf(f, "} %lu\n", mc->count);
+    }
+    fputs("# TYPE scanbd_script_exits counter\n", f);
+    fputs("# HELP scanbd_script_exits The ended scripts by wait status.\n", f);
+    for(int c = 0; c < metrics_num_counters; c += 1) {
+        const metrics_counter_t* mc = &metrics_counters[c];
+        if (mc->family != METRICS_EXITS) {
+            continue;
+        }
+        fputs("scanbd_script_exits_total{device=", f);
+        stats_label(f, mc->device);
+        fprintf(f, ",reason=\"%s\",code=\"%d\"} %lu\n", mc->label, mc->code, mc->count);
+    }
+    metrics_unlock();
+    fputs("# TYPE scanbd_hotplug_events counter\n", f);
+    fputs("# HELP scanbd_hotplug_events The hotplug events reported by udev.\n", f);
+    fprintf(f, "scanbd_hotplug_events_total{event=\"add\"} %lu\n",
+            atomic_load(&metrics_hotplug_added));
+    fprintf(f, "scanbd_hotplug_events_total{event=\"remove\"} %lu\n",
+            atomic_load(&metrics_hotplug_removed));
+}
+
+char* metrics_report(void) {
+    char* report = NULL;
+    size_t size = 0;
+    FILE* f = NULL;
+    if ((f = open_memstream(&report, &size)) == NULL) {
+        slog(SLOG_ERROR, "Can't create the metrics: %s", strerror(errno));
+        return NULL;
+    }
+    stats_openmetrics(f);
+    metrics_report_counters(f);
+    fputs("# EOF\n", f);
+    if (fclose(f) != 0) {
+        slog(SLOG_ERROR, "Can't create the metrics: %s", strerror(errno));
+        free(report);
+        return NULL;
+    }
+    return report;
+}
+
+static void metrics_drop(metrics_conn_t* conn) {
+    evloop_remove_io(conn);
+    evloop_remove_timer(conn);
+    close(conn->fd);
+    for(int i = 0; i < METRICS_CLIENTS; i += 1) {
+        if (metrics_conns[i] == conn) {
+            metrics_conns[i] = NULL;
+        }
+    }
+    free(conn->response);
+    free(conn);
+}
+
+static void metrics_expired(void* arg) {
+    slog(SLOG_DEBUG, "metrics: connection timed out");
+    metrics_drop(arg);
+}
+
+// the response to the request (whatever it asks for)
+static bool metrics_respond(metrics_conn_t* conn) {
+    char* body = metrics_report();
+    if (body == NULL) {
+        return false;
+    }
+    FILE* f = NULL;
+    if ((f = open_memstream(&conn->response, &conn->size)) == NULL) {
+        slog(SLOG_ERROR, "Can't create the metrics: %s", strerror(errno));
+        free(body);
+        return false;
+    }
+    fprintf(f, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+            "Content-Length: %zu\r\n"
+            "Connection: close\r\n"
+            "\r\n%s", strlen(body), body);
+    free(body);
+    if (fclose(f) != 0) {
+        slog(SLOG_ERROR, "Can't create the metrics: %s", strerror(errno));
+        free(conn->response);
+        conn->response = NULL;
+        return false;
+    }
+    conn->sent = 0;
+    return true;
+}
+
+// the end of the request header
+static bool metrics_requested(const metrics_conn_t* conn) {
+    return (strstr(conn->request, "\r\n\r\n") != NULL) ||
+        (strstr(conn->request, "\n\n") != NULL) ||
+        (conn->received >= METRICS_REQUEST - 1);
+}
+
+static void metrics_io(int fd, short revents, void* arg) {
+    metrics_conn_t* conn = arg;
+    if (conn->response == NULL) {
+        ssize_t n = read(fd, conn->request + conn->received,
+                         METRICS_REQUEST - 1 - conn->received);
+        if (n < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR)) {
+                slog(SLOG_DEBUG, "metrics: read: %s", strerror(errno));
+                metrics_drop(conn);
+            }
+            return;
+        }
+        conn->received += (size_t)n;
+        conn->request[conn->received] = '\0';
+        // a client may shut down its side after the request
+        if ((n > 0) && !metrics_requested(conn)) {
+            return;
+        }
+        if (!metrics_respond(conn)) {
+            metrics_drop(conn);
+            return;
+        }
+        evloop_set_io(conn, POLLOUT, true);
+    }
+    else if (!(revents & (POLLOUT | POLLERR | POLLHUP))) {
+        return;
+    }
+    while(conn->sent < conn->size) {
+        ssize_t n = send(fd, conn->response + conn->sent, conn->size - conn->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                // the rest when the socket is writable again
+                return;
+            }
+            slog(SLOG_DEBUG, "metrics: send: %s", strerror(errno));
+            break;
+        }
+        conn->sent += (size_t)n;
+    }
+    metrics_drop(conn);
+}
+
+static bool metrics_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) ||
+        (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)) {
+        slog(SLOG_WARN, "metrics: fcntl: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void metrics_accept(int fd, short revents, void* arg) {
+    (void)revents;
+    (void)arg;
+    int cfd = -1;
+    while((cfd = accept(fd, NULL, NULL)) >= 0) {
+        int slot = -1;
+        for(int i = 0; i < METRICS_CLIENTS; i += 1) {
+            if (metrics_conns[i] == NULL) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            slog(SLOG_DEBUG, "metrics: too many connections (max %d)", METRICS_CLIENTS);
+            close(cfd);
+            continue;
+        }
+        metrics_conn_t* conn = NULL;
+        if (!metrics_nonblocking(cfd) || ((conn = calloc(1, sizeof(metrics_conn_t))) == NULL)) {
+            close(cfd);
+            continue;
+        }
+        conn->fd = cfd;
+        if (!evloop_add_io(cfd, POLLIN, true, metrics_io, conn)) {
+            close(cfd);
+            free(conn);
+            continue;
+        }
+        if (!evloop_add_timer(METRICS_TIMEOUT, true, metrics_expired, conn)) {
+            evloop_remove_io(conn);
+            close(cfd);
+            free(conn);
+            continue;
+        }
+        metrics_conns[slot] = conn;
+    }
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) &&
+        (errno != ECONNABORTED)) {
+        slog(SLOG_WARN, "metrics: accept: %s", strerror(errno));
+    }
+}
+
+// the unix socket path, replaces a stale one
+static int metrics_listen_unix(const char* path, uid_t uid, gid_t gid) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        slog(SLOG_ERROR, "metrics socket path too long: %s", path);
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        slog(SLOG_ERROR, "metrics: socket: %s", strerror(errno));
+        return -1;
+    }
+    if ((unlink(path) < 0) && (errno != ENOENT)) {
+        slog(SLOG_WARN, "Can't unlink %s: %s", path, strerror(errno));
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        slog(SLOG_ERROR, "Can't bind the metrics socket %s: %s", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    // the metrics are readable by all, as the status page
+    if ((chmod(path, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH) < 0) ||
+        (chown(path, uid, gid) < 0)) {
+        slog(SLOG_WARN, "Can't set the owner and mode of %s: %s", path, strerror(errno));
+    }
+    if ((metrics_path = strdup(path)) == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the metrics");
+        unlink(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// the tcp port on the loopback interface
+static int metrics_listen_tcp(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        slog(SLOG_ERROR, "metrics: socket: %s", strerror(errno));
+        return -1;
+    }
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        slog(SLOG_WARN, "metrics: setsockopt: %s", strerror(errno));
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        slog(SLOG_ERROR, "Can't bind the metrics port %d: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool metrics_open(const char* listen_on, uid_t uid, gid_t gid) {
+    assert(listen_on != NULL);
+    assert(metrics_fd < 0);
+    int fd = -1;
+    if (listen_on[0] == '/') {
+        fd = metrics_listen_unix(listen_on, uid, gid);
+    }
+    else {
+        char* end = NULL;
+        long port = strtol(listen_on, &end, 10);
+        if ((end == listen_on) || (*end != '\0') || (port < 1) || (port > 65535)) {
+            slog(SLOG_ERROR, "metrics: neither an absolute path nor a port: %s", listen_on);
+            return false;
+        }
+        fd = metrics_listen_tcp((int)port);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    if (!metrics_nonblocking(fd) || (listen(fd, METRICS_CLIENTS) < 0) ||
+        !evloop_add_io(fd, POLLIN, true, metrics_accept, &metrics_fd)) {
+        slog(SLOG_ERROR, "Can't listen on %s: %s", listen_on, strerror(errno));
+        close(fd);
+        if (metrics_path != NULL) {
+            unlink(metrics_path);
+            free(metrics_path);
+            metrics_path = NULL;
+        }
+        return false;
+    }
+    metrics_fd = fd;
+    slog(SLOG_INFO, "metrics on %s", listen_on);
+    return true;
+}
+
+void metrics_close(void) {
+    if (metrics_fd < 0) {
+        return;
+    }
+    for(int i = 0; i < METRICS_CLIENTS; i += 1) {
+        if (metrics_conns[i] != NULL) {
+            metrics_drop(metrics_conns[i]);
+        }
+    }
+    evloop_remove_io(&metrics_fd);
+    close(metrics_fd);
+    metrics_fd = -1;
+    if (metrics_path != NULL) {
+        if (unlink(metrics_path) < 0) {
+            slog(SLOG_WARN, "Can't unlink metrics socket %s: %s", metrics_path, strerror(errno));
+        }
+        free(metrics_path);
+        metrics_path = NULL;
+    }
+}
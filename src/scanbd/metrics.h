@@ -0,0 +1,71 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "common.h"
+
+// the metrics endpoint: an optional listener (see C_METRICS) on a unix
+// socket or on a localhost tcp port, served by the reactor (see
+// evloop.h). Each connection sends one HTTP request (the path is
+// ignored) and gets the metrics in the OpenMetrics text format:
+//
+//  - the histograms of the statistics (see stats.h) per device, the
+//    poll rate is the rate of scanbd_poll_seconds_count
+//  - scanbd_triggers_total{device, action}: the triggered actions
+//  - scanbd_script_exits_total{device, reason, code}: the wait status
+//    of the action and hook scripts (reason exited or signaled)
+//  - scanbd_hotplug_events_total{event}: the add / remove events
+//
+// e.g. curl --unix-socket /run/scanbd/metrics http://localhost/metrics
+
+// the connections served at the same time, more are closed at once
+#define METRICS_CLIENTS 8
+// a connection not served within this time (ms) is closed
+#define METRICS_TIMEOUT 2000
+// the size of the request (header) read from a connection
+#define METRICS_REQUEST 1024
+// the number of (device, label) counters, the least recently counted
+// one is reused when all are taken
+#define METRICS_COUNTERS 256
+
+// listens on listen_on: an absolute path (unix socket, replaced, owned
+// by uid / gid) or a port number (127.0.0.1), returns false on errors
+// the connections are served as soon as the reactor runs
+extern bool metrics_open(const char* listen_on, uid_t uid, gid_t gid);
+// closes the listener and the connections (removes the unix socket)
+extern void metrics_close(void);
+
+// the counters, may be called from any thread
+// the action of device was triggered
+extern void metrics_trigger(const char* device, const char* action);
+// a script of device has ended with the wait status
+extern void metrics_script_exit(const char* device, int status);
+// a hotplug event (see hotplug_event())
+extern void metrics_hotplug(bool added);
+
+// returns the OpenMetrics exposition (terminated by # EOF), must be
+// freed by the caller, NULL on error
+extern char* metrics_report(void);
+
+#endif // METRICS_H
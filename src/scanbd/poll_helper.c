@@ -0,0 +1,528 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+#include "scanbd.h"
+#include "poll_helper.h"
+#include <stdatomic.h>
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+// the commands of the parent, the reply carries the status and the
+// count (options of an open, records of a read)
+enum poll_helper_op {
+    POLL_HELPER_OPEN = 1,
+    POLL_HELPER_CLOSE,
+    POLL_HELPER_READ
+};
+
+struct poll_helper_msg {
+    int op;                      // the command (see above)
+    int count;                   // the options to read (in request)
+    SANE_Status status;          // the reply status
+};
+typedef struct poll_helper_msg poll_helper_msg_t;
+
+struct poll_helper_desc {
+    bool valid;                  // the option has a descriptor
+    char name[POLL_HELPER_NAME];
+    SANE_Value_Type type;
+    SANE_Unit unit;
+    SANE_Int size;
+    SANE_Int cap;
+};
+typedef struct poll_helper_desc poll_helper_desc_t;
+
+// the shared memory block: the helper writes the records at head, the
+// parent takes them from tail (a single producer / consumer ring)
+struct poll_helper_shm {
+    atomic_uint head;
+    atomic_uint tail;
+    poll_helper_record_t ring[POLL_HELPER_RING];
+    int request[POLL_HELPER_RING];  // the options of a read
+    int num_options;                // of the opened device
+    poll_helper_desc_t descs[POLL_HELPER_OPTIONS];
+};
+typedef struct poll_helper_shm poll_helper_shm_t;
+
+struct poll_helper {
+    char* device;
+    int timeout;                 // ms per command
+    pid_t pid;                   // the helper, -1 if not running
+    int channel;                 // the parent end of the socketpair
+    int shm_fd;
+    poll_helper_shm_t* shm;
+    int num_options;             // of the opened device, 0 if closed
+    // the descriptors of the opened device, built from shm->descs
+    SANE_Option_Descriptor descs[POLL_HELPER_OPTIONS];
+    bool valid[POLL_HELPER_OPTIONS];
+    char names[POLL_HELPER_OPTIONS][POLL_HELPER_NAME];
+};
+
+static char poll_helper_path[PATH_MAX] = "scanbd";
+
+void poll_helper_setup(const char* argv0) {
+    assert(argv0 != NULL);
+    ssize_t n = readlink("/proc/self/exe", poll_helper_path, sizeof(poll_helper_path) - 1);
+    if (n > 0) {
+        poll_helper_path[n] = '\0';
+        return;
+    }
+    if (realpath(argv0, poll_helper_path) == NULL) {
+        strncpy(poll_helper_path, argv0, sizeof(poll_helper_path) - 1);
+        poll_helper_path[sizeof(poll_helper_path) - 1] = '\0';
+    }
+}
+
+// the whole message, false on EOF or an error
+static bool poll_helper_send(int fd, const poll_helper_msg_t* msg) {
+    while(send(fd, msg, sizeof(*msg), MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool poll_helper_receive(int fd, poll_helper_msg_t* msg) {
+    size_t got = 0;
+    while(got < sizeof(*msg)) {
+        ssize_t n = recv(fd, (char*)msg + got, sizeof(*msg) - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+poll_helper_t* poll_helper_new(const char* device, int timeout) {
+    assert(device != NULL);
+    poll_helper_t* ph = (poll_helper_t*) calloc(1, sizeof(poll_helper_t));
+    if (ph == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the poll helper");
+        return NULL;
+    }
+    ph->device = strdup(device);
+    ph->timeout = (timeout > 0) ? timeout : C_POLL_HELPER_TIMEOUT_DEF;
+    ph->pid = -1;
+    ph->channel = -1;
+    ph->shm = MAP_FAILED;
+
+    // an unlinked file: the helper inherits the descriptor over the exec
+    char name[] = "/tmp/scanbd-helper.XXXXXX";
+    ph->shm_fd = mkstemp(name);
+    if (ph->shm_fd < 0) {
+        slog(SLOG_ERROR, "Can't create the shared memory of the poll helper: %s",
+             strerror(errno));
+        goto error;
+    }
+    unlink(name);
+    if (fcntl(ph->shm_fd, F_SETFD, FD_CLOEXEC) < 0) {
+        slog(SLOG_WARN, "fcntl: %s", strerror(errno));
+    }
+    if (ftruncate(ph->shm_fd, sizeof(poll_helper_shm_t)) < 0) {
+        slog(SLOG_ERROR, "ftruncate: %s", strerror(errno));
+        goto error;
+    }
+    ph->shm = mmap(NULL, sizeof(poll_helper_shm_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, ph->shm_fd, 0);
+    if ((ph->shm == MAP_FAILED) || (ph->device == NULL)) {
+        slog(SLOG_ERROR, "Can't map the shared memory of the poll helper: %s",
+             strerror(errno));
+        goto error;
+    }
+    return ph;
+error:
+    poll_helper_free(ph);
+    return NULL;
+}
+
+// kills the helper (a hung one doesn't end otherwise) and reaps it
+static void poll_helper_stop(poll_helper_t* ph) {
+    if (ph->pid > 0) {
+        kill(ph->pid, SIGKILL);
+        while((waitpid(ph->pid, NULL, 0) < 0) && (errno == EINTR)) {
+        }
+        ph->pid = -1;
+    }
+    if (ph->channel >= 0) {
+        close(ph->channel);
+        ph->channel = -1;
+    }
+    ph->num_options = 0;
+}
+
+void poll_helper_free(poll_helper_t* ph) {
+    if (ph == NULL) {
+        return;
+    }
+    poll_helper_stop(ph);
+    if (ph->shm != MAP_FAILED) {
+        munmap(ph->shm, sizeof(poll_helper_shm_t));
+    }
+    if (ph->shm_fd >= 0) {
+        close(ph->shm_fd);
+    }
+    free(ph->device);
+    free(ph);
+}
+
+// starts the helper: like a script it runs with the effective ids of
+// the daemon (see launch.c), the child makes only async-signal-safe
+// calls until the exec
+static bool poll_helper_spawn(poll_helper_t* ph) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        slog(SLOG_ERROR, "socketpair: %s", strerror(errno));
+        return false;
+    }
+    // above the fixed descriptors, so the dup2() can't overwrite them
+    int channel = fcntl(sv[1], F_DUPFD, POLL_HELPER_FD_SHM + 1);
+    int shm = fcntl(ph->shm_fd, F_DUPFD, POLL_HELPER_FD_SHM + 1);
+    close(sv[1]);
+    if ((channel < 0) || (shm < 0)) {
+        slog(SLOG_ERROR, "fcntl: %s", strerror(errno));
+        close(sv[0]);
+        if (channel >= 0) {
+            close(channel);
+        }
+        if (shm >= 0) {
+            close(shm);
+        }
+        return false;
+    }
+    if (fcntl(sv[0], F_SETFD, FD_CLOEXEC) < 0) {
+        slog(SLOG_WARN, "fcntl: %s", strerror(errno));
+    }
+    char level[16];
+    snprintf(level, sizeof(level), "-d%u", debug_level);
+    char* const argv[] = {poll_helper_path, "--poll-helper", ph->device,
+                          debug ? level : NULL, NULL};
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0) {
+        max_fd = 1024;
+    }
+    uid_t euid = geteuid();
+    gid_t egid = getegid();
+    bool switch_ids = (getuid() != euid) || (getgid() != egid);
+    sigset_t empty;
+    sigemptyset(&empty);
+    atomic_store(&ph->shm->head, 0);
+    atomic_store(&ph->shm->tail, 0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (switch_ids &&
+            ((seteuid(0) < 0) || (setegid(0) < 0) || (setgid(egid) < 0) || (setuid(euid) < 0))) {
+            _exit(126);
+        }
+        if ((dup2(channel, POLL_HELPER_FD_CHANNEL) < 0) || (dup2(shm, POLL_HELPER_FD_SHM) < 0)) {
+            _exit(126);
+        }
+        for(long fd = POLL_HELPER_FD_SHM + 1; fd < max_fd; fd += 1) {
+            close(fd);
+        }
+        signal(SIGPIPE, SIG_DFL);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        execv(poll_helper_path, argv);
+        _exit(127);
+    }
+    close(channel);
+    close(shm);
+    if (pid < 0) {
+        slog(SLOG_ERROR, "Can't start the poll helper of %s: %s", ph->device, strerror(errno));
+        close(sv[0]);
+        return false;
+    }
+    slog(SLOG_INFO, "poll helper of %s started (pid %ld)", ph->device, (long)pid);
+    ph->pid = pid;
+    ph->channel = sv[0];
+    return true;
+}
+
+// sends the command and waits at most the timeout for the reply,
+// a helper that fails is stopped
+static bool poll_helper_call(poll_helper_t* ph, poll_helper_msg_t* msg) {
+    if ((ph->pid < 0) && !poll_helper_spawn(ph)) {
+        return false;
+    }
+    if (!poll_helper_send(ph->channel, msg)) {
+        slog(SLOG_WARN, "poll helper of %s has gone, restarting", ph->device);
+        poll_helper_stop(ph);
+        return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = ph->channel;
+    pfd.events = POLLIN;
+    int ret = 0;
+    while(((ret = poll(&pfd, 1, ph->timeout)) < 0) && (errno == EINTR)) {
+    }
+    if (ret == 0) {
+        slog(SLOG_WARN, "poll helper of %s hung for %d ms, restarting",
+             ph->device, ph->timeout);
+        poll_helper_stop(ph);
+        return false;
+    }
+    if ((ret < 0) || !poll_helper_receive(ph->channel, msg)) {
+        slog(SLOG_WARN, "poll helper of %s has gone, restarting", ph->device);
+        poll_helper_stop(ph);
+        return false;
+    }
+    return true;
+}
+
+SANE_Status poll_helper_open(poll_helper_t* ph) {
+    assert(ph != NULL);
+    poll_helper_msg_t msg = {POLL_HELPER_OPEN, 0, SANE_STATUS_GOOD};
+    if (!poll_helper_call(ph, &msg)) {
+        return SANE_STATUS_IO_ERROR;
+    }
+    if (msg.status != SANE_STATUS_GOOD) {
+        return msg.status;
+    }
+    // a copy: the helper can't change the descriptors in use
+    int count = ph->shm->num_options;
+    if ((count < 0) || (count > POLL_HELPER_OPTIONS)) {
+        count = 0;
+    }
+    for(int i = 0; i < count; i += 1) {
+        const poll_helper_desc_t* d = &ph->shm->descs[i];
+        SANE_Option_Descriptor* od = &ph->descs[i];
+        memset(od, 0, sizeof(*od));
+        ph->valid[i] = d->valid;
+        if (!d->valid) {
+            continue;
+        }
+        memcpy(ph->names[i], d->name, POLL_HELPER_NAME);
+        ph->names[i][POLL_HELPER_NAME - 1] = '\0';
+        od->name = ph->names[i];
+        od->title = ph->names[i];
+        od->desc = "";
+        od->type = d->type;
+        od->unit = d->unit;
+        od->size = d->size;
+        od->cap = d->cap;
+        od->constraint_type = SANE_CONSTRAINT_NONE;
+    }
+    ph->num_options = count;
+    return SANE_STATUS_GOOD;
+}
+
+int poll_helper_options(const poll_helper_t* ph) {
+    assert(ph != NULL);
+    return ph->num_options;
+}
+
+void poll_helper_close(poll_helper_t* ph) {
+    assert(ph != NULL);
+    ph->num_options = 0;
+    if (ph->pid < 0) {
+        return;
+    }
+    poll_helper_msg_t msg = {POLL_HELPER_CLOSE, 0, SANE_STATUS_GOOD};
+    poll_helper_call(ph, &msg);
+}
+
+const SANE_Option_Descriptor* poll_helper_descriptor(poll_helper_t* ph, int option) {
+    assert(ph != NULL);
+    if ((option < 0) || (option >= ph->num_options) || !ph->valid[option]) {
+        return NULL;
+    }
+    return &ph->descs[option];
+}
+
+bool poll_helper_read(poll_helper_t* ph, const int* options, int n,
+                      poll_helper_record_t* records) {
+    assert(ph != NULL);
+    assert((n >= 0) && (n <= POLL_HELPER_RING));
+    if (ph->num_options == 0) {
+        return false;
+    }
+    memcpy(ph->shm->request, options, n * sizeof(int));
+    poll_helper_msg_t msg = {POLL_HELPER_READ, n, SANE_STATUS_GOOD};
+    if (!poll_helper_call(ph, &msg)) {
+        return false;
+    }
+    unsigned int tail = atomic_load_explicit(&ph->shm->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ph->shm->head, memory_order_acquire);
+    for(int i = 0; i < n; i += 1) {
+        if (tail == head) {
+            // the helper has read less options
+            records[i].option = options[i];
+            records[i].status = SANE_STATUS_IO_ERROR;
+            records[i].string = false;
+            records[i].num_value = 0;
+            continue;
+        }
+        records[i] = ph->shm->ring[tail % POLL_HELPER_RING];
+        records[i].str_value[POLL_HELPER_STR - 1] = '\0';
+        tail += 1;
+    }
+    atomic_store_explicit(&ph->shm->tail, head, memory_order_release);
+    return true;
+}
+
+// the helper process
+
+// reads the value of the option like get_sane_option_value() (see
+// sane.c) into the record
+static void poll_helper_value(SANE_Handle h, int option, poll_helper_record_t* r) {
+    r->option = option;
+    r->status = SANE_STATUS_INVAL;
+    r->string = false;
+    r->num_value = 0;
+    r->str_value[0] = '\0';
+    const SANE_Option_Descriptor* odesc = sane_get_option_descriptor(h, option);
+    if (odesc == NULL) {
+        return;
+    }
+    if ((odesc->type == SANE_TYPE_BOOL) || (odesc->type == SANE_TYPE_INT) ||
+        (odesc->type == SANE_TYPE_FIXED) || (odesc->type == SANE_TYPE_BUTTON)) {
+        if ((unsigned int)odesc->size > sizeof(long int)) {
+            return;
+        }
+        unsigned long int value = 0;
+        r->status = sane_control_option(h, option, SANE_ACTION_GET_VALUE, &value, NULL);
+        r->num_value = (r->status == SANE_STATUS_GOOD) ? value : 0;
+    }
+    else if (odesc->type == SANE_TYPE_STRING) {
+        char* str = calloc(odesc->size + 1, 1);
+        if (str == NULL) {
+            return;
+        }
+        r->string = true;
+        r->status = sane_control_option(h, option, SANE_ACTION_GET_VALUE, str, NULL);
+        if (r->status == SANE_STATUS_GOOD) {
+            strncpy(r->str_value, str, POLL_HELPER_STR - 1);
+        }
+        free(str);
+    }
+}
+
+// the descriptors of the opened device into the shared memory
+static void poll_helper_publish(SANE_Handle h, poll_helper_shm_t* shm, int count) {
+    if (count > POLL_HELPER_OPTIONS) {
+        slog(SLOG_WARN, "only the first %d of %d options are polled",
+             POLL_HELPER_OPTIONS, count);
+        count = POLL_HELPER_OPTIONS;
+    }
+    for(int i = 0; i < count; i += 1) {
+        poll_helper_desc_t* d = &shm->descs[i];
+        const SANE_Option_Descriptor* odesc = sane_get_option_descriptor(h, i);
+        memset(d, 0, sizeof(*d));
+        if (odesc == NULL) {
+            continue;
+        }
+        d->valid = true;
+        if (odesc->name != NULL) {
+            strncpy(d->name, odesc->name, POLL_HELPER_NAME - 1);
+        }
+        d->type = odesc->type;
+        d->unit = odesc->unit;
+        d->size = odesc->size;
+        d->cap = odesc->cap;
+    }
+    shm->num_options = count;
+}
+
+int poll_helper_main(const char* device) {
+    assert(device != NULL);
+    poll_helper_shm_t* shm = mmap(NULL, sizeof(poll_helper_shm_t), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, POLL_HELPER_FD_SHM, 0);
+    if (shm == MAP_FAILED) {
+        slog(SLOG_ERROR, "poll helper: can't map the shared memory: %s", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    SANE_Int version;
+    SANE_Status status = sane_init(&version, NULL);
+    if (status != SANE_STATUS_GOOD) {
+        slog(SLOG_ERROR, "poll helper: sane_init: %s", sane_strstatus(status));
+        return EXIT_FAILURE;
+    }
+    slog(SLOG_DEBUG, "poll helper of %s", device);
+
+    SANE_Handle h = NULL;
+    poll_helper_msg_t msg;
+    // the parent closes the channel at its stop (or end)
+    while(poll_helper_receive(POLL_HELPER_FD_CHANNEL, &msg)) {
+        msg.status = SANE_STATUS_GOOD;
+        switch(msg.op) {
+        case POLL_HELPER_OPEN: {
+            if (h == NULL) {
+                msg.status = sane_open(device, &h);
+                if (msg.status != SANE_STATUS_GOOD) {
+                    h = NULL;
+                    break;
+                }
+            }
+            // option 0 is the number of options
+            SANE_Int count = 0;
+            msg.status = sane_control_option(h, 0, SANE_ACTION_GET_VALUE, &count, NULL);
+            if (msg.status == SANE_STATUS_GOOD) {
+                poll_helper_publish(h, shm, count);
+            }
+            break;
+        }
+        case POLL_HELPER_CLOSE:
+            if (h != NULL) {
+                sane_close(h);
+                h = NULL;
+            }
+            break;
+        case POLL_HELPER_READ:
+            if ((h == NULL) || (msg.count < 0) || (msg.count > POLL_HELPER_RING)) {
+                msg.status = SANE_STATUS_INVAL;
+                break;
+            }
+            for(int i = 0; i < msg.count; i += 1) {
+                unsigned int head = atomic_load_explicit(&shm->head, memory_order_relaxed);
+                if (head - atomic_load_explicit(&shm->tail, memory_order_acquire) >= POLL_HELPER_RING) {
+                    break;
+                }
+                poll_helper_value(h, shm->request[i], &shm->ring[head % POLL_HELPER_RING]);
+                atomic_store_explicit(&shm->head, head + 1, memory_order_release);
+            }
+            break;
+        default:
+            msg.status = SANE_STATUS_UNSUPPORTED;
+            break;
+        }
+        if (!poll_helper_send(POLL_HELPER_FD_CHANNEL, &msg)) {
+            break;
+        }
+    }
+    if (h != NULL) {
+        sane_close(h);
+    }
+    sane_exit();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef POLL_HELPER_H
+#define POLL_HELPER_H
+
+#include "common.h"
+#include <sane/sane.h>
+
+// the out-of-process poller (see C_POLL_HELPER): the backend calls of
+// a device are made by a helper process (scanbd --poll-helper device)
+// with its own sane_init(). A leaky, crashing or hung backend only hits
+// its helper, and the backends of different devices run in parallel.
+// The helper gets its commands (open, close, read) over a socketpair
+// and returns the descriptors and the option values in a shared memory
+// block, the values as a ring of compact records (one per option read).
+// A helper that dies or doesn't answer within the timeout is killed,
+// the next open starts a new one: no sane_exit() / sane_init() cycle
+// of the daemon is needed for it.
+
+// the options of a device the helper transfers (more are cut off)
+#define POLL_HELPER_OPTIONS 256
+// the records of the ring: the most options of one read
+#define POLL_HELPER_RING 64
+// the length of an option name and of a string value (longer ones
+// are truncated)
+#define POLL_HELPER_NAME 64
+#define POLL_HELPER_STR 128
+// the descriptors the helper gets at the exec
+#define POLL_HELPER_FD_CHANNEL 3
+#define POLL_HELPER_FD_SHM 4
+
+// the value of an option read by the helper
+struct poll_helper_record {
+    int option;                  // the option number
+    SANE_Status status;          // of sane_control_option()
+    bool string;                 // str_value is valid
+    unsigned long num_value;     // (BOOL|INT|FIXED|BUTTON)
+    char str_value[POLL_HELPER_STR]; // (STRING)
+};
+typedef struct poll_helper_record poll_helper_record_t;
+
+typedef struct poll_helper poll_helper_t;
+
+// the executable of the helpers: the running scanbd (argv0 if its path
+// can't be found)
+extern void poll_helper_setup(const char* argv0);
+
+// the helper of the device, started by the first open; a call longer
+// than timeout ms kills it
+extern poll_helper_t* poll_helper_new(const char* device, int timeout);
+// stops the helper
+extern void poll_helper_free(poll_helper_t* ph);
+// opens the device in the helper (started if not running), returns
+// the status of sane_open()
+extern SANE_Status poll_helper_open(poll_helper_t* ph);
+extern void poll_helper_close(poll_helper_t* ph);
+// the number of options of the opened device (at most
+// POLL_HELPER_OPTIONS)
+extern int poll_helper_options(const poll_helper_t* ph);
+// the descriptor of the option of the opened device (name, type,
+// unit, size and cap only), or NULL
+extern const SANE_Option_Descriptor* poll_helper_descriptor(poll_helper_t* ph, int option);
+// reads the values of the n (<= POLL_HELPER_RING) options into
+// records, returns false if the helper has failed (it is stopped, the
+// device counts as closed)
+extern bool poll_helper_read(poll_helper_t* ph, const int* options, int n,
+                             poll_helper_record_t* records);
+
+// the helper process: serves the commands of the parent for the
+// device, returns the exit status
+extern int poll_helper_main(const char* device);
+
+#endif // POLL_HELPER_H
@@ -0,0 +1,365 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "poll_state.h"
+
+#include <sys/mman.h>
+
+struct poll_state_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;                  // the number of records
+    uint64_t generation;             // of the rule set
+    int64_t saved;                   // the time of the write
+};
+
+struct poll_state_record {
+    char device[POLL_STATE_NAME_MAX];
+    char option[POLL_STATE_OPTION_MAX];
+    char str_value[POLL_STATE_STRING_MAX];
+    uint64_t num_value;
+    int32_t type;
+    uint32_t has_str;
+    uint32_t idle;                   // s since the last change
+    uint32_t reserved;
+};
+
+// an entry of the table: the record (without idle) and the time of
+// the last change
+struct poll_state_entry {
+    struct poll_state_record record;
+    struct timespec changed;         // CLOCK_MONOTONIC
+    bool restored;                   // loaded, not yet taken by the
+    // poller of the device (see poll_state_restored())
+};
+
+// the table is shared by the pollers (updates) and the reactor (the
+// writes), the mutex is never held during I/O
+static pthread_mutex_t poll_state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct poll_state_entry poll_state_entries[POLL_STATE_RECORDS];
+static int poll_state_count = 0;
+static bool poll_state_dirty = false;
+static bool poll_state_full = false;        // the overflow was logged
+static uint64_t poll_state_generation = 0;  // of the loaded entries
+static struct timespec poll_state_written;  // the last write
+
+static void poll_state_lock(void) {
+    if (pthread_mutex_lock(&poll_state_mutex) != 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: this shouldn't happen");
+    }
+}
+
+static void poll_state_unlock(void) {
+    if (pthread_mutex_unlock(&poll_state_mutex) != 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: this shouldn't happen");
+    }
+}
+
+static bool poll_state_terminated(const char* field, size_t size) {
+    return memchr(field, '\0', size) != NULL;
+}
+
+// the entry of the option of device or NULL
+// the poll_state_mutex must be held by the caller
+static struct poll_state_entry* poll_state_find(const char* device, const char* option) {
+    for(int i = 0; i < poll_state_count; i += 1) {
+        if ((strcmp(poll_state_entries[i].record.option, option) == 0) &&
+            (strcmp(poll_state_entries[i].record.device, device) == 0)) {
+            return &poll_state_entries[i];
+        }
+    }
+    return NULL;
+}
+
+// the poll_state_mutex must be held by the caller
+static void poll_state_drop(struct poll_state_entry* e) {
+    poll_state_count -= 1;
+    *e = poll_state_entries[poll_state_count];
+    poll_state_dirty = true;
+}
+
+void poll_state_load(const char* path, uint64_t generation) {
+    assert(path != NULL);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            slog(SLOG_WARN, "Can't open poll state %s: %s", path, strerror(errno));
+        }
+        return;
+    }
+    struct stat sb;
+    if ((fstat(fd, &sb) < 0) || ((size_t)sb.st_size < sizeof(struct poll_state_header))) {
+        slog(SLOG_WARN, "poll state %s is invalid", path);
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)sb.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        slog(SLOG_WARN, "Can't map poll state %s: %s", path, strerror(errno));
+        return;
+    }
+
+    const struct poll_state_header* header = (const struct poll_state_header*)map;
+    if ((memcmp(header->magic, POLL_STATE_MAGIC, sizeof(header->magic)) != 0) ||
+        (header->version != POLL_STATE_VERSION) ||
+        (header->count > POLL_STATE_RECORDS) ||
+        (size != sizeof(struct poll_state_header) +
+         (size_t)header->count * sizeof(struct poll_state_record))) {
+        slog(SLOG_WARN, "poll state %s is invalid", path);
+        goto cleanup;
+    }
+    if (header->generation != generation) {
+        slog(SLOG_INFO, "poll state %s belongs to another config, ignored", path);
+        goto cleanup;
+    }
+    int64_t age = (int64_t)time(NULL) - header->saved;
+    if ((age < 0) || (age > POLL_STATE_MAX_AGE)) {
+        slog(SLOG_INFO, "poll state %s is %lld s old, ignored", path, (long long)age);
+        goto cleanup;
+    }
+    int count = (int)header->count;
+    const struct poll_state_record* records =
+        (const struct poll_state_record*)((const char*)map + sizeof(struct poll_state_header));
+    for(int i = 0; i < count; i += 1) {
+        if (!poll_state_terminated(records[i].device, sizeof(records[i].device)) ||
+            !poll_state_terminated(records[i].option, sizeof(records[i].option)) ||
+            !poll_state_terminated(records[i].str_value, sizeof(records[i].str_value))) {
+            slog(SLOG_WARN, "poll state %s is invalid", path);
+            goto cleanup;
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    poll_state_lock();
+    poll_state_count = 0;
+    for(int i = 0; i < count; i += 1) {
+        struct poll_state_entry* e = &poll_state_entries[poll_state_count];
+        e->record = records[i];
+        // the change happened idle s before the write
+        e->changed = now;
+        e->changed.tv_sec -= (time_t)records[i].idle + age;
+        e->restored = true;
+        poll_state_count += 1;
+    }
+    poll_state_generation = generation;
+    poll_state_written = now;
+    poll_state_unlock();
+    slog(SLOG_INFO, "loaded %d values of the poll state %s (%lld s old)",
+         count, path, (long long)age);
+cleanup:
+    munmap(map, size);
+}
+
+void poll_state_update(const char* device, const char* option, int type,
+                       unsigned long num_value, const char* str_value,
+                       const struct timespec* changed) {
+    assert(device != NULL);
+    assert(option != NULL);
+    bool fits = (strlen(device) < POLL_STATE_NAME_MAX) && (strlen(option) < POLL_STATE_OPTION_MAX) &&
+        ((str_value == NULL) || (strlen(str_value) < POLL_STATE_STRING_MAX));
+
+    poll_state_lock();
+    struct poll_state_entry* e = poll_state_find(device, option);
+    if (!fits) {
+        // not checkpointed: a restart starts this option from scratch
+        if (e != NULL) {
+            poll_state_drop(e);
+        }
+        poll_state_unlock();
+        return;
+    }
+    if (e == NULL) {
+        if (poll_state_count >= POLL_STATE_RECORDS) {
+            if (!poll_state_full) {
+                slog(SLOG_WARN, "poll state full, option %s of %s not checkpointed", option, device);
+                poll_state_full = true;
+            }
+            poll_state_unlock();
+            return;
+        }
+        e = &poll_state_entries[poll_state_count];
+        poll_state_count += 1;
+        memset(&e->record, 0, sizeof(e->record));
+        strcpy(e->record.device, device);
+        strcpy(e->record.option, option);
+    }
+    e->record.type = type;
+    e->record.num_value = num_value;
+    e->record.has_str = (str_value != NULL);
+    strcpy(e->record.str_value, (str_value != NULL) ? str_value : "");
+    if (changed != NULL) {
+        e->changed = *changed;
+    }
+    else {
+        clock_gettime(CLOCK_MONOTONIC, &e->changed);
+    }
+    e->restored = false;
+    poll_state_dirty = true;
+    poll_state_unlock();
+}
+
+bool poll_state_restore(const char* device, const char* option, int type,
+                        uint64_t generation, poll_state_value_t* v) {
+    assert(device != NULL);
+    assert(option != NULL);
+    assert(v != NULL);
+    bool found = false;
+    poll_state_lock();
+    struct poll_state_entry* e = poll_state_find(device, option);
+    if ((e != NULL) && e->restored && (poll_state_generation == generation) &&
+        (e->record.type == type)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        v->num_value = (unsigned long)e->record.num_value;
+        v->has_str = (e->record.has_str != 0);
+        strcpy(v->str_value, e->record.str_value);
+        v->idle = (int)(now.tv_sec - e->changed.tv_sec);
+        found = true;
+    }
+    poll_state_unlock();
+    return found;
+}
+
+void poll_state_restored(const char* device) {
+    assert(device != NULL);
+    poll_state_lock();
+    for(int i = 0; i < poll_state_count; ) {
+        struct poll_state_entry* e = &poll_state_entries[i];
+        if (e->restored && (strcmp(e->record.device, device) == 0)) {
+            // the last entry moves to i
+            poll_state_drop(e);
+            continue;
+        }
+        i += 1;
+    }
+    poll_state_unlock();
+}
+
+void poll_state_forget(const char* device) {
+    assert(device != NULL);
+    poll_state_lock();
+    for(int i = 0; i < poll_state_count; ) {
+        struct poll_state_entry* e = &poll_state_entries[i];
+        if (strcmp(e->record.device, device) == 0) {
+            // the last entry moves to i
+            poll_state_drop(e);
+            continue;
+        }
+        i += 1;
+    }
+    poll_state_unlock();
+}
+
+bool poll_state_store(const char* path, uint64_t generation, bool force) {
+    assert(path != NULL);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    poll_state_lock();
+    if (!force && !poll_state_dirty &&
+        (now.tv_sec - poll_state_written.tv_sec < POLL_STATE_REFRESH)) {
+        poll_state_unlock();
+        return true;
+    }
+    // a copy of the table: the file is written without the mutex
+    struct poll_state_record* records = NULL;
+    if (poll_state_count > 0) {
+        records = calloc(poll_state_count, sizeof(struct poll_state_record));
+        if (records == NULL) {
+            poll_state_unlock();
+            slog(SLOG_ERROR, "Can't allocate memory for the poll state");
+            return false;
+        }
+    }
+    struct poll_state_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, POLL_STATE_MAGIC, sizeof(header.magic));
+    header.version = POLL_STATE_VERSION;
+    header.count = 0;
+    header.generation = generation;
+    header.saved = (int64_t)time(NULL);
+    for(int i = 0; i < poll_state_count; i += 1) {
+        const struct poll_state_entry* e = &poll_state_entries[i];
+        if (e->restored && (poll_state_generation != generation)) {
+            // loaded for another rule set, the device wasn't opened
+            continue;
+        }
+        // a loaded value of a device not opened since keeps its checkpoint
+        // with the original time of the change
+        records[header.count] = e->record;
+        time_t idle = now.tv_sec - e->changed.tv_sec;
+        records[header.count].idle = (idle > 0) ? (uint32_t)idle : 0;
+        header.count += 1;
+    }
+    poll_state_dirty = false;
+    poll_state_written = now;
+    poll_state_unlock();
+
+    bool ok = false;
+    char tmp[PATH_MAX];
+    FILE* file = NULL;
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        slog(SLOG_WARN, "poll state path %s too long", path);
+        goto cleanup;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        slog(SLOG_WARN, "Can't create poll state %s: %s", tmp, strerror(errno));
+        goto cleanup;
+    }
+    file = fdopen(fd, "w");
+    if (file == NULL) {
+        slog(SLOG_WARN, "Can't create poll state %s: %s", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        goto cleanup;
+    }
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (ok && (header.count > 0)) {
+        ok = fwrite(records, sizeof(struct poll_state_record), header.count, file) == header.count;
+    }
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        slog(SLOG_WARN, "Can't write poll state %s: %s", tmp, strerror(errno));
+        unlink(tmp);
+        goto cleanup;
+    }
+    if (rename(tmp, path) < 0) {
+        slog(SLOG_WARN, "Can't replace poll state %s: %s", path, strerror(errno));
+        unlink(tmp);
+        ok = false;
+        goto cleanup;
+    }
+    slog(SLOG_DEBUG, "stored %u values in the poll state %s", header.count, path);
+cleanup:
+    // a failed write is retried with the next change or refresh
+    free(records);
+    return ok;
+}
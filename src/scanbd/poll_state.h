@@ -0,0 +1,95 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef POLL_STATE_H
+#define POLL_STATE_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+// the checkpoint of the pollers: the before-values of the options
+// bound to actions (per device and option name) and the time of their
+// last change are kept in a table, the reactor writes it to a small
+// file of fixed size records (next to the device cache) together with
+// the generation of the rule set (see cfg_rules_t). A restarted daemon
+// takes the before-values of a checkpoint of the same rule set that
+// isn't older than POLL_STATE_MAX_AGE: a button pressed or held during
+// the restart triggers once (and only once), an idle device parks
+// again without a new park_idle period. The handles don't survive a
+// restart, each device is opened again.
+
+#define POLL_STATE_MAGIC "SCANBDPS"
+#define POLL_STATE_VERSION 1
+
+#define POLL_STATE_NAME_MAX 256
+#define POLL_STATE_OPTION_MAX 64
+#define POLL_STATE_STRING_MAX 128
+
+// the number of options checkpointed
+#define POLL_STATE_RECORDS 1024
+// s: an older checkpoint is ignored (the daemon was down too long)
+#define POLL_STATE_MAX_AGE 300
+// ms: a changed table is written within this time
+#define POLL_STATE_TICK 1000
+// s: an unchanged table is rewritten after this time, so the
+// checkpoint of a running daemon never gets too old
+#define POLL_STATE_REFRESH 60
+
+// a restored before-value
+struct poll_state_value {
+    unsigned long num_value;
+    bool has_str;                         // str_value is valid
+    char str_value[POLL_STATE_STRING_MAX];
+    int idle;                             // s since the last change
+};
+typedef struct poll_state_value poll_state_value_t;
+
+// loads the checkpoint file path written for the rule set generation,
+// its values are offered by poll_state_restore()
+extern void poll_state_load(const char* path, uint64_t generation);
+
+// the before-value of the option of device changed: type is the
+// SANE_Value_Type, str_value NULL for a numerical option, changed the
+// time of the change (CLOCK_MONOTONIC, NULL: now)
+// a string too long for the checkpoint drops the option from it
+extern void poll_state_update(const char* device, const char* option, int type,
+                              unsigned long num_value, const char* str_value,
+                              const struct timespec* changed);
+
+// the loaded before-value of the option of device into v, false if
+// there is none for the option (of type) and the rule set generation
+extern bool poll_state_restore(const char* device, const char* option, int type,
+                               uint64_t generation, poll_state_value_t* v);
+// the loaded values of device are used (or outdated)
+extern void poll_state_restored(const char* device);
+
+// the device is gone, its options are dropped from the checkpoint
+extern void poll_state_forget(const char* device);
+
+// writes the checkpoint to path if the table changed or force is set
+// (or the last write is POLL_STATE_REFRESH s old)
+// returns false on errors
+extern bool poll_state_store(const char* path, uint64_t generation, bool force);
+
+#endif // POLL_STATE_H
@@ -0,0 +1,231 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "predicate.h"
+
+// the metacharacters of extended regular expressions
+#define PREDICATE_META ".[]()*+?{}|^$\\"
+
+bool predicate_match_compile(predicate_match_t* m, const char* pattern) {
+    assert(m != NULL);
+    assert(pattern != NULL);
+    m->pattern = pattern;
+    size_t len = strlen(pattern);
+    const char* literal = pattern;
+    bool prefix = false;
+    bool exact = false;
+    if ((len > 0) && (literal[0] == '^')) {
+        prefix = true;
+        literal += 1;
+        len -= 1;
+    }
+    if (prefix && (len > 0) && (literal[len - 1] == '$') &&
+        ((len < 2) || (literal[len - 2] != '\\'))) {
+        exact = true;
+        len -= 1;
+    }
+    if (strcspn(literal, PREDICATE_META) >= len) {
+        m->literal = literal;
+        m->len = len;
+        if (exact) {
+            m->kind = PREDICATE_MATCH_EXACT;
+        }
+        else if (prefix) {
+            m->kind = PREDICATE_MATCH_PREFIX;
+        }
+        else if (len == 0) {
+            m->kind = PREDICATE_MATCH_ANY;
+        }
+        else {
+            m->kind = PREDICATE_MATCH_SUBSTR;
+        }
+        return true;
+    }
+    m->kind = PREDICATE_MATCH_REGEX;
+    m->literal = NULL;
+    m->len = 0;
+    int ret = regcomp(&m->reg, pattern, REG_EXTENDED | REG_NOSUB);
+    if (ret != 0) {
+        char err_text[1024];
+        regerror(ret, &m->reg, err_text, 1024);
+        slog(SLOG_WARN, "Can't compile regex: %s : %s", pattern, err_text);
+        return false;
+    }
+    return true;
+}
+
+void predicate_match_free(predicate_match_t* m) {
+    assert(m != NULL);
+    if (m->kind == PREDICATE_MATCH_REGEX) {
+        regfree(&m->reg);
+    }
+}
+
+bool predicate_match(const predicate_match_t* m, const char* s) {
+    assert(m != NULL);
+    assert(s != NULL);
+    switch(m->kind) {
+    case PREDICATE_MATCH_ANY:
+        return true;
+    case PREDICATE_MATCH_SUBSTR:
+        return strstr(s, m->literal) != NULL;
+    case PREDICATE_MATCH_PREFIX:
+        return strncmp(s, m->literal, m->len) == 0;
+    case PREDICATE_MATCH_EXACT:
+        return (strncmp(s, m->literal, m->len) == 0) && (s[m->len] == '\0');
+    case PREDICATE_MATCH_REGEX:
+        return regexec(&m->reg, s, 0, NULL, 0) == 0;
+    }
+    return false;
+}
+
+void predicate_set_ranges(predicate_t* p, long from, long from_max, long to, long to_max) {
+    assert(p != NULL);
+    p->from_min = from;
+    p->from_max = (from_max < from) ? from : from_max;
+    p->to_min = to;
+    p->to_max = (to_max < to) ? to : to_max;
+}
+
+static bool predicate_str_equal(const char* a, const char* b) {
+    if ((a == NULL) || (b == NULL)) {
+        return a == b;
+    }
+    return strcmp(a, b) == 0;
+}
+
+bool predicate_equal(const predicate_t* a, const predicate_t* b) {
+    assert(a != NULL);
+    assert(b != NULL);
+    return (a->from_min == b->from_min) && (a->from_max == b->from_max) &&
+        (a->to_min == b->to_min) && (a->to_max == b->to_max) &&
+        (a->str_valid == b->str_valid) &&
+        predicate_str_equal(a->str_from.pattern, b->str_from.pattern) &&
+        predicate_str_equal(a->str_to.pattern, b->str_to.pattern) &&
+        (a->level == b->level) && (a->debounce == b->debounce) &&
+        (a->hold == b->hold);
+}
+
+unsigned int predicate_classify_num(const predicate_t* p, long value) {
+    assert(p != NULL);
+    unsigned int cls = 0;
+    if ((value >= p->from_min) && (value <= p->from_max)) {
+        cls |= PREDICATE_FROM;
+    }
+    if ((value >= p->to_min) && (value <= p->to_max)) {
+        cls |= PREDICATE_TO;
+    }
+    return cls;
+}
+
+unsigned int predicate_classify_str(const predicate_t* p, const char* value) {
+    assert(p != NULL);
+    unsigned int cls = 0;
+    if ((value == NULL) || !p->str_valid) {
+        return cls;
+    }
+    if (predicate_match(&p->str_from, value)) {
+        cls |= PREDICATE_FROM;
+    }
+    if (predicate_match(&p->str_to, value)) {
+        cls |= PREDICATE_TO;
+    }
+    return cls;
+}
+
+void predicate_state_init(predicate_state_t* s, unsigned int cls) {
+    assert(s != NULL);
+    s->stable = cls;
+    s->pending = cls;
+    s->armed = false;
+    s->latched = (cls & PREDICATE_TO) != 0;
+}
+
+// the ms from start to now
+static long predicate_ms(const struct timespec* start, const struct timespec* now) {
+    return (now->tv_sec - start->tv_sec) * 1000L +
+        (now->tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+bool predicate_eval(const predicate_t* p, predicate_state_t* s,
+                    unsigned int cls, const struct timespec* now) {
+    assert(p != NULL);
+    assert(s != NULL);
+    assert(now != NULL);
+    unsigned int before = s->stable;
+
+    // a new class is taken after it lasted the debounce time, a bounce
+    // back to the stable class cancels it
+    if (cls == s->stable) {
+        s->pending = cls;
+    }
+    else {
+        if (cls != s->pending) {
+            s->pending = cls;
+            s->pending_since = *now;
+        }
+        if (predicate_ms(&s->pending_since, now) >= p->debounce) {
+            s->stable = cls;
+        }
+    }
+
+    bool to = (s->stable & PREDICATE_TO) != 0;
+    bool edge = false;
+    if (p->level) {
+        if (!to) {
+            s->latched = false;
+        }
+        edge = to && !s->latched;
+    }
+    else {
+        edge = ((before & PREDICATE_FROM) != 0) && to;
+    }
+    if (!to) {
+        s->armed = false;
+        return false;
+    }
+    if (edge && !s->armed) {
+        s->armed = true;
+        s->armed_since = *now;
+    }
+    if (!s->armed || (predicate_ms(&s->armed_since, now) < p->hold)) {
+        return false;
+    }
+    s->armed = false;
+    s->latched = true;
+    return true;
+}
+
+bool predicate_settled(const predicate_t* p, const predicate_state_t* s) {
+    assert(p != NULL);
+    assert(s != NULL);
+    if ((s->pending != s->stable) || s->armed) {
+        // debouncing or holding
+        return false;
+    }
+    if (p->level) {
+        return ((s->stable & PREDICATE_TO) == 0) || s->latched;
+    }
+    // a class meeting both conditions fires at each evaluation
+    return (s->stable & (PREDICATE_FROM | PREDICATE_TO)) != (PREDICATE_FROM | PREDICATE_TO);
+}
@@ -0,0 +1,113 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include "common.h"
+#include <regex.h>
+
+// the compiled trigger of an action: the value ranges of the
+// numerical-trigger, the string matchers of the string-trigger, the
+// mode and the debounce and hold time. A poller classifies each polled
+// value by the conditions it meets (predicate_classify_*()) and feeds
+// the class to predicate_eval(), which keeps the state of the option.
+
+// the classes of a value (or-ed)
+#define PREDICATE_FROM 0x1      // meets the from-condition
+#define PREDICATE_TO   0x2      // meets the to-condition
+
+enum predicate_match_kind {
+    PREDICATE_MATCH_ANY,        // empty pattern, matches all strings
+    PREDICATE_MATCH_SUBSTR,     // no metacharacters: a substring
+    PREDICATE_MATCH_PREFIX,     // ^literal
+    PREDICATE_MATCH_EXACT,      // ^literal$
+    PREDICATE_MATCH_REGEX       // all other patterns
+};
+
+// a string matcher with the semantics of regexec() of the (extended)
+// pattern, literal patterns are compared without the regex engine
+struct predicate_match {
+    const char* pattern;        // the pattern (of the config)
+    enum predicate_match_kind kind;
+    const char* literal;        // the literal part of the pattern
+    size_t len;                 // and its length
+    regex_t reg;                // PREDICATE_MATCH_REGEX: compiled
+};
+typedef struct predicate_match predicate_match_t;
+
+struct predicate {
+    long from_min;              // numerical-trigger from-value range
+    long from_max;              // (signed: a range may be negative)
+    long to_min;                // numerical-trigger to-value range
+    long to_max;
+    predicate_match_t str_from; // string-trigger from-value
+    predicate_match_t str_to;   // string-trigger to-value
+    bool str_valid;             // both string matchers compiled
+    bool level;                 // level mode: fires once if the
+    // to-condition holds (edge mode: at the change from the from- to
+    // the to-condition)
+    int debounce;               // ms a new class has to last until
+    // it is taken
+    int hold;                   // ms the to-condition has to last
+    // until the action fires
+};
+typedef struct predicate predicate_t;
+
+// the evaluation state of an option
+struct predicate_state {
+    unsigned int stable;        // the (debounced) class
+    unsigned int pending;       // the class being debounced
+    struct timespec pending_since;
+    bool armed;                 // the to-condition holds since armed_since
+    struct timespec armed_since;
+    bool latched;               // level mode: fired for this level
+};
+typedef struct predicate_state predicate_state_t;
+
+// compiles the pattern, on error a warning is logged and false returned
+extern bool predicate_match_compile(predicate_match_t* m, const char* pattern);
+extern void predicate_match_free(predicate_match_t* m);
+extern bool predicate_match(const predicate_match_t* m, const char* s);
+
+// sets the ranges [from, from_max] and [to, to_max], a maximum below
+// the value makes the range the single value
+extern void predicate_set_ranges(predicate_t* p, long from, long from_max,
+                                 long to, long to_max);
+// false if both predicates don't trigger the same way
+extern bool predicate_equal(const predicate_t* a, const predicate_t* b);
+
+// value is signed (a SANE_Word with its sign)
+extern unsigned int predicate_classify_num(const predicate_t* p, long value);
+// a NULL string meets no condition
+extern unsigned int predicate_classify_str(const predicate_t* p, const char* value);
+
+// the option has the class of its before-value
+extern void predicate_state_init(predicate_state_t* s, unsigned int cls);
+// takes the class of the actual value, returns true if the action fires
+extern bool predicate_eval(const predicate_t* p, predicate_state_t* s,
+                           unsigned int cls, const struct timespec* now);
+// true if the action can't fire as long as the value (class) doesn't
+// change: the poller may skip predicate_eval() then
+extern bool predicate_settled(const predicate_t* p, const predicate_state_t* s);
+
+#endif // PREDICATE_H
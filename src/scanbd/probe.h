@@ -0,0 +1,76 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef PROBE_H
+#define PROBE_H
+
+// the static tracepoints (USDT, provider scanbd) of the hot paths:
+// with the systemtap sdt.h each probe is a single nop and a note in
+// the ELF file, bpftrace / perf / stap attach to them at runtime, e.g.
+//
+//     bpftrace -e 'usdt:/usr/sbin/scanbd:scanbd:poll__end { ... }'
+//
+// the probes are compiled in where <sys/sdt.h> is found (Linux, the
+// systemtap-sdt-dev package), SCANBD_NO_USDT (configure --disable-usdt,
+// NO_USDT in Makefile.conf) leaves them out.
+//
+// the probes (arguments):
+//  poll__start (device)              a poll cycle of a poller begins
+//  poll__end (device, delay)         ... ends, the next one in delay ms
+//  option__start (device, option)    a backend query of an option
+//  option__end (device, option, value)
+//                                    ... the numeric value
+//  options__changed (device, count)
+//                                    count options of the device were
+//                                    (de)activated and are rebound
+//  button__start (device)            a backend query of the buttons
+//  button__end (device, pressed)     ... the number of pressed buttons
+//  trigger (device, action)          an action was triggered
+//  spawn (script, pid)               a script was started (pid < 0: failed)
+//  wait (pid, status)                ... has ended (waitpid status)
+//  dbus__message (interface, member) a dbus method call is dispatched
+//  udev__receive (action, devnode)   udev reported a device event
+//  scanbm__ready (usec)              scanbm forks saned, usec after its
+//                                    start (a pool worker: the accept)
+
+#if !defined(SCANBD_NO_USDT) && defined(__linux__) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define SCANBD_USDT 1
+# endif
+#endif
+
+#ifdef SCANBD_USDT
+# define SCANBD_PROBE1(name, a1) \
+    DTRACE_PROBE1(scanbd, name, a1)
+# define SCANBD_PROBE2(name, a1, a2) \
+    DTRACE_PROBE2(scanbd, name, a1, a2)
+# define SCANBD_PROBE3(name, a1, a2, a3) \
+    DTRACE_PROBE3(scanbd, name, a1, a2, a3)
+#else
+// the arguments aren't evaluated
+# define SCANBD_PROBE1(name, a1) do {} while(0)
+# define SCANBD_PROBE2(name, a1, a2) do {} while(0)
+# define SCANBD_PROBE3(name, a1, a2, a3) do {} while(0)
+#endif
+
+#endif // PROBE_H
@@ -0,0 +1,54 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "rcu.h"
+
+// the writer polls the readers count while waiting
+#define RCU_WAIT_NS 50000L
+
+void* rcu_read_lock(rcu_ptr_t* r) {
+    assert(r != NULL);
+    // announced before the load: a writer replacing the value after
+    // the load sees this reader
+    atomic_fetch_add(&r->readers, 1);
+    return atomic_load(&r->value);
+}
+
+void rcu_read_unlock(rcu_ptr_t* r) {
+    assert(r != NULL);
+    atomic_fetch_sub(&r->readers, 1);
+}
+
+void* rcu_replace(rcu_ptr_t* r, void* value) {
+    assert(r != NULL);
+    void* old = atomic_exchange(&r->value, value);
+    // a reader of the old value has announced itself before loading
+    // it: once the count drops to zero, no reader holds it anymore
+    // (later readers get the new value)
+    struct timespec wait = {0, RCU_WAIT_NS};
+    while(atomic_load(&r->readers) > 0) {
+        nanosleep(&wait, NULL);
+    }
+    return old;
+}
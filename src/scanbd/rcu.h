@@ -0,0 +1,52 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef RCU_H
+#define RCU_H
+
+#include "common.h"
+#include <stdatomic.h>
+
+// a read-copy-update pointer: the readers load the published value
+// lock-free and never wait, the (single) writer publishes a new value
+// and waits until no reader uses the old one anymore, then it may
+// free it. The readers must not block the writer for long (no waits
+// for other threads between rcu_read_lock() and rcu_read_unlock()).
+// A zero-initialized rcu_ptr_t is valid and publishes NULL.
+
+struct rcu_ptr {
+    _Atomic(void*) value;        // the published value
+    atomic_uint readers;         // the readers of any value
+};
+typedef struct rcu_ptr rcu_ptr_t;
+
+// begins a read, returns the published value (valid until
+// rcu_read_unlock())
+extern void* rcu_read_lock(rcu_ptr_t* r);
+extern void rcu_read_unlock(rcu_ptr_t* r);
+
+// publishes value, returns the old value after the last reader of it
+// has finished
+extern void* rcu_replace(rcu_ptr_t* r, void* value);
+
+#endif // RCU_H
@@ -0,0 +1,284 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "registry.h"
+
+#define REGISTRY_USED (SCANBD_REGISTRY_SIZE / 2)
+
+// an entry is free if name == NULL, removed entries (deleted == true)
+// keep the probe chains intact until they are reused
+struct registry_entry {
+    char* name;
+    bool deleted;
+    unsigned long hash;
+    int number;              // the device number (positional)
+    void* poller;
+    registry_func_t wake;    // of the poller
+    registry_ref_t ref;
+};
+typedef struct registry_entry registry_entry_t;
+
+static registry_entry_t registry[SCANBD_REGISTRY_SIZE];
+
+// the number of registered devices
+static int registry_count = 0;
+
+// the generation of the last registration
+static unsigned int registry_generation = 0;
+
+// the entry of the device numbers which can be triggered (or -1)
+static int registry_numbers[SCANBD_MAILBOX_DEVICES];
+
+// the entry of the mailbox ids in use (or -1)
+static int registry_ids[SCANBD_MAILBOX_DEVICES];
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+static void registry_init(void) {
+    for(int d = 0; d < SCANBD_MAILBOX_DEVICES; d += 1) {
+        registry_numbers[d] = -1;
+        registry_ids[d] = -1;
+    }
+}
+
+// djb2
+static unsigned long registry_hash(const char* str) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *str++)) {
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    }
+    return hash;
+}
+
+// returns the entry of name, or -1
+// the registry_mutex must be held by the caller
+static int registry_find(const char* name, unsigned long hash) {
+    for(int i = 0; i < SCANBD_REGISTRY_SIZE; i += 1) {
+        int e = (hash + i) & (SCANBD_REGISTRY_SIZE - 1);
+        if (registry[e].name == NULL) {
+            if (!registry[e].deleted) {
+                return -1;
+            }
+            continue;
+        }
+        if ((registry[e].hash == hash) && (strcmp(registry[e].name, name) == 0)) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+// the registry_mutex must be held by the caller
+static void registry_set_number(int e, int number) {
+    int old = registry[e].number;
+    if ((old >= 0) && (old < SCANBD_MAILBOX_DEVICES) && (registry_numbers[old] == e)) {
+        registry_numbers[old] = -1;
+    }
+    registry[e].number = number;
+    if ((number >= 0) && (number < SCANBD_MAILBOX_DEVICES)) {
+        registry_numbers[number] = e;
+    }
+}
+
+// the registry_mutex must be held by the caller
+static void registry_free(int e) {
+    registry_set_number(e, -1);
+    if (registry[e].ref.id >= 0) {
+        registry_ids[registry[e].ref.id] = -1;
+    }
+    free(registry[e].name);
+    registry[e].name = NULL;
+    registry[e].deleted = true;
+    registry[e].poller = NULL;
+    registry[e].wake = NULL;
+    registry_count -= 1;
+    if (registry_count == 0) {
+        // no probe chain left to keep
+        for(int i = 0; i < SCANBD_REGISTRY_SIZE; i += 1) {
+            registry[i].deleted = false;
+        }
+    }
+}
+
+void registry_add(const char* name, int number, void* poller,
+                  registry_func_t wake, registry_ref_t* ref) {
+    assert(name != NULL);
+    assert(wake != NULL);
+    assert(ref != NULL);
+    pthread_once(&registry_once, registry_init);
+    ref->id = -1;
+    ref->generation = 0;
+    if (pthread_mutex_lock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    unsigned long hash = registry_hash(name);
+    int e = registry_find(name, hash);
+    if (e >= 0) {
+        slog(SLOG_DEBUG, "device %s registered again", name);
+        registry_free(e);
+    }
+    if (registry_count >= REGISTRY_USED) {
+        slog(SLOG_WARN, "Can't register device %s (max %d devices)", name, REGISTRY_USED);
+        goto cleanup;
+    }
+    for(int i = 0; i < SCANBD_REGISTRY_SIZE; i += 1) {
+        e = (hash + i) & (SCANBD_REGISTRY_SIZE - 1);
+        if (registry[e].name == NULL) {
+            break;
+        }
+    }
+    if ((registry[e].name = strdup(name)) == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the device registry");
+        goto cleanup;
+    }
+    registry[e].deleted = false;
+    registry[e].hash = hash;
+    registry[e].number = -1;
+    registry[e].poller = poller;
+    registry[e].wake = wake;
+    registry[e].ref.id = -1;
+    registry[e].ref.generation = ++registry_generation;
+    for(int d = 0; d < SCANBD_MAILBOX_DEVICES; d += 1) {
+        if (registry_ids[d] < 0) {
+            registry_ids[d] = e;
+            registry[e].ref.id = d;
+            break;
+        }
+    }
+    if (registry[e].ref.id < 0) {
+        slog(SLOG_WARN, "Device %s can't be triggered (max %d devices)",
+             name, SCANBD_MAILBOX_DEVICES);
+    }
+    registry_count += 1;
+    registry_set_number(e, number);
+    *ref = registry[e].ref;
+    slog(SLOG_DEBUG, "registered device %s (number %d, mailbox %d, generation %u)",
+         name, number, ref->id, ref->generation);
+cleanup:
+    if (pthread_mutex_unlock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void registry_renumber(const char* name, int number) {
+    assert(name != NULL);
+    pthread_once(&registry_once, registry_init);
+    if (pthread_mutex_lock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    int e = registry_find(name, registry_hash(name));
+    if (e >= 0) {
+        registry_set_number(e, number);
+    }
+    if (pthread_mutex_unlock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void registry_remove(const char* name) {
+    assert(name != NULL);
+    pthread_once(&registry_once, registry_init);
+    if (pthread_mutex_lock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    int e = registry_find(name, registry_hash(name));
+    if (e >= 0) {
+        registry_free(e);
+    }
+    if (pthread_mutex_unlock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void* registry_lookup(const char* name, registry_func_t wake, registry_ref_t* ref) {
+    assert(name != NULL);
+    pthread_once(&registry_once, registry_init);
+    void* poller = NULL;
+    if (pthread_mutex_lock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return NULL;
+    }
+    int e = registry_find(name, registry_hash(name));
+    if ((e >= 0) && ((wake == NULL) || (registry[e].wake == wake))) {
+        poller = registry[e].poller;
+        if (ref != NULL) {
+            *ref = registry[e].ref;
+        }
+    }
+    if (pthread_mutex_unlock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return poller;
+}
+
+bool registry_resolve(int number, registry_ref_t* ref) {
+    assert(ref != NULL);
+    pthread_once(&registry_once, registry_init);
+    bool found = false;
+    if ((number < 0) || (number >= SCANBD_MAILBOX_DEVICES)) {
+        return false;
+    }
+    if (pthread_mutex_lock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    int e = registry_numbers[number];
+    if (e >= 0) {
+        *ref = registry[e].ref;
+        found = true;
+    }
+    if (pthread_mutex_unlock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return found;
+}
+
+// the registration is indexed by its mailbox id: the registration of
+// the id with the generation of ref is the one of ref
+bool registry_wake(const registry_ref_t* ref) {
+    assert(ref != NULL);
+    pthread_once(&registry_once, registry_init);
+    bool found = false;
+    if ((ref->id < 0) || (ref->id >= SCANBD_MAILBOX_DEVICES)) {
+        return false;
+    }
+    if (pthread_mutex_lock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    int e = registry_ids[ref->id];
+    if ((e >= 0) && (registry[e].ref.generation == ref->generation)) {
+        registry[e].wake(registry[e].poller);
+        found = true;
+    }
+    if (pthread_mutex_unlock(&registry_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return found;
+}
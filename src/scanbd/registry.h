@@ -0,0 +1,84 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "common.h"
+#include "mailbox.h"
+
+// the device registry: a hash table keyed by the device name (the sane
+// device name, with scanbuttond the sane device descriptor holding the
+// usb location) mapping a device to its poller and its mailbox id. A
+// device keeps its mailbox id as long as it is registered, whatever
+// number a rediscovery gives it. Each registration gets a new
+// generation: a trigger posted for a removed device is dropped even if
+// the next device gets the same mailbox id.
+
+// the size of the hash table (a power of 2), at most half of it is used
+#define SCANBD_REGISTRY_SIZE 128
+
+struct registry_ref {
+    int id;                  // the mailbox id (-1: not triggerable)
+    unsigned int generation; // the generation of the registration
+};
+typedef struct registry_ref registry_ref_t;
+
+// wakes the poller up after a remote trigger (see registry_wake()),
+// called with the registry locked: it must not wait for a poller busy
+// in a backend call
+typedef void (*registry_func_t)(void* poller);
+
+// registers the poller of the device name with the device number and
+// its wake function and fills ref (a registered name is registered
+// again: the name must be unique per device, identical scanners of
+// scanbuttond get the device number appended), the pollers of sane
+// and scanbuttond share the registry (see SCANBD_HYBRID): the wake
+// function tells them apart
+extern void registry_add(const char* name, int number, void* poller,
+                         registry_func_t wake, registry_ref_t* ref);
+// the device name has the device number after a rediscovery
+extern void registry_renumber(const char* name, int number);
+extern void registry_remove(const char* name);
+// returns the poller of the device name registered with wake (any
+// poller if wake is NULL) or NULL and fills ref (if not NULL)
+extern void* registry_lookup(const char* name, registry_func_t wake, registry_ref_t* ref);
+// fills ref with the registration of the device number, returns false
+// if there is no such device
+extern bool registry_resolve(int number, registry_ref_t* ref);
+
+// the result of parking (or resuming) the poller of a device name for
+// saned (see sane_acquire_device())
+enum registry_park {
+    REGISTRY_PARK_NONE,   // no poller polls the device
+    REGISTRY_PARK_DONE,   // parked (resumed)
+    REGISTRY_PARK_STUCK   // the poller is stuck in a backend call and
+    // still holds its device
+};
+typedef enum registry_park registry_park_t;
+
+// calls the wake function of the registration ref after a remote
+// trigger, the poller can't be removed meanwhile
+// returns false if there is no such registration
+extern bool registry_wake(const registry_ref_t* ref);
+
+#endif // REGISTRY_H
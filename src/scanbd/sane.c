@@ -22,8 +22,23 @@
 
 #include "scanbd.h"
 #include "scanbd_dbus.h"
-
-#define CANCEL_TEST
+#include "scheduler.h"
+#include "action.h"
+#include "script_env.h"
+#include "mailbox.h"
+#include "registry.h"
+#include "stats.h"
+#include "device_cache.h"
+#include "poll_state.h"
+#include "rcu.h"
+#include "poll_helper.h"
+#include "status_page.h"
+#include "metrics.h"
+#include "probe.h"
+#ifdef SCANBD_HYBRID
+# include "scanbuttond_wrapper.h"
+#endif
+#include <stdatomic.h>
 
 // all programm-global sane functions use this mutex to avoid races
 #ifdef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
@@ -35,11 +50,22 @@ static pthread_mutex_t sane_mutex;
 
 static pthread_cond_t  sane_cv    = PTHREAD_COND_INITIALIZER;
 
+// guards the stopped flags of the polling threads, signaled if a
+// polling thread has ended (see sane_thread_destroy())
+static pthread_mutex_t sane_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  sane_stop_cv    = PTHREAD_COND_INITIALIZER;
+// the number of abandoned pollers still stuck in a backend call
+// (guarded by the sane_stop_mutex): SANE must not be left meanwhile
+static int sane_stuck = 0;
+
 // the following locking strategie must be obeyed:
 // 1) lock the sane_mutex
-// 2) lock the device specific mutex
+// 2) take the I/O token of the device (see sane_io_enter())
+// 3) lock the device specific mutex
 // in this order to avoid deadlocks
-// holding more than these two locks is not intended
+// the device specific mutex is only held for short state transitions,
+// never during backend I/O (the holder of the I/O token does the I/O)
+// the readers of the poller list don't lock at all (see sane_pollers)
 
 #ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
 void sane_init_mutex()
@@ -61,26 +87,26 @@ void sane_init_mutex()
 }
 #endif
 
+// the buffer of a string value is kept across the poll cycles: an
+// unchanged value costs no allocation
 struct sane_opt_value {    
-    unsigned long num_value; // before-value or after-value or actual-value (BOOL|INT|FIXED)
+    unsigned long num_value; // actual-value (BOOL|INT|FIXED)
     struct {                 // (STRING)
-        char*     str;       // actual-value
-        regex_t*  reg;       // before-regex or after-regex
+        char*     str;       // actual-value (NULL or buf)
+        char*     buf;       // the buffer
+        size_t    size;      // and its size
     } str_value;
 };
 typedef struct sane_opt_value sane_opt_value_t;
 
 struct sane_dev_option {
     int number;                  // the option-number of the device-option
-    sane_opt_value_t from_value; // the before-value of the option
-    sane_opt_value_t to_value;   // the after-value of the option (to
-    // fire the trigger)
+    const cfg_rule_action_t* rule; // the matched (compiled) action with
+    // the trigger values and the script to be called if the
+    // option-value changes
     sane_opt_value_t value;      // the option value (from the last
     // polling cycle)
-    const char* script;          // the found (matched) script to be called if
-    // the option-valued changes
-    const char* action_name;	 // the name of this action as
-    // specified in the config file
+    predicate_state_t state;     // the evaluation state of the rule
 };
 typedef struct sane_dev_option sane_dev_option_t;
 
@@ -92,8 +118,46 @@ struct sane_dev_function {
 };
 typedef struct sane_dev_function sane_dev_function_t;
 
+// the part of an option descriptor the actions and functions are
+// matched against: unlike the descriptors it survives the release of
+// the device, so the rules can be rebound at any time (see reload)
+struct sane_opt_info {
+    bool valid;                  // the option had a descriptor
+    char* name;                  // the option name (copy) or NULL
+    SANE_Value_Type type;
+    SANE_Int cap;
+    bool changed;                // rebound by sane_poll_refresh()
+};
+typedef struct sane_opt_info sane_opt_info_t;
+
+// a block of memory the tables of the matched actions and functions
+// are allocated from: it is reset instead of freed, so a rebuild of
+// the tables only goes to the allocator if they need more space
+struct sane_arena {
+    char* block;
+    size_t size;                 // the size of the block
+    size_t used;                 // the allocated bytes
+};
+typedef struct sane_arena sane_arena_t;
+
+// the tables of a device live in one of two arenas: a rebind builds
+// the new tables in the other one while the old tables are still
+// needed for the before-values
+// when the poller ends, the tables go to sane_tables_pool for the next
+// poller (a stop/start cycle reuses the arenas of the stopped pollers)
+struct sane_tables {
+    sane_arena_t arena[2];
+    int active;                  // the arena holding opts and functions
+    struct sane_tables* next;    // in the pool
+};
+typedef struct sane_tables sane_tables_t;
+
 // each polling thread is represented by struct sane_thread
-// there is no locking, since this is "thread private data"
+// the device, the tables and the poll state are used by the holder
+// of the I/O token only (the critical region of *st): the poller
+// during a step, a reload or a park of saned. The mutex only guards
+// the token and the requests to the poller (woken, resume), so a
+// wake-up never waits for a slow backend call
 struct sane_thread {
     pthread_t tid;                   // the thread-id of the polling
     // thread
@@ -101,30 +165,314 @@ struct sane_thread {
     pthread_cond_t cv;		     // cv for this data-structure
     bool triggered;		     // a rule for this device has fired (triggered == true)
     int  triggered_option;           // the action number which triggered
-    const SANE_Device* dev;          // the device
+    const SANE_Device* dev;          // the device (points to device)
+    SANE_Device device;              // private copy of the device
+    // description, the list of sane_get_devices() doesn't survive a
+    // rescan
     int num_of_options;	             // the number of all options for
     // this device
+    const SANE_Option_Descriptor** descs; // the option descriptors
+    // (indexed by option number), valid until the device is closed
+    sane_opt_info_t* infos;          // the names, types and caps of the
+    // options (indexed by option number), valid until the thread ends
+    sane_opt_value_t* snapshot;      // the option values of the actual
+    // poll cycle (indexed by option number)
+    unsigned long* snapshot_cycle;   // the cycle snapshot[i] was fetched in
+    unsigned long cycle;             // the number of the actual poll cycle
+    bool options_changed;            // the descriptors may have changed:
+    // the device was reopened or the backend reported a changed option
+    // set (see sane_poll_refresh())
+    unsigned int state_gen;          // the generation of the button_state
+    // subscriptions all values were sent to (see dbus_state_generation())
     SANE_Handle h;                   // the handle of the opened device
+    poll_helper_t* helper;           // the helper process making the
+    // backend calls, or NULL (see C_POLL_HELPER)
+    sane_tables_t* tables;           // the memory of opts and functions
     sane_dev_option_t *opts;         // the list of matched actions
     // for this device
     int num_of_options_with_scripts; // the number of elements in the
     // above list
+    int opts_capacity;               // the allocated elements of opts
     sane_dev_function_t *functions;  // the list of matched functions
     // for this device
     int num_of_options_with_functions;// the number of elements in the
     // above list
+    int functions_capacity;          // the allocated elements of functions
+    poll_interval_t interval;        // the (adaptive) polling interval
+    bool scheduled;                  // polled by the poll scheduler
+    // instead of an own thread
+    bool opened;                     // device opened and options matched
+    poll_job_t job;                  // scheduler: the job record
+    action_queue_t actions;          // the queued action scripts
+    script_env_t env;                // the environment of the scripts
+    atomic_int index;                // the device number (positional,
+    // renumbered without the I/O token, see update_sane_threads())
+    registry_ref_t ref;              // the mailbox id and generation of
+    // the device (see registry.h)
+    bool keep_open;                  // the device isn't released to the
+    // action scripts (see C_KEEP_OPEN)
+    bool read_resets;                // a read resets the value in the
+    // backend (see C_READ_RESETS)
+    int poll_rate;                   // the reads per s the backend
+    // takes, 0: no limit (see C_POLL_RATE)
+    unsigned int reads;              // the option reads since the last
+    // charge of the budget (see sane_budget())
+    struct timespec budget;          // the next cycle may read the
+    // device (CLOCK_MONOTONIC)
+    cfg_priority_t priority;         // the priority class (see C_PRIORITY)
+    cpu_policy_t policy;             // the cpus and scheduling of the
+    // polling thread (see C_POLL_CPUS)
+    stats_device_t* stats;           // the latency statistics
+    status_device_t* status;         // the record on the status page
+    struct timespec due;             // the next poll is due (jitter)
+    bool parked;                     // the device is used by saned,
+    // closed and not polled until released (see sane_acquire_device())
+    bool woken;                      // the sleep of the polling thread
+    // ends (see sane_wake())
+    bool resume;                     // an idle parked device resumes
+    // with the next step (see sane_wake())
+    bool io_busy;                    // the I/O token is taken (see
+    // sane_io_enter())
+    atomic_bool stop;                // the poller should end (read
+    // without the mutex, see sane_thread_stop())
+    bool stopped;                    // the polling thread has ended
+    // (guarded by the sane_stop_mutex)
+    bool abandoned;                  // the poller was stuck at its stop
+    // and is leaked (guarded by the sane_stop_mutex)
 };
 typedef struct sane_thread sane_thread_t;
 
-// the list of all polling threads
-static sane_thread_t* sane_poll_threads = NULL;
+// the tables of the ended pollers (guarded by the sane_mutex)
+static sane_tables_t* sane_tables_pool = NULL;
+
+// the list of all polling threads (same order as sane_device_list)
+static sane_thread_t** sane_poll_threads = NULL;
 
 // the list of all devices locally connected to our system
 static const SANE_Device** sane_device_list = NULL;
 
+// the list sane_device_list is made of (see sane_polled_devices()):
+// a list of sane or of the device cache
+static const SANE_Device** sane_device_source = NULL;
+
 // the number of devices = the number of polling threads
 static int num_devices = 0;
 
+// the device list loaded from the device cache, until it is replaced
+// by the list of a discovery
+static const SANE_Device** sane_cached_list = NULL;
+
+// the published snapshot of the running pollers: the readers (e.g.
+// the udev filter, see sane_usb_device()) don't take the sane_mutex,
+// so they don't wait for a start, stop or rescan (see rcu.h)
+struct sane_pollers {
+    int count;                       // the number of pollers
+    sane_thread_t* st[];             // the pollers
+};
+typedef struct sane_pollers sane_pollers_t;
+
+static rcu_ptr_t sane_pollers;
+
+// publishes the n pollers (NULL entries are skipped), the replaced
+// snapshot is freed after its last reader
+// the sane_mutex must be held by the caller, the pollers of a
+// replaced snapshot must not be destroyed before
+static void sane_publish(sane_thread_t* const* threads, int n) {
+    sane_pollers_t* p = NULL;
+    if (n > 0) {
+        p = malloc(sizeof(sane_pollers_t) + (size_t)n * sizeof(sane_thread_t*));
+        if (p == NULL) {
+            slog(SLOG_ERROR, "Can't allocate memory for the poller snapshot");
+            exit(EXIT_FAILURE);
+        }
+        p->count = 0;
+        for(int i = 0; i < n; i += 1) {
+            if (threads[i] != NULL) {
+                p->st[p->count] = threads[i];
+                p->count += 1;
+            }
+        }
+    }
+    free(rcu_replace(&sane_pollers, p));
+}
+
+// the sane_mutex must be held by the caller
+static void sane_cache_release(void) {
+    if ((sane_cached_list != NULL) && (sane_device_source != sane_cached_list)) {
+        device_cache_free(sane_cached_list);
+        sane_cached_list = NULL;
+    }
+}
+
+// the device number of the poller at index: in hybrid mode the sane
+// devices are numbered after the devices of scanbuttond
+static int sane_number(int index) {
+#ifdef SCANBD_HYBRID
+    return scbtn_device_count() + index;
+#else
+    return index;
+#endif
+}
+
+// the devices of list to be polled by sane: in hybrid mode a NULL
+// terminated copy of list without the devices polled by scanbuttond
+// (see scbtn_claims_device()), otherwise list itself
+static const SANE_Device** sane_polled_devices(const SANE_Device** list) {
+#ifdef SCANBD_HYBRID
+    if (list == NULL) {
+        return NULL;
+    }
+    int n = 0;
+    while(list[n] != NULL) {
+        n += 1;
+    }
+    const SANE_Device** polled = calloc(n + 1, sizeof(const SANE_Device*));
+    if (polled == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the device list");
+        exit(EXIT_FAILURE);
+    }
+    int k = 0;
+    for(int i = 0; i < n; i += 1) {
+        if (scbtn_claims_device(list[i]->name)) {
+            slog(SLOG_INFO, "device %s is polled by scanbuttond", list[i]->name);
+            continue;
+        }
+        polled[k] = list[i];
+        k += 1;
+    }
+    return polled;
+#else
+    return list;
+#endif
+}
+
+// makes polled (see sane_polled_devices()) of source the devices of
+// the pollers
+// the sane_mutex must be held by the caller
+static void sane_devices_set(const SANE_Device** source, const SANE_Device** polled) {
+    if (sane_device_list != sane_device_source) {
+        free(sane_device_list);
+    }
+    sane_device_source = source;
+    sane_device_list = polled;
+    num_devices = 0;
+    while((polled != NULL) && (polled[num_devices] != NULL)) {
+        num_devices += 1;
+    }
+}
+
+// stores the discovered devices in the device cache (if configured)
+static void sane_cache_store(const SANE_Device** list) {
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    const char* path = cfg_getstr(cfg_sec_global, C_DEVICE_CACHE);
+    if ((path == NULL) || (*path == '\0')) {
+        return;
+    }
+    device_cache_store(path, list);
+}
+
+// uses the devices of the device cache instead of a discovery: the
+// pollers can be started at once, verify_sane_devices() has to follow
+// returns false if there is no (valid) cache
+bool get_sane_cached_devices(void) {
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    const char* path = cfg_getstr(cfg_sec_global, C_DEVICE_CACHE);
+    if ((path == NULL) || (*path == '\0')) {
+        return false;
+    }
+
+    if (pthread_mutex_lock(&sane_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    bool found = false;
+    int count = 0;
+    const SANE_Device** list = device_cache_load(path, &count);
+    if (list == NULL) {
+        goto cleanup;
+    }
+    if (count == 0) {
+        // nothing to start early
+        device_cache_free(list);
+        goto cleanup;
+    }
+    sane_devices_set(list, sane_polled_devices(list));
+    sane_cache_release();
+    sane_cached_list = list;
+    for(int i = 0; i < count; i += 1) {
+        slog(SLOG_DEBUG, "cached device: %s %s %s %s",
+             list[i]->name, list[i]->vendor, list[i]->model, list[i]->type);
+    }
+    slog(SLOG_INFO, "starting with %d devices of the device cache %s", count, path);
+    found = true;
+cleanup:
+    if (pthread_mutex_unlock(&sane_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return found;
+}
+
+// the checkpoint file of the pollers (see C_POLL_STATE) or NULL
+static const char* sane_state_path(void) {
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    const char* path = cfg_getstr(cfg_sec_global, C_POLL_STATE);
+    if ((path == NULL) || (*path == '\0')) {
+        return NULL;
+    }
+    return path;
+}
+
+// loads the checkpoint of the last run before the pollers start: the
+// first open of each device takes its before-values
+// returns false if no checkpoint is configured
+bool load_sane_poll_state(void) {
+    const char* path = sane_state_path();
+    if (path == NULL) {
+        return false;
+    }
+    assert(cfg_rules != NULL);
+    poll_state_load(path, cfg_rules->generation);
+    return true;
+}
+
+// writes the checkpoint if the before-values changed (or force is set)
+void store_sane_poll_state(bool force) {
+    const char* path = sane_state_path();
+    if (path == NULL) {
+        return;
+    }
+    assert(cfg_rules != NULL);
+    poll_state_store(path, cfg_rules->generation, force);
+}
+
+// the usb scanners are named with their location by the sane
+// backends (e.g. "genesys:libusb:001:004")
+bool sane_usb_device(int busnum, int devnum) {
+    char location[32];
+    snprintf(location, sizeof(location), "libusb:%03d:%03d", busnum, devnum);
+    bool found = false;
+    // the names of the pollers are fixed, a rescan doesn't block us
+    const sane_pollers_t* p = rcu_read_lock(&sane_pollers);
+    for(int i = 0; (p != NULL) && (i < p->count) && !found; i += 1) {
+        found = (strstr(p->st[i]->device.name, location) != NULL);
+    }
+    rcu_read_unlock(&sane_pollers);
+    return found;
+}
+
+// the discovery after a start from the device cache: the pollers of
+// stale devices are stopped, new devices get a poller, the cache is
+// updated
+void verify_sane_devices(void) {
+    slog(SLOG_INFO, "verifying the cached devices");
+    update_sane_threads();
+}
+
 void get_sane_devices(void) {
     // detect all the scanners we have
     slog(SLOG_INFO, "Scanning for local-only devices" );
@@ -135,21 +483,27 @@ void get_sane_devices(void) {
         return;
     }
     SANE_Status sane_status = SANE_STATUS_INVAL;
-    sane_device_list = NULL;
-    num_devices = 0;
-    if ((sane_status = sane_get_devices(&sane_device_list, SANE_TRUE)) != SANE_STATUS_GOOD) {
+    const SANE_Device** list = NULL;
+    sane_devices_set(NULL, NULL);
+    sane_cache_release();
+    struct timespec start;
+    stats_now(&start);
+    if ((sane_status = sane_get_devices(&list, SANE_TRUE)) != SANE_STATUS_GOOD) {
         slog(SLOG_WARN, "Can't get the sane device list");
+        list = NULL;
+    }
+    stats_record(NULL, STATS_RESCAN, stats_since(&start));
+    if (sane_status == SANE_STATUS_GOOD) {
+        sane_cache_store(list);
     }
-    const SANE_Device** dev = sane_device_list;
-    if (dev == NULL) {
+    if (list == NULL) {
         slog(SLOG_DEBUG, "device list null");
         goto cleanup;
     }
-    while(*dev != NULL) {
+    sane_devices_set(list, sane_polled_devices(list));
+    for(const SANE_Device** dev = list; *dev != NULL; dev++) {
         slog(SLOG_DEBUG, "found device: %s %s %s %s",
              (*dev)->name, (*dev)->vendor, (*dev)->model, (*dev)->type);
-        num_devices += 1;
-        dev++;
     }
     if (pthread_cond_broadcast(&sane_cv)) {
         slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
@@ -162,51 +516,77 @@ cleanup:
     }
 }	
 
-// simple hash function for C-strings
-static unsigned long hash(const char *str) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
-    }
-    return hash;
-}
-
 static void sane_option_value_init(sane_opt_value_t* v) {
     v->num_value = 0;
     v->str_value.str = NULL;
-    v->str_value.reg = NULL;
+    v->str_value.buf = NULL;
+    v->str_value.size = 0;
 }
 
 static void sane_option_value_free(sane_opt_value_t* v) {
-    if (v->str_value.str != NULL) {
-        free((void*)v->str_value.str);
-        v->str_value.str = NULL;
+    free(v->str_value.buf);
+    sane_option_value_init(v);
+}
+
+// makes the buffer of v at least size bytes, returns it
+static char* sane_option_value_reserve(sane_opt_value_t* v, size_t size) {
+    if (v->str_value.size < size) {
+        char* buf = realloc(v->str_value.buf, size);
+        assert(buf != NULL);
+        v->str_value.buf = buf;
+        v->str_value.size = size;
+    }
+    return v->str_value.buf;
+}
+
+// compares the actual values (not the regexes)
+static bool sane_option_value_equal(const sane_opt_value_t* a, const sane_opt_value_t* b) {
+    assert(a != NULL);
+    assert(b != NULL);
+    if (a->num_value != b->num_value) {
+        return false;
+    }
+    if ((a->str_value.str == NULL) || (b->str_value.str == NULL)) {
+        return a->str_value.str == b->str_value.str;
     }
-    if (v->str_value.reg != NULL) {
-        regfree(v->str_value.reg);
-        free(v->str_value.reg);
-        v->str_value.reg = NULL;
+    return strcmp(a->str_value.str, b->str_value.str) == 0;
+}
+
+// copies src into dst, reusing the buffer of dst
+static void sane_option_value_assign(sane_opt_value_t* dst, const sane_opt_value_t* src) {
+    assert(dst != NULL);
+    assert(src != NULL);
+    dst->num_value = src->num_value;
+    dst->str_value.str = NULL;
+    if (src->str_value.str != NULL) {
+        size_t size = strlen(src->str_value.str) + 1;
+        dst->str_value.str = memcpy(sane_option_value_reserve(dst, size),
+                                    src->str_value.str, size);
     }
 }
 
-static sane_opt_value_t get_sane_option_value(SANE_Handle* h, int index) {
+static void sane_option_value_copy(sane_opt_value_t* dst, const sane_opt_value_t* src) {
+    assert(dst != NULL);
+    assert(src != NULL);
+    sane_option_value_init(dst);
+    sane_option_value_assign(dst, src);
+}
+
+// reads the value of option with index (and descriptor odesc) of the
+// device (opened) with handle h into res, reusing its buffer
+// returns true if the backend reports a changed option set
+// (SANE_INFO_RELOAD_OPTIONS, see sane_poll_refresh())
+static bool get_sane_option_value(SANE_Handle h, const SANE_Option_Descriptor* odesc,
+                                  int index, sane_opt_value_t* v) {
     slog(SLOG_DEBUG, "get_sane_option_value");
-    // get the value of option with index of the device (opened) with
-    // handle h
     // if option can't be found or other catastrophy happens, the
     // value 0 gets returned
-#if ((__STDC_VERSION__  - 0) < 201112L) || ((__GNUC__ - 0) < 5)
-    sane_opt_value_t res;
-#else
-    sane_opt_value_t res = {};
-#endif
-
-    sane_option_value_init(&res);
+    v->num_value = 0;
+    v->str_value.str = NULL;
+    SANE_Int info = 0;
 
-    const SANE_Option_Descriptor* odesc = NULL;
-    if ((odesc = sane_get_option_descriptor(h, index)) == NULL) {
-        return res;
+    if (odesc == NULL) {
+        return false;
     }
     if ((odesc->type == SANE_TYPE_BOOL) || (odesc->type == SANE_TYPE_INT) ||
             (odesc->type == SANE_TYPE_FIXED) || (odesc->type == SANE_TYPE_BUTTON)) {
@@ -215,114 +595,497 @@ static sane_opt_value_t get_sane_option_value(SANE_Handle* h, int index) {
             //if we can store it in an long int
             SANE_Status status = SANE_STATUS_INVAL;
             if ((status = sane_control_option(h, index, SANE_ACTION_GET_VALUE,
-                                              &value, NULL)) != SANE_STATUS_GOOD) {
+                                              &value, &info)) != SANE_STATUS_GOOD) {
                 slog(SLOG_WARN, "Can't read value of %s: %s",
                      odesc->name, sane_strstatus(status));
-                return res;
+                return false;
             }
-            res.num_value = value;
-            return res;
+            v->num_value = value;
+            return (info & SANE_INFO_RELOAD_OPTIONS) != 0;
         }
         else {
             // shouldn't happen
             slog(SLOG_WARN, "Value of %s, sane-type %d too big", odesc->name, odesc->type);
-            return res;
+            return false;
         }
     }
     else if (odesc->type == SANE_TYPE_STRING) {
-        res.str_value.str = calloc(odesc->size + 1, sizeof(char));
-        assert(res.str_value.str != NULL);
+        char* str = sane_option_value_reserve(v, odesc->size + 1);
+        memset(str, 0, odesc->size + 1);
+        v->str_value.str = str;
         SANE_Status status = SANE_STATUS_INVAL;
         if ((status = sane_control_option(h, index, SANE_ACTION_GET_VALUE,
-                                          res.str_value.str, NULL)) != SANE_STATUS_GOOD) {
+                                          str, &info)) != SANE_STATUS_GOOD) {
             slog(SLOG_WARN, "Can't read value of %s: %s", odesc->name, sane_strstatus(status));
-            return res;
+            return false;
         }
-        res.str_value.str[odesc->size] = '\0';
-        size_t slen = strlen(res.str_value.str);
-        res.num_value = hash(res.str_value.str);
+        str[odesc->size] = '\0';
 
-        slog(SLOG_INFO, "Value of %s as string (len %d, hash %d): %s",
-             odesc->name, slen, res.num_value, res.str_value.str);
-        return res;
+        slog(SLOG_INFO, "Value of %s as string: %s", odesc->name, str);
+        return (info & SANE_INFO_RELOAD_OPTIONS) != 0;
     }
     else {
         slog(SLOG_WARN, "Can't read option %s of type %d", odesc->name, odesc->type);
     }
-    return res;
+    return false;
 }
 
 
-// cleanup handler for sane_poll
-static void sane_thread_cleanup_mutex(void* arg) {
-    assert(arg != NULL);
-    slog(SLOG_DEBUG, "sane_thread_cleanup_mutex");
-    pthread_mutex_t* mutex = (pthread_mutex_t*)arg;
-    if (pthread_mutex_unlock(mutex) < 0) {
-        // if we can't unlock the mutex, something is heavily wrong!
-        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+// the backend calls of the poller go to libsane, or with C_POLL_HELPER
+// to the helper process of the device (st->h only marks the device
+// as opened then)
+// these functions can only be used in the critical region of *st
+static SANE_Status sane_dev_open(sane_thread_t* st) {
+    if (st->helper == NULL) {
+        return sane_open(st->dev->name, &st->h);
+    }
+    SANE_Status status = poll_helper_open(st->helper);
+    st->h = (status == SANE_STATUS_GOOD) ? (SANE_Handle)st->helper : NULL;
+    return status;
+}
+
+static void sane_dev_close(sane_thread_t* st) {
+    if (st->h == NULL) {
+        return;
+    }
+    if (st->helper == NULL) {
+        sane_close(st->h);
+    }
+    else {
+        poll_helper_close(st->helper);
+    }
+    st->h = NULL;
+}
+
+static SANE_Status sane_dev_num_options(sane_thread_t* st, int* num) {
+    if (st->helper == NULL) {
+        return sane_control_option(st->h, 0, SANE_ACTION_GET_VALUE, num, 0);
+    }
+    *num = poll_helper_options(st->helper);
+    return SANE_STATUS_GOOD;
+}
+
+static const SANE_Option_Descriptor* sane_dev_descriptor(sane_thread_t* st, int opt) {
+    if (st->helper == NULL) {
+        return sane_get_option_descriptor(st->h, opt);
+    }
+    return poll_helper_descriptor(st->helper, opt);
+}
+
+// the value read by the helper into v (see get_sane_option_value())
+static void sane_dev_assign(sane_opt_value_t* v, const SANE_Option_Descriptor* odesc,
+                            const poll_helper_record_t* r) {
+    v->num_value = 0;
+    v->str_value.str = NULL;
+    if (r->status != SANE_STATUS_GOOD) {
+        slog(SLOG_WARN, "Can't read value of %s: %s",
+             odesc ? odesc->name : SCANBD_NULL_STRING, sane_strstatus(r->status));
+        return;
+    }
+    if (!r->string) {
+        v->num_value = r->num_value;
+        return;
+    }
+    size_t size = strlen(r->str_value) + 1;
+    v->str_value.str = memcpy(sane_option_value_reserve(v, size), r->str_value, size);
+    slog(SLOG_INFO, "Value of %s as string: %s",
+         odesc ? odesc->name : SCANBD_NULL_STRING, v->str_value.str);
+}
+
+// (re)reads the descriptors of all options of the opened device into
+// st->descs, all entries are NULL if the device isn't open
+// this function can only be used in the critical region of *st
+static void sane_snapshot_descriptors(sane_thread_t* st) {
+    assert(st != NULL);
+    assert(st->descs != NULL);
+    for(int opt = 0; opt < st->num_of_options; opt += 1) {
+        st->descs[opt] = NULL;
+        if (st->h != NULL) {
+            st->descs[opt] = sane_dev_descriptor(st, opt);
+        }
+    }
+}
+
+// returns the value of option number in the actual poll cycle: the
+// value is queried from the backend only at the first call per cycle,
+// further calls (multiple actions, functions) use the snapshot
+// because the query may reset the value in the backend
+// this function can only be used in the critical region of *st
+static const sane_opt_value_t* sane_snapshot_value(sane_thread_t* st, int number) {
+    assert(st != NULL);
+    assert(number >= 0);
+    assert(number < st->num_of_options);
+    if (st->snapshot_cycle[number] != st->cycle) {
+        struct timespec start;
+        stats_now(&start);
+        SCANBD_PROBE2(option__start, st->dev->name, number);
+        st->reads += 1;
+        if (st->helper == NULL) {
+            if (get_sane_option_value(st->h, st->descs[number], number, &st->snapshot[number])) {
+                st->options_changed = true;
+            }
+        }
+        else {
+            // a failed helper reads as a failed call: the next prefetch
+            // finds the device closed
+            poll_helper_record_t r;
+            if (!poll_helper_read(st->helper, &number, 1, &r)) {
+                r.status = SANE_STATUS_IO_ERROR;
+            }
+            sane_dev_assign(&st->snapshot[number], st->descs[number], &r);
+        }
+        SCANBD_PROBE3(option__end, st->dev->name, number, st->snapshot[number].num_value);
+        stats_record(st->stats, STATS_POLL, stats_since(&start));
+        st->snapshot_cycle[number] = st->cycle;
+    }
+    else {
+        slog(SLOG_DEBUG, "got the value of option %d already", number);
+    }
+    return &st->snapshot[number];
+}
+
+// with the helper the values of all matched options of the cycle are
+// fetched at once, one read per POLL_HELPER_RING options instead of a
+// round trip per option (the poll statistics record the reads)
+// returns false if the helper has failed, the device is closed then
+// this function can only be used in the critical region of *st
+static bool sane_snapshot_prefetch(sane_thread_t* st) {
+    assert(st != NULL);
+    if (st->helper == NULL) {
+        return true;
+    }
+    int numbers[POLL_HELPER_RING];
+    poll_helper_record_t records[POLL_HELPER_RING];
+    int n = 0;
+    int count = st->num_of_options_with_scripts;
+    for(int si = 0; si <= count; si += 1) {
+        if (si < count) {
+            int number = st->opts[si].number;
+            if ((st->descs[number] == NULL) || (st->snapshot_cycle[number] == st->cycle)) {
+                continue;
+            }
+            st->snapshot_cycle[number] = st->cycle;
+            numbers[n] = number;
+            n += 1;
+        }
+        if ((n < POLL_HELPER_RING) && ((si < count) || (n == 0))) {
+            continue;
+        }
+        struct timespec start;
+        stats_now(&start);
+        st->reads += n;
+        if (!poll_helper_read(st->helper, numbers, n, records)) {
+            st->h = NULL;
+            sane_snapshot_descriptors(st);
+            return false;
+        }
+        stats_record(st->stats, STATS_POLL, stats_since(&start));
+        for(int i = 0; i < n; i += 1) {
+            sane_dev_assign(&st->snapshot[numbers[i]], st->descs[numbers[i]], &records[i]);
+        }
+        n = 0;
+    }
+    return true;
+}
+
+// a trigger ended the cycle at opts[si]: if the backend resets a value
+// when it is read (see C_READ_RESETS), the values of the remaining
+// options already read in this cycle (by the prefetch or for the
+// environment of the script) are taken by the next cycle, reading them
+// again would lose a press. Otherwise the next cycle reads them again.
+// this function can only be used in the critical region of *st
+static void sane_snapshot_carry(sane_thread_t* st, int si) {
+    assert(st != NULL);
+    if (!st->read_resets) {
+        return;
+    }
+    for(int n = si + 1; n < st->num_of_options_with_scripts; n += 1) {
+        int number = st->opts[n].number;
+        if (st->snapshot_cycle[number] == st->cycle) {
+            st->snapshot_cycle[number] = st->cycle + 1;
+        }
+    }
+}
+
+// releases the option snapshot of the device
+static void sane_snapshot_free(sane_thread_t* st) {
+    assert(st != NULL);
+    if (st->snapshot != NULL) {
+        for(int opt = 0; opt < st->num_of_options; opt += 1) {
+            sane_option_value_free(&st->snapshot[opt]);
+        }
+        free(st->snapshot);
+        st->snapshot = NULL;
+    }
+    free(st->snapshot_cycle);
+    st->snapshot_cycle = NULL;
+    free(st->descs);
+    st->descs = NULL;
+    if (st->infos != NULL) {
+        for(int opt = 0; opt < st->num_of_options; opt += 1) {
+            free(st->infos[opt].name);
+        }
+        free(st->infos);
+        st->infos = NULL;
+    }
+}
+
+// copies the matching relevant part of the descriptor odesc (or NULL)
+// into info
+static void sane_info_set(sane_opt_info_t* info, const SANE_Option_Descriptor* odesc) {
+    free(info->name);
+    info->name = NULL;
+    info->valid = (odesc != NULL);
+    if (odesc == NULL) {
+        return;
+    }
+    info->type = odesc->type;
+    info->cap = odesc->cap;
+    if (odesc->name != NULL) {
+        info->name = strdup(odesc->name);
+        assert(info->name != NULL);
+    }
+}
+
+// the descriptor odesc binds other rules than info: the option became
+// (in)active, or changed its type or name
+static bool sane_info_differs(const sane_opt_info_t* info, const SANE_Option_Descriptor* odesc) {
+    if (info->valid != (odesc != NULL)) {
+        return true;
+    }
+    if (odesc == NULL) {
+        return false;
+    }
+    if ((SANE_OPTION_IS_ACTIVE(info->cap) != SANE_OPTION_IS_ACTIVE(odesc->cap)) ||
+        (info->type != odesc->type)) {
+        return true;
+    }
+    if ((info->name == NULL) || (odesc->name == NULL)) {
+        return info->name != odesc->name;
+    }
+    return strcmp(info->name, odesc->name) != 0;
+}
+
+// copies the matching relevant part of the descriptors of the opened
+// device into st->infos
+// this function can only be used in the critical region of *st
+static void sane_snapshot_infos(sane_thread_t* st) {
+    assert(st != NULL);
+    assert(st->descs != NULL);
+    if (st->infos != NULL) {
+        slog(SLOG_ERROR, "possible memory leak: %s, %d", __FILE__, __LINE__);
+    }
+    st->infos = (sane_opt_info_t*) calloc(st->num_of_options, sizeof(sane_opt_info_t));
+    assert(st->infos != NULL);
+    for(int opt = 0; opt < st->num_of_options; opt += 1) {
+        sane_info_set(&st->infos[opt], st->descs[opt]);
+    }
+}
+
+// the sizes allocated from an arena are rounded up to a multiple of
+// the alignment of all members of the tables
+union sane_arena_align {
+    void* p;
+    long l;
+    long double d;
+};
+#define SANE_ARENA_ALIGN(n) \
+    (((n) + sizeof(union sane_arena_align) - 1) / sizeof(union sane_arena_align) * \
+     sizeof(union sane_arena_align))
+
+// resets the arena to hold at least size bytes, the content is lost
+static void sane_arena_reserve(sane_arena_t* a, size_t size) {
+    assert(a != NULL);
+    size = SANE_ARENA_ALIGN(size + 1);
+    a->used = 0;
+    if (a->size < size) {
+        free(a->block);
+        a->block = malloc(size);
+        assert(a->block != NULL);
+        a->size = size;
+    }
+}
+
+// allocates size bytes of the reserved space of the arena
+static void* sane_arena_alloc(sane_arena_t* a, size_t size) {
+    assert(a != NULL);
+    size = SANE_ARENA_ALIGN(size);
+    assert(a->used + size <= a->size);
+    void* p = a->block + a->used;
+    a->used += size;
+    return p;
+}
+
+// takes the tables of an ended poller from the pool or allocates new ones
+// the sane_mutex must be held by the caller
+static sane_tables_t* sane_tables_get(void) {
+    sane_tables_t* t = sane_tables_pool;
+    if (t != NULL) {
+        sane_tables_pool = t->next;
+        t->next = NULL;
+        return t;
+    }
+    t = (sane_tables_t*) calloc(1, sizeof(sane_tables_t));
+    assert(t != NULL);
+    return t;
+}
+
+// returns the tables to the pool, the arenas are kept
+// the sane_mutex must be held by the caller
+static void sane_tables_put(sane_tables_t* t) {
+    if (t == NULL) {
+        return;
+    }
+    t->arena[0].used = 0;
+    t->arena[1].used = 0;
+    t->next = sane_tables_pool;
+    sane_tables_pool = t;
+}
+
+// an option the actions and functions can be bound to
+static bool sane_option_usable(const sane_opt_info_t* odesc) {
+    return odesc->valid && SANE_OPTION_IS_ACTIVE(odesc->cap) && (odesc->name != NULL) &&
+        ((odesc->type == SANE_TYPE_BOOL) || (odesc->type == SANE_TYPE_INT) ||
+         (odesc->type == SANE_TYPE_FIXED)|| (odesc->type == SANE_TYPE_STRING) ||
+         (odesc->type == SANE_TYPE_BUTTON));
+}
+
+// adds the number of actions and functions of the section matching the
+// option name to *actions and *functions
+static void sane_count_option(const cfg_rule_section_t* rs, const char* name,
+                              int* actions, int* functions) {
+    for(int i = 0; i < rs->num_actions; i += 1) {
+        if (regexec(&rs->actions[i].filter_reg, name, 0, NULL, 0) == 0) {
+            *actions += 1;
+        }
+    }
+    for(int i = 0; i < rs->num_functions; i += 1) {
+        if (regexec(&rs->functions[i].filter_reg, name, 0, NULL, 0) == 0) {
+            *functions += 1;
+        }
+    }
+}
+
+// adds the number of options matched by the actions and functions of
+// the section to *actions and *functions: the upper bound of the
+// table sizes (overriding matches don't add an entry)
+static void sane_count_matches(const sane_thread_t* st, const cfg_rule_section_t* rs,
+                               int* actions, int* functions) {
+    for(int opt = 1; opt < st->num_of_options; opt += 1) {
+        if (sane_option_usable(&st->infos[opt])) {
+            sane_count_option(rs, st->infos[opt].name, actions, functions);
+        }
+    }
+}
+
+// allocates opts and functions in the inactive arena of the tables,
+// sized to the options matched by the actual rules
+// this function can only be used in the critical region of *st
+static void sane_tables_alloc(sane_thread_t* st) {
+    assert(st->tables != NULL);
+    int actions = 0;
+    int functions = 0;
+    sane_count_matches(st, &cfg_rules->global, &actions, &functions);
+    for(int loc = 0; loc < cfg_rules->num_devices; loc += 1) {
+        const cfg_rule_section_t* loc_i = &cfg_rules->devices[loc];
+        if (regexec(&loc_i->filter_reg, st->dev->name, 0, NULL, 0) == 0) {
+            sane_count_matches(st, loc_i, &actions, &functions);
+        }
     }
+    // a function entry is unique per option
+    if (functions > st->num_of_options) {
+        functions = st->num_of_options;
+    }
+
+    st->tables->active ^= 1;
+    sane_arena_t* a = &st->tables->arena[st->tables->active];
+    sane_arena_reserve(a, SANE_ARENA_ALIGN(actions * sizeof(sane_dev_option_t)) +
+                       SANE_ARENA_ALIGN(functions * sizeof(sane_dev_function_t)));
+    st->opts = (sane_dev_option_t*) sane_arena_alloc(a, actions * sizeof(sane_dev_option_t));
+    st->opts_capacity = actions;
+    st->functions = (sane_dev_function_t*) sane_arena_alloc(a, functions *
+                                                            sizeof(sane_dev_function_t));
+    st->functions_capacity = functions;
+    slog(SLOG_DEBUG, "tables of device %s: %d actions, %d functions (%zu bytes)",
+         st->dev->name, actions, functions, a->used);
 }
 
-// cleanup handler for sane_poll
-static void sane_thread_cleanup_value(void* arg) {
-    assert(arg != NULL);
-    slog(SLOG_DEBUG, "sane_thread_cleanup_value");
-    sane_opt_value_t* v = (sane_opt_value_t*)arg;
-    sane_option_value_free(v);
+// releases the values of the options of the tables, the memory of the
+// tables stays in the arena
+static void sane_tables_clear(sane_dev_option_t* opts, int capacity) {
+    for(int k = 0; k < capacity; k += 1) {
+        sane_option_value_free(&opts[k].value);
+    }
 }
 
+// binds the function to the (usable) option opt if its filter matches
+// the option name, a function overrides an earlier one of the option
+// this function can only be used in the critical region of *st
+static void sane_bind_function(sane_thread_t* st, const cfg_rule_function_t* function_i, int opt) {
+    const char* name = st->infos[opt].name;
+    assert(name != NULL);
+    // regex compare with the filter
+    if (regexec(&function_i->filter_reg, name, 0, NULL, 0) != 0) {
+        // no match
+        return;
+    }
+    // match
+    slog(SLOG_INFO, "installing function %s for %s, option[%d]: %s as env: %s",
+         function_i->title, st->dev->name, opt, name, function_i->env);
+
+    // looking for option already present in the
+    // array
+    int n = 0;
+    for(n = 0; n < st->num_of_options_with_functions; n += 1) {
+        if (st->functions[n].number == opt) {
+            slog(SLOG_WARN, "function %s overrides function of option[%d]",
+                 function_i->title, n);
+            // break out with n == index_of_found_option
+            break;
+        }
+    }
+    // 0 <= n < st->num_of_options_with_scripts:
+    // we found it
+    // n == st->num_of_options_with_scripts:
+    // not found => new
+
+    if (n == st->functions_capacity) {
+        return; // no space left in array
+    }
+    st->functions[n].number = opt;
+    st->functions[n].env = function_i->env;
+
+    if (n == st->num_of_options_with_functions) {
+        // not found in the list
+        // we have a new option to be polled
+        st->num_of_options_with_functions += 1;
+    }
+}
 
 // this function can only be used in the critical region of *st
-static void sane_find_matching_functions(sane_thread_t* st, cfg_t* sec) {
+static void sane_find_matching_functions(sane_thread_t* st, const cfg_rule_section_t* rs) {
     // TODO: use of recursive mutex???
     slog(SLOG_DEBUG, "sane_find_matching_functions");
-    const char* title = cfg_title(sec);
-    if (title == NULL) {
-        title = SCANBD_NULL_STRING;
-    }
-    int functions = cfg_size(sec, C_FUNCTION);
-    if (functions <= 0) {
-        slog(SLOG_INFO, "no matching functions in section %s", title);
+    if (rs->num_functions <= 0) {
+        slog(SLOG_INFO, "no matching functions in section %s", rs->title);
         return;
     }
     
-    slog(SLOG_INFO, "found %d functions in section %s", functions, title);
-    // iterate over all global functions
-    for(int i = 0; i < functions; i += 1) {
-        // get the function from the config file
-        cfg_t* function_i = cfg_getnsec(sec, C_FUNCTION, i);
-        assert(function_i != NULL);
-
-        // get the filter-regex from the config-file
-        const char* opt_regex = cfg_getstr(function_i, C_FILTER);
-        assert(opt_regex != NULL);
-
-        const char* title = cfg_title(function_i);
-        if (title == NULL) {
-            title = "(none)";
-        }
-        // compile the filter-regex
+    slog(SLOG_INFO, "found %d functions in section %s", rs->num_functions, rs->title);
+    // iterate over all (precompiled) functions of the section
+    for(int i = 0; i < rs->num_functions; i += 1) {
+        const cfg_rule_function_t* function_i = &rs->functions[i];
         slog(SLOG_DEBUG, "checking function %s with filter: %s",
-             title, opt_regex);
-        regex_t creg;
-        int ret = regcomp(&creg, opt_regex, REG_EXTENDED | REG_NOSUB);
-        if (ret < 0) {
-            char err_text[1024];
-            regerror(ret, &creg, err_text, 1024);
-            slog(SLOG_WARN, "Can't compile regex: %s : %s", opt_regex, err_text);
-            continue;
-        }
+             function_i->title, function_i->filter);
         // look for matching option-names
         for(int opt = 1; opt < st->num_of_options; opt += 1) {
-            const SANE_Option_Descriptor* odesc = NULL;
-            if ((odesc = sane_get_option_descriptor(st->h, opt)) == NULL) {
+            const sane_opt_info_t* odesc = &st->infos[opt];
+            if (!odesc->valid) {
                 // no valid option-descriptor available
                 // skip it
                 slog(SLOG_INFO, "option[%d] has no valid descriptor", opt);
                 continue;
             }
-            assert(odesc);
             if (!SANE_OPTION_IS_ACTIVE(odesc->cap)) {
                 slog(SLOG_INFO, "option[%d] is not active", opt);
                 continue;
@@ -345,99 +1108,136 @@ static void sane_find_matching_functions(sane_thread_t* st, cfg_t* sec) {
             }
             slog(SLOG_INFO, "found active option[%d] %s (type: %d) for device %s",
                  opt, odesc->name, odesc->type, st->dev->name);
-            // regex compare with the filter
-            if (regexec(&creg, odesc->name, 0, NULL, 0) != 0) {
-                // no match
-                continue;
-            }
-            // match
-
-            // now get the script
-            const char* env = cfg_getstr(function_i, C_ENV);
-            assert(env != NULL);
-            slog(SLOG_INFO, "installing function %s for %s, option[%d]: %s as env: %s",
-                 title, st->dev->name, opt, odesc->name, env);
-
-            // looking for option already present in the
-            // array
-            int n = 0;
-            for(n = 0; n < st->num_of_options_with_functions; n += 1) {
-                if (st->functions[n].number == opt) {
-                    slog(SLOG_WARN, "function %s overrides function of option[%d]",
-                         title, n);
-                    // break out with n == index_of_found_option
-                    break;
-                }
-            }
-            // 0 <= n < st->num_of_options_with_scripts:
-            // we found it
-            // n == st->num_of_options_with_scripts:
-            // not found => new
-
-            st->functions[n].number = opt;
-            st->functions[n].env = env;
-
-            if (n == st->num_of_options_with_functions) {
-                // not found in the list
-                // we have a new option to be polled
-                st->num_of_options_with_functions += 1;
-            }
+            sane_bind_function(st, function_i, opt);
         } // foreach option
-        // this compiled regex isn't used anymore
-        regfree(&creg);
-    } // foreach action
+    } // foreach function
+}
+
+// the class of the value v of an option with type for the trigger p
+static unsigned int sane_option_class(const predicate_t* p, SANE_Value_Type type,
+                                      const sane_opt_value_t* v) {
+    if ((type == SANE_TYPE_BOOL) || (type == SANE_TYPE_INT) ||
+        (type == SANE_TYPE_FIXED) || (type == SANE_TYPE_BUTTON)) {
+        // the word is read into the low bytes: its sign is restored
+        return predicate_classify_num(p, (long)(SANE_Word)v->num_value);
+    }
+    if (type == SANE_TYPE_STRING) {
+        return predicate_classify_str(p, v->str_value.str);
+    }
+    return 0;
 }
 
+// the trigger of opts[n] starts from its before-value
 // this function can only be used in the critical region of *st
-static void sane_find_matching_options(sane_thread_t* st, cfg_t* sec) {
-    slog(SLOG_DEBUG, "sane_find_matching_options");
-    const char* title = cfg_title(sec);
-    if (title == NULL) {
-        title = SCANBD_NULL_STRING;
+static void sane_option_rearm(sane_thread_t* st, int n) {
+    const sane_dev_option_t* o = &st->opts[n];
+    predicate_state_init(&st->opts[n].state,
+                         sane_option_class(&o->rule->pred, st->infos[o->number].type, &o->value));
+}
+
+// binds the action to the (usable) option opt if its filter matches
+// the option name: the before-value is the value of the actual cycle,
+// an action overrides an earlier one of the option unless
+// multiple_actions is set
+// this function can only be used in the critical region of *st
+static void sane_bind_action(sane_thread_t* st, const cfg_rule_action_t* action_i, int opt,
+                             bool multiple_actions) {
+    const char* name = st->infos[opt].name;
+    assert(name != NULL);
+    // regex compare with the filter
+    if (regexec(&action_i->filter_reg, name, 0, NULL, 0) != 0) {
+        // no match
+        return;
     }
-    // TODO: use of recursive mutex???
-    int actions = cfg_size(sec, C_ACTION);
-    if (actions <= 0) {
-        slog(SLOG_INFO, "no matching actions in section %s",  title);
+    // match
+    if ((st->infos[opt].type == SANE_TYPE_STRING) && !action_i->pred.str_valid) {
+        // the string-trigger regexes didn't compile
+        slog(SLOG_WARN, "action %s has no valid string-trigger, skipping option[%d]",
+             action_i->title, opt);
         return;
     }
-    
-    slog(SLOG_INFO, "found %d actions in section %s", actions, title);
 
-    // iterate over all global actions
-    for(int i = 0; i < actions; i += 1) {
-        // get the action from the config file
-        cfg_t* action_i = cfg_getnsec(sec, C_ACTION, i);
-        assert(action_i != NULL);
+    slog(SLOG_INFO, "installing action %s (%d) for %s, option[%d]: %s as: %s",
+         action_i->title, st->num_of_options_with_scripts, st->dev->name,
+         opt, name, action_i->script);
+
+    // looking for option already present in the
+    // array
+    int n = 0;
+    for(n = 0; n < st->num_of_options_with_scripts; n += 1) {
+        if (st->opts[n].number == opt) {
+            if (!multiple_actions) {
+                slog(SLOG_WARN, "action %s overrides script %s of option[%d] with %s",
+                     action_i->title, st->opts[n].rule->script, opt, action_i->script);
+                // break out with n == index_of_found_option
+                break;
+            }
+            else {
+                if (st->num_of_options_with_scripts < st->opts_capacity) {
+                    n = st->num_of_options_with_scripts;
+                    slog(SLOG_INFO, "adding additional action %s (%d) for option[%d] with %s",
+                         action_i->title, n, opt, action_i->script);
+                    break;
+                }
+                else {
+                    slog(SLOG_INFO, "can't add additional action %s for option[%d] with %s",
+                         action_i->title, opt, action_i->script);
+                    n = st->opts_capacity;
+                    break;
+                }
+            }
+        }
+    }
+    // 0 <= n < st->num_of_options_with_scripts:
+    // we found it (override now)
+    // n == st->num_of_options_with_scripts:
+    // not found => new
 
-        // get the filter-regex from the config-file
-        const char* opt_regex = cfg_getstr(action_i, C_FILTER);
-        assert(opt_regex != NULL);
+    if (n == st->opts_capacity) {
+        return; // no space left in array
+    }
+    st->opts[n].number = opt;
+    st->opts[n].rule = action_i;
+    sane_option_value_free(&st->opts[n].value);
+    sane_option_value_copy(&st->opts[n].value, sane_snapshot_value(st, opt));
+    sane_option_rearm(st, n);
+
+    if (n == st->num_of_options_with_scripts) {
+        // not found in the list
+        // we have a new option to be polled
+        st->num_of_options_with_scripts += 1;
+    }
+}
 
-        const char* title = cfg_title(action_i);
-        if (title == NULL) {
-            title = "(none)";
-        }
-        // compile the filter-regex
+// this function can only be used in the critical region of *st
+static void sane_find_matching_options(sane_thread_t* st, const cfg_rule_section_t* rs) {
+    slog(SLOG_DEBUG, "sane_find_matching_options");
+    // TODO: use of recursive mutex???
+    if (rs->num_actions <= 0) {
+        slog(SLOG_INFO, "no matching actions in section %s", rs->title);
+        return;
+    }
+    
+    slog(SLOG_INFO, "found %d actions in section %s", rs->num_actions, rs->title);
+
+    bool multiple_actions = cfg_rules->multiple_actions;
+    if (multiple_actions) {
+        slog(SLOG_INFO, "multiple actions allowed");
+    }
+
+    // iterate over all (precompiled) actions of the section
+    for(int i = 0; i < rs->num_actions; i += 1) {
+        const cfg_rule_action_t* action_i = &rs->actions[i];
         slog(SLOG_DEBUG, "checking action %s with filter: %s",
-             title, opt_regex);
-        regex_t creg;
-        int ret = regcomp(&creg, opt_regex, REG_EXTENDED | REG_NOSUB);
-        if (ret < 0) {
-            char err_text[1024];
-            regerror(ret, &creg, err_text, 1024);
-            slog(SLOG_WARN, "Can't compile regex: %s : %s", opt_regex, err_text);
-            continue;
-        }
+             action_i->title, action_i->filter);
         // look for matching option-names
         for(int opt = 1; opt < st->num_of_options; opt += 1) {
-            const SANE_Option_Descriptor* odesc = NULL;
-            if ((odesc = sane_get_option_descriptor(st->h, opt)) == NULL) {
+            const sane_opt_info_t* odesc = &st->infos[opt];
+            if (!odesc->valid) {
                 // no valid option-descriptor available
                 // skip it
                 continue;
             }
-            assert(odesc);
             if (!SANE_OPTION_IS_ACTIVE(odesc->cap)) {
                 continue;
             }
@@ -458,232 +1258,40 @@ static void sane_find_matching_options(sane_thread_t* st, cfg_t* sec) {
             }
             slog(SLOG_INFO, "found active option[%d] %s (type: %d) for device %s",
                  opt, odesc->name, odesc->type, st->dev->name);
-            // regex compare with the filter
-            if (regexec(&creg, odesc->name, 0, NULL, 0) != 0) {
-                // no match
-                continue;
-            }
-            // match
-
-            // now get the script from the action
-
-            const char* script = cfg_getstr(action_i, C_SCRIPT);
-
-            if (!script || (strlen(script) == 0)) {
-                script = SCANBD_NULL_STRING;
-            }       
-
-            assert(script != NULL);
-            slog(SLOG_INFO, "installing action %s (%d) for %s, option[%d]: %s as: %s",
-                 title, st->num_of_options_with_scripts, st->dev->name, opt, odesc->name, script);
-
-            // get pointer to global section of config
-
-            cfg_t* cfg_sec_global = NULL;
-            cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
-            assert(cfg_sec_global);
-
-            bool multiple_actions = cfg_getbool(cfg_sec_global, C_MULTIPLE_ACTIONS);
-            slog(SLOG_INFO, "multiple actions allowed");
-
-            // looking for option already present in the
-            // array
-            int n = 0;
-            for(n = 0; n < st->num_of_options_with_scripts; n += 1) {
-                if (st->opts[n].number == opt) {
-                    if (!multiple_actions) {
-                        slog(SLOG_WARN, "action %s overrides script %s of option[%d] with %s",
-                             title, st->opts[n].script, opt, script);
-                        // break out with n == index_of_found_option
-                        break;
-                    }
-                    else {
-                        if (n < st->num_of_options) {
-                            n = st->num_of_options_with_scripts;
-                            slog(SLOG_INFO, "adding additional action %s (%d) for option[%d] with %s",
-                                 title, n, opt, script);
-                            break;
-                        }
-                        else {
-                            slog(SLOG_INFO, "can't add additional action %s for option[%d] with %s",
-                                 title, opt, script);
-                            break;
-                        }
-                    }
-                }
-            }
-            // 0 <= n < st->num_of_options_with_scripts:
-            // we found it (override now)
-            // n == st->num_of_options_with_scripts:
-            // not found => new
-
-            if (n == st->num_of_options) {
-                continue; // no space left in array
-            }
-            st->opts[n].number = opt;
-            st->opts[n].action_name = title;
-            st->opts[n].script = script;
-            sane_option_value_free(&st->opts[n].from_value);
-            sane_option_value_free(&st->opts[n].to_value);
-            sane_option_value_free(&st->opts[n].value);
-
-            if ((odesc->type == SANE_TYPE_BOOL) || (odesc->type == SANE_TYPE_INT) ||
-                    (odesc->type == SANE_TYPE_FIXED) || (odesc->type == SANE_TYPE_BUTTON)) {
-                // numerical option
-                cfg_t* num_trigger = cfg_getsec(action_i, C_NUMERICAL_TRIGGER);
-                assert(num_trigger);
-                st->opts[n].from_value.num_value = cfg_getint(num_trigger,
-                                                              C_FROM_VALUE);
-                st->opts[n].to_value.num_value = cfg_getint(num_trigger, C_TO_VALUE);
-
-                st->opts[n].value = get_sane_option_value(st->h, opt);
-
-                slog(SLOG_INFO, "Initial value of option %s is %d", odesc->name,
-                     st->opts[n].value);
-            } // type BOOL | INT || FIXED
-            else if (odesc->type == SANE_TYPE_STRING) {
-                bool valid = true;
-                // string option
-                cfg_t* str_trigger = cfg_getsec(action_i, C_STRING_TRIGGER);
-                assert(str_trigger);
-
-                st->opts[n].from_value.str_value.str =
-                        strdup(cfg_getstr(str_trigger,
-                                          C_FROM_VALUE));
-                st->opts[n].from_value.str_value.reg = malloc(sizeof(regex_t));
-                int ret = 0;
-                ret = regcomp(st->opts[n].from_value.str_value.reg,
-                              st->opts[n].from_value.str_value.str,
-                              REG_EXTENDED | REG_NOSUB);
-                if (ret < 0) {
-                    char err_text[1024];
-                    regerror(ret, &creg, err_text, 1024);
-                    slog(SLOG_WARN, "Can't compile regex: %s : %s",
-                         st->opts[n].from_value.str_value.str, err_text);
-                    valid = false;;
-                }
-                st->opts[n].to_value.str_value.str =
-                        strdup(cfg_getstr(str_trigger,
-                                          C_TO_VALUE));
-                st->opts[n].to_value.str_value.reg = malloc(sizeof(regex_t));
-                ret = regcomp(st->opts[n].to_value.str_value.reg,
-                              st->opts[n].to_value.str_value.str,
-                              REG_EXTENDED | REG_NOSUB);
-                if (ret < 0) {
-                    char err_text[1024];
-                    regerror(ret, &creg, err_text, 1024);
-                    slog(SLOG_WARN, "Can't compile regex: %s : %s",
-                         st->opts[n].to_value.str_value.str, err_text);
-                    valid = false;;
-                }
-
-                st->opts[n].value = get_sane_option_value(st->h, opt);
-
-                if (!valid) {
-                    sane_option_value_free(&st->opts[n].from_value);
-                    sane_option_value_free(&st->opts[n].to_value);
-                    sane_option_value_free(&st->opts[n].value);
-                    continue;
-                }
-            } // type STRING
-            else {
-                assert(false); // should not happen
-            }
-            if (n == st->num_of_options_with_scripts) {
-                // not found in the list
-                // we have a new option to be polled
-                st->num_of_options_with_scripts += 1;
-            }
+            sane_bind_action(st, action_i, opt, multiple_actions);
         } // foreach option
-        // this compiled regex isn't used anymore
-        regfree(&creg);
     } // foreach action
 }
 
-
-// thread start funktion
-// TODO: refactor, this is awfull long!
-
-static void* sane_poll(void* arg) {
-#ifdef CANCEL_TEST
-    if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) < 0) {
-        slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
-    }
-#endif
-    sane_thread_t* st = (sane_thread_t*)arg;
+// builds the tables of matching actions and functions from the
+// actual rules, the poll interval and the static part of the script
+// environment
+// this function can only be used in the critical region of *st
+static void sane_poll_match(sane_thread_t* st) {
     assert(st != NULL);
-    slog(SLOG_DEBUG, "sane_poll");
-    // we only expect the main thread to handle signals
-    sigset_t mask;
-    sigfillset(&mask);
-    pthread_sigmask(SIG_BLOCK, &mask, NULL);
-    
-//    static int si = 0; // don't know why this was a static variable -> nonsense in the case of multiple sane_poll threads
-    int si = 0;
+    assert(st->infos != NULL);
 
-    // this thread uses the device and the san_thread_t datastructure
-    // lock it
-    pthread_cleanup_push(sane_thread_cleanup_mutex, ((void*)&st->mutex));
-    if (pthread_mutex_lock(&st->mutex) < 0) {
-        // if we can't get the mutex, something is heavily wrong!
-        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        pthread_exit(NULL);
-    }
-    
-    // open the device this thread should poll
-    SANE_Status status = SANE_STATUS_INVAL;
-    if ((status = sane_open(st->dev->name, &st->h)) != SANE_STATUS_GOOD) {
-        slog(SLOG_ERROR, "Can't open device %s: %s", st->dev->name, sane_strstatus(status));
-        slog(SLOG_WARN, "abandon polling of %s", st->dev->name);
-        pthread_exit(NULL);
-    }
-    // figure out the number of options this device has
-    // option 0 (zero) is guaranteed to exist with the total number of
-    // options of that device (including option 0)
-    st->num_of_options = 0;
-    if ((status = sane_control_option(st->h, 0, SANE_ACTION_GET_VALUE,
-                                      &st->num_of_options, 0)) != SANE_STATUS_GOOD) {
-        slog(SLOG_ERROR, "Can't get the number of scanner options");
-        pthread_exit(NULL);
-    }
-    if (st->num_of_options == 0) {
-        // no options -> nothing to poll
-        slog(SLOG_INFO, "No options for device %s", st->dev->name);
-        pthread_exit(NULL);
-    }
-    slog(SLOG_INFO, "found %d options for device %s", st->num_of_options, st->dev->name);
+    // the compiled rules of the config
+    assert(cfg_rules != NULL);
 
-    // allocate an array of options for the  matching actions
+    // allocate the arrays of options for the matching actions and
+    // functions
     //
     // only one script is possible per option, later matching
     // actions overwrite previous ones
-
-    // initialize the list of matching options
     if (st->opts != NULL) {
         slog(SLOG_ERROR, "possible memory leak: %s, %d", __FILE__, __LINE__);
     }
-    st->opts = NULL;
-    st->opts = (sane_dev_option_t*) calloc(st->num_of_options,
-                                           sizeof(sane_dev_option_t));
-    assert(st->opts != NULL);
-    for(int i = 0; i < st->num_of_options; i += 1) {
-        sane_option_value_init(&st->opts[i].from_value);
-        sane_option_value_init(&st->opts[i].to_value);
+    sane_tables_alloc(st);
+    for(int i = 0; i < st->opts_capacity; i += 1) {
+        st->opts[i].number = 0;
+        st->opts[i].rule = NULL;
         sane_option_value_init(&st->opts[i].value);
     }
-
     // the number of valid entries in the above list
     st->num_of_options_with_scripts = 0;
 
-    // initialize the list of matching functions
-    if (st->functions != NULL) {
-        slog(SLOG_ERROR, "possible memory leak: %s, %d", __FILE__, __LINE__);
-    }
-    st->functions = NULL;
-    st->functions = (sane_dev_function_t*) calloc(st->num_of_options,
-                                                  sizeof(sane_dev_function_t));
-    assert(st->functions != NULL);
-    for(int i = 0; i < st->num_of_options; i += 1) {
+    for(int i = 0; i < st->functions_capacity; i += 1) {
         st->functions[i].number = 0;
         st->functions[i].env = NULL;
     }
@@ -697,571 +1305,1271 @@ static void* sane_poll(void* arg) {
     assert(cfg_sec_global);
 
     // find the global actions
-    sane_find_matching_options(st, cfg_sec_global);
+    sane_find_matching_options(st, &cfg_rules->global);
 
     // find the global functions
-    sane_find_matching_functions(st, cfg_sec_global);
+    sane_find_matching_functions(st, &cfg_rules->global);
     
     // find (if any) device specifc sections
     // these override global definitions, if any
-    int local_sections = cfg_size(cfg, C_DEVICE);
-    slog(SLOG_DEBUG, "found %d local device sections", local_sections);
+    slog(SLOG_DEBUG, "found %d local device sections", cfg_rules->num_devices);
+
+    // the priority class, the cpu policies, the poll interval, the
+    // keep_open policy and the profile of the backend, device sections
+    // may override them
+    st->priority = cfg_device_priority(st->dev->name);
+    cpu_policy_t script_policy;
+    cfg_device_policy(st->dev->name, &st->policy, &script_policy);
+    poll_interval_init(&st->interval, cfg_sec_global, st->priority);
+    st->keep_open = cfg_getbool(cfg_sec_global, C_KEEP_OPEN);
+    st->read_resets = cfg_getbool(cfg_sec_global, C_READ_RESETS);
+    st->poll_rate = cfg_getint(cfg_sec_global, C_POLL_RATE);
     
-    for(int loc = 0; loc < local_sections; loc += 1) {
-        cfg_t* loc_i = cfg_getnsec(cfg, C_DEVICE, loc);
-        assert(loc_i != NULL);
-
-        // get the filter-regex from the config-file
-        const char* loc_regex = cfg_getstr(loc_i, C_FILTER);
-        assert(loc_regex != NULL);
-
-        const char* title = cfg_title(loc_i);
-        if (title == NULL) {
-            title = "(none)";
-        }
-        // compile the filter-regex
+    for(int loc = 0; loc < cfg_rules->num_devices; loc += 1) {
+        const cfg_rule_section_t* loc_i = &cfg_rules->devices[loc];
         slog(SLOG_INFO, "checking device section %s with filter: %s",
-             title, loc_regex);
-        regex_t creg;
-        int ret = regcomp(&creg, loc_regex, REG_EXTENDED | REG_NOSUB);
-        if (ret < 0) {
-            char err_text[1024];
-            regerror(ret, &creg, err_text, 1024);
-            slog(SLOG_WARN, "Can't compile regex: %s : %s", loc_regex, err_text);
-            continue;
-        }
+             loc_i->title, loc_i->filter);
         // compare the regex against the device name
-        if (regexec(&creg, st->dev->name, 0, NULL, 0) == 0) {
+        if (regexec(&loc_i->filter_reg, st->dev->name, 0, NULL, 0) == 0) {
             // match
-            int loc_actions = cfg_size(loc_i, C_ACTION);
             slog(SLOG_INFO, "found %d local action for device %s [%s]",
-                 loc_actions, st->dev->name, title);
+                 loc_i->num_actions, st->dev->name, loc_i->title);
             // get the local actions for this device
             sane_find_matching_options(st, loc_i);
             // get the local functions for this device
             sane_find_matching_functions(st, loc_i);
+            // get the local poll interval for this device
+            poll_interval_override(&st->interval, loc_i->sec);
+            if (cfg_size(loc_i->sec, C_KEEP_OPEN) > 0) {
+                st->keep_open = cfg_getbool(loc_i->sec, C_KEEP_OPEN);
+            }
+            if (cfg_size(loc_i->sec, C_READ_RESETS) > 0) {
+                st->read_resets = cfg_getbool(loc_i->sec, C_READ_RESETS);
+            }
+            if (cfg_size(loc_i->sec, C_POLL_RATE) > 0) {
+                st->poll_rate = cfg_getint(loc_i->sec, C_POLL_RATE);
+            }
         }
-        regfree(&creg);
     } // foreach local section
     
-    int timeout = cfg_getint(cfg_sec_global, C_TIMEOUT);
-    if (timeout <= 0) {
-        timeout = C_TIMEOUT_DEF;
+    slog(SLOG_DEBUG, "timeout: %d ms, max: %d ms, burst: %d ms for %d s",
+         st->interval.timeout, st->interval.timeout_max,
+         st->interval.burst_timeout, st->interval.burst_duration);
+    if (st->keep_open) {
+        slog(SLOG_INFO, "keeping device %s open for the action scripts", st->dev->name);
     }
-    slog(SLOG_DEBUG, "timeout: %d ms", timeout);
-    
-    slog(SLOG_DEBUG, "Start the polling for device %s", st->dev->name);
-    while(true) {
-        slog(SLOG_DEBUG, "polling thread for %s, before cancellation point", st->dev->name);
-#ifdef CANCEL_TEST
-        if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) < 0) {
-            slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
+    if (st->poll_rate < 0) {
+        st->poll_rate = 0;
+    }
+    slog(SLOG_DEBUG, "profile of device %s: read_resets %d, poll_rate %d/s",
+         st->dev->name, st->read_resets, st->poll_rate);
+    // a polling thread applies the class itself (see sane_poll())
+    action_queue_priority(&st->actions, st->priority);
+    action_queue_policy(&st->actions, &script_policy);
+    if (st->scheduled) {
+        poll_scheduler_priority(&st->job, st->priority);
+    }
+
+    // the static part of the script environment
+    script_env_free(&st->env);
+    script_env_init(&st->env, st->dev->name, st->num_of_options_with_functions);
+}
+
+// publishes the before-values of the bound options to the checkpoint
+// (see poll_state.h), their last change is the last activity
+// this function can only be used in the critical region of *st
+static void sane_state_publish(sane_thread_t* st) {
+    for(int n = 0; n < st->num_of_options_with_scripts; n += 1) {
+        const sane_opt_info_t* info = &st->infos[st->opts[n].number];
+        poll_state_update(st->dev->name, info->name, info->type, st->opts[n].value.num_value,
+                          st->opts[n].value.str_value.str, &st->interval.active);
+    }
+}
+
+// the first open after a restart: the bound options take the
+// before-values of the checkpoint, so a value changed during the
+// restart triggers with the first cycle and a value that didn't
+// change doesn't, an idle device parks as it did before
+// this function can only be used in the critical region of *st
+static void sane_poll_restore(sane_thread_t* st) {
+    int restored = 0;
+    int idle = -1;
+    for(int n = 0; n < st->num_of_options_with_scripts; n += 1) {
+        const sane_opt_info_t* info = &st->infos[st->opts[n].number];
+        poll_state_value_t v;
+        if (!poll_state_restore(st->dev->name, info->name, info->type,
+                                cfg_rules->generation, &v)) {
+            continue;
         }
-#endif
-        // special cancellation point
-        pthread_testcancel();
+        sane_opt_value_t before;
+        sane_option_value_init(&before);
+        before.num_value = v.num_value;
+        before.str_value.str = v.has_str ? v.str_value : NULL;
+        sane_option_value_assign(&st->opts[n].value, &before);
+        sane_option_rearm(st, n);
+        restored += 1;
+        if ((idle < 0) || (v.idle < idle)) {
+            idle = v.idle;
+        }
+    }
+    poll_state_restored(st->dev->name);
+    if (restored == 0) {
+        return;
+    }
+    if ((st->interval.park_idle > 0) && (idle > 0)) {
+        clock_gettime(CLOCK_MONOTONIC, &st->interval.active);
+        st->interval.active.tv_sec -= (idle < st->interval.park_idle) ? idle : st->interval.park_idle;
+    }
+    slog(SLOG_INFO, "restored %d before-values of device %s, idle for %d s",
+         restored, st->dev->name, idle);
+}
 
-#ifdef CANCEL_TEST
-    if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) < 0) {
-        slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
+// opens the device and builds the tables of matching actions and
+// functions
+// this function can only be used in the critical region of *st
+static bool sane_poll_open(sane_thread_t* st) {
+    assert(st != NULL);
+    // open the device this thread should poll
+    SANE_Status status = SANE_STATUS_INVAL;
+    if ((status = sane_dev_open(st)) != SANE_STATUS_GOOD) {
+        slog(SLOG_ERROR, "Can't open device %s: %s", st->dev->name, sane_strstatus(status));
+        slog(SLOG_WARN, "abandon polling of %s", st->dev->name);
+        return false;
     }
-#endif
-    slog(SLOG_DEBUG, "polling thread for %s, after cancellation point", st->dev->name);
+    if (atomic_load(&st->stop)) {
+        // stopped while opening: the rules may be gone
+        return false;
+    }
+    // figure out the number of options this device has
+    // option 0 (zero) is guaranteed to exist with the total number of
+    // options of that device (including option 0)
+    st->num_of_options = 0;
+    if ((status = sane_dev_num_options(st, &st->num_of_options)) != SANE_STATUS_GOOD) {
+        slog(SLOG_ERROR, "Can't get the number of scanner options");
+        return false;
+    }
+    if (st->num_of_options == 0) {
+        // no options -> nothing to poll
+        slog(SLOG_INFO, "No options for device %s", st->dev->name);
+        return false;
+    }
+    slog(SLOG_INFO, "found %d options for device %s", st->num_of_options, st->dev->name);
 
-    slog(SLOG_DEBUG, "polling device %s", st->dev->name);
+    // the option snapshot: the descriptors stay valid until the
+    // device is closed, the values get fetched once per poll cycle
+    if (st->descs != NULL) {
+        slog(SLOG_ERROR, "possible memory leak: %s, %d", __FILE__, __LINE__);
+    }
+    st->descs = (const SANE_Option_Descriptor**) calloc(st->num_of_options,
+                                                        sizeof(SANE_Option_Descriptor*));
+    st->snapshot = (sane_opt_value_t*) calloc(st->num_of_options, sizeof(sane_opt_value_t));
+    st->snapshot_cycle = (unsigned long*) calloc(st->num_of_options, sizeof(unsigned long));
+    assert(st->descs != NULL);
+    assert(st->snapshot != NULL);
+    assert(st->snapshot_cycle != NULL);
+    for(int i = 0; i < st->num_of_options; i += 1) {
+        sane_option_value_init(&st->snapshot[i]);
+    }
+    sane_snapshot_descriptors(st);
+    sane_snapshot_infos(st);
+    // the values fetched while matching the actions belong to the
+    // first cycle
+    st->cycle = 1;
+
+    sane_poll_match(st);
+    sane_poll_restore(st);
+    sane_state_publish(st);
+    return true;
+}
+
+// rebinds the opened device to the actual (reloaded) rules: the
+// tables are rebuilt, the before-values of the options already polled
+// are kept, so a button pressed during the reload isn't lost
+// this function can only be used in the critical region of *st
+static void sane_poll_rebind(sane_thread_t* st) {
+    assert(st != NULL);
 
-        for(si = 0; si < st->num_of_options_with_scripts; si += 1) {
-            const SANE_Option_Descriptor* odesc = NULL;
-            odesc = sane_get_option_descriptor(st->h, st->opts[si].number);
-            assert(odesc);
+    sane_dev_option_t* old_opts = st->opts;
+    int old_num_opts = st->num_of_options_with_scripts;
+    int old_opts_capacity = st->opts_capacity;
+    sane_dev_function_t* old_functions = st->functions;
+    int old_num_functions = st->num_of_options_with_functions;
 
-            if (st->opts[si].script != NULL) {
-                if (strlen(st->opts[si].script) <= 0) {
-                    slog(SLOG_WARN, "No valid script for option %s for device %s",
-                         odesc->name, st->dev->name);
-                    continue;
-                }
+    st->opts = NULL;
+    st->functions = NULL;
+    sane_poll_match(st);
+
+    bool changed = (old_num_opts != st->num_of_options_with_scripts) ||
+        (old_num_functions != st->num_of_options_with_functions);
+    for(int n = 0; n < st->num_of_options_with_scripts; n += 1) {
+        if ((n >= old_num_opts) || (old_opts[n].number != st->opts[n].number) ||
+            !cfg_rule_action_equal(old_opts[n].rule, st->opts[n].rule)) {
+            changed = true;
+        }
+        for(int o = 0; o < old_num_opts; o += 1) {
+            if (old_opts[o].number == st->opts[n].number) {
+                sane_option_value_free(&st->opts[n].value);
+                sane_option_value_copy(&st->opts[n].value, &old_opts[o].value);
+                sane_option_rearm(st, n);
+                break;
             }
-            else {
-                slog(SLOG_WARN, "No script for option %s for device %s",
-                     odesc->name, st->dev->name);
+        }
+    }
+    for(int n = 0; (n < st->num_of_options_with_functions) && (n < old_num_functions); n += 1) {
+        if ((old_functions[n].number != st->functions[n].number) ||
+            (strcmp(old_functions[n].env, st->functions[n].env) != 0)) {
+            changed = true;
+        }
+    }
+    slog(SLOG_INFO, "rebound device %s to the new config: %d actions, %d functions%s",
+         st->dev->name, st->num_of_options_with_scripts, st->num_of_options_with_functions,
+         changed ? "" : " (unchanged)");
+    sane_state_publish(st);
+
+    // the old tables stay in their arena for the next rebind
+    sane_tables_clear(old_opts, old_opts_capacity);
+}
+
+// removes the actions and functions bound to the option opt from the
+// tables, the entries behind it move up (with their before-values)
+// this function can only be used in the critical region of *st
+static void sane_unbind_option(sane_thread_t* st, int opt) {
+    int k = 0;
+    for(int n = 0; n < st->num_of_options_with_scripts; n += 1) {
+        if (st->opts[n].number == opt) {
+            sane_option_value_free(&st->opts[n].value);
+            continue;
+        }
+        if (k != n) {
+            st->opts[k] = st->opts[n];
+        }
+        k += 1;
+    }
+    for(int n = k; n < st->num_of_options_with_scripts; n += 1) {
+        // moved up (or freed) above
+        st->opts[n].number = 0;
+        st->opts[n].rule = NULL;
+        sane_option_value_init(&st->opts[n].value);
+    }
+    st->num_of_options_with_scripts = k;
+
+    k = 0;
+    for(int n = 0; n < st->num_of_options_with_functions; n += 1) {
+        if (st->functions[n].number == opt) {
+            continue;
+        }
+        st->functions[k] = st->functions[n];
+        k += 1;
+    }
+    st->num_of_options_with_functions = k;
+}
+
+// binds the actions and functions of the rules to the (usable) option
+// opt in the order of sane_poll_match(): the global section first,
+// then the sections of the device
+// this function can only be used in the critical region of *st
+static void sane_bind_option(sane_thread_t* st, int opt) {
+    bool multiple_actions = cfg_rules->multiple_actions;
+    const cfg_rule_section_t* rs = &cfg_rules->global;
+    for(int loc = -1; loc < cfg_rules->num_devices; loc += 1) {
+        if (loc >= 0) {
+            rs = &cfg_rules->devices[loc];
+            if (regexec(&rs->filter_reg, st->dev->name, 0, NULL, 0) != 0) {
                 continue;
             }
-            assert(st->opts[si].script != NULL);
-            assert(strlen(st->opts[si].script) > 0);
-
-            sane_opt_value_t value;
-            sane_option_value_init(&value);
-            // push the cleanup-handler to free the value storage
-            pthread_cleanup_push(sane_thread_cleanup_value, &value);
-
-            // get the actual value
-            // but don't query an option twice or more (see config multiple_actions)
-            // because this may reset the values and no other value changes can be
-            // detected
-            int o = 0;
-            bool gotAlready = false;
-            for(o = 0; o < si; o += 1) {
-                if (st->opts[o].number == st->opts[si].number) {
-                    gotAlready = true;
-                    break;
-                }
-            }
-            if (!gotAlready) {
-                // first query of option with this number
-                value = get_sane_option_value(st->h, st->opts[si].number);
-            }
-            else {
-                // additional query, so copy the value
-                slog(SLOG_INFO, "got the value already -> copy");
-                // found: copy the value
-                slog(SLOG_DEBUG, "copy the value of option %d", st->opts[o].number);
-                value.num_value = st->opts[o].value.num_value;
-                if (st->opts[o].value.str_value.str != NULL) {
-                    value.str_value.str = strdup(st->opts[o].value.str_value.str);
-                    assert(value.str_value.str != NULL);
-                }
-            }
+        }
+        for(int i = 0; i < rs->num_actions; i += 1) {
+            sane_bind_action(st, &rs->actions[i], opt, multiple_actions);
+        }
+        for(int i = 0; i < rs->num_functions; i += 1) {
+            sane_bind_function(st, &rs->functions[i], opt);
+        }
+    }
+}
 
-            slog(SLOG_INFO, "checking option %s number %d (%d) for device %s: value: %d",
-                 odesc->name, st->opts[si].number, si,
-                 st->dev->name, value);
-
-            if ((odesc->type == SANE_TYPE_BOOL) || (odesc->type == SANE_TYPE_INT) ||
-                    (odesc->type == SANE_TYPE_FIXED) || (odesc->type == SANE_TYPE_BUTTON)) {
-                if ((st->opts[si].from_value.num_value == st->opts[si].value.num_value) &&
-                        (st->opts[si].to_value.num_value == value.num_value)) {
-                    slog(SLOG_DEBUG, "value trigger: numerical");
-                    st->triggered = true;
-                    st->triggered_option = si;
-                    // we need to trigger all waiting threads
-                    if (pthread_cond_broadcast(&st->cv) < 0) {
-                        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
-                    }
-                }
-            }
-            else if (odesc->type == SANE_TYPE_STRING) {
-                if ((regexec(st->opts[si].from_value.str_value.reg,
-                             st->opts[si].value.str_value.str, 0, NULL, 0) == 0) &&
-                        (regexec(st->opts[si].to_value.str_value.reg,
-                                 value.str_value.str, 0, NULL, 0) == 0)) {
-                    slog(SLOG_DEBUG, "value trigger: string");
-                    st->triggered = true;
-                    st->triggered_option = si;
-                    // we need to trigger all waiting threads
-                    if (pthread_cond_broadcast(&st->cv) < 0) {
-                        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
-                    }
-                }
+// follows a changed option set of the opened device: some backends
+// (de)activate options with the scan mode. The descriptors of the
+// handle are compared in place with st->infos (no backend call), only
+// the options that became (in)active or changed their type or name are
+// matched against the compiled rules again, the other bindings keep
+// their before-values and trigger states. If the tables have no room
+// for the new bindings, they are rebuilt (see sane_poll_rebind()).
+// this function can only be used in the critical region of *st
+static void sane_poll_refresh(sane_thread_t* st) {
+    assert(st != NULL);
+    st->options_changed = false;
+    if ((st->h == NULL) || (st->infos == NULL)) {
+        // the descriptors of a closed device are gone
+        return;
+    }
+    int changed = 0;
+    int actions = 0;
+    int functions = 0;
+    for(int opt = 1; opt < st->num_of_options; opt += 1) {
+        sane_opt_info_t* info = &st->infos[opt];
+        info->changed = sane_info_differs(info, st->descs[opt]);
+        if (!info->changed) {
+            continue;
+        }
+        changed += 1;
+        sane_info_set(info, st->descs[opt]);
+        if (!sane_option_usable(info)) {
+            continue;
+        }
+        sane_count_option(&cfg_rules->global, info->name, &actions, &functions);
+        for(int loc = 0; loc < cfg_rules->num_devices; loc += 1) {
+            const cfg_rule_section_t* loc_i = &cfg_rules->devices[loc];
+            if (regexec(&loc_i->filter_reg, st->dev->name, 0, NULL, 0) == 0) {
+                sane_count_option(loc_i, info->name, &actions, &functions);
             }
-            else {
-                assert(false);
+        }
+    }
+    if (changed == 0) {
+        return;
+    }
+    SCANBD_PROBE2(options__changed, st->dev->name, changed);
+
+    for(int opt = 1; opt < st->num_of_options; opt += 1) {
+        if (st->infos[opt].changed) {
+            sane_unbind_option(st, opt);
+        }
+    }
+    if ((st->num_of_options_with_scripts + actions > st->opts_capacity) ||
+        (st->num_of_options_with_functions + functions > st->functions_capacity)) {
+        slog(SLOG_INFO, "%d options of device %s changed, rebuilding the tables",
+             changed, st->dev->name);
+        sane_poll_rebind(st);
+        return;
+    }
+    for(int opt = 1; opt < st->num_of_options; opt += 1) {
+        if (st->infos[opt].changed && sane_option_usable(&st->infos[opt])) {
+            sane_bind_option(st, opt);
+        }
+    }
+    // the functions are the variables of the environment
+    script_env_free(&st->env);
+    script_env_init(&st->env, st->dev->name, st->num_of_options_with_functions);
+    sane_state_publish(st);
+    slog(SLOG_INFO, "%d options of device %s changed: %d actions, %d functions",
+         changed, st->dev->name, st->num_of_options_with_scripts,
+         st->num_of_options_with_functions);
+}
+
+// queues the script of the triggered action to the action executor:
+// builds the environment, sends the signals and releases the device
+// to the script, the device is reopened after the queued scripts have
+// finished
+// this function can only be used in the critical region of *st
+static void sane_trigger(sane_thread_t* st) {
+    assert(st != NULL);
+
+    assert(st->triggered_option >= 0); // index into the opts-array
+    assert(st->triggered_option < st->num_of_options_with_scripts);
+
+    slog(SLOG_ERROR, "trigger action for option[%d] for device %s with script %s",
+         st->opts[st->triggered_option].number, st->dev->name,
+         st->opts[st->triggered_option].rule->script);
+    SCANBD_PROBE2(trigger, st->dev->name, st->opts[st->triggered_option].rule->title);
+
+    // prepare the environment for the script to be called:
+    // the static part was built when the device was opened, only
+    // the values of the function-options and the action are added
+    for(int e = 0; e < st->num_of_options_with_functions; e += 1) {
+        const SANE_Option_Descriptor* fdesc = st->descs[st->functions[e].number];
+
+        // if the function-option is the same as an
+        // action-option, the snapshot holds the value
+        // already and the option isn't re-queried, because
+        // it is (may be) reset after the query by the backend
+        // (if the device is released, the snapshot holds the last
+        // values)
+        const sane_opt_value_t* v = sane_snapshot_value(st, st->functions[e].number);
+        if (fdesc == NULL) {
+            script_env_set(&st->env, e, st->functions[e].env,
+                           v->str_value.str, v->num_value);
+        }
+        else if ((fdesc->type == SANE_TYPE_BOOL) || (fdesc->type == SANE_TYPE_INT) ||
+                (fdesc->type == SANE_TYPE_FIXED) || (fdesc->type == SANE_TYPE_BUTTON)) {
+            script_env_set(&st->env, e, st->functions[e].env, NULL, v->num_value);
+        }
+        else if (fdesc->type == SANE_TYPE_STRING) {
+            script_env_set(&st->env, e, st->functions[e].env,
+                           v->str_value.str ? v->str_value.str : "", 0);
+        }
+        else {
+            assert(false);
+        }
+    }
+    if (atomic_load(&st->stop)) {
+        // stopped while the backend was queried: the poller may be
+        // abandoned and its rules gone (see sane_thread_destroy())
+        st->triggered = false;
+        st->triggered_option = -1; // invalid
+        return;
+    }
+    char** env = script_env_build(&st->env, st->opts[st->triggered_option].rule->title);
+    if (env == NULL) {
+        st->triggered = false;
+        st->triggered_option = -1; // invalid
+        if (pthread_cond_broadcast(&st->cv) < 0) {
+            slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
+        }
+        return;
+    }
+
+    // sendout an dbus-signal with all the values as
+    // arguments
+    dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_BEGIN, st->dev->name);
+
+    //dbus_send_signal_argv_async(SCANBD_DBUS_SIGNAL_TRIGGER, env);
+    dbus_send_trigger(st->dev->name, st->opts[st->triggered_option].rule->title, env);
+    status_triggered(st->status, st->opts[st->triggered_option].rule->title);
+    metrics_trigger(st->dev->name, st->opts[st->triggered_option].rule->title);
+
+    // the action-script will use the device,
+    // so we have to release the device
+    // (and the descriptors with it), unless the scripts of this
+    // device don't need exclusive access
+    if ((st->h != NULL) && !st->keep_open) {
+        sane_dev_close(st);
+        sane_snapshot_descriptors(st);
+    }
+
+    assert(st->opts[st->triggered_option].rule->script);
+    assert(strlen(st->opts[st->triggered_option].rule->script) > 0);
+
+    // the script path was made absolute when the config was compiled,
+    // the executor keeps a copy (a reload may replace the rules)
+    const char* script_abs = st->opts[st->triggered_option].rule->script;
+    assert(script_abs);
+
+    // the executor takes over the env
+    assert(st->interval.timeout > 0);
+    action_queue_submit(&st->actions, script_abs, env, st->interval.timeout);
+
+    st->triggered = false;
+    st->triggered_option = -1; // invalid
+    // we need to trigger all waiting threads
+    if (pthread_cond_broadcast(&st->cv) < 0) {
+        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
+    }
+}
+
+// polls all matched options of the device once and queues the script
+// of a triggered action
+// returns the number of ms until the next poll is due or -1 if the
+// polling of this device should be abandoned
+// this function can only be used in the critical region of *st
+static int sane_poll_once(sane_thread_t* st) {
+    assert(st != NULL);
+    SANE_Status status = SANE_STATUS_INVAL;
+    // some option value changed in this cycle
+    bool activity = false;
+
+    if (st->parked) {
+        // the device is used by saned, remote triggers stay pending
+        if (st->h != NULL) {
+            // opened by the first cycle after the acquire
+            sane_dev_close(st);
+            sane_snapshot_descriptors(st);
+        }
+        return st->interval.timeout;
+    }
+
+    // a remote trigger (dbus) of this device
+    int action = trigger_mailbox_take(st->ref.id, st->ref.generation);
+    if (action >= 0) {
+        if (action < st->num_of_options_with_scripts) {
+            slog(SLOG_DEBUG, "remote trigger of action %d for device %s",
+                 action, st->dev->name);
+            st->triggered = true;
+            st->triggered_option = action;
+            sane_trigger(st);
+            return poll_interval_next(&st->interval, true);
+        }
+        slog(SLOG_WARN, "No such action %d for device number %d", action,
+             atomic_load(&st->index));
+    }
+
+    if (st->h == NULL) {
+        // the device is released to the action scripts
+        if (action_queue_busy(&st->actions)) {
+            // parked until the queued scripts have finished
+            return st->interval.timeout;
+        }
+        slog(SLOG_DEBUG, "reopen device %s", st->dev->name);
+        struct timespec start;
+        stats_now(&start);
+        if ((status = sane_dev_open(st)) != SANE_STATUS_GOOD) {
+            slog(SLOG_ERROR, "Can't open device %s, %s",
+                 st->dev->name, sane_strstatus(status));
+            st->h = NULL;
+            if (status == SANE_STATUS_ACCESS_DENIED) {
+                slog(SLOG_WARN, "abandon polling of %s", st->dev->name);
+                return -1;
             }
-            // free the previous allocated value
-            sane_option_value_free(&st->opts[si].value);
+            return st->interval.timeout;
+        }
+        // the descriptors of the new handle, the option set may have
+        // changed meanwhile (e.g. the mode set by a scan)
+        sane_snapshot_descriptors(st);
+        st->options_changed = true;
+        stats_record(st->stats, STATS_REOPEN, stats_since(&start));
+        status_reopened(st->status);
+        if (atomic_load(&st->stop)) {
+            // stopped while reopening: the rules may be gone
+            return -1;
+        }
+    }
 
-            // pass the responsibility to free the value to the main
-            // thread, if this thread gets canceled
-            if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) < 0) {
-                slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
+    // a new snapshot of the option values
+    st->cycle += 1;
+    if (st->options_changed) {
+        // the before-values of the rebound options are the values of
+        // this cycle
+        sane_poll_refresh(st);
+    }
+    if (!sane_snapshot_prefetch(st)) {
+        // the helper is restarted by the reopen
+        return st->interval.timeout;
+    }
+    struct timespec now;
+    stats_now(&now);
+    // the subscribers get the changed values, a new subscriber all
+    unsigned int state_gen = dbus_state_generation();
+    bool state_all = (state_gen != 0) && (state_gen != st->state_gen);
+
+    int si = 0;
+    for(si = 0; si < st->num_of_options_with_scripts; si += 1) {
+        const SANE_Option_Descriptor* odesc = st->descs[st->opts[si].number];
+        if (odesc == NULL) {
+            slog(SLOG_WARN, "No descriptor for option[%d] for device %s",
+                 st->opts[si].number, st->dev->name);
+            continue;
+        }
+
+        assert(st->opts[si].rule != NULL);
+        if (st->opts[si].rule->script != NULL) {
+            if (strlen(st->opts[si].rule->script) <= 0) {
+                slog(SLOG_WARN, "No valid script for option %s for device %s",
+                     odesc->name, st->dev->name);
+                continue;
             }
-            st->opts[si].value = value;
-            pthread_cleanup_pop(0);
-            if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) < 0) {
-                slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
+        }
+        else {
+            slog(SLOG_WARN, "No script for option %s for device %s",
+                 odesc->name, st->dev->name);
+            continue;
+        }
+        assert(st->opts[si].rule->script != NULL);
+        assert(strlen(st->opts[si].rule->script) > 0);
+
+        // get the actual value
+        // but don't query an option twice or more (see config multiple_actions)
+        // because this may reset the values and no other value changes can be
+        // detected: the snapshot queries each option only once per cycle
+        const sane_opt_value_t* value = sane_snapshot_value(st, st->opts[si].number);
+        if (atomic_load(&st->stop)) {
+            // stopped while the backend was queried: the poller may be
+            // abandoned and its rules gone (see sane_thread_destroy())
+            return -1;
+        }
+
+        slog(SLOG_INFO, "checking option %s number %d (%d) for device %s: value: %d",
+             odesc->name, st->opts[si].number, si,
+             st->dev->name, value->num_value);
+
+        // the fast path of an idle cycle: an unchanged value of a
+        // settled trigger can't fire
+        bool changed = !sane_option_value_equal(value, &st->opts[si].value);
+        if ((state_gen != 0) && (changed || state_all)) {
+            dbus_send_state(st->dev->name, odesc->name, (long)(SANE_Word)value->num_value,
+                            value->str_value.str);
+        }
+        if (!changed && predicate_settled(&st->opts[si].rule->pred, &st->opts[si].state)) {
+            continue;
+        }
+
+        // the compiled trigger: ranges, literal string compares,
+        // debounce and hold (see predicate.h)
+        unsigned int cls = sane_option_class(&st->opts[si].rule->pred, odesc->type, value);
+        if (predicate_eval(&st->opts[si].rule->pred, &st->opts[si].state, cls, &now)) {
+            slog(SLOG_DEBUG, "value trigger: %s",
+                 (odesc->type == SANE_TYPE_STRING) ? "string" : "numerical");
+            st->triggered = true;
+            st->triggered_option = si;
+            // we need to trigger all waiting threads
+            if (pthread_cond_broadcast(&st->cv) < 0) {
+                slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
             }
+        }
+        if (changed) {
+            activity = true;
+            // keep the value as the before-value of the next cycle
+            sane_option_value_assign(&st->opts[si].value, value);
+            const sane_opt_info_t* info = &st->infos[st->opts[si].number];
+            poll_state_update(st->dev->name, info->name, info->type, value->num_value,
+                              value->str_value.str, NULL);
+        }
 
-            // was there a value change?
-            if (st->triggered && (st->triggered_option >= 0)) {
-                assert(st->triggered_option >= 0); // index into the opts-array
-                assert(st->triggered_option < st->num_of_options_with_scripts);
-
-                slog(SLOG_ERROR, "trigger action for %s for device %s with script %s",
-                     odesc->name, st->dev->name, st->opts[st->triggered_option].script);
-
-                // prepare the environment for the script to be called
-
-                // number of env-vars =
-                // number of found function-options
-                // plus the values in the environment-section (2):
-                // device, action
-                // plus those 4:
-                // PATH, PWD, USER, HOME
-                // plus the sentinel
-                cfg_t* global_envs = cfg_getsec(cfg_sec_global, C_ENVIRONMENT);
-
-                int number_of_envs = st->num_of_options_with_functions + 4 + 2 + 1;
-                char** env = calloc(number_of_envs, sizeof(char*));
-                for(int e = 0; e < number_of_envs; e += 1) {
-                    env[e] = calloc(NAME_MAX + 1, sizeof(char));
-                }
-                int e = 0;
-                for(e = 0; e < st->num_of_options_with_functions; e += 1) {
-                    const SANE_Option_Descriptor* fdesc = NULL;
-                    fdesc = sane_get_option_descriptor(st->h,
-                                                       st->functions[e].number);
-                    assert(fdesc);
-
-                    // check if the function-option is the same
-                    // as a action-option. If so, use the
-                    // action-option value instead of re-get the same
-                    // option value, because it is (may be) reset
-                    // after the query by the backend
-
-                    sane_opt_value_t v;
-                    sane_option_value_init(&v);
-                    int o = 0;
-                    for(o = 0; o < st->num_of_options_with_scripts; o += 1) {
-                        if (st->opts[o].number == st->functions[e].number) {
-                            break;
-                        }
-                    }
-                    if (o == st->num_of_options_with_scripts) {
-                        // not found: query the value
-                        v = get_sane_option_value(st->h, st->functions[e].number);
-                    }
-                    else {
-                        slog(SLOG_DEBUG, "don't re-get the value");
-                    }
-                    if ((fdesc->type == SANE_TYPE_BOOL) || (fdesc->type == SANE_TYPE_INT) ||
-                            (fdesc->type == SANE_TYPE_FIXED) || (odesc->type == SANE_TYPE_BUTTON)) {
-                        snprintf(env[e], NAME_MAX, "%s=%lu", st->functions[e].env,
-                                 v.num_value);
-                        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    }
-                    else if (fdesc->type == SANE_TYPE_STRING) {
-                        snprintf(env[e], NAME_MAX, "%s=%s", st->functions[e].env,
-                                 v.str_value.str);
-                        slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    }
-                    else {
-                        assert(false);
-                    }
-                    sane_option_value_free(&v);
-                }
-                const char* ev = "PATH";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, "/usr/sbin:/usr/bin:/sbin:/bin");
-                    slog(SLOG_DEBUG, "No PATH, setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = "PWD";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    char buf[PATH_MAX+1];
-                    char* ptr = getcwd(buf, PATH_MAX);
-                    if (!ptr) {
-                        slog(SLOG_ERROR, "can't get pwd");
-                    }
-                    else {
-                        assert(ptr);
-                        snprintf(env[e], NAME_MAX, "%s=%s", ev, ptr);
-                        slog(SLOG_DEBUG, "No PWD, setting env: %s", env[e]);
-                        e += 1;
-                    }
-                }
-                ev = "USER";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    struct passwd* pwd = NULL;
-                    pwd = getpwuid(geteuid());
-                    assert(pwd);
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, pwd->pw_name);
-                    slog(SLOG_DEBUG, "No USER, setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = "HOME";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    struct passwd* pwd = 0;
-                    pwd = getpwuid(geteuid());
-                    assert(pwd);
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, pwd->pw_dir);
-                    slog(SLOG_DEBUG, "No HOME, setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = cfg_getstr(global_envs, C_DEVICE);
-                if (ev != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, st->dev->name);
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = cfg_getstr(global_envs, C_ACTION);
-                if (ev != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev,
-                             st->opts[st->triggered_option].action_name);
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                env[e] = NULL;
-                assert(e == number_of_envs-1);
-
-                // sendout an dbus-signal with all the values as
-                // arguments
-                dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_BEGIN, st->dev->name);
-
-                //dbus_send_signal_argv_async(SCANBD_DBUS_SIGNAL_TRIGGER, env);
-                dbus_send_signal_argv(SCANBD_DBUS_SIGNAL_TRIGGER, env);
-                // the action-script will use the device,
-                // so we have to release the device
-                sane_close(st->h);
-                st->h = NULL;
-
-                assert(st->triggered_option >= 0);
-                assert(st->opts[st->triggered_option].script);
-                assert(strlen(st->opts[st->triggered_option].script) > 0);
-
-                // need to copy the values because we leave the
-                // critical section
-                // While doing so, convert the script to an absolute path
-                // int triggered_option = st->triggered_option;
-          
-                char *script_abs = 
-                     make_script_path_abs(st->opts[st->triggered_option].script);
-                
-                assert(script_abs);
-
-                // leave the critical section
-                if (pthread_mutex_unlock(&st->mutex) < 0) {
-                    // if we can't unlock the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
+        // was there a value change?
+        if (st->triggered && (st->triggered_option >= 0)) {
+            activity = true;
+            sane_trigger(st);
+            // the device is released to the script, the remaining
+            // options are checked after the reopen
+            sane_snapshot_carry(st, si);
+            break;
+        }
+    } // foreach option
+    if (si == st->num_of_options_with_scripts) {
+        st->state_gen = state_gen;
+    }
+    return poll_interval_next(&st->interval, activity);
+}
 
-                if (strcmp(script_abs, SCANBD_NULL_STRING) != 0) {
-
-                    assert(timeout > 0);
-                    usleep(timeout * 1000); //ms
-
-                    pid_t cpid;
-                    if ((cpid = fork()) < 0) {
-                        slog(SLOG_ERROR, "Can't fork: %s", strerror(errno));
-                    }
-                    else if (cpid > 0) { // parent
-                        slog(SLOG_INFO, "waiting for child: %s", script_abs);
-                        int status;
-                        if (waitpid(cpid, &status, 0) < 0) {
-                            slog(SLOG_ERROR, "waitpid: %s", strerror(errno));
-                        }
-                        if (WIFEXITED(status)) {
-                            slog(SLOG_INFO, "child %s exited with status: %d",
-                                 script_abs, WEXITSTATUS(status));
-                        }
-                        if (WIFSIGNALED(status)) {
-                            slog(SLOG_INFO, "child %s signaled with signal: %d",
-                                 script_abs, WTERMSIG(status));
-                        }
-                    }
-                    else { // child
-                        uid_t euid = geteuid();
-                        uid_t egid = getegid();
-                        if (seteuid(0) < 0) {
-                            slog(SLOG_DEBUG, "Can't seteuid root: %s", strerror(errno));
-                            exit(EXIT_FAILURE);
-                        } 
-                        if (setegid(0) < 0) {
-                            slog(SLOG_DEBUG, "Can't setegid root: %s", strerror(errno));
-                            exit(EXIT_FAILURE);
-                        } 
-                        slog(SLOG_DEBUG, "setgid to gid=%d", egid);
-                        if (setgid(egid) < 0) {
-                            slog(SLOG_DEBUG, "Can't setgid for gid=%d: %s", egid, strerror(errno));
-                            exit(EXIT_FAILURE);
-                        } 
-                        slog(SLOG_DEBUG, "setuid to uid=%d", euid);
-                        if (setuid(euid) < 0) {
-                            slog(SLOG_DEBUG, "Can't setuid for uid=%d : %s", euid, strerror(errno));
-                            exit(EXIT_FAILURE);
-                        } 
-                        
-                        slog(SLOG_DEBUG, "exec for %s", script_abs);
-                        if (access(script_abs, F_OK | X_OK) < 0) {
-                            slog(SLOG_ERROR, "access: %s", strerror(errno));
-                        }
-                        struct stat stat_buf;
-                        if (stat(script_abs, &stat_buf) < 0) {
-                            slog(SLOG_ERROR, "stat: %s", strerror(errno));
-                        }
-                        else {
-                            slog(SLOG_DEBUG, "octal mode for %s: %lo", script_abs, stat_buf.st_mode);
-                            slog(SLOG_DEBUG, "file uid: %ld, file gid: %ld", stat_buf.st_uid, stat_buf.st_gid);
-                        }
-                        if (execle(script_abs, script_abs, NULL, env) < 0) {
-                            slog(SLOG_ERROR, "execlp: %s", strerror(errno));
-                        }
-                        exit(EXIT_FAILURE); // not reached
-                    }
-                } // script_abs == SCANBD_NULL_STRING
-
-                assert(script_abs != NULL);
-                free(script_abs);
-
-                // free (last element is the sentinel!)
-                assert(env != NULL);
-                for(int e = 0; e < number_of_envs - 1; e += 1) {
-                    assert(env[e] != NULL);
-                    free(env[e]);
-                }
-                free(env);
+// the idle park (see poll_interval_t): a parked device is closed, so
+// it can autosuspend, each heartbeat opens it for one poll cycle
+// this function can only be used in the critical region of *st
+static void sane_poll_park(sane_thread_t* st, bool idle) {
+    assert(st != NULL);
+    if (!st->interval.idle) {
+        if (idle) {
+            slog(SLOG_INFO, "device %s resumed", st->dev->name);
+            stats_record(st->stats, STATS_PARKED, stats_since(&st->interval.parked));
+        }
+        return;
+    }
+    if (!idle) {
+        slog(SLOG_INFO, "device %s idle for %d s, parked", st->dev->name,
+             st->interval.park_idle);
+    }
+    if ((st->h != NULL) && !action_queue_busy(&st->actions)) {
+        sane_dev_close(st);
+        sane_snapshot_descriptors(st);
+    }
+}
 
-                // enter the critical section
-                if (pthread_mutex_lock(&st->mutex) < 0) {
-                    // if we can't get the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
+// the poll budget of the backend (see C_POLL_RATE): the reads since
+// the last charge move the time the device may be read again by
+// reads / poll_rate s, a wake-up or a burst doesn't read earlier
+// returns the ms until the device may be read, 0: now
+// this function can only be used in the critical region of *st
+static int sane_budget(sane_thread_t* st) {
+    if (st->poll_rate <= 0) {
+        st->reads = 0;
+        return 0;
+    }
+    struct timespec now;
+    stats_now(&now);
+    if (st->reads > 0) {
+        if ((st->budget.tv_sec < now.tv_sec) ||
+            ((st->budget.tv_sec == now.tv_sec) && (st->budget.tv_nsec < now.tv_nsec))) {
+            st->budget = now;
+        }
+        long ms = (long)st->reads * 1000L / st->poll_rate;
+        st->budget.tv_sec += ms / 1000;
+        st->budget.tv_nsec += (ms % 1000) * 1000000L;
+        if (st->budget.tv_nsec >= 1000000000L) {
+            st->budget.tv_sec += 1;
+            st->budget.tv_nsec -= 1000000000L;
+        }
+        st->reads = 0;
+    }
+    long ms = (st->budget.tv_sec - now.tv_sec) * 1000L +
+        (st->budget.tv_nsec - now.tv_nsec) / 1000000L;
+    return (ms > 0) ? (int)ms : 0;
+}
 
-                st->triggered = false;
-                st->triggered_option = -1; // invalid
-                // we need to trigger all waiting threads
-                if (pthread_cond_broadcast(&st->cv) < 0) {
-                    slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
-                }
+// one polling cycle (see sane_poll_once()), records the poll jitter
+// this function can only be used in the critical region of *st
+static int sane_poll_cycle(sane_thread_t* st) {
+    assert(st != NULL);
+    // the reads of the open or of the previous cycle
+    int wait = sane_budget(st);
+    if (wait > 0) {
+        return wait;
+    }
+    bool idle = st->interval.idle;
+    if (idle && !st->parked) {
+        stats_record(st->stats, STATS_WAKEUP, stats_since(&st->interval.heartbeat));
+        stats_now(&st->interval.heartbeat);
+    }
+    else {
+        stats_poll_begin(st->stats, &st->due);
+    }
+    SCANBD_PROBE1(poll__start, st->dev->name);
+    int delay = sane_poll_once(st);
+    SCANBD_PROBE2(poll__end, st->dev->name, delay);
+    if (delay >= 0) {
+        wait = sane_budget(st);
+        if (delay < wait) {
+            delay = wait;
+        }
+        sane_poll_park(st, idle);
+        stats_poll_end(&st->due, delay);
+        if (st->parked) {
+            status_state(st->status, STATUS_PARKED);
+        }
+        else {
+            status_polled(st->status, (st->h != NULL) ? STATUS_OPEN :
+                          (st->interval.idle ? STATUS_IDLE : STATUS_RELEASED));
+        }
+    }
+    return delay;
+}
 
-                // leave the critical section
-                if (pthread_mutex_unlock(&st->mutex) < 0) {
-                    // if we can't release the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
-                // sleep the timeout to settle devices, necessary?
-                usleep(timeout * 1000); //ms
+// sleeps delay ms, a wake-up (see sane_wake()) ends the sleep early
+// the mutex of st must be held (not the I/O token), it is released
+// while sleeping
+static void sane_poll_sleep(sane_thread_t* st, int delay) {
+    assert(st != NULL);
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += delay / 1000;
+    until.tv_nsec += (long)(delay % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec += 1;
+        until.tv_nsec -= 1000000000L;
+    }
+    while(!st->woken && !atomic_load(&st->stop)) {
+        int ret = pthread_cond_timedwait(&st->cv, &st->mutex, &until);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_timedwait: %s", strerror(ret));
+            break;
+        }
+    }
+    st->woken = false;
+}
 
-                // send out the debus signal
-                dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_END, st->dev->name);
+// wakes the poller up after a remote trigger: the trigger is taken
+// now instead of after the poll interval, a parked device resumes
+// the registry calls this function (see registry_wake()), st can't
+// vanish meanwhile
+// the poll interval belongs to the holder of the I/O token, the
+// resume is taken over by the next step (see sane_io_enter())
+static void sane_wake(void* arg) {
+    sane_thread_t* st = (sane_thread_t*)arg;
+    assert(st != NULL);
+    if (pthread_mutex_lock(&st->mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    st->resume = true;
+    if (st->scheduled) {
+        poll_scheduler_wake(&st->job);
+    }
+    else {
+        st->woken = true;
+        if (pthread_cond_broadcast(&st->cv) < 0) {
+            slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
+        }
+    }
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// takes the I/O token of st (enters the critical region of *st),
+// waits until the actual holder has returned it (or until deadline,
+// NULL: no limit), a pending resume (see sane_wake()) is taken over
+// returns false if the holder is stuck in a backend call beyond the
+// deadline, the token isn't taken
+static bool sane_io_enter_until(sane_thread_t* st, const struct timespec* deadline) {
+    assert(st != NULL);
+    if (pthread_mutex_lock(&st->mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    while(st->io_busy) {
+        int ret = (deadline != NULL)
+            ? pthread_cond_timedwait(&st->cv, &st->mutex, deadline)
+            : pthread_cond_wait(&st->cv, &st->mutex);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(ret));
+        }
+    }
+    bool taken = !st->io_busy;
+    bool resume = false;
+    if (taken) {
+        st->io_busy = true;
+        resume = st->resume;
+        st->resume = false;
+    }
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (resume && poll_interval_wake(&st->interval)) {
+        slog(SLOG_DEBUG, "wake up of parked device %s", st->dev->name);
+    }
+    return taken;
+}
+
+// takes the I/O token of st, waits as long as the holder needs
+static void sane_io_enter(sane_thread_t* st) {
+    sane_io_enter_until(st, NULL);
+}
+
+// returns the I/O token of st (leaves the critical region of *st)
+static void sane_io_leave(sane_thread_t* st) {
+    assert(st != NULL);
+    if (pthread_mutex_lock(&st->mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    st->io_busy = false;
+    if (pthread_cond_broadcast(&st->cv) < 0) {
+        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
+    }
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
 
-                // enter the critical section
-                if (pthread_mutex_lock(&st->mutex) < 0) {
-                    // if we can't get the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
+// one step of the poller: the first step opens the device (unless a
+// script of the previous poller still uses it, see
+// action_queue_busy()), afterwards each step is one polling cycle
+// returns the number of ms until the next step is due or -1 if the
+// polling of this device should be abandoned
+// this function can only be used in the critical region of *st
+static int sane_poll_step(sane_thread_t* st) {
+    assert(st != NULL);
+    if (!st->opened) {
+        if (st->parked) {
+            // used by saned, opened after the release
+            return C_TIMEOUT_DEF;
+        }
+        if (action_queue_busy(&st->actions)) {
+            slog(SLOG_DEBUG, "device %s still used by a script", st->dev->name);
+            return C_TIMEOUT_DEF;
+        }
+        if (!sane_poll_open(st)) {
+            return -1;
+        }
+        st->opened = true;
+        slog(SLOG_DEBUG, "Start the polling for device %s", st->dev->name);
+    }
+    slog(SLOG_DEBUG, "polling device %s", st->dev->name);
+    return sane_poll_cycle(st);
+}
 
-                slog(SLOG_DEBUG, "reopen device %s", st->dev->name);
-                if ((status = sane_open(st->dev->name, &st->h)) != SANE_STATUS_GOOD) {
-                    slog(SLOG_ERROR, "Can't open device %s, %s",
-                         st->dev->name, sane_strstatus(status));
-                    if (status == SANE_STATUS_ACCESS_DENIED) {
-                        slog(SLOG_WARN, "abandon polling of %s", st->dev->name);
-                        pthread_exit(NULL);
-                    }
-                }
-            } // if triggered
-        } // foreach option
+// the (stopped) poller st has ended its last cycle: a poller abandoned
+// meanwhile (see sane_thread_destroy()) isn't stuck anymore
+static void sane_thread_ended(sane_thread_t* st) {
+    assert(st != NULL);
+    if (pthread_mutex_lock(&sane_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    st->stopped = true;
+    if (st->abandoned) {
+        sane_stuck -= 1;
+        slog(SLOG_INFO, "abandoned poller of device %s has ended", st->dev->name);
+        // its replacement has another record
+        status_device_put(st->status);
+        st->status = NULL;
+        stats_device_put(st->stats);
+        st->stats = NULL;
+    }
+    if (pthread_cond_broadcast(&sane_stop_cv)) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+    if (pthread_mutex_unlock(&sane_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
 
-        // release the mutex
+// thread start funktion
+// the thread ends cooperatively: a stop (see sane_thread_stop()) ends
+// the sleep, the actual cycle is completed
 
-        // because pthread_cleanup_pop is a macro we can't use it here
-        // pthread_cleanup_pop(1);
+static void* sane_poll(void* arg) {
+    sane_thread_t* st = (sane_thread_t*)arg;
+    assert(st != NULL);
+    slog(SLOG_DEBUG, "sane_poll");
+    // we only expect the main thread to handle signals
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    
+    // this thread uses the device and the san_thread_t datastructure
+    // while it holds the I/O token, the mutex is only held to sleep
+    // the first step always places the thread: the policy is unset
+    cfg_priority_t priority = CFG_PRIORITY_NORMAL;
+    cpu_policy_t policy;
+    cpu_policy_init(&policy);
+    while(!atomic_load(&st->stop)) {
+        sane_io_enter(st);
+        int delay = sane_poll_step(st);
+        bool changed = (st->priority != priority) || !cpu_policy_equal(&st->policy, &policy);
+        priority = st->priority;
+        policy = st->policy;
+        sane_io_leave(st);
+        if (changed) {
+            // matched (or reloaded) with another class or policy
+            poll_thread_priority(priority, &policy);
+        }
+        if (delay < 0) {
+            break;
+        }
+        // sleep the polling timeout (or until woken up or stopped),
+        // the mutex is released meanwhile
+        if (pthread_mutex_lock(&st->mutex) < 0) {
+            // if we can't get the mutex, something is heavily wrong!
+            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+            break;
+        }
+        sane_poll_sleep(st, delay);
         if (pthread_mutex_unlock(&st->mutex) < 0) {
             // if we can't unlock the mutex, something is heavily wrong!
             slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-            pthread_exit(NULL);
         }
+    }
+    slog(SLOG_DEBUG, "polling thread for %s ends", st->dev->name);
+    sane_thread_ended(st);
+    return NULL;
+}
 
-        // sleep the polling timeout
-        usleep(timeout * 1000); //ms
+// job function of the poll scheduler: each run is one step of the
+// poller (see sane_poll_step())
+static int sane_poll_job(void* arg) {
+    sane_thread_t* st = (sane_thread_t*)arg;
+    assert(st != NULL);
 
-        // regain the mutex
-        // because pthread_cleanup_push is a macro we can't use it here
-//         pthread_cleanup_push(sane_thread_cleanup_mutex, ((void*)&st->mutex));
-        if (pthread_mutex_lock(&st->mutex) < 0) {
-            // if we can't get the mutex, something is heavily wrong!
-            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-            pthread_exit(NULL);
-        }
+    if (atomic_load(&st->stop)) {
+        return -1;
+    }
+    sane_io_enter(st);
+    int delay = sane_poll_step(st);
+    sane_io_leave(st);
+    if (atomic_load(&st->stop)) {
+        // the job isn't run again
+        sane_thread_ended(st);
     }
-    pthread_cleanup_pop(1); // release the mutex
-    pthread_exit(NULL);
+    return delay;
 }
 
 // helper to trigger a specified action from another thread
-// (e.g. dbus) via an action number
+// (e.g. dbus) via an action number: posts the action to the trigger
+// mailbox of the device, the polling thread (or job) of the device
+// queues the script in its next cycle
 void sane_trigger_action(int number_of_dev, int action) {
-    assert(number_of_dev >= 0);
-    assert(action >= 0);
+    // the numbers come from remote, trigger_mailbox_post() checks them
     slog(SLOG_DEBUG, "sane_trigger_action device=%d, action=%d", number_of_dev, action);
 
-    if (pthread_mutex_lock(&sane_mutex) < 0) {
-        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    registry_ref_t ref;
+    if (!registry_resolve(number_of_dev, &ref)) {
+        slog(SLOG_WARN, "No such device number %d", number_of_dev);
+        return;
+    }
+    if (!trigger_mailbox_post(ref.id, ref.generation, action)) {
+        slog(SLOG_WARN, "trigger of action %d for device number %d rejected",
+             action, number_of_dev);
         return;
     }
-    if (num_devices <= 0) {
-        slog(SLOG_WARN, "No devices at all");
-        goto cleanup_sane;
+    registry_wake(&ref);
+}
+
+// as sane_trigger_action(), but for the device name: unlike a device
+// number the name can't refer to another device after a rediscovery
+void sane_trigger_device(const char* name, int action) {
+    assert(name != NULL);
+    slog(SLOG_DEBUG, "sane_trigger_device device=%s, action=%d", name, action);
+
+    registry_ref_t ref;
+    if (registry_lookup(name, NULL, &ref) == NULL) {
+        slog(SLOG_WARN, "No such device %s", name);
+        return;
     }
-    if (number_of_dev >= num_devices) {
-        slog(SLOG_WARN, "No such device number %d", number_of_dev);
-        goto cleanup_sane;
+    if (!trigger_mailbox_post(ref.id, ref.generation, action)) {
+        slog(SLOG_WARN, "trigger of action %d for device %s rejected", action, name);
+        return;
     }
+    registry_wake(&ref);
+}
 
-    while(sane_poll_threads == NULL) {
-        // no devices actually polling
-        slog(SLOG_WARN, "No polling at the moment, waiting ...");
-        if (pthread_cond_wait(&sane_cv, &sane_mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_cond_wait: ", strerror(errno));
-            goto cleanup_sane;
+// allocates the datastructure for the polling thread of device dev
+// and starts the thread
+// the sane_mutex must be held by the caller
+static sane_thread_t* sane_thread_create(const SANE_Device* dev, int index) {
+    assert(dev != NULL);
+    slog(SLOG_DEBUG, "Starting poll thread for %s", dev->name);
+
+    sane_thread_t* st = (sane_thread_t*) calloc(1, sizeof(sane_thread_t));
+    if (st == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for polling thread");
+        return NULL;
+    }
+    st->device.name = strdup(dev->name);
+    st->device.vendor = strdup(dev->vendor ? dev->vendor : SCANBD_NULL_STRING);
+    st->device.model = strdup(dev->model ? dev->model : SCANBD_NULL_STRING);
+    st->device.type = strdup(dev->type ? dev->type : SCANBD_NULL_STRING);
+    if (!st->device.name || !st->device.vendor || !st->device.model || !st->device.type) {
+        slog(SLOG_ERROR, "Can't allocate memory for device description");
+        free((char*)st->device.name);
+        free((char*)st->device.vendor);
+        free((char*)st->device.model);
+        free((char*)st->device.type);
+        free(st);
+        return NULL;
+    }
+    st->tid = 0;
+    st->dev = &st->device;
+    st->h = 0;
+    st->helper = NULL;
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    if (cfg_getbool(cfg_sec_global, C_POLL_HELPER)) {
+        st->helper = poll_helper_new(st->device.name,
+                                     cfg_getint(cfg_sec_global, C_POLL_HELPER_TIMEOUT));
+        if (st->helper == NULL) {
+            slog(SLOG_WARN, "polling %s without a helper", st->device.name);
         }
     }
-    assert(sane_poll_threads != NULL);
-    sane_thread_t* st = &sane_poll_threads[number_of_dev];
+    st->tables = sane_tables_get();
+    st->opts = NULL;
+    st->functions = NULL;
+    st->opts_capacity = 0;
+    st->functions_capacity = 0;
+    st->num_of_options = 0;
+    st->triggered = false;
+    st->triggered_option = -1;
+    st->num_of_options_with_scripts = 0;
+    st->num_of_options_with_functions = 0;
+    st->scheduled = false;
+    st->opened = false;
+    st->priority = CFG_PRIORITY_NORMAL;
+    st->woken = false;
+    st->resume = false;
+    st->io_busy = false;
+    atomic_init(&st->stop, false);
+    st->stopped = false;
+    st->abandoned = false;
+    atomic_init(&st->index, index);
+    st->stats = stats_device(st->dev->name);
+    st->status = status_device(st->dev->name);
+    action_queue_init(&st->actions, st->dev->name);
+
+    if (pthread_mutex_init(&st->mutex, NULL) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_init: should not happen");
+    }
+    if (pthread_cond_init(&st->cv, NULL) < 0) {
+        slog(SLOG_ERROR, "pthread_cond_init: should not happen");
+    }
+    // a remote trigger may wake the poller from now on
+    registry_add(st->dev->name, sane_number(index), st, sane_wake, &st->ref);
+    if (poll_scheduler_active()) {
+        // no own thread, the device is polled by the scheduler workers
+        st->scheduled = true;
+        poll_scheduler_add(&st->job, st->device.name, sane_poll_job, (void*)st);
+        slog(SLOG_DEBUG, "Job scheduled for device %s", st->dev->name);
+        return st;
+    }
+    if (pthread_create(&st->tid, NULL, sane_poll, (void*)st) < 0) {
+        slog(SLOG_ERROR, "Can't start sane_poll_thread: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    slog(SLOG_DEBUG, "Thread started for device %s", st->dev->name);
+    return st;
+}
+
+// asks the poller st to end, all pollers are asked before the first
+// one is waited for (see sane_thread_destroy()), so they end in
+// parallel: a sleeping thread wakes up at once, the others end after
+// their actual cycle, a job isn't run again
+static void sane_thread_stop(sane_thread_t* st) {
     assert(st != NULL);
-    
-    // this thread uses the device and the sane_thread_t datastructure
-    // lock it
+    // no wake-up reaches st anymore
+    registry_remove(st->dev->name);
+    atomic_store(&st->stop, true);
+    if (st->scheduled) {
+        return;
+    }
+    slog(SLOG_DEBUG, "stopping poll thread for device %s", st->dev->name);
+    // the mutex isn't held during backend calls: a thread in a cycle
+    // (or stuck in a backend call) finds the flag before the next sleep
     if (pthread_mutex_lock(&st->mutex) < 0) {
         slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        goto cleanup_sane;
+        return;
     }
-
-    if (action >= st->num_of_options_with_scripts) {
-        slog(SLOG_WARN, "No such action %d for device number %d", action, number_of_dev);
-        goto cleanup_dev;
+    if (pthread_cond_broadcast(&st->cv) < 0) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
     }
+}
 
-    while(st->triggered == true) {
-        slog(SLOG_DEBUG, "sane_trigger_action: an action is active, waiting ...");
-        if (pthread_cond_wait(&st->cv, &st->mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(errno));
-            goto cleanup_dev;
+// waits until deadline for the (stopped) poller st to end
+// returns false if the poller is still running: it is stuck in a
+// backend call and abandoned
+static bool sane_thread_join(sane_thread_t* st, const struct timespec* deadline) {
+    assert(st != NULL);
+    assert(deadline != NULL);
+    if (st->scheduled) {
+        slog(SLOG_DEBUG, "removing poll job for device %s", st->dev->name);
+        return poll_scheduler_remove(&st->job, deadline);
+    }
+    slog(SLOG_DEBUG, "waiting for poll thread for device %s", st->dev->name);
+    // the thread may have checked the flag right before
+    // sane_thread_stop(): it sleeps now, the lock succeeds
+    if (pthread_mutex_timedlock(&st->mutex, deadline) == 0) {
+        if (pthread_cond_broadcast(&st->cv) < 0) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+        if (pthread_mutex_unlock(&st->mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
         }
     }
-    
-    slog(SLOG_DEBUG, "sane_trigger_action: an action is active, waiting ...");
-
-    st->triggered = true;
-    st->triggered_option = action;
-    // we need to trigger all waiting threads
-    if (pthread_cond_broadcast(&st->cv) < 0) {
-        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
+    if (pthread_mutex_lock(&sane_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    while(!st->stopped) {
+        int ret = pthread_cond_timedwait(&sane_stop_cv, &sane_stop_mutex, deadline);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_timedwait: %s", strerror(ret));
+            break;
+        }
     }
+    bool stopped = st->stopped;
+    if (pthread_mutex_unlock(&sane_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (!stopped) {
+        if (pthread_detach(st->tid) != 0) {
+            slog(SLOG_ERROR, "pthread_detach: %s", strerror(errno));
+        }
+        return false;
+    }
+    // joining all threads to prevent memory leaks
+    if (pthread_join(st->tid, NULL) < 0) {
+        slog(SLOG_ERROR, "pthread_join: %s", strerror(errno));
+    }
+    st->tid = 0;
+    return true;
+}
 
-cleanup_dev:
-    if (pthread_mutex_unlock(&st->mutex) < 0) {
+// the poller st is stuck at its stop: it is counted until it ends (see
+// sane_thread_ended())
+static void sane_thread_abandon(sane_thread_t* st) {
+    assert(st != NULL);
+    if (pthread_mutex_lock(&sane_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    // it may have ended right after the deadline
+    if (!st->stopped && !st->abandoned) {
+        st->abandoned = true;
+        sane_stuck += 1;
+    }
+    else if (st->stopped) {
+        status_device_put(st->status);
+        st->status = NULL;
+        stats_device_put(st->stats);
+        st->stats = NULL;
+    }
+    if (pthread_mutex_unlock(&sane_stop_mutex) < 0) {
         slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
     }
-cleanup_sane:
-    if (pthread_mutex_unlock(&sane_mutex) < 0) {
+}
+
+// the number of abandoned pollers still stuck in a backend call
+static int sane_stuck_pollers(void) {
+    if (pthread_mutex_lock(&sane_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return 0;
+    }
+    int stuck = sane_stuck;
+    if (pthread_mutex_unlock(&sane_stop_mutex) < 0) {
         slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
     }
-    return;
+    return stuck;
+}
+
+// waits until deadline for the stopped poller st (see
+// sane_thread_stop()) and releases all its resources including st
+// itself
+// a poller stuck in a backend call is abandoned: st and the device
+// handle are leaked, the thread finds the stop flag after the call
+// (see sane_thread_abandon())
+static void sane_thread_destroy(sane_thread_t* st, const struct timespec* deadline) {
+    assert(st != NULL);
+    bool joined = sane_thread_join(st, deadline);
+    // drop the pending actions, an active action goes on running
+    action_queue_remove(&st->actions);
+    if (!joined) {
+        slog(SLOG_WARN, "poller of device %s is stuck, abandoned", st->dev->name);
+        sane_thread_abandon(st);
+        return;
+    }
+    // close the associated device of the thread
+    slog(SLOG_DEBUG, "closing device %s", st->dev->name);
+    if (st->h != NULL) {
+        sane_dev_close(st);
+    }
+    // the poller has ended, so this is the only writer
+    status_device_put(st->status);
+    st->status = NULL;
+    stats_device_put(st->stats);
+    st->stats = NULL;
+    if (st->opts) {
+        slog(SLOG_DEBUG, "freeing opt resources for device %s thread",
+             st->dev->name);
+        // free the values of the matching options list of that device /
+        // threads, the lists stay in the arena
+        sane_tables_clear(st->opts, st->opts_capacity);
+        st->opts = NULL;
+        st->functions = NULL;
+    }
+    // the tables go to the pool for the next poller
+    sane_tables_put(st->tables);
+    st->tables = NULL;
+    sane_snapshot_free(st);
+    script_env_free(&st->env);
+
+    if (pthread_cond_destroy(&st->cv) < 0) {
+        slog(SLOG_ERROR, "pthread_cond_destroy: %s", strerror(errno));
+    }
+    if (pthread_mutex_destroy(&st->mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_destroy: %s", strerror(errno));
+    }
+    poll_helper_free(st->helper);
+    free((char*)st->device.name);
+    free((char*)st->device.vendor);
+    free((char*)st->device.model);
+    free((char*)st->device.type);
+    free(st);
+}
+
+// starts the poll scheduler, if configured and not already running,
+// and the action executor
+static void sane_start_scheduler(void) {
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    int workers = cfg_getint(cfg_sec_global, C_POLL_WORKERS);
+    if (workers > 0) {
+        poll_scheduler_start(workers, cfg_getint(cfg_sec_global, C_SLOW_POLL),
+                             &cfg_rules->global.poll);
+    }
+    action_executor_start(cfg_getint(cfg_sec_global, C_ACTION_WORKERS),
+                          cfg_getint(cfg_sec_global, C_ACTION_QUEUE),
+                          &cfg_rules->global.script);
 }
 
 void start_sane_threads(void) {
@@ -1272,50 +2580,31 @@ void start_sane_threads(void) {
         slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
         return;
     }
-    
+
     if (sane_poll_threads != NULL) {
         // if there are active threads kill them
         stop_sane_threads();
     }
     // allocate the thread list
     assert(sane_poll_threads == NULL);
-    
+
     if (num_devices == 0) {
         slog(SLOG_ERROR, "no devices, not starting any polling thread");
         goto cleanup;
-    } 
-    sane_poll_threads = (sane_thread_t*) calloc(num_devices, sizeof(sane_thread_t));
+    }
+    sane_poll_threads = (sane_thread_t**) calloc(num_devices, sizeof(sane_thread_t*));
     if (sane_poll_threads == NULL) {
         slog(SLOG_ERROR, "Can't allocate memory for polling threads");
         goto cleanup;
     }
-    // starting for each device a seperate thread
+    sane_start_scheduler();
+    // starting for each device a seperate thread (or job)
     for(int i = 0; i < num_devices; i += 1) {
-        slog(SLOG_DEBUG, "Starting poll thread for %s", sane_device_list[i]->name);
-        sane_poll_threads[i].tid = 0;
-        sane_poll_threads[i].dev = sane_device_list[i];
-        sane_poll_threads[i].h = 0;
-        sane_poll_threads[i].opts = NULL;
-        sane_poll_threads[i].functions = NULL;
-        sane_poll_threads[i].num_of_options = 0;
-        sane_poll_threads[i].triggered = false;
-        sane_poll_threads[i].triggered_option = -1;
-        sane_poll_threads[i].num_of_options_with_scripts = 0;
-        sane_poll_threads[i].num_of_options_with_functions = 0;
-
-        if (pthread_mutex_init(&sane_poll_threads[i].mutex, NULL) < 0) {
-            slog(SLOG_ERROR, "pthread_mutex_init: should not happen");
-        }
-        if (pthread_cond_init(&sane_poll_threads[i].cv, NULL) < 0) {
-            slog(SLOG_ERROR, "pthread_cond_init: should not happen");
-        }
-        if (pthread_create(&sane_poll_threads[i].tid, NULL, sane_poll,
-                           (void*)&sane_poll_threads[i]) < 0) {
-            slog(SLOG_ERROR, "Can't start sane_poll_thread: %s", strerror(errno));
+        if ((sane_poll_threads[i] = sane_thread_create(sane_device_list[i], i)) == NULL) {
             exit(EXIT_FAILURE);
         }
-        slog(SLOG_DEBUG, "Thread started for device %s", sane_device_list[i]->name);
     }
+    sane_publish(sane_poll_threads, num_devices);
     if (pthread_cond_broadcast(&sane_cv)) {
         slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
     }
@@ -1327,94 +2616,222 @@ cleanup:
     }
 }
 
+// parks (acquire == true) or resumes the poller of the device name: a
+// parked poller has closed its device (after a pending trigger was
+// queued) for saned, resumed it reopens the device in the next cycle,
+// the matched options and their before-values survive
+// returns REGISTRY_PARK_NONE if no poller polls name
+static registry_park_t sane_park_device(const char* name, bool acquire) {
+    assert(name != NULL);
+    registry_park_t result = REGISTRY_PARK_NONE;
+    if (pthread_mutex_lock(&sane_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return REGISTRY_PARK_NONE;
+    }
+    // the registry only holds running pollers, they can't vanish while
+    // the sane_mutex is held
+    sane_thread_t* st = (sane_thread_t*)registry_lookup(name, sane_wake, NULL);
+    if (st == NULL) {
+        goto cleanup;
+    }
+    // waits for the actual cycle of the poller, a trigger of this cycle
+    // is queued meanwhile, the reactor doesn't wait for a stuck backend
+    struct timespec deadline;
+    poll_stop_deadline(&deadline);
+    if (!sane_io_enter_until(st, &deadline)) {
+        slog(SLOG_WARN, "poller of device %s is stuck, not %s", name,
+             acquire ? "parked" : "resumed");
+        result = REGISTRY_PARK_STUCK;
+        goto cleanup;
+    }
+    result = REGISTRY_PARK_DONE;
+    st->parked = acquire;
+    if (!acquire) {
+        // an idle park ends with the release as well
+        poll_interval_wake(&st->interval);
+    }
+    if (acquire && (st->h != NULL)) {
+        sane_dev_close(st);
+        sane_snapshot_descriptors(st);
+    }
+    sane_io_leave(st);
+    slog(SLOG_INFO, "%s device %s", acquire ? "parked" : "resumed", name);
+cleanup:
+    if (pthread_mutex_unlock(&sane_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return result;
+}
+
+registry_park_t sane_acquire_device(const char* name) {
+    slog(SLOG_DEBUG, "sane_acquire_device %s", name);
+    return sane_park_device(name, true);
+}
+
+registry_park_t sane_release_device(const char* name) {
+    slog(SLOG_DEBUG, "sane_release_device %s", name);
+    return sane_park_device(name, false);
+}
+
 // stops all sane polling threads
+// returns the number of abandoned pollers still stuck in a backend
+// call (of this and earlier stops): SANE can't be left (sane_exit())
+// and their devices aren't released yet
 
-void stop_sane_threads(void) {
+int stop_sane_threads(void) {
     slog(SLOG_DEBUG, "stop_sane_threads");
 
     if (pthread_mutex_lock(&sane_mutex) < 0) {
         // if we can't get the mutex, something is heavily wrong!
         slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        return;
+        return sane_stuck_pollers();
     }
-    
+
     if (sane_poll_threads == NULL) {
         // we don't have any active threads
         slog(SLOG_DEBUG, "stop_sane_threads: nothing to stop");
         goto cleanup;
     }
-    // sending cancel request to all threads
+    // no reader finds the pollers anymore
+    sane_publish(NULL, 0);
+    // one deadline for all pollers, they end in parallel
+    struct timespec deadline;
+    poll_stop_deadline(&deadline);
+    // sending the stop request to all threads
     for(int i = 0; i < num_devices; i += 1) {
-        if (pthread_mutex_lock(&sane_poll_threads[i].mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        sane_thread_stop(sane_poll_threads[i]);
+    }
+    // waiting for all threads to vanish
+    for(int i = 0; i < num_devices; i += 1) {
+        sane_thread_destroy(sane_poll_threads[i], &deadline);
+        sane_poll_threads[i] = NULL;
+    }
+    // free the thread list
+    free(sane_poll_threads);
+    sane_poll_threads = NULL;
+    // a reload may change the number of workers
+    poll_scheduler_stop(&deadline);
+    action_executor_stop();
+    // no threads active anymore
+    if (pthread_cond_broadcast(&sane_cv)) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+cleanup:
+    if (pthread_mutex_unlock(&sane_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return sane_stuck_pollers();
+}
+
+// rescans the local devices and compares the new list with the
+// running polling threads: only the threads of removed devices are
+// stopped and only for new devices threads are started, all other
+// devices keep on polling (used for hotplug events)
+
+void update_sane_threads(void) {
+    slog(SLOG_DEBUG, "update_sane_threads");
+
+    if (pthread_mutex_lock(&sane_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+
+    const SANE_Device** new_device_list = NULL;
+    SANE_Status sane_status = SANE_STATUS_INVAL;
+    struct timespec start;
+    stats_now(&start);
+    if ((sane_status = sane_get_devices(&new_device_list, SANE_TRUE)) != SANE_STATUS_GOOD) {
+        slog(SLOG_WARN, "Can't get the sane device list");
+        new_device_list = NULL;
+    }
+    stats_record(NULL, STATS_RESCAN, stats_since(&start));
+    if (sane_status == SANE_STATUS_GOOD) {
+        sane_cache_store(new_device_list);
+    }
+    const SANE_Device** new_polled = sane_polled_devices(new_device_list);
+    int new_num_devices = 0;
+    if (new_polled != NULL) {
+        while(new_polled[new_num_devices] != NULL) {
+            new_num_devices += 1;
         }
-        while(sane_poll_threads[i].triggered == true) {
-            slog(SLOG_DEBUG, "stop_sane_threads: an action is active, waiting ...");
+    }
 
-            if (pthread_cond_wait(&sane_poll_threads[i].cv,
-                                  &sane_poll_threads[i].mutex) < 0) {
-                slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(errno));
+    sane_thread_t** new_poll_threads = NULL;
+    if (new_num_devices > 0) {
+        new_poll_threads = (sane_thread_t**) calloc(new_num_devices, sizeof(sane_thread_t*));
+        if (new_poll_threads == NULL) {
+            slog(SLOG_ERROR, "Can't allocate memory for polling threads");
+            if (new_polled != new_device_list) {
+                free(new_polled);
             }
+            goto cleanup;
         }
-        if (pthread_mutex_unlock(&sane_poll_threads[i].mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        }
+    }
 
-        slog(SLOG_DEBUG, "stopping poll thread for device %s", (*(sane_device_list + i))->name);
-        if (pthread_cancel(sane_poll_threads[i].tid) < 0) {
-            if (errno == ESRCH) {
-                slog(SLOG_ERROR, "poll thread for device %s was already cancelled");
-            }
-            else {
-                slog(SLOG_ERROR, "unknown error from pthread_cancel: %s", strerror(errno));
+    if (sane_poll_threads != NULL) {
+        // keep the threads of all devices still present
+        for(int i = 0; i < num_devices; i += 1) {
+            for(int k = 0; k < new_num_devices; k += 1) {
+                if (new_poll_threads[k] == NULL &&
+                    strcmp(sane_poll_threads[i]->dev->name, new_polled[k]->name) == 0) {
+                    new_poll_threads[k] = sane_poll_threads[i];
+                    sane_poll_threads[i] = NULL;
+                    break;
+                }
             }
         }
-    }
-    // waiting for all threads to vanish
-    for(int i = 0; i < num_devices; i += 1) {
-        slog(SLOG_DEBUG, "waiting for poll thread for device %s",
-             (*(sane_device_list + i))->name);
-        // joining all threads to prevent memory leaks
-        if (pthread_join(sane_poll_threads[i].tid, NULL) < 0) {
-            slog(SLOG_ERROR, "pthread_join: %s", strerror(errno));
-        }
-        sane_poll_threads[i].tid = 0;
-        // close the associated device of the thread
-        slog(SLOG_DEBUG, "closing device %s", sane_poll_threads[i].dev->name);
-        if (sane_poll_threads[i].h != NULL) {
-            sane_close(sane_poll_threads[i].h);
-            sane_poll_threads[i].h = NULL;
-        }
-        if (sane_poll_threads[i].opts) {
-            slog(SLOG_DEBUG, "freeing opt resources for device %s thread",
-                 sane_poll_threads[i].dev->name);
-            // free the matching options list of that device / threads
-            for (int k = 0; k < sane_poll_threads[i].num_of_options; k += 1) {
-                sane_option_value_free(&sane_poll_threads[i].opts[k].from_value);
-                sane_option_value_free(&sane_poll_threads[i].opts[k].to_value);
-                sane_option_value_free(&sane_poll_threads[i].opts[k].value);
+        // the remaining threads belong to removed devices, the readers
+        // only find the kept ones
+        sane_publish(new_poll_threads, new_num_devices);
+        struct timespec deadline;
+        poll_stop_deadline(&deadline);
+        for(int i = 0; i < num_devices; i += 1) {
+            if (sane_poll_threads[i] != NULL) {
+                slog(SLOG_INFO, "device %s removed", sane_poll_threads[i]->dev->name);
+                sane_thread_stop(sane_poll_threads[i]);
             }
-            free(sane_poll_threads[i].opts);
-            sane_poll_threads[i].opts = NULL;
         }
-        if (sane_poll_threads[i].functions) {
-            slog(SLOG_DEBUG, "freeing function resources for device %s thread",
-                 sane_poll_threads[i].dev->name);
-            free(sane_poll_threads[i].functions);
-            sane_poll_threads[i].functions = NULL;
+        for(int i = 0; i < num_devices; i += 1) {
+            if (sane_poll_threads[i] != NULL) {
+                poll_state_forget(sane_poll_threads[i]->dev->name);
+                sane_thread_destroy(sane_poll_threads[i], &deadline);
+            }
         }
+        free(sane_poll_threads);
+        sane_poll_threads = NULL;
+    }
 
-        if (pthread_cond_destroy(&sane_poll_threads[i].cv) < 0) {
-            slog(SLOG_ERROR, "pthread_cond_destroy: %s", strerror(errno));
+    // the kept threads may have a new device number, a stuck poller
+    // doesn't hold up the reactor: no I/O token is needed
+    for(int k = 0; k < new_num_devices; k += 1) {
+        sane_thread_t* st = new_poll_threads[k];
+        if ((st != NULL) && (atomic_load(&st->index) != k)) {
+            atomic_store(&st->index, k);
+            // the mailbox of the device stays, only the number moves
+            registry_renumber(st->dev->name, sane_number(k));
         }
-        if (pthread_mutex_destroy(&sane_poll_threads[i].mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_mutex_destroy: %s", strerror(errno));
+    }
+
+    // start the threads for the added devices
+    sane_start_scheduler();
+    for(int k = 0; k < new_num_devices; k += 1) {
+        if (new_poll_threads[k] == NULL) {
+            slog(SLOG_INFO, "device %s added", new_polled[k]->name);
+            if ((new_poll_threads[k] = sane_thread_create(new_polled[k], k)) == NULL) {
+                exit(EXIT_FAILURE);
+            }
         }
     }
-    // free the thread list
-    free(sane_poll_threads);
-    sane_poll_threads = NULL;
-    // no threads active anymore
+
+    sane_poll_threads = new_poll_threads;
+    sane_devices_set(new_device_list, new_polled);
+    sane_cache_release();
+    sane_publish(sane_poll_threads, num_devices);
+
     if (pthread_cond_broadcast(&sane_cv)) {
         slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
     }
@@ -1425,3 +2842,98 @@ cleanup:
         return;
     }
 }
+
+// reloads the config without restarting SANE: the new config is
+// parsed first, then installed while all pollers are quiesced (between
+// two poll cycles) and the pollers are rebound to the new rules, the
+// devices stay open and keep their before-values
+// on a parse error the actual config is kept
+// returns false if no pollers are running or the new config changes
+// the poll or action workers: the caller has to restart the pollers
+// then
+
+bool reload_sane_threads(const char* config_file_name) {
+    slog(SLOG_DEBUG, "reload_sane_threads");
+
+    cfg_t* new_cfg = cfg_do_load(config_file_name);
+    if (new_cfg == NULL) {
+        slog(SLOG_ERROR, "keeping the actual config");
+        return true;
+    }
+
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    cfg_t* new_sec_global = cfg_getsec(new_cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    assert(new_sec_global);
+    if ((cfg_getint(cfg_sec_global, C_POLL_WORKERS) != cfg_getint(new_sec_global, C_POLL_WORKERS)) ||
+        (cfg_getint(cfg_sec_global, C_SLOW_POLL) != cfg_getint(new_sec_global, C_SLOW_POLL)) ||
+        (cfg_getbool(cfg_sec_global, C_POLL_HELPER) != cfg_getbool(new_sec_global, C_POLL_HELPER)) ||
+        (cfg_getint(cfg_sec_global, C_ACTION_WORKERS) != cfg_getint(new_sec_global, C_ACTION_WORKERS)) ||
+        (cfg_getint(cfg_sec_global, C_ACTION_QUEUE) != cfg_getint(new_sec_global, C_ACTION_QUEUE)) ||
+        // the workers take the global cpu policies at their start
+        (strcmp(cfg_getstr(cfg_sec_global, C_POLL_CPUS), cfg_getstr(new_sec_global, C_POLL_CPUS)) != 0) ||
+        (cfg_getint(cfg_sec_global, C_POLL_RTPRIO) != cfg_getint(new_sec_global, C_POLL_RTPRIO)) ||
+        (strcmp(cfg_getstr(cfg_sec_global, C_SCRIPT_CPUS), cfg_getstr(new_sec_global, C_SCRIPT_CPUS)) != 0)) {
+        slog(SLOG_INFO, "the workers changed, restarting the polling");
+        cfg_free(new_cfg);
+        return false;
+    }
+
+    if (pthread_mutex_lock(&sane_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        cfg_free(new_cfg);
+        return false;
+    }
+    if (sane_poll_threads == NULL) {
+        // stopped (or no devices): the restart starts the polling
+        if (pthread_mutex_unlock(&sane_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+        cfg_free(new_cfg);
+        return false;
+    }
+    // quiesce all pollers: each one is between two cycles (or not yet
+    // opened) while its I/O token is held, a poller stuck in a backend
+    // call is abandoned by the restart
+    int pollers = num_devices;
+    struct timespec deadline;
+    poll_stop_deadline(&deadline);
+    for(int i = 0; i < pollers; i += 1) {
+        if (!sane_io_enter_until(sane_poll_threads[i], &deadline)) {
+            slog(SLOG_WARN, "poller of device %s is stuck, restarting the polling",
+                 sane_poll_threads[i]->dev->name);
+            for(int k = i - 1; k >= 0; k -= 1) {
+                sane_io_leave(sane_poll_threads[k]);
+            }
+            if (pthread_mutex_unlock(&sane_mutex) < 0) {
+                slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+            }
+            cfg_free(new_cfg);
+            return false;
+        }
+    }
+
+    cfg_retired_t old = {};
+    cfg_do_install(new_cfg, &old);
+
+    for(int i = 0; i < pollers; i += 1) {
+        sane_thread_t* st = sane_poll_threads[i];
+        if (st->opts == NULL) {
+            // not opened yet, the open uses the new rules
+            continue;
+        }
+        sane_poll_rebind(st);
+    }
+
+    for(int i = pollers - 1; i >= 0; i -= 1) {
+        sane_io_leave(sane_poll_threads[i]);
+    }
+    if (pthread_mutex_unlock(&sane_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    // no poller references the old rules anymore
+    cfg_retired_free(&old);
+    return true;
+}
@@ -0,0 +1,311 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "saned_pool.h"
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+// an idle worker of the pool: the manager keeps its end of the channel
+// until the connection is passed
+struct saned_pool_worker {
+    pid_t pid;                       // -1: the slot is free
+    int channel;                     // the manager end of the socketpair
+};
+typedef struct saned_pool_worker saned_pool_worker_t;
+
+static saned_pool_worker_t saned_pool_workers[SANED_POOL_MAX];
+static int saned_pool_size = 0;
+
+static bool saned_pool_listening(int fd) {
+#ifdef SO_ACCEPTCONN
+    int value = 0;
+    socklen_t length = sizeof(value);
+    if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &value, &length) < 0) {
+        return false;
+    }
+    return value != 0;
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+int saned_pool_listen_fd(void) {
+    const char* listen_pid = getenv("LISTEN_PID");
+    const char* listen_fds = getenv("LISTEN_FDS");
+    if ((listen_pid != NULL) && (listen_fds != NULL) &&
+        (atol(listen_pid) == (long)getpid()) && (atoi(listen_fds) >= 1) &&
+        saned_pool_listening(SANED_POOL_LISTEN_FDS_START)) {
+        slog(SLOG_DEBUG, "listening socket from systemd");
+        return SANED_POOL_LISTEN_FDS_START;
+    }
+    if (saned_pool_listening(STDIN_FILENO)) {
+        slog(SLOG_DEBUG, "listening socket from inetd");
+        return STDIN_FILENO;
+    }
+    return -1;
+}
+
+// passes the descriptor fd over the channel
+static bool saned_pool_send(int channel, int fd) {
+    char byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = sizeof(byte);
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    while(sendmsg(channel, &msg, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR) {
+            slog(SLOG_WARN, "sendmsg: %s", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+// waits for a descriptor on the channel
+// returns the descriptor or -1 (the manager has gone)
+static int saned_pool_receive(int channel) {
+    char byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = sizeof(byte);
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof(control.space);
+
+    ssize_t n = 0;
+    while((n = recvmsg(channel, &msg, 0)) < 0) {
+        if (errno != EINTR) {
+            slog(SLOG_WARN, "recvmsg: %s", strerror(errno));
+            return -1;
+        }
+    }
+    if (n == 0) {
+        return -1;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if ((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) ||
+        (cmsg->cmsg_type != SCM_RIGHTS) || (cmsg->cmsg_len != CMSG_LEN(sizeof(int)))) {
+        slog(SLOG_WARN, "no connection received");
+        return -1;
+    }
+    int fd = -1;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+// places the connection where saned expects it: on stdin / stdout (inetd)
+// and on the descriptors of the listening socket (the systemd
+// descriptor or stderr of inetd), so the listening socket isn't
+// inherited by saned
+static void saned_pool_attach(int conn, int listen_fd) {
+    for(int fd = 0; fd <= SANED_POOL_LISTEN_FDS_START; fd += 1) {
+        if ((fd == STDIN_FILENO) || (fd == STDOUT_FILENO) ||
+            (fd == listen_fd) || saned_pool_listening(fd)) {
+            if ((fd != conn) && (dup2(conn, fd) < 0)) {
+                slog(SLOG_WARN, "dup2: %s", strerror(errno));
+            }
+        }
+    }
+    if (conn > SANED_POOL_LISTEN_FDS_START) {
+        close(conn);
+    }
+}
+
+// the child doesn't keep the channels of the other workers, otherwise
+// they don't notice the end of the manager
+static void saned_pool_close_channels(void) {
+    for(int i = 0; i < saned_pool_size; i += 1) {
+        if (saned_pool_workers[i].channel >= 0) {
+            close(saned_pool_workers[i].channel);
+            saned_pool_workers[i].channel = -1;
+        }
+    }
+}
+
+// forks a warm worker into the free slot i
+static void saned_pool_spawn(int i, int listen_fd,
+                             void (*prepare)(void), void (*serve)(void)) {
+    int channel[2] = {-1, -1};
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel) < 0) {
+        slog(SLOG_WARN, "socketpair: %s", strerror(errno));
+        return;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        slog(SLOG_WARN, "fork of pool worker failed: %s", strerror(errno));
+        close(channel[0]);
+        close(channel[1]);
+        return;
+    }
+    if (pid > 0) {
+        // manager
+        close(channel[1]);
+        saned_pool_workers[i].pid = pid;
+        saned_pool_workers[i].channel = channel[0];
+        slog(SLOG_DEBUG, "pool worker %d started", pid);
+        return;
+    }
+    // worker
+    close(channel[0]);
+    saned_pool_close_channels();
+    prepare();
+    int conn = saned_pool_receive(channel[1]);
+    close(channel[1]);
+    if (conn < 0) {
+        slog(SLOG_DEBUG, "pool worker: manager has gone");
+        exit(EXIT_SUCCESS);
+    }
+    saned_pool_attach(conn, listen_fd);
+    serve();
+    exit(EXIT_SUCCESS); // not reached
+}
+
+// reaps the exited workers, an idle worker frees its slot
+static void saned_pool_reap(void) {
+    pid_t pid = -1;
+    while((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        for(int i = 0; i < saned_pool_size; i += 1) {
+            if (saned_pool_workers[i].pid == pid) {
+                slog(SLOG_WARN, "idle pool worker %d exited", pid);
+                close(saned_pool_workers[i].channel);
+                saned_pool_workers[i].pid = -1;
+                saned_pool_workers[i].channel = -1;
+            }
+        }
+    }
+}
+
+// passes conn to an idle worker
+// returns false if there is none
+static bool saned_pool_dispatch(int conn) {
+    for(int i = 0; i < saned_pool_size; i += 1) {
+        if (saned_pool_workers[i].pid < 0) {
+            continue;
+        }
+        bool sent = saned_pool_send(saned_pool_workers[i].channel, conn);
+        if (sent) {
+            slog(SLOG_DEBUG, "connection passed to pool worker %d", saned_pool_workers[i].pid);
+        }
+        // the worker serves the connection (or is broken): the slot
+        // gets a new worker
+        close(saned_pool_workers[i].channel);
+        saned_pool_workers[i].pid = -1;
+        saned_pool_workers[i].channel = -1;
+        if (sent) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void saned_pool_run(int listen_fd, int size,
+                    void (*prepare)(void), void (*serve)(void)) {
+    assert(listen_fd >= 0);
+    assert(prepare != NULL);
+    assert(serve != NULL);
+
+    if (size > SANED_POOL_MAX) {
+        slog(SLOG_WARN, "saned pool limited to %d workers", SANED_POOL_MAX);
+        size = SANED_POOL_MAX;
+    }
+    if (size < 1) {
+        size = 1;
+    }
+    saned_pool_size = size;
+    for(int i = 0; i < saned_pool_size; i += 1) {
+        saned_pool_workers[i].pid = -1;
+        saned_pool_workers[i].channel = -1;
+    }
+    slog(SLOG_INFO, "serving saned connections with %d pre-forked workers", saned_pool_size);
+
+    while(true) {
+        saned_pool_reap();
+        // the slots of the served connections get a new worker before
+        // the next connection is accepted
+        for(int i = 0; i < saned_pool_size; i += 1) {
+            if (saned_pool_workers[i].pid < 0) {
+                saned_pool_spawn(i, listen_fd, prepare, serve);
+            }
+        }
+
+        int conn = accept(listen_fd, NULL, NULL);
+        if (conn < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED)) {
+                continue;
+            }
+            slog(SLOG_ERROR, "accept: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        slog(SLOG_DEBUG, "connection accepted");
+
+        if (!saned_pool_dispatch(conn)) {
+            // no idle worker: serve the connection cold
+            slog(SLOG_INFO, "no idle pool worker, forking one");
+            pid_t pid = fork();
+            if (pid < 0) {
+                slog(SLOG_WARN, "fork of pool worker failed: %s", strerror(errno));
+            }
+            else if (pid == 0) {
+                saned_pool_close_channels();
+                prepare();
+                saned_pool_attach(conn, listen_fd);
+                serve();
+                exit(EXIT_SUCCESS); // not reached
+            }
+        }
+        close(conn);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef SANED_POOL_H
+#define SANED_POOL_H
+
+#include "common.h"
+
+// the pooled manager mode: scanbm gets the listening sane-port socket
+// (inetd "wait" or systemd Accept=no) and keeps a pool of pre-forked
+// workers, which have done the startup of scanbm (config, libraries,
+// dbus connection) before a client connects. The accepted connection
+// is passed to an idle worker (SCM_RIGHTS), which acquires the devices
+// and starts saned on it. Without an idle worker a new one is forked.
+
+#define SANED_POOL_MAX 16
+
+// first descriptor passed by systemd (see sd_listen_fds(3))
+#define SANED_POOL_LISTEN_FDS_START 3
+
+// returns the listening socket given to scanbm (systemd socket
+// activation or inetd wait-mode), or -1
+extern int saned_pool_listen_fd(void);
+
+// accepts the connections on listen_fd and serves them with a pool of
+// size pre-forked workers: each worker calls prepare() at once, and
+// serve() with the connection on stdin / stdout; serve() must not
+// return
+// never returns
+extern void saned_pool_run(int listen_fd, int size,
+                           void (*prepare)(void), void (*serve)(void));
+
+#endif // SANED_POOL_H
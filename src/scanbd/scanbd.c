@@ -21,7 +21,19 @@
  */
 
 #include "scanbd.h"
+#include "evloop.h"
+#include "stats.h"
+#include "saned_pool.h"
+#include "status_page.h"
+#include "metrics.h"
+#include "probe.h"
+#ifdef USE_SANE
+#include "poll_state.h"
+#endif
 
+#ifdef USE_SANE
+# include "poll_helper.h"
+#endif
 #ifdef USE_SCANBUTTOND
 # include "scanbuttond_loader.h"
 # include "scanbuttond_wrapper.h"
@@ -31,12 +43,17 @@ backend_t* backend = NULL;
 
 cfg_t* cfg = NULL;
 
+// scanbm: the start of the process (of the session in a pool worker)
+static struct timespec scanbm_start;
+static bool scanbm_pooled = false;
+
 // the actual values of the command-line options
 struct scanbdOptions scanbd_options = {
     /* managerMode */      false,
     /* foreground */       false,
     /* signal */	   false,
-    /* config_file_name */ SCANBD_CONF
+    /* config_file_name */ SCANBD_CONF,
+    /* config_snapshot */  SCANBD_CFG_SNAPSHOT
 };
 
 // the options for getopt_long()
@@ -46,31 +63,86 @@ static struct option options[] = {
     {"debug",      2, NULL, 'd'},
     {"foreground", 0, NULL, 'f'},
     {"config",     1, NULL, 'c'},
+    {"snapshot",   1, NULL, 'S'},
     {"trigger",    1, NULL, 't'},
     {"action",     1, NULL, 'a'},
+    {"count",      1, NULL, 'n'},
+    {"rate",       1, NULL, 'r'},
+#ifdef USE_SANE
+    // internal: the helper process of a poller (see poll_helper.h)
+    {"poll-helper", 1, NULL, 'H'},
+#endif
     { 0,           0, NULL, 0}
 };
 
+// the reactor thread (dbus, udev and the hooks) on its cpus (see
+// C_REACTOR_CPUS), again after each reload of the config
+static void scanbd_place_reactor(void) {
+    assert(cfg_rules != NULL);
+    cpu_policy_thread(&cfg_rules->reactor, "reactor");
+}
+
 void sig_hup_handler(int signal) {
     slog(SLOG_DEBUG, "sig_hup_handler called");
+    struct timespec start;
+    stats_now(&start);
 
     if (signal == SIGALRM) {
         slog(SLOG_INFO, "reconfiguration due to SIGALARM, device was busy?");
     }
 
-    // stop all threads
 #ifdef USE_SANE
-    stop_sane_threads();
-#else
+    // the fast path: only the rules are replaced, SANE and the opened
+    // devices of the kept pollers stay untouched
+    slog(SLOG_DEBUG, "reread the config");
+#ifdef SCANBD_HYBRID
+    // the scanbuttond pollers reference the rules and the config, both
+    // are freed by the install: they are stopped first
     stop_scbtn_threads();
 #endif
+    if (reload_sane_threads(scanbd_options.config_file_name)) {
+        cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+        assert(cfg_sec_global);
+        debug = cfg_getbool(cfg_sec_global, C_DEBUG);
+        debug_level = cfg_getint(cfg_sec_global, C_DEBUG_LEVEL);
+        scanbd_place_reactor();
+#ifdef USE_LIBUDEV
+        udev_reload();
+#endif
+#ifdef SCANBD_HYBRID
+        // the scanbuttond devices first: they are left out by sane
+        get_scbtn_devices();
+        start_scbtn_threads();
+#endif
+        // look for added or removed devices
+        update_sane_threads();
+        stats_record(NULL, STATS_RECONFIGURE, stats_since(&start));
+        return;
+    }
+#endif
 
-    slog(SLOG_DEBUG, "sane_exit");
+    // stop all threads, a poller stuck in a backend call still uses
+    // SANE (or the scanbuttond backend): it isn't reinitialized then
+    int stuck = 0;
 #ifdef USE_SANE
-    sane_exit();
-#else
-    scbtn_shutdown();
+    stuck += stop_sane_threads();
+#endif
+#ifdef USE_SCANBUTTOND
+    stuck += stop_scbtn_threads();
 #endif
+    bool reinit = (stuck == 0);
+    if (reinit) {
+        slog(SLOG_DEBUG, "sane_exit");
+#ifdef USE_SANE
+        sane_exit();
+#endif
+#ifdef USE_SCANBUTTOND
+        scbtn_shutdown();
+#endif
+    }
+    else {
+        slog(SLOG_WARN, "%d pollers are stuck, the backends stay initialized", stuck);
+    }
 
 #ifdef SANE_REINIT_TIMEOUT
     sleep(SANE_REINIT_TIMEOUT); // TODO: don't know if this is
@@ -84,54 +156,150 @@ void sig_hup_handler(int signal) {
     assert(cfg_sec_global);
     debug = cfg_getbool(cfg_sec_global, C_DEBUG);
     debug_level = cfg_getint(cfg_sec_global, C_DEBUG_LEVEL);
+    scanbd_place_reactor();
+#ifdef USE_LIBUDEV
+    udev_reload();
+#endif
 
-    slog(SLOG_DEBUG, "sane_init");
+    if (reinit) {
+        slog(SLOG_DEBUG, "sane_init");
 #ifdef USE_SANE
-    sane_init(NULL, NULL);
-#else
-    if (scanbtnd_init() < 0) {
-        slog(SLOG_INFO, "Could not initialize scanbuttond modules!\n");
-        exit(EXIT_FAILURE);
+        sane_init(NULL, NULL);
+#endif
+#ifdef USE_SCANBUTTOND
+        if (scanbtnd_init() < 0) {
+            slog(SLOG_INFO, "Could not initialize scanbuttond modules!\n");
+            exit(EXIT_FAILURE);
+        }
+#endif
     }
+#ifdef USE_SCANBUTTOND
     assert(backend);
-
 #endif
 
+    // scanbuttond first: the sane discovery leaves out its devices
+#ifdef USE_SCANBUTTOND
+    get_scbtn_devices();
+#endif
 #ifdef USE_SANE
     get_sane_devices();
-#else
-    get_scbtn_devices();
 #endif
 
     // start all threads
+#ifdef USE_SCANBUTTOND
+    start_scbtn_threads();
+#endif
 #ifdef USE_SANE
     start_sane_threads();
-#else
+#endif
+    stats_record(NULL, STATS_RECONFIGURE, stats_since(&start));
+}
+
+#ifdef SCANBD_SIGNAL_HANDOFF
+// a release not acknowledged to scanbm (or too late): the polling
+// resumes after SCANBM_HANDOFF_TIMEOUT, unless scanbm restarts it
+// before (SIGUSR2)
+static bool handoff_timer = false;
+
+static void handoff_cancel(void) {
+    if (handoff_timer) {
+        evloop_remove_timer(&handoff_timer);
+        handoff_timer = false;
+    }
+}
+#endif
+
+void sig_usr2_handler(int signal) {
+    slog(SLOG_DEBUG, "sig_usr2_handler called");
+    (void)signal;
+#ifdef SCANBD_SIGNAL_HANDOFF
+    handoff_cancel();
+#endif
+    // start all threads
+#ifdef USE_SCANBUTTOND
     start_scbtn_threads();
 #endif
+#ifdef USE_SANE
+    start_sane_threads();
+#endif
+}
 
+#ifdef SCANBD_SIGNAL_HANDOFF
+static void handoff_expired(void* arg) {
+    (void)arg;
+    slog(SLOG_INFO, "no scanbm has taken over the devices, polling resumes");
+    sig_usr2_handler(SIGUSR2);
 }
+#endif
 
 void sig_usr1_handler(int signal) {
     slog(SLOG_DEBUG, "sig_usr1_handler called");
     (void)signal;
+    struct timespec start;
+    stats_now(&start);
     // stop all threads
+    int stuck = 0;
 #ifdef USE_SANE
-    stop_sane_threads();
+    stuck += stop_sane_threads();
+#endif
+#ifdef USE_SCANBUTTOND
+    stuck += stop_scbtn_threads();
+#endif
+#ifdef SCANBD_SIGNAL_HANDOFF
+    // a new release: an earlier one unacknowledged doesn't resume
+    handoff_cancel();
+    // the devices are closed now: acknowledge the release to scanbm,
+    // unless a poller stuck in a backend call still holds its device
+    int value = 0;
+    pid_t sender = evloop_signal_queued(signal, &value);
+    if ((sender <= 0) || (value != SCANBM_HANDOFF_VALUE)) {
+        return;
+    }
+    unsigned long elapsed = stats_since(&start) / 1000;
+    if (stuck > 0) {
+        slog(SLOG_WARN, "%d pollers are stuck, the release isn't acknowledged", stuck);
+    }
+    else if (elapsed >= SCANBM_HANDOFF_TIMEOUT * 1000UL) {
+        slog(SLOG_WARN, "release took longer than %d s, scanbm has given up",
+             SCANBM_HANDOFF_TIMEOUT);
+    }
+    else {
+        union sigval sv;
+        sv.sival_int = SCANBM_HANDOFF_VALUE;
+        if (sigqueue(sender, SIGUSR1, sv) == 0) {
+            return;
+        }
+        slog(SLOG_WARN, "Can't acknowledge the release to pid %d: %s",
+             sender, strerror(errno));
+    }
+    // scanbm goes on without the acknowledge after the same timeout:
+    // a late one may find no scanbm anymore that restarts the polling
+    int rest = 0;
+    if (elapsed < SCANBM_HANDOFF_TIMEOUT * 1000UL) {
+        rest = (int)(SCANBM_HANDOFF_TIMEOUT * 1000UL - elapsed);
+    }
+    handoff_timer = evloop_add_timer(rest, true, handoff_expired, &handoff_timer);
+    if (!handoff_timer) {
+        slog(SLOG_WARN, "can't add the handoff timer, polling resumes");
+        sig_usr2_handler(SIGUSR2);
+    }
 #else
-    stop_scbtn_threads();
+    (void)start;
 #endif
 }
 
-void sig_usr2_handler(int signal) {
-    slog(SLOG_DEBUG, "sig_usr2_handler called");
+void sig_stats_handler(int signal) {
+    slog(SLOG_DEBUG, "sig_stats_handler called");
     (void)signal;
-    // start all threads
-#ifdef USE_SANE
-    start_sane_threads();
-#else
-    start_scbtn_threads();
-#endif
+    // write the latency statistics
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    const char* stats_file = cfg_getstr(cfg_sec_global, C_STATS_FILE);
+    if ((stats_file == NULL) || (strlen(stats_file) == 0)) {
+        slog(SLOG_INFO, "no stats_file configured, the statistics are available via dbus");
+        return;
+    }
+    stats_dump(stats_file);
 }
 
 void sig_term_handler(int signal) {
@@ -144,10 +312,14 @@ void sig_term_handler(int signal) {
     else {
         // not in manager-mode
         // stop all threads
+        int stuck = 0;
 #ifdef USE_SANE
-        stop_sane_threads();
-#else
-        stop_scbtn_threads();
+        stuck += stop_sane_threads();
+        // the before-values of the stopped pollers for the next start
+        store_sane_poll_state(true);
+#endif
+#ifdef USE_SCANBUTTOND
+        stuck += stop_scbtn_threads();
 #endif
         dbus_stop_dbus_thread();
 
@@ -179,11 +351,272 @@ void sig_term_handler(int signal) {
                 exit(EXIT_FAILURE);
             }
         }
+        // an abandoned poller may still write its record: the page
+        // stays mapped until the exit
+        status_page_close(stuck == 0);
+        metrics_close();
     }
     slog(SLOG_INFO, "exiting scanbd");
     exit(EXIT_SUCCESS);
 }
 
+#ifdef USE_SANE
+// one-shot timer of the reactor: the discovery after a warm start from
+// the device cache
+static void verify_sane_cache(void* arg) {
+    evloop_remove_timer(arg);
+    verify_sane_devices();
+}
+
+// periodic timer of the reactor: the checkpoint of the pollers
+static void store_sane_state(void* arg) {
+    (void)arg;
+    store_sane_poll_state(false);
+}
+#endif
+
+// scanbm: stops the polling of the running scanbd (pid) and waits
+// until it has released the devices, at most SCANBM_HANDOFF_TIMEOUT
+// seconds (without acknowledge the devices get a second)
+static void scanbm_signal_acquire(pid_t scanbd_pid) {
+#ifdef SCANBD_SIGNAL_HANDOFF
+    sigset_t ack;
+    sigset_t old;
+    sigemptyset(&ack);
+    sigaddset(&ack, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &ack, &old) < 0) {
+        slog(SLOG_WARN, "sigprocmask: %s", strerror(errno));
+    }
+    union sigval sv;
+    sv.sival_int = SCANBM_HANDOFF_VALUE;
+    slog(SLOG_DEBUG, "queueing SIGUSR1 to pid %d", scanbd_pid);
+    if (sigqueue(scanbd_pid, SIGUSR1, sv) < 0) {
+        slog(SLOG_WARN, "Can't send signal SIGUSR1 to pid %d: %s",
+             scanbd_pid, strerror(errno));
+        slog(SLOG_DEBUG, "uid=%d, euid=%d", getuid(), geteuid());
+    }
+    else {
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += SCANBM_HANDOFF_TIMEOUT;
+        while(true) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            struct timespec rest;
+            rest.tv_sec = until.tv_sec - now.tv_sec;
+            rest.tv_nsec = until.tv_nsec - now.tv_nsec;
+            if (rest.tv_nsec < 0) {
+                rest.tv_sec -= 1;
+                rest.tv_nsec += 1000000000L;
+            }
+            if (rest.tv_sec < 0) {
+                slog(SLOG_WARN, "no acknowledge of the release from pid %d", scanbd_pid);
+                break;
+            }
+            siginfo_t info;
+            if (sigtimedwait(&ack, &info, &rest) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                slog(SLOG_WARN, "no acknowledge of the release from pid %d", scanbd_pid);
+                break;
+            }
+            if ((info.si_code == SI_QUEUE) && (info.si_pid == scanbd_pid) &&
+                (info.si_value.sival_int == SCANBM_HANDOFF_VALUE)) {
+                slog(SLOG_DEBUG, "release acknowledged by pid %d", scanbd_pid);
+                break;
+            }
+        }
+    }
+    if (sigprocmask(SIG_SETMASK, &old, NULL) < 0) {
+        slog(SLOG_WARN, "sigprocmask: %s", strerror(errno));
+    }
+#else
+    slog(SLOG_DEBUG, "sending SIGUSR1");
+    if (kill(scanbd_pid, SIGUSR1) < 0) {
+        slog(SLOG_WARN, "Can't send signal SIGUSR1 to pid %d: %s",
+             scanbd_pid, strerror(errno));
+        slog(SLOG_DEBUG, "uid=%d, euid=%d", getuid(), geteuid());
+    }
+    // sleep some time to give the other scanbd to close all the
+    // usb-connections
+    sleep(1);
+#endif
+}
+
+// the saned_devices of the config (see dbus_call_methods()), the
+// array must be freed by the caller
+static void scanbm_saned_devices(cfg_t* cfg_sec_global, const char*** devices, size_t* num) {
+    *num = cfg_size(cfg_sec_global, C_SANED_DEVICES);
+    *devices = NULL;
+    if (*num == 0) {
+        return;
+    }
+    if ((*devices = calloc(*num, sizeof(const char*))) == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the saned devices");
+        exit(EXIT_FAILURE);
+    }
+    for(size_t i = 0; i < *num; i += 1) {
+        (*devices)[i] = cfg_getnstr(cfg_sec_global, C_SANED_DEVICES, i);
+        assert((*devices)[i]);
+    }
+}
+
+// scanbm: serves the connection on stdin / stdout: releases the devices
+// of the running scanbd, runs saned and resumes the polling
+// never returns
+static void scanbm_session(void) {
+    cfg_t* cfg_sec_global = NULL;
+    cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+
+    if (scanbm_pooled) {
+        // the worker has started long ago, the client has just connected
+        stats_now(&scanbm_start);
+    }
+
+    const char** devices = NULL;
+    size_t numberOfDevices = 0;
+    pid_t scanbd_pid = -1;
+    // get the name of the saned executable
+    const char* saned = NULL;
+    saned = cfg_getstr(cfg_sec_global, C_SANED);
+    assert(saned);
+
+    if (scanbd_options.signal) {
+        slog(SLOG_DEBUG, "manager mode: signal");
+        // get the path of the pid-file of the running scanbd
+        const char* scanbd_pid_file = NULL;
+        scanbd_pid_file = cfg_getstr(cfg_sec_global, C_PIDFILE);
+        assert(scanbd_pid_file);
+
+        // get the pid of the running scanbd out of the pidfile
+        FILE* pidfile;
+        if ((pidfile = fopen(scanbd_pid_file, "r")) == NULL) {
+            slog(SLOG_WARN, "Can't open pidfile %s", scanbd_pid_file);
+        }
+        else {
+            char pida[NAME_MAX];
+            if (fgets(pida, NAME_MAX, pidfile) == NULL) {
+                slog(SLOG_WARN, "Can't read pid from pidfile %s", scanbd_pid_file);
+            }
+            if (fclose(pidfile) < 0) {
+                slog(SLOG_WARN, "Can't close pidfile %s", scanbd_pid_file);
+            }
+            scanbd_pid = atoi(pida);
+            slog(SLOG_DEBUG, "found scanbd with pid %d", scanbd_pid);
+            // set scanbd to sleep mode
+            if (scanbd_pid > 0) {
+                scanbm_signal_acquire(scanbd_pid);
+            }
+        }
+    } // signal-mode
+    else {
+        // only the client connection: the acquire below is the first
+        // (and only) round trip to scanbd
+        if (!dbus_init_client()) {
+            slog(SLOG_WARN, "no dbus connection to scanbd");
+        }
+        slog(SLOG_DEBUG, "dbus signal saned-start");
+        dbus_send_signal(SCANBD_DBUS_SIGNAL_SANED_BEGIN, NULL);
+        slog(SLOG_DEBUG, "manager mode: dbus");
+        slog(SLOG_DEBUG, "calling dbus method: %s", SCANBD_DBUS_METHOD_ACQUIRE);
+        // the replies come after scanbd has released the devices
+        // if only some devices are used by saned, the others keep on
+        // polling
+        scanbm_saned_devices(cfg_sec_global, &devices, &numberOfDevices);
+        if (!dbus_call_methods(SCANBD_DBUS_METHOD_ACQUIRE, devices, numberOfDevices)) {
+            slog(SLOG_WARN, "scanbd didn't acknowledge the release of the devices");
+        }
+    }
+    // the cold start of scanbm (or the accept of a pool worker) up to
+    // the fork of saned
+    unsigned long startup = stats_since(&scanbm_start);
+    slog(SLOG_INFO, "saned starts %lu us after the start of scanbm", startup);
+    SCANBD_PROBE1(scanbm__ready, startup);
+    // start the real saned
+    slog(SLOG_DEBUG, "forking subprocess for saned");
+    pid_t spid = -1;
+    if ((spid = fork()) < 0) {
+        slog(SLOG_ERROR, "fork for saned subprocess failed: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    else if (spid > 0) { // parent
+        // wait for the saned process to finish
+        int status = 0;
+        slog(SLOG_DEBUG, "waiting for saned");
+        if (waitpid(spid, &status, 0) < 0) {
+            slog(SLOG_ERROR, "waiting for saned failed: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (WIFEXITED(status)) {
+            slog(SLOG_INFO, "saned exited with status: %d", WEXITSTATUS(status));
+        }
+        if (WIFSIGNALED(status)) {
+            slog(SLOG_INFO, "saned exited due to signal: %d", WTERMSIG(status));
+        }
+        // saned finished and now
+        // reactivate scandb
+        if (scanbd_options.signal) {
+            // saned has exited, its usb-connections are closed
+            if (scanbd_pid > 0) {
+                slog(SLOG_DEBUG, "sending SIGUSR2");
+                if (kill(scanbd_pid, SIGUSR2) < 0) {
+                    slog(SLOG_INFO, "Can't send signal SIGUSR1 to pid %d: %s",
+                         scanbd_pid, strerror(errno));
+                }
+            }
+        } // signal-mode
+        else {
+            slog(SLOG_DEBUG, "calling dbus method: %s", SCANBD_DBUS_METHOD_RELEASE);
+            dbus_call_methods(SCANBD_DBUS_METHOD_RELEASE, devices, numberOfDevices);
+            slog(SLOG_DEBUG, "dbus signal saned-end");
+            dbus_send_signal(SCANBD_DBUS_SIGNAL_SANED_END, NULL);
+        }
+        free(devices);
+    }
+    else { // child
+        // Ensure that saned gets the systemd fd's
+        // We do not call sd_listen_fds() as that sets FD_CLOEXEC on the fd's
+        char listen_fds[64] = "";
+        if (getenv("LISTEN_PID") != NULL) {
+            snprintf(listen_fds, 64, "LISTEN_PID=%ld", (long) getpid());
+            putenv(listen_fds);
+            slog(SLOG_DEBUG, "Systemd detected: Updating LISTEN_PID env. variable");
+        }
+        size_t numberOfEnvs = cfg_size(cfg_sec_global, "saned_env");
+        for(size_t i = 0; i < numberOfEnvs; i += 1) {
+            const char* e = cfg_getnstr(cfg_sec_global, "saned_env", i);
+            assert(e);
+            if (putenv((char*)e) < 0) { // const-cast should not be neccessary
+                slog(SLOG_WARN, "Can't set environment %s: %s", e, strerror(errno));
+            }
+            else {
+                slog(SLOG_DEBUG, "Setting environment: %s", e);
+            }
+        }
+        if (setsid() < 0) {
+            slog(SLOG_WARN, "setsid: %s", strerror(errno));
+        }
+        if (execl(saned, "saned", (char*)NULL) < 0) {
+            slog(SLOG_ERROR, "exec of saned failed: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS); // not reached
+    }
+    exit(EXIT_SUCCESS);
+}
+
+// scanbm: the startup of a pool worker before a client connects
+static void scanbm_warmup(void) {
+    if (!scanbd_options.signal) {
+        // connect to the bus in advance
+        if (!dbus_init_client()) {
+            slog(SLOG_WARN, "pool worker: no dbus connection yet");
+        }
+    }
+}
+
 bool isNumber(const char* string) {
     if (!string) {
         return false;
@@ -198,6 +631,7 @@ bool isNumber(const char* string) {
 }
 
 int main(int argc, char** argv) {
+    stats_now(&scanbm_start);
     // init the logging feature
     slog_init(argv[0]);
 
@@ -273,12 +707,16 @@ int main(int argc, char** argv) {
 
     int trigger_device = -1;
     int trigger_action = -1;
+    // a batch of triggers for a load test (see trigger_batch.h)
+    int trigger_count = 1;
+    int trigger_rate = 0;
+    const char* helper_device = NULL;
 
     // read the options of the commandline
     while(true) {
         int option_index = 0;
         int c = 0;
-        if ((c = getopt_long(argc, argv, "mc:d::ft:a:", options, &option_index)) < 0) {
+        if ((c = getopt_long(argc, argv, "mc:d::ft:a:S:n:r:", options, &option_index)) < 0) {
             break;
         }
         switch(c) {
@@ -310,6 +748,10 @@ int main(int argc, char** argv) {
             slog(SLOG_INFO, "config-file: %s", optarg);
             scanbd_options.config_file_name = strdup(optarg);
             break;
+        case 'S':
+            slog(SLOG_INFO, "config-snapshot: %s", optarg);
+            scanbd_options.config_snapshot = strdup(optarg);
+            break;
         case 't':
             slog(SLOG_INFO, "trigger for device number: %d", atoi(optarg));
             if (isNumber(optarg)) {
@@ -330,12 +772,45 @@ int main(int argc, char** argv) {
                 slog(SLOG_WARN, "use numerical argument for option -a");
             }
             break;
+        case 'n':
+            slog(SLOG_INFO, "trigger count: %d", atoi(optarg));
+            if (isNumber(optarg) && (atoi(optarg) > 0)) {
+                trigger_count = atoi(optarg);
+            }
+            else {
+                slog(SLOG_WARN, "use positive numerical argument for option -n");
+            }
+            break;
+        case 'r':
+            slog(SLOG_INFO, "trigger rate: %d/s", atoi(optarg));
+            if (isNumber(optarg)) {
+                trigger_rate = atoi(optarg);
+            }
+            else {
+                slog(SLOG_WARN, "use numerical argument for option -r");
+            }
+            break;
+        case 'H':
+            helper_device = optarg;
+            break;
         default:
             break;
         }
     }
 
+#ifdef USE_SANE
+    if (helper_device != NULL) {
+        // started by a poller: no config, no daemon
+        exit(poll_helper_main(helper_device));
+    }
+    // before the daemon changes the directory
+    poll_helper_setup(argv[0]);
+#else
+    (void)helper_device;
+#endif
+
     // read & parse scanbd.conf
+    cfg_set_snapshot(scanbd_options.config_snapshot);
     cfg_do_parse(scanbd_options.config_file_name);
 
     cfg_t* cfg_sec_global = NULL;
@@ -388,133 +863,27 @@ int main(int argc, char** argv) {
 
         if ((trigger_device >= 0) && (trigger_action >= 0)) {
             slog(SLOG_DEBUG, "Entering trigger mode");
+            if ((trigger_count > 1) || (trigger_rate > 0)) {
+                // the daemon paces the batch, the call returns at once
+                exit(dbus_call_trigger_batch(trigger_device, trigger_action,
+                                             trigger_count, trigger_rate) ?
+                     EXIT_SUCCESS : EXIT_FAILURE);
+            }
             dbus_call_trigger(trigger_device, trigger_action);
             exit(EXIT_SUCCESS);
         }
 
-        pid_t scanbd_pid = -1;
-        // get the name of the saned executable
-        const char* saned = NULL;
-        cfg_t* cfg_sec_global = NULL;
-        cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
-        assert(cfg_sec_global);
-        saned = cfg_getstr(cfg_sec_global, C_SANED);
-        assert(saned);
-
-        if (scanbd_options.signal) {
-            slog(SLOG_DEBUG, "manager mode: signal");
-            // get the path of the pid-file of the running scanbd
-            const char* scanbd_pid_file = NULL;
-            scanbd_pid_file = cfg_getstr(cfg_sec_global, C_PIDFILE);
-            assert(scanbd_pid_file);
-
-            // get the pid of the running scanbd out of the pidfile
-            FILE* pidfile;
-            if ((pidfile = fopen(scanbd_pid_file, "r")) == NULL) {
-                slog(SLOG_WARN, "Can't open pidfile %s", scanbd_pid_file);
-            }
-            else {
-                char pida[NAME_MAX];
-                if (fgets(pida, NAME_MAX, pidfile) == NULL) {
-                    slog(SLOG_WARN, "Can't read pid from pidfile %s", scanbd_pid_file);
-                }
-                if (fclose(pidfile) < 0) {
-                    slog(SLOG_WARN, "Can't close pidfile %s", scanbd_pid_file);
-                }
-                scanbd_pid = atoi(pida);
-                slog(SLOG_DEBUG, "found scanbd with pid %d", scanbd_pid);
-                // set scanbd to sleep mode
-                slog(SLOG_DEBUG, "sending SIGUSR1", scanbd_pid);
-                if (kill(scanbd_pid, SIGUSR1) < 0) {
-                    slog(SLOG_WARN, "Can't send signal SIGUSR1 to pid %d: %s",
-                         scanbd_pid, strerror(errno));
-                    slog(SLOG_DEBUG, "uid=%d, euid=%d", getuid(), geteuid());
-                    //exit(EXIT_FAILURE);
-                }
-            }
-            // sleep some time to give the other scanbd to close all the
-            // usb-connections
-            sleep(1);
-        } // signal-mode
-        else {
-            slog(SLOG_DEBUG, "dbus signal saned-start");
-            dbus_send_signal(SCANBD_DBUS_SIGNAL_SANED_BEGIN, NULL);
-            slog(SLOG_DEBUG, "manager mode: dbus");
-            slog(SLOG_DEBUG, "calling dbus method: %s", SCANBD_DBUS_METHOD_ACQUIRE);
-            dbus_call_method(SCANBD_DBUS_METHOD_ACQUIRE, NULL);
-        }
-        // start the real saned
-        slog(SLOG_DEBUG, "forking subprocess for saned");
-        pid_t spid = -1;
-        if ((spid = fork()) < 0) {
-            slog(SLOG_ERROR, "fork for saned subprocess failed: %s", strerror(errno));
-            exit(EXIT_FAILURE);
-        }
-        else if (spid > 0) { // parent
-            // wait for the saned process to finish
-            int status = 0;
-            slog(SLOG_DEBUG, "waiting for saned");
-            if (waitpid(spid, &status, 0) < 0) {
-                slog(SLOG_ERROR, "waiting for saned failed: %s", strerror(errno));
-                exit(EXIT_FAILURE);
-            }
-            if (WIFEXITED(status)) {
-                slog(SLOG_INFO, "saned exited with status: %d", WEXITSTATUS(status));
-            }
-            if (WIFSIGNALED(status)) {
-                slog(SLOG_INFO, "saned exited due to signal: %d", WTERMSIG(status));
-            }
-            // saned finished and now
-            // reactivate scandb
-            if (scanbd_options.signal) {
-                // sleep some time to give the other scanbd to close all the
-                // usb-connections
-                sleep(1);
-                if (scanbd_pid > 0) {
-                    slog(SLOG_DEBUG, "sending SIGUSR2");
-                    if (kill(scanbd_pid, SIGUSR2) < 0) {
-                        slog(SLOG_INFO, "Can't send signal SIGUSR1 to pid %d: %s",
-                             scanbd_pid, strerror(errno));
-                    }
-                }
-            } // signal-mode
-            else {
-                slog(SLOG_DEBUG, "calling dbus method: %s", SCANBD_DBUS_METHOD_RELEASE);
-                dbus_call_method(SCANBD_DBUS_METHOD_RELEASE, NULL);
-                slog(SLOG_DEBUG, "dbus signal saned-end");
-                dbus_send_signal(SCANBD_DBUS_SIGNAL_SANED_END, NULL);
-            }
-        }
-        else { // child
-            // Ensure that saned gets the systemd fd's
-            // We do not call sd_listen_fds() as that sets FD_CLOEXEC on the fd's
-            char listen_fds[64] = "";
-            if (getenv("LISTEN_PID") != NULL) {
-                snprintf(listen_fds, 64, "LISTEN_PID=%ld", (long) getpid());
-                putenv(listen_fds);
-                slog(SLOG_DEBUG, "Systemd detected: Updating LISTEN_PID env. variable");
-            }
-            size_t numberOfEnvs = cfg_size(cfg_sec_global, "saned_env");
-            for(size_t i = 0; i < numberOfEnvs; i += 1) {
-                const char* e = cfg_getnstr(cfg_sec_global, "saned_env", i);
-                assert(e);
-                if (putenv((char*)e) < 0) { // const-cast should not be neccessary
-                    slog(SLOG_WARN, "Can't set environment %s: %s", e, strerror(errno));
-                }
-                else {
-                    slog(SLOG_DEBUG, "Setting environment: %s", e);
-                }
-            }
-            if (setsid() < 0) {
-                slog(SLOG_WARN, "setsid: %s", strerror(errno));
-            }
-            if (execl(saned, "saned", (char*)NULL) < 0) {
-                slog(SLOG_ERROR, "exec of saned failed: %s", strerror(errno));
-                exit(EXIT_FAILURE);
+        // with a pool the connections are served by pre-forked workers
+        int saned_pool = cfg_getint(cfg_sec_global, C_SANED_POOL);
+        if (saned_pool > 0) {
+            int listen_fd = saned_pool_listen_fd();
+            if (listen_fd >= 0) {
+                scanbm_pooled = true;
+                saned_pool_run(listen_fd, saned_pool, scanbm_warmup, scanbm_session);
             }
-            exit(EXIT_SUCCESS); // not reached
+            slog(SLOG_WARN, "saned_pool needs the listening socket (inetd wait or systemd Accept=no)");
         }
-        exit(EXIT_SUCCESS);
+        scanbm_session();
     }
     else { // not in manager mode
 
@@ -523,6 +892,8 @@ int main(int argc, char** argv) {
             slog(SLOG_DEBUG, "daemonize");
             daemonize();
         }
+        // from now on the pollers don't wait for syslog
+        slog_start();
 
         cfg_t* cfg_sec_global = NULL;
         cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
@@ -597,6 +968,22 @@ int main(int argc, char** argv) {
             }
         }
 
+        // the status page, the pollers register their devices
+        const char* status_file = cfg_getstr(cfg_sec_global, C_STATUS_PAGE);
+        if ((status_file != NULL) && (strlen(status_file) > 0)) {
+            if (!status_page_open(status_file, pwd->pw_uid, grp->gr_gid)) {
+                slog(SLOG_WARN, "running without the status page %s", status_file);
+            }
+        }
+
+        // the metrics endpoint, served by the reactor
+        const char* metrics = cfg_getstr(cfg_sec_global, C_METRICS);
+        if ((metrics != NULL) && (strlen(metrics) > 0)) {
+            if (!metrics_open(metrics, pwd->pw_uid, grp->gr_gid)) {
+                slog(SLOG_WARN, "running without the metrics on %s", metrics);
+            }
+        }
+
         // drop the privileges
         // first change our effective gid
         if (grp != NULL) {
@@ -628,6 +1015,9 @@ int main(int argc, char** argv) {
             }
         }
 
+        // the scripts run with the dropped ids: checked with them
+        cfg_check_scripts();
+
         // Init DBus well known interface
         // must be possible with the user from config file
         dbus_init();
@@ -645,24 +1035,37 @@ int main(int argc, char** argv) {
         slog(SLOG_INFO, "sane version %d.%d",
              SANE_VERSION_MAJOR(sane_version),
              SANE_VERSION_MINOR(sane_version));
-#else
+#endif
+#ifdef USE_SCANBUTTOND
         if (scanbtnd_init() < 0) {
             slog(SLOG_INFO, "Could not initialize scanbuttond modules!\n");
             exit(EXIT_FAILURE);
         }
         assert(backend);
 #endif
-        // get all devices locally connected to the system
-#ifdef USE_SANE
-        get_sane_devices();
-#else
+        // get all devices locally connected to the system, scanbuttond
+        // first: the sane discovery leaves out its devices
+#ifdef USE_SCANBUTTOND
         get_scbtn_devices();
+#endif
+#ifdef USE_SANE
+        // a warm start uses the device cache, the discovery runs in
+        // the reactor after the pollers have been started
+        static bool cached = false;
+        cached = get_sane_cached_devices();
+        if (!cached) {
+            get_sane_devices();
+        }
+        // the pollers start with the before-values of the last run
+        static bool checkpoint = false;
+        checkpoint = load_sane_poll_state();
 #endif
         // start the polling threads
+#ifdef USE_SCANBUTTOND
+        start_scbtn_threads();
+#endif
 #ifdef USE_SANE
         start_sane_threads();
-#else
-        start_scbtn_threads();
 #endif
 
         // start dbus thread
@@ -672,13 +1075,31 @@ int main(int argc, char** argv) {
         udev_start_udev_thread();
 #endif
 
-        // well, sit here and wait ...
-        // this thread executes the signal handlers
-        while(true) {
-            if (pause() < 0) {
-                slog(SLOG_DEBUG, "pause: %s", strerror(errno));
-            }
+        // from now on the signals are handled by the reactor, outside
+        // of the signal context and never interleaved with the dbus
+        // and udev handlers
+        evloop_add_signal(SIGHUP, sig_hup_handler);
+#ifdef USE_SCANBUTTOND
+        evloop_add_signal(SIGALRM, sig_hup_handler);
+#endif
+        evloop_add_signal(SIGUSR1, sig_usr1_handler);
+        evloop_add_signal(SIGUSR2, sig_usr2_handler);
+        evloop_add_signal(SCANBD_STATS_SIGNAL, sig_stats_handler);
+        evloop_add_signal(SIGTERM, sig_term_handler);
+        evloop_add_signal(SIGINT, sig_term_handler);
+#ifdef USE_SANE
+        if (cached) {
+            evloop_add_timer(0, true, verify_sane_cache, &cached);
+        }
+        if (checkpoint) {
+            evloop_add_timer(POLL_STATE_TICK, true, store_sane_state, &checkpoint);
         }
+#endif
+
+        // well, sit here and wait ...
+        // this thread runs the reactor
+        scanbd_place_reactor();
+        evloop_run();
     }
     exit(EXIT_SUCCESS); // never reached
 }
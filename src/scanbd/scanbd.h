@@ -29,6 +29,15 @@
 # endif
 #endif
 
+// the hybrid mode (USE_SANE and USE_SCANBUTTOND): the devices driven by
+// a scanbuttond backend are polled over raw usb, all other devices
+// are polled by sane. The discovery of scanbuttond runs first, the
+// sane discovery leaves out its devices (see scbtn_claims_device()),
+// both sets of pollers share the device registry (see registry.h)
+#if defined(USE_SANE) && defined(USE_SCANBUTTOND)
+# define SCANBD_HYBRID
+#endif
+
 #ifndef _GNU_SOURCE
 # define _GNU_SOURCE
 #endif
@@ -40,7 +49,8 @@
 
 #ifdef USE_SANE
 # include <sane/sane.h>
-#else
+#endif
+#ifdef USE_SCANBUTTOND
 # include <scanbuttond/libusbi.h>
 #endif
 
@@ -48,6 +58,7 @@
 #include "slog.h"
 #include "scanbd_dbus.h"
 #include "udev.h"
+#include "registry.h"
 
 // #define SANE_REINIT // do a sane_exit()/sane_init() sequence if new devices are found
 #define SANE_REINIT_TIMEOUT 3 // TODO: don't know if this is really neccessary
@@ -55,6 +66,15 @@
 #define SCANBUTTOND_ALARM_TIMEOUT 5 // reconfigure after this amount of seconds if
 // device was busy
 
+// scanbm in signal-mode queues SIGUSR1 with this value, scanbd
+// acknowledges the release of the devices with the same signal and
+// value, scanbm waits at most SCANBM_HANDOFF_TIMEOUT seconds for it
+#if defined(SI_QUEUE) && defined(_POSIX_REALTIME_SIGNALS) && ((_POSIX_REALTIME_SIGNALS - 0) > 0)
+# define SCANBD_SIGNAL_HANDOFF
+#endif
+#define SCANBM_HANDOFF_VALUE 0x5cbd
+#define SCANBM_HANDOFF_TIMEOUT 10
+
 #define C_FROM_VALUE "from-value"
 #define C_FROM_VALUE_DEF_INT 0
 #define C_FROM_VALUE_DEF_STR ""
@@ -63,6 +83,23 @@
 #define C_TO_VALUE_DEF_INT 1
 #define C_TO_VALUE_DEF_STR ".+"
 
+// numerical ranges: a maximum below the from- / to-value means the
+// single value
+#define C_FROM_MAX "from-max"
+#define C_TO_MAX "to-max"
+#define C_RANGE_MAX_DEF -1
+
+#define C_MODE "mode"
+#define C_MODE_EDGE "edge"
+#define C_MODE_LEVEL "level"
+#define C_MODE_DEF C_MODE_EDGE
+
+// ms a new value has to last / the to-value has to be held
+#define C_DEBOUNCE "debounce"
+#define C_DEBOUNCE_DEF 0
+#define C_HOLD "hold"
+#define C_HOLD_DEF 0
+
 #define C_FILTER "filter"
 #define C_ACTION_DEF "^scan.*"
 #define C_FUNCTION_DEF "^function.*"
@@ -130,14 +167,156 @@
 #define C_SANED_ENVS "saned_env"
 #define C_SANED_ENVS_DEF "{}"
 
+// empty: saned acquires all devices
+#define C_SANED_DEVICES "saned_devices"
+#define C_SANED_DEVICES_DEF "{}"
+
+// 0: scanbm serves a single connection (inetd nowait, systemd Accept=yes)
+#define C_SANED_POOL "saned_pool"
+#define C_SANED_POOL_DEF 0
+
 #define C_TIMEOUT "timeout"
 #define C_TIMEOUT_DEF 500
 
+#define C_TIMEOUT_MAX "timeout_max"
+#define C_TIMEOUT_MAX_DEF 0
+
+#define C_BURST_TIMEOUT "burst_timeout"
+#define C_BURST_TIMEOUT_DEF 0
+
+#define C_BURST_DURATION "burst_duration"
+#define C_BURST_DURATION_DEF 0
+
+// the idle park of a device (s, 0: never), see poll_interval_t
+#define C_PARK_IDLE "park_idle"
+#define C_PARK_IDLE_DEF 0
+
+#define C_PARK_HEARTBEAT "park_heartbeat"
+#define C_PARK_HEARTBEAT_DEF 60000
+
+// in device sections -1 means: use the value of the global section
+#define C_INHERIT_INT -1
+
+#define C_POLL_WORKERS "poll_workers"
+#define C_POLL_WORKERS_DEF 0
+
+#define C_ACTION_WORKERS "action_workers"
+#define C_ACTION_WORKERS_DEF 2
+
+#define C_ACTION_QUEUE "action_queue"
+#define C_ACTION_QUEUE_DEF 1
+
+// a stop (or restart) of the pollers waits at most this long (ms) for
+// a poller stuck in a backend call, then it is abandoned
+#define C_STOP_TIMEOUT "stop_timeout"
+#define C_STOP_TIMEOUT_DEF 2000
+
+// with the poll scheduler: a device whose poll takes at least this
+// long (ms) is polled by the slow lane worker until it recovers (0:
+// no slow lane)
+#define C_SLOW_POLL "slow_poll"
+#define C_SLOW_POLL_DEF 1000
+
+// the backend calls of each device are made by an own helper process
+// (see poll_helper.h), a call not answered within the timeout (ms)
+// restarts the helper
+#define C_POLL_HELPER "poll_helper"
+#define C_POLL_HELPER_DEF false
+#define C_POLL_HELPER_TIMEOUT "poll_helper_timeout"
+#define C_POLL_HELPER_TIMEOUT_DEF 5000
+
+// the trigger signals are sent in batches this many ms after the first
+// event, repeated events of the same device and action are counted as
+// one (0: with the next round of the reactor)
+#define C_DBUS_COALESCE "dbus_coalesce"
+#define C_DBUS_COALESCE_DEF 0
+
+// the priority class of a device (see cfg_priority_t)
+#define C_PRIORITY "priority"
+#define C_PRIORITY_INTERACTIVE "interactive"
+#define C_PRIORITY_NORMAL "normal"
+#define C_PRIORITY_BACKGROUND "background"
+#define C_PRIORITY_DEF C_PRIORITY_NORMAL
+// the poll interval (ms) of the class: at most (interactive) or at
+// least (background), unless the device section sets a timeout
+#define C_PRIORITY_INTERACTIVE_TIMEOUT 50
+#define C_PRIORITY_BACKGROUND_TIMEOUT 5000
+
+// the cpus (a list like "0-1,3", empty: all cpus of the daemon) of the
+// reactor (dbus, udev and the hooks), of the pollers and of the
+// scripts, see cpu_policy.h
+#define C_REACTOR_CPUS "reactor_cpus"
+#define C_REACTOR_CPUS_DEF ""
+#define C_POLL_CPUS "poll_cpus"
+#define C_POLL_CPUS_DEF ""
+#define C_SCRIPT_CPUS "script_cpus"
+#define C_SCRIPT_CPUS_DEF ""
+// the pollers run with SCHED_FIFO and this priority (1-99, 0: the
+// policy of the priority class)
+#define C_POLL_RTPRIO "poll_rtprio"
+#define C_POLL_RTPRIO_DEF 0
+#define C_POLL_RTPRIO_MAX 99
+// the nice value of the scripts (0-19, 0: the one of the daemon)
+#define C_SCRIPT_NICE "script_nice"
+#define C_SCRIPT_NICE_DEF 0
+#define C_SCRIPT_NICE_MAX 19
+
+#define C_KEEP_OPEN "keep_open"
+#define C_KEEP_OPEN_DEF false
+
+#define C_INTERRUPT_WAKEUP "interrupt_wakeup"
+#define C_INTERRUPT_WAKEUP_DEF false
+
+// the profile of the backend (usually set in its device section): the
+// backend resets a value when it is read, the values read before a
+// trigger ended the cycle are used by the next cycle (see
+// sane_snapshot_carry())
+#define C_READ_RESETS "read_resets"
+#define C_READ_RESETS_DEF true
+// the option reads per second the backend takes, a cycle is delayed
+// until the reads of the previous one fit (0: no limit)
+#define C_POLL_RATE "poll_rate"
+#define C_POLL_RATE_DEF 0
+
+// the settle time of hotplug events (ms), see hotplug.h
+#define C_HOTPLUG_SETTLE "hotplug_settle"
+#define C_HOTPLUG_SETTLE_DEF 500
+
+// the udev events of usb devices which aren't scanners are ignored
+#define C_UDEV_FILTER "udev_filter"
+#define C_UDEV_FILTER_DEF true
+
+// the kernel only reports the udev events of devices with this tag
+// (empty: all usb devices)
+#define C_UDEV_TAG "udev_tag"
+#define C_UDEV_TAG_DEF ""
+
 // TODO: move definition of scanbd.pid to configuration in Makefiles
 //
 #define C_PIDFILE "pidfile"
 #define C_PIDFILE_DEF "/var/run/scanbd.pid"
 
+// empty: the statistics are only available via dbus
+#define C_STATS_FILE "stats_file"
+#define C_STATS_FILE_DEF ""
+
+// empty: no device cache, the pollers start after the discovery
+#define C_DEVICE_CACHE "device_cache"
+#define C_DEVICE_CACHE_DEF ""
+
+// empty: no checkpoint, a restart polls from scratch (see poll_state.h)
+#define C_POLL_STATE "poll_state"
+#define C_POLL_STATE_DEF ""
+
+// empty: no status page (see status_page.h)
+#define C_STATUS_PAGE "status_page"
+#define C_STATUS_PAGE_DEF ""
+
+// empty: no metrics endpoint, a path: unix socket, a number: tcp port
+// on localhost (see metrics.h)
+#define C_METRICS "metrics"
+#define C_METRICS_DEF ""
+
 #define C_ENVIRONMENT "environment"
 
 #define C_FUNCTION "function"
@@ -157,6 +336,12 @@
 #error SCANBD_CFG_DIR is not set!
 #endif
 
+// the default of the config snapshot (see config_snapshot.h), an
+// empty name (-S "") disables the snapshot
+#ifndef SCANBD_CFG_SNAPSHOT
+#define SCANBD_CFG_SNAPSHOT "/var/cache/scanbd/config.snapshot"
+#endif
+
 #define NAME_POLLING_MODE "scanbd"
 #define NAME_MANAGER_MODE "scanbm"
 
@@ -165,6 +350,7 @@ struct scanbdOptions {
     bool        foreground;
     bool        signal;
     const char* config_file_name;
+    const char* config_snapshot;
 };
 
 // command-line options
@@ -179,8 +365,28 @@ extern void sane_init_mutex();
 #endif
 extern void get_sane_devices(void);
 extern void sane_trigger_action(int, int);
-extern void stop_sane_threads(void);
+// returns the number of pollers still stuck in a backend call
+extern int stop_sane_threads(void);
 extern void start_sane_threads(void);
+extern void update_sane_threads(void);
+#ifdef USE_SANE
+extern bool reload_sane_threads(const char* config_file_name);
+// warm start: the pollers are started from the device cache, the
+// discovery follows
+extern bool get_sane_cached_devices(void);
+extern void verify_sane_devices(void);
+// the checkpoint of the before-values (see poll_state.h): loaded before
+// the pollers start, written by the reactor and at the exit
+extern bool load_sane_poll_state(void);
+extern void store_sane_poll_state(bool force);
+// only the poller of the device name stops / resumes (for saned)
+extern registry_park_t sane_acquire_device(const char* name);
+extern registry_park_t sane_release_device(const char* name);
+// triggers the action of the device name (not of a device number)
+extern void sane_trigger_device(const char* name, int action);
+// a device of the sane device list is at the usb location
+extern bool sane_usb_device(int busnum, int devnum);
+#endif
 
 extern void daemonize(void);
 
@@ -45,6 +45,14 @@
 #define SCANBD_DBUS_METHOD_ACQUIRE  "aquire"
 #define SCANBD_DBUS_METHOD_RELEASE  "release"
 #define SCANBD_DBUS_METHOD_TRIGGER  "trigger"
+// the batch triggers for load tests: a(suuu) of (device, action, count,
+// rate), replies the number of batches started (see trigger_batch.h)
+#define SCANBD_DBUS_METHOD_TRIGGER_BATCH "trigger_batch"
+#define SCANBD_DBUS_METHOD_ACTION_STATS "action_stats"
+#define SCANBD_DBUS_METHOD_STATS "stats"
+// the caller receives the button_state signals (of one device)
+#define SCANBD_DBUS_METHOD_SUBSCRIBE "subscribe"
+#define SCANBD_DBUS_METHOD_UNSUBSCRIBE "unsubscribe"
 
 // dbus signals send out 
 #define SCANBD_DBUS_SIGNAL_TRIGGER	"trigger"
@@ -52,6 +60,11 @@
 #define SCANBD_DBUS_SIGNAL_SANED_END	"saned_end"
 #define SCANBD_DBUS_SIGNAL_SCAN_BEGIN	"scan_begin"
 #define SCANBD_DBUS_SIGNAL_SCAN_END	"scan_end"
+// the queued trigger events (device, action, count, {name: value})
+#define SCANBD_DBUS_SIGNAL_TRIGGER_EVENTS	"trigger_events"
+// a changed option value (device, option, value, string value), sent
+// to the subscribers only
+#define SCANBD_DBUS_SIGNAL_BUTTON_STATE	"button_state"
 
 // dbus signals we receive
 #define DBUS_HAL_INTERFACE          "org.freedesktop.Hal.Manager"
@@ -60,19 +73,40 @@
 
 #define HAL_SCANNER_CAPABILITY      "scanner"
 
+// the bus tells a subscriber has gone
+#define DBUS_BUS_SIGNAL_NAME_OWNER  "NameOwnerChanged"
+
 extern void dbus_send_signal(const char*, const char*);
 extern void dbus_send_signal_argv(const char*, char**);
 extern void dbus_send_signal_argv_async(const char*, char**);
+extern void dbus_send_trigger(const char*, const char*, char**);
+
+// the button_state subscriptions: 0 if there are none, otherwise the
+// generation of the subscriptions, a poller seeing a new generation
+// sends all its values once (the new subscriber has none yet)
+extern unsigned int dbus_state_generation(void);
+extern void dbus_send_state(const char* device, const char* option,
+                            long value, const char* str);
 
 extern bool dbus_init(void);
+// the connection of scanbm (see dbus_init_client())
+extern bool dbus_init_client(void);
 extern void dbus_send(void);
 
-extern void dbus_call_method(const char*, const char*);
+extern bool dbus_call_method(const char*, const char*);
+// calls method once for each of the values (device names) without
+// waiting for the replies in between, false if any call failed; without
+// values method is called once without argument
+extern bool dbus_call_methods(const char* method, const char** values, size_t num_values);
 extern void dbus_call_trigger(unsigned int, unsigned int);
+// device, action, count, rate (triggers per second, 0: unpaced)
+extern bool dbus_call_trigger_batch(unsigned int, unsigned int, unsigned int, unsigned int);
 
 extern void dbus_start_dbus_thread(void);
 extern void dbus_stop_dbus_thread(void);
 
 extern void dbus_signal_device_removed(void);
 extern void dbus_signal_device_added(void);
+// the numbers of added and removed devices (see hotplug.h)
+extern void dbus_signal_devices_changed(int added, int removed);
 #endif
@@ -147,6 +147,19 @@ backend_t* scanbtnd_load_backend(const char* filename){
         slog(SLOG_ERROR, "Can't find symbol: %s", error);
         goto cleanup;
     }
+    // optional: all buttons in one query
+    backend->scanbtnd_get_buttons = dlsym(dll_handle, "scanbtnd_get_buttons");
+    if ((error = dlerror()) != NULL) {
+        slog(SLOG_DEBUG, "%s reports single buttons only", filename);
+        backend->scanbtnd_get_buttons = NULL;
+    }
+    // optional: the usb ids for the probing of the meta backend
+    backend->scanbtnd_match_device = dlsym(dll_handle, "scanbtnd_match_device");
+    if ((error = dlerror()) != NULL) {
+        slog(SLOG_DEBUG, "%s is initialized without probing", filename);
+        backend->scanbtnd_match_device = NULL;
+    }
+    backend->initialized = 0;
     return backend;
 
 cleanup:
@@ -24,8 +24,16 @@
 #include <scanbuttond/scanbuttond.h>
 #include "scanbuttond_loader.h"
 #include "scanbuttond_wrapper.h"
-
-#define CANCEL_TEST
+#include "scheduler.h"
+#include "action.h"
+#include "script_env.h"
+#include "mailbox.h"
+#include "registry.h"
+#include "stats.h"
+#include "status_page.h"
+#include "metrics.h"
+#include "probe.h"
+#include <stdatomic.h>
 
 // all programm-global scbtn functions use this mutex to avoid races
 #ifdef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
@@ -37,6 +45,18 @@ pthread_mutex_t scbtn_mutex;
 
 pthread_cond_t  scbtn_cv    = PTHREAD_COND_INITIALIZER;
 
+// guards the stopped flags of the polling threads, signaled if a
+// polling thread has ended (see scbtn_thread_join())
+static pthread_mutex_t scbtn_stop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  scbtn_stop_cv    = PTHREAD_COND_INITIALIZER;
+// the number of abandoned pollers still stuck in a backend call
+// (guarded by the scbtn_stop_mutex): the backend must not be unloaded
+// meanwhile
+static int scbtn_stuck = 0;
+
+// the size of the registry name of a device (see scbtn_device_name())
+#define SCBTN_NAME_MAX 256
+
 // the following locking strategie must be obeyed:
 // 1) lock the scbtn_mutex
 // 2) lock the device specific mutex
@@ -64,21 +84,18 @@ void scbtn_init_mutex()
 #endif
 
 struct scbtn_opt_value {
-    unsigned long num_value; // before-value or after-value or actual-value (BOOL|INT|FIXED)
+    unsigned long num_value; // actual-value (BOOL|INT|FIXED)
 };
 typedef struct scbtn_opt_value scbtn_opt_value_t;
 
 struct scbtn_dev_option {
     int number;                  // the option-number of the device-option
-    scbtn_opt_value_t from_value; // the before-value of the option
-    scbtn_opt_value_t to_value;   // the after-value of the option (to
-    // fire the trigger)
+    const cfg_rule_action_t* rule; // the matched (compiled) action with
+    // the trigger values and the script to be called if the
+    // option-value changes
     scbtn_opt_value_t value;      // the option value (from the last
     //				 // polling cycle)
-    const char* script;          // the found (matched) script to be called if
-    // the option-valued changes
-    const char* action_name;	 // the name of this action as
-    // specified in the config file
+    predicate_state_t state;      // the evaluation state of the rule
 };
 typedef struct scbtn_dev_option scbtn_dev_option_t;
 
@@ -110,6 +127,49 @@ struct scbtn_thread {
     // for this device
     int num_of_options_with_functions;// the number of elements in the
     // above list
+    poll_interval_t interval;        // the (adaptive) polling interval
+    bool scheduled;                  // polled by the poll scheduler
+    // instead of an own thread
+    bool opened;                     // device opened and options matched
+    poll_job_t job;                  // scheduler: the job record
+    action_queue_t actions;          // the queued action scripts
+    bool released;                   // the device is closed for the scripts
+    bool keep_open;                  // the device isn't released to the
+    // action scripts (see C_KEEP_OPEN)
+    cfg_priority_t priority;         // the priority class (see C_PRIORITY)
+    cpu_policy_t policy;             // the cpus and scheduling of the
+    // polling thread (see C_POLL_CPUS)
+    int* buttons;                    // the state of all buttons from
+    // scanbtnd_get_buttons() (NULL: the backend reports single buttons)
+    bool interrupt_wakeup;           // wait on the interrupt endpoint
+    // instead of sleeping (see C_INTERRUPT_WAKEUP)
+    bool interrupted;                // an interrupt event woke the poller
+    unsigned int state_gen;          // the generation of the button_state
+    // subscriptions all values were sent to (see dbus_state_generation())
+    stats_device_t* stats;           // the latency statistics
+    status_device_t* status;         // the record on the status page
+    struct timespec due;             // the next poll is due (jitter)
+    bool parked;                     // the device is used by saned,
+    // released and not polled until resumed (see scbtn_acquire_device())
+    bool woken;                      // the sleep of the polling thread
+    // ends (see scbtn_wake(), guarded by the wake_mutex)
+    atomic_bool wake;                // a wake-up is pending, taken by
+    // the next step (see scbtn_wake())
+    pthread_mutex_t wake_mutex;      // guards woken, never held during
+    // a backend call (unlike the mutex)
+    pthread_cond_t wake_cv;          // signaled if woken is set
+    script_env_t env;                // the environment of the scripts
+    int index;                       // the device number (positional)
+    char name[SCBTN_NAME_MAX];       // the registry name (see
+    // scbtn_device_name())
+    registry_ref_t ref;              // the mailbox id and generation of
+    // the device (see registry.h)
+    atomic_bool stop;                // the poller should end (read
+    // without the mutex, see scbtn_thread_stop())
+    bool stopped;                    // the polling thread has ended
+    // (guarded by the scbtn_stop_mutex)
+    bool abandoned;                  // the poller was stuck at its stop
+    // and is leaked (guarded by the scbtn_stop_mutex)
 };
 typedef struct scbtn_thread scbtn_thread_t;
 
@@ -119,6 +179,29 @@ static scbtn_thread_t* scbtn_poll_threads = NULL;
 // the list of all devices locally connected to our system
 static const scanner_t* scbtn_device_list = NULL;
 
+// the name of dev (the device number) in the device registry into
+// name: the sane device descriptor (with the usb location), the
+// product if the backend has none; identical scanners share the
+// product, so it gets the device number appended ("product#number")
+// if another device of the list has the same product
+static void scbtn_device_name(const scanner_t* dev, int number, char* name, size_t size) {
+    assert(dev != NULL);
+    assert(name != NULL);
+    if (dev->sane_device != NULL) {
+        snprintf(name, size, "%s", dev->sane_device);
+        return;
+    }
+    const char* product = dev->product ? dev->product : SCANBD_NULL_STRING;
+    for(const scanner_t* other = scbtn_device_list; other != NULL; other = other->next) {
+        if ((other != dev) && (other->sane_device == NULL) &&
+            (strcmp(other->product ? other->product : SCANBD_NULL_STRING, product) == 0)) {
+            snprintf(name, size, "%s#%d", product, number);
+            return;
+        }
+    }
+    snprintf(name, size, "%s", product);
+}
+
 // the number of devices = the number of polling threads
 static int num_devices = 0;
 
@@ -133,9 +216,12 @@ void get_scbtn_devices(void) {
     }
     scbtn_device_list = NULL;
     num_devices = 0;
+    struct timespec start;
+    stats_now(&start);
     if ((scbtn_device_list = backend->scanbtnd_get_supported_devices()) == NULL) {
         slog(SLOG_WARN, "Can't get the scbtn device list");
     }
+    stats_record(NULL, STATS_RESCAN, stats_since(&start));
     const scanner_t* dev = scbtn_device_list;
     if (dev == NULL) {
         slog(SLOG_DEBUG, "device list null");
@@ -158,66 +244,27 @@ cleanup:
     }
 }
 
-// cleanup handler for sane_poll
-static void scbtn_thread_cleanup_mutex(void* arg) {
-    assert(arg != NULL);
-    slog(SLOG_DEBUG, "scbtn_thread_cleanup_mutex");
-    pthread_mutex_t* mutex = (pthread_mutex_t*)arg;
-    if (pthread_mutex_unlock(mutex) < 0) {
-        // if we can't unlock the mutex, something is heavily wrong!
-        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-    }
-}
-
-// cleanup handler for sane_poll
-static void scbtn_thread_cleanup_value(void* arg) {
-    assert(arg != NULL);
-    slog(SLOG_DEBUG, "sane_thread_cleanup_value");
-    //    sane_opt_value_t* v = (sane_opt_value_t*)arg;
-    //    sane_option_value_free(v);
-}
-
 // this function can only be used in the critical region of *st
-static void scbtn_find_matching_options(scbtn_thread_t* st, cfg_t* sec) {
+static void scbtn_find_matching_options(scbtn_thread_t* st, const cfg_rule_section_t* rs) {
     slog(SLOG_DEBUG, "sane_find_matching_options");
-    const char* title = cfg_title(sec);
-    if (title == NULL) {
-        title = SCANBD_NULL_STRING;
-    }
     // TODO: use of recursive mutex???
-    int actions = cfg_size(sec, C_ACTION);
-    if (actions <= 0) {
-        slog(SLOG_INFO, "no matching actions in section %s",  title);
+    if (rs->num_actions <= 0) {
+        slog(SLOG_INFO, "no matching actions in section %s", rs->title);
         return;
     }
 
-    slog(SLOG_INFO, "found %d actions in section %s", actions, title);
-
-    // iterate over all global actions
-    for(int i = 0; i < actions; i += 1) {
-        // get the action from the config file
-        cfg_t* action_i = cfg_getnsec(sec, C_ACTION, i);
-        assert(action_i != NULL);
+    slog(SLOG_INFO, "found %d actions in section %s", rs->num_actions, rs->title);
 
-        // get the filter-regex from the config-file
-        const char* opt_regex = cfg_getstr(action_i, C_FILTER);
-        assert(opt_regex != NULL);
+    bool multiple_actions = cfg_rules->multiple_actions;
+    if (multiple_actions) {
+        slog(SLOG_INFO, "multiple actions allowed");
+    }
 
-        const char* title = cfg_title(action_i);
-        if (title == NULL) {
-            title = "(none)";
-        }
-        // compile the filter-regex
+    // iterate over all (precompiled) actions of the section
+    for(int i = 0; i < rs->num_actions; i += 1) {
+        const cfg_rule_action_t* action_i = &rs->actions[i];
         slog(SLOG_DEBUG, "checking action %s with filter: %s",
-             title, opt_regex);
-        regex_t creg;
-        int ret = regcomp(&creg, opt_regex, REG_EXTENDED | REG_NOSUB);
-        if (ret < 0) {
-            char err_text[1024];
-            regerror(ret, &creg, err_text, 1024);
-            slog(SLOG_WARN, "Can't compile regex: %s : %s", opt_regex, err_text);
-            continue;
-        }
+             action_i->title, action_i->filter);
         // look for matching option-names
         for(int opt = 0; opt < st->num_of_options; opt += 1) {
             const char* name = scanbtnd_button_name(st->dev->meta_info, opt + 1);
@@ -226,29 +273,14 @@ static void scbtn_find_matching_options(scbtn_thread_t* st, cfg_t* sec) {
             slog(SLOG_INFO, "found active option[%d] %s for device %s",
                  opt, name, st->dev->product);
             // regex compare with the filter
-            if (regexec(&creg, name, 0, NULL, 0) != 0) {
+            if (regexec(&action_i->filter_reg, name, 0, NULL, 0) != 0) {
                 // no match
                 continue;
             }
             // match
-
-            // now get the script
-            const char* script = cfg_getstr(action_i, C_SCRIPT);
-
-            if (!script || (strlen(script) == 0)) {
-                script = SCANBD_NULL_STRING;
-            }
-
-            assert(script != NULL);
             slog(SLOG_INFO, "installing action %s (%d) for %s, option[%d]: %s as: %s",
-                 title, st->num_of_options_with_scripts, st->dev->product, opt, name, script);
-
-            cfg_t* cfg_sec_global = NULL;
-            cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
-            assert(cfg_sec_global);
-
-            bool multiple_actions = cfg_getbool(cfg_sec_global, C_MULTIPLE_ACTIONS);
-            slog(SLOG_INFO, "multiple actions allowed");
+                 action_i->title, st->num_of_options_with_scripts, st->dev->product,
+                 opt, name, action_i->script);
 
             // looking for option already present in the
             // array
@@ -257,7 +289,7 @@ static void scbtn_find_matching_options(scbtn_thread_t* st, cfg_t* sec) {
                 if (st->opts[n].number == opt + 1) {
                     if (!multiple_actions) {
                         slog(SLOG_WARN, "action %s overrides script %s of option[%d] with %s",
-                             title, st->opts[n].script, opt, script);
+                             action_i->title, st->opts[n].rule->script, opt, action_i->script);
                         // break out with n == index_of_found_option
                         break;
                     }
@@ -265,12 +297,12 @@ static void scbtn_find_matching_options(scbtn_thread_t* st, cfg_t* sec) {
                         if (n < st->num_of_options) {
                             n = st->num_of_options_with_scripts;
                             slog(SLOG_INFO, "adding additional action %s (%d) for option[%d] with %s",
-                                 title, n, opt, script);
+                                 action_i->title, n, opt, action_i->script);
                             break;
                         }
                         else {
                             slog(SLOG_INFO, "can't add additional action %s for option[%d] with %s",
-                                 title, opt, script);
+                                 action_i->title, opt, action_i->script);
                             break;
                         }
                     }
@@ -281,20 +313,14 @@ static void scbtn_find_matching_options(scbtn_thread_t* st, cfg_t* sec) {
             // n == st->num_of_options_with_scripts:
             // not found => new
 
+            if (n == st->num_of_options) {
+                continue; // no space left in array
+            }
             st->opts[n].number = opt + 1;
-            st->opts[n].action_name = title;
-            st->opts[n].script = script;
-            st->opts[n].from_value.num_value = 0;
-            st->opts[n].to_value.num_value = 0;
-            st->opts[n].value.num_value = 0;
-
-            cfg_t* num_trigger = cfg_getsec(action_i, C_NUMERICAL_TRIGGER);
-            assert(num_trigger);
-            st->opts[n].from_value.num_value = cfg_getint(num_trigger,
-                                                          C_FROM_VALUE);
-            st->opts[n].to_value.num_value = cfg_getint(num_trigger, C_TO_VALUE);
-
+            st->opts[n].rule = action_i;
             st->opts[n].value.num_value = 0;
+            predicate_state_init(&st->opts[n].state,
+                                 predicate_classify_num(&action_i->pred, 0));
 
             if (n == st->num_of_options_with_scripts) {
                 // not found in the list
@@ -302,53 +328,26 @@ static void scbtn_find_matching_options(scbtn_thread_t* st, cfg_t* sec) {
                 st->num_of_options_with_scripts += 1;
             }
         } // foreach option
-        // this compiled regex isn't used anymore
-        regfree(&creg);
     } // foreach action
 }
 
 
-void scbtn_find_matching_functions(scbtn_thread_t* st, cfg_t* sec) {
+static void scbtn_find_matching_functions(scbtn_thread_t* st, const cfg_rule_section_t* rs) {
     // TODO: use of recursive mutex???
     slog(SLOG_DEBUG, "sane_find_matching_functions");
-    const char* title = cfg_title(sec);
-    if (title == NULL) {
-        title = SCANBD_NULL_STRING;
-    }
-    int functions = cfg_size(sec, C_FUNCTION);
-    if (functions <= 0) {
-        slog(SLOG_INFO, "no matching functions in section %s", title);
+    if (rs->num_functions <= 0) {
+        slog(SLOG_INFO, "no matching functions in section %s", rs->title);
         return;
     }
     slog(SLOG_INFO, "scanbuttond backends can't use function definitions");
     st->num_of_options_with_functions = 0;
 }
 
-void* scbtn_poll(void* arg) {
-#ifdef CANCEL_TEST
-    if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) < 0) {
-        slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
-    }
-#endif
-    scbtn_thread_t* st = (scbtn_thread_t*)arg;
+// opens the device and builds the tables of matching actions and
+// functions
+// this function can only be used in the critical region of *st
+static bool scbtn_poll_open(scbtn_thread_t* st) {
     assert(st != NULL);
-    slog(SLOG_DEBUG, "scbtn_poll");
-    // we only expect the main thread to handle signals
-    sigset_t mask;
-    sigfillset(&mask);
-    pthread_sigmask(SIG_BLOCK, &mask, NULL);
-
-    static int si = 0;
-
-    // this thread uses the device and the san_thread_t datastructure
-    // lock it
-    pthread_cleanup_push(scbtn_thread_cleanup_mutex, ((void*)&st->mutex));
-    if (pthread_mutex_lock(&st->mutex) < 0) {
-        // if we can't get the mutex, something is heavily wrong!
-        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        pthread_exit(NULL);
-    }
-
     int ores = backend->scanbtnd_open((scanner_t*)st->dev);
     if (ores != 0) {
         slog(SLOG_WARN, "scanbtnd_open failed, error code: %s", strerror(ores));
@@ -359,7 +358,11 @@ void* scbtn_poll(void* arg) {
         if (alarm(SCANBUTTOND_ALARM_TIMEOUT) > 0) {
             slog(SLOG_WARN, "alarm error, there was a pending alarm");
         }
-        pthread_exit(NULL);
+        return false;
+    }
+    if (atomic_load(&st->stop)) {
+        // stopped while opening: the rules may be gone
+        return false;
     }
 
     // figure out the number of options this device has
@@ -369,10 +372,18 @@ void* scbtn_poll(void* arg) {
     if (st->num_of_options == 0) {
         // no options -> nothing to poll
         slog(SLOG_INFO, "No options for device %s", st->dev->product);
-        pthread_exit(NULL);
+        return false;
     }
     slog(SLOG_INFO, "found %d options for device %s", st->num_of_options, st->dev->product);
 
+    // the backend may report all buttons in one query
+    free(st->buttons);
+    st->buttons = NULL;
+    if (backend->scanbtnd_get_buttons != NULL) {
+        st->buttons = (int*) calloc(st->num_of_options, sizeof(int));
+        assert(st->buttons != NULL);
+    }
+
     // allocate an array of options for the  matching actions
     //
     // only one script is possible per option, later matching
@@ -387,8 +398,7 @@ void* scbtn_poll(void* arg) {
                                             sizeof(scbtn_dev_option_t));
     assert(st->opts != NULL);
     for(int i = 0; i < st->num_of_options; i += 1) {
-        st->opts[i].from_value.num_value = 0;
-        st->opts[i].to_value.num_value = 0;
+        st->opts[i].rule = NULL;
         st->opts[i].value.num_value = 0;
     }
 
@@ -416,404 +426,763 @@ void* scbtn_poll(void* arg) {
     cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
     assert(cfg_sec_global);
 
+    // the compiled rules of the config
+    assert(cfg_rules != NULL);
+
     // find the global actions
-    scbtn_find_matching_options(st, cfg_sec_global);
+    scbtn_find_matching_options(st, &cfg_rules->global);
 
     // find the global functions
-    scbtn_find_matching_functions(st, cfg_sec_global);
+    scbtn_find_matching_functions(st, &cfg_rules->global);
 
     // find (if any) device specifc sections
     // these override global definitions, if any
-    int local_sections = cfg_size(cfg, C_DEVICE);
-    slog(SLOG_DEBUG, "found %d local device sections", local_sections);
-
-    for(int loc = 0; loc < local_sections; loc += 1) {
-        cfg_t* loc_i = cfg_getnsec(cfg, C_DEVICE, loc);
-        assert(loc_i != NULL);
-
-        // get the filter-regex from the config-file
-        const char* loc_regex = cfg_getstr(loc_i, C_FILTER);
-        assert(loc_regex != NULL);
-
-        const char* title = cfg_title(loc_i);
-        if (title == NULL) {
-            title = "(none)";
-        }
-        // compile the filter-regex
+    slog(SLOG_DEBUG, "found %d local device sections", cfg_rules->num_devices);
+
+    // the priority class, the cpu policies, the poll interval and the
+    // keep_open policy, device sections may override them
+    st->priority = cfg_device_priority(st->dev->product);
+    cpu_policy_t script_policy;
+    cfg_device_policy(st->dev->product, &st->policy, &script_policy);
+    poll_interval_init(&st->interval, cfg_sec_global, st->priority);
+    st->keep_open = cfg_getbool(cfg_sec_global, C_KEEP_OPEN);
+    st->interrupt_wakeup = cfg_getbool(cfg_sec_global, C_INTERRUPT_WAKEUP);
+
+    for(int loc = 0; loc < cfg_rules->num_devices; loc += 1) {
+        const cfg_rule_section_t* loc_i = &cfg_rules->devices[loc];
         slog(SLOG_INFO, "checking device section %s with filter: %s",
-             title, loc_regex);
-        regex_t creg;
-        int ret = regcomp(&creg, loc_regex, REG_EXTENDED | REG_NOSUB);
-        if (ret < 0) {
-            char err_text[1024];
-            regerror(ret, &creg, err_text, 1024);
-            slog(SLOG_WARN, "Can't compile regex: %s : %s", loc_regex, err_text);
-            continue;
-        }
+             loc_i->title, loc_i->filter);
         // compare the regex against the device name
-        if (regexec(&creg, st->dev->product, 0, NULL, 0) == 0) {
+        if (regexec(&loc_i->filter_reg, st->dev->product, 0, NULL, 0) == 0) {
             // match
-            int loc_actions = cfg_size(loc_i, C_ACTION);
             slog(SLOG_INFO, "found %d local action for device %s [%s]",
-                 loc_actions, st->dev->product, title);
+                 loc_i->num_actions, st->dev->product, loc_i->title);
             // get the local actions for this device
             scbtn_find_matching_options(st, loc_i);
             // get the local functions for this device
             scbtn_find_matching_functions(st, loc_i);
+            // get the local poll interval for this device
+            poll_interval_override(&st->interval, loc_i->sec);
+            if (cfg_size(loc_i->sec, C_KEEP_OPEN) > 0) {
+                st->keep_open = cfg_getbool(loc_i->sec, C_KEEP_OPEN);
+            }
+            if (cfg_size(loc_i->sec, C_INTERRUPT_WAKEUP) > 0) {
+                st->interrupt_wakeup = cfg_getbool(loc_i->sec, C_INTERRUPT_WAKEUP);
+            }
         }
-        regfree(&creg);
     } // foreach local section
 
-    int timeout = cfg_getint(cfg_sec_global, C_TIMEOUT);
-    if (timeout <= 0) {
-        timeout = C_TIMEOUT_DEF;
+    slog(SLOG_DEBUG, "timeout: %d ms, max: %d ms, burst: %d ms for %d s",
+         st->interval.timeout, st->interval.timeout_max,
+         st->interval.burst_timeout, st->interval.burst_duration);
+    if (st->keep_open) {
+        slog(SLOG_INFO, "keeping device %s open for the action scripts", st->dev->product);
+    }
+    // a polling thread applies the class itself (see scbtn_poll())
+    action_queue_priority(&st->actions, st->priority);
+    action_queue_policy(&st->actions, &script_policy);
+    if (st->scheduled) {
+        poll_scheduler_priority(&st->job, st->priority);
     }
-    slog(SLOG_DEBUG, "timeout: %d ms", timeout);
 
-    slog(SLOG_DEBUG, "Start the polling for device %s", st->dev->product);
+    // the static part of the script environment
+    script_env_free(&st->env);
+    script_env_init(&st->env, st->dev->sane_device, st->num_of_options_with_functions);
+    return true;
+}
 
-    while(true) {
-        slog(SLOG_DEBUG, "polling thread for %s, before cancellation point", st->dev->product);
-#ifdef CANCEL_TEST
-        if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) < 0) {
-            slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
+// queues the script of the triggered action to the action executor:
+// builds the environment, sends the signals and releases the device
+// to the script, the device is reopened after the queued scripts have
+// finished
+// this function can only be used in the critical region of *st
+static void scbtn_trigger(scbtn_thread_t* st) {
+    assert(st != NULL);
+
+    assert(st->triggered_option >= 0); // index into the opts-array
+    assert(st->triggered_option < st->num_of_options_with_scripts);
+
+    if (atomic_load(&st->stop)) {
+        // stopped while the backend was called: the poller may be
+        // abandoned and its rules gone (see stop_scbtn_threads())
+        st->triggered = false;
+        st->triggered_option = -1; // invalid
+        return;
+    }
+    
+    slog(SLOG_ERROR, "trigger action for device %s with script %s",
+         st->name, st->opts[st->triggered_option].rule->script);
+    SCANBD_PROBE2(trigger, st->name, st->opts[st->triggered_option].rule->title);
+    
+    // prepare the environment for the script to be called:
+    // the static part was built when the device was opened, only
+    // the action is added
+    assert(st->num_of_options_with_functions == 0);
+
+    char** env = script_env_build(&st->env, st->opts[st->triggered_option].rule->title);
+    if (env == NULL) {
+        st->triggered = false;
+        st->triggered_option = -1; // invalid
+        if (pthread_cond_broadcast(&st->cv) < 0) {
+            slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
         }
-#endif
-        // special cancellation point
-        pthread_testcancel();
-        
-#ifdef CANCEL_TEST
-        if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) < 0) {
-            slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
+        return;
+    }
+
+    // sendout an dbus-signal with all the values as
+    // arguments
+    dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_BEGIN, st->name);
+    
+    //dbus_send_signal_argv_async(SCANBD_DBUS_SIGNAL_TRIGGER, env);
+    dbus_send_trigger(st->name, st->opts[st->triggered_option].rule->title, env);
+    status_triggered(st->status, st->opts[st->triggered_option].rule->title);
+    metrics_trigger(st->name, st->opts[st->triggered_option].rule->title);
+
+    // the action-script will use the device,
+    // so we have to release the device, unless the scripts of this
+    // device don't need exclusive access
+    if (!st->released && !st->keep_open) {
+        if (backend->scanbtnd_close((scanner_t*)st->dev) < 0) {
+            slog(SLOG_ERROR, "unable to close scanner backend");
         }
-#endif
-        slog(SLOG_DEBUG, "polling thread for %s, after cancellation point", st->dev->product);
-        
-        slog(SLOG_DEBUG, "polling device %s", st->dev->product);
-        
-        int button = backend->scanbtnd_get_button((scanner_t*)st->dev);
-        if (button) {
-            slog(SLOG_INFO, "################ button %d pressed ################", button);
-        } else {
-            slog(SLOG_INFO, "button %d", button);
+        st->released = true;
+    }
+    assert(st->opts[st->triggered_option].rule->script);
+    assert(strlen(st->opts[st->triggered_option].rule->script) > 0);
+
+    // the script path was made absolute when the config was compiled,
+    // the executor keeps a copy
+    const char* script_abs = st->opts[st->triggered_option].rule->script;
+    assert(script_abs);
+
+    // the executor takes over the env
+    assert(st->interval.timeout > 0);
+    action_queue_submit(&st->actions, script_abs, env, st->interval.timeout);
+
+    st->triggered = false;
+    st->triggered_option = -1; // invalid
+    // we need to trigger all waiting threads
+    if (pthread_cond_broadcast(&st->cv) < 0) {
+        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
+    }
+}
+
+// polls the device once and queues the script of a triggered action
+// returns the number of ms until the next poll is due or -1 if the
+// polling of this device should be abandoned
+// this function can only be used in the critical region of *st
+static int scbtn_poll_once(scbtn_thread_t* st) {
+    assert(st != NULL);
+
+    if (st->parked) {
+        // the device is used by saned, remote triggers stay pending
+        if (!st->released) {
+            // opened by the first cycle after the acquire
+            backend->scanbtnd_close((scanner_t*)st->dev);
+            st->released = true;
         }
-        
-        for(si = 0; si < st->num_of_options_with_scripts; si += 1) {
-            //	    const scbtn_Option_Descriptor* odesc = NULL;
-            //	    assert((odesc = scbtn_get_option_descriptor(st->h, st->opts[i].number)) != NULL);
-            
-            const backend_t* b = st->dev->meta_info;
-            slog(SLOG_INFO, "option: %d", st->opts[si].number);
-            const char* name = scanbtnd_button_name(b, st->opts[si].number);
-            assert(name);
-            
-            if (st->opts[si].script != NULL) {
-                if (strlen(st->opts[si].script) <= 0) {
-                    slog(SLOG_WARN, "No valid script for option %s for device %s",
-                         name, st->dev->product);
-                    continue;
-                }
+        return st->interval.timeout;
+    }
+
+    // a remote trigger (dbus) of this device
+    int action = trigger_mailbox_take(st->ref.id, st->ref.generation);
+    if (action >= 0) {
+        if (action < st->num_of_options_with_scripts) {
+            slog(SLOG_DEBUG, "remote trigger of action %d for device %s",
+                 action, st->dev->product);
+            st->triggered = true;
+            st->triggered_option = action;
+            scbtn_trigger(st);
+            return poll_interval_next(&st->interval, true);
+        }
+        slog(SLOG_WARN, "No such action %d for device number %d", action, st->index);
+    }
+
+    if (st->released) {
+        // the device is released to the action scripts
+        if (action_queue_busy(&st->actions)) {
+            // parked until the queued scripts have finished
+            return st->interval.timeout;
+        }
+        slog(SLOG_DEBUG, "reopen device %s", st->dev->product);
+
+        struct timespec start;
+        stats_now(&start);
+        int ores = backend->scanbtnd_open((scanner_t*)st->dev);
+        if (ores != 0) {
+            slog(SLOG_WARN, "scanbtnd_open failed, error code: %d", ores);
+            slog(SLOG_WARN, "abandon polling of %s", st->dev->product);
+            if (ores == -ENODEV) {
+                slog(SLOG_WARN, "scanbtnd_open failed, no device -> canceling thread");
+            }
+            if (alarm(SCANBUTTOND_ALARM_TIMEOUT) > 0) {
+                slog(SLOG_WARN, "alarm error, there was a pending alarm");
             }
-            else {
-                slog(SLOG_WARN, "No script for option %s for device %s",
+            return -1;
+        }
+        stats_record(st->stats, STATS_REOPEN, stats_since(&start));
+        status_reopened(st->status);
+        st->released = false;
+    }
+
+    // one query for the state of all buttons, if the backend can,
+    // otherwise only the (highest) pressed button is known
+    int button = 0;
+    int pressed = 0;
+    struct timespec start;
+    stats_now(&start);
+    SCANBD_PROBE1(button__start, st->dev->product);
+    if (st->buttons != NULL) {
+        pressed = backend->scanbtnd_get_buttons((scanner_t*)st->dev, st->buttons,
+                                                st->num_of_options);
+        if (pressed == -ENOSYS) {
+            slog(SLOG_DEBUG, "device %s reports single buttons only", st->dev->product);
+            free(st->buttons);
+            st->buttons = NULL;
+        }
+        else if (pressed < 0) {
+            slog(SLOG_WARN, "can't get the buttons of device %s: %d", st->dev->product, pressed);
+            memset(st->buttons, 0, st->num_of_options * sizeof(int));
+        }
+    }
+    if (st->buttons == NULL) {
+        button = backend->scanbtnd_get_button((scanner_t*)st->dev);
+        pressed = (button > 0) ? 1 : 0;
+    }
+    SCANBD_PROBE2(button__end, st->dev->product, pressed);
+    stats_record(st->stats, STATS_POLL, stats_since(&start));
+    if (atomic_load(&st->stop)) {
+        // stopped while the backend was queried: the poller may be
+        // abandoned and its rules gone (see stop_scbtn_threads())
+        return -1;
+    }
+    // any pressed button (or interrupt event) keeps the poll interval
+    // short
+    bool activity = (pressed > 0) || st->interrupted;
+    st->interrupted = false;
+    if (pressed > 0) {
+        slog(SLOG_INFO, "################ %d button(s) pressed ################", pressed);
+    } else {
+        slog(SLOG_INFO, "button %d", button);
+    }
+    // the subscribers get the changed values, a new subscriber all
+    unsigned int state_gen = dbus_state_generation();
+    bool state_all = (state_gen != 0) && (state_gen != st->state_gen);
+    
+    int si = 0;
+    for(si = 0; si < st->num_of_options_with_scripts; si += 1) {
+        //	    const scbtn_Option_Descriptor* odesc = NULL;
+        //	    assert((odesc = scbtn_get_option_descriptor(st->h, st->opts[i].number)) != NULL);
+        
+        const backend_t* b = st->dev->meta_info;
+        slog(SLOG_INFO, "option: %d", st->opts[si].number);
+        const char* name = scanbtnd_button_name(b, st->opts[si].number);
+        assert(name);
+        
+        assert(st->opts[si].rule != NULL);
+        if (st->opts[si].rule->script != NULL) {
+            if (strlen(st->opts[si].rule->script) <= 0) {
+                slog(SLOG_WARN, "No valid script for option %s for device %s",
                      name, st->dev->product);
                 continue;
             }
-            assert(st->opts[si].script != NULL);
-            assert(strlen(st->opts[si].script) > 0);
-            
-            //	    scbtn_opt_value_t value;
-            //	    scbtn_option_value_init(&value);
-            // push the cleanup-handle to free the value storage
-            pthread_cleanup_push(scbtn_thread_cleanup_value, NULL);
-            
-            slog(SLOG_INFO, "checking option %s number %d (%d) for device %s",
-                 name, st->opts[si].number, si,
-                 st->dev->product);
-            
-            
-            unsigned long value = 0;
-            
-            if ((button > 0) && (button == st->opts[si].number)) {
-                value = 1;
-                slog(SLOG_INFO, "button %d has been pressed.", button);
-                if ((st->opts[si].from_value.num_value == st->opts[si].value.num_value) &&
-                        (st->opts[si].to_value.num_value == value)) {
-                    slog(SLOG_DEBUG, "value trigger: numerical");
-                    st->triggered = true;
-                    st->triggered_option = si;
-                    // we need to trigger all waiting threads
-                    if (pthread_cond_broadcast(&st->cv) < 0) {
-                        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
-                    }
-                }
-            }
-            
-            // pass the responsibility to free the value to the main
-            // thread, if this thread gets canceled
-            if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) < 0) {
-                slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
-            }
-            st->opts[si].value.num_value = value;
-            pthread_cleanup_pop(0);
-            if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) < 0) {
-                slog(SLOG_ERROR, "pthread_setcancelstate: %s", strerror(errno));
-            }
-            
-            // was there a value change?
-            if (st->triggered && (st->triggered_option >= 0)) {
-                assert(st->triggered_option >= 0); // index into the opts-array
-                assert(st->triggered_option < st->num_of_options_with_scripts);
-                
-                slog(SLOG_ERROR, "trigger action for device %s with script %s",
-                     st->dev->product, st->opts[st->triggered_option].script);
-                
-                // prepare the environment for the script to be called
-                
-                // number of env-vars =
-                // number of found function-options
-                // plus the values in the environment-section (2):
-                // device, action
-                // plus those 4:
-                // PATH, PWD, USER, HOME
-                // plus the sentinel
-                cfg_t* global_envs = cfg_getsec(cfg_sec_global, C_ENVIRONMENT);
-                
-                assert(st->num_of_options_with_functions == 0);
-                
-                int number_of_envs = st->num_of_options_with_functions + 4 + 2 + 1;
-                char** env = calloc(number_of_envs, sizeof(char*));
-                for(int e = 0; e < number_of_envs; e += 1) {
-                    env[e] = calloc(NAME_MAX + 1, sizeof(char));
-                }
-                int e = 0;
-                const char* ev = "PATH";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, "/usr/sbin:/usr/bin:/sbin:/bin");
-                    slog(SLOG_DEBUG, "No PATH, setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = "PWD";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    char buf[PATH_MAX+1];
-                    char* ptr = getcwd(buf, PATH_MAX);
-                    if (!ptr) {
-                        slog(SLOG_ERROR, "can't get pwd");
-                    }
-                    else {
-                        assert(ptr);
-                        snprintf(env[e], NAME_MAX, "%s=%s", ev, ptr);
-                        slog(SLOG_DEBUG, "No PWD, setting env: %s", env[e]);
-                        e += 1;
-                    }
-                }
-                ev = "USER";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    struct passwd* pwd = NULL;
-                    pwd = getpwuid(geteuid());
-                    assert(pwd);
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, pwd->pw_name);
-                    slog(SLOG_DEBUG, "No USER, setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = "HOME";
-                if (getenv(ev) != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, getenv(ev));
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                else {
-                    struct passwd* pwd = 0;
-                    pwd = getpwuid(geteuid());
-                    assert(pwd);
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, pwd->pw_dir);
-                    slog(SLOG_DEBUG, "No HOME, setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = cfg_getstr(global_envs, C_DEVICE);
-                if (ev != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev, st->dev->sane_device);
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                ev = cfg_getstr(global_envs, C_ACTION);
-                if (ev != NULL) {
-                    snprintf(env[e], NAME_MAX, "%s=%s", ev,
-                             st->opts[st->triggered_option].action_name);
-                    slog(SLOG_DEBUG, "setting env: %s", env[e]);
-                    e += 1;
-                }
-                env[e] = NULL;
-                assert(e == number_of_envs-1);
-                
-                // sendout an dbus-signal with all the values as
-                // arguments
-                dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_BEGIN, st->dev->product);
-                
-                //dbus_send_signal_argv_async(SCANBD_DBUS_SIGNAL_TRIGGER, env);
-                dbus_send_signal_argv(SCANBD_DBUS_SIGNAL_TRIGGER, env);
-                
-                // the action-script will use the device,
-                // so we have to release the device
-                //		scbtn_close(st->h);
-                //		st->h = NULL;
-                
-                if (backend->scanbtnd_close((scanner_t*)st->dev) < 0) {
-                    slog(SLOG_ERROR, "unable to close scanner backend");
-                }
-                
-                assert(st->triggered_option >= 0);
-                assert(st->opts[st->triggered_option].script);
-                assert(strlen(st->opts[st->triggered_option].script) > 0);
-                
-                // need to copy the values because we leave the
-                // critical section
-                // int triggered_option = st->triggered_option;
-                
-                char* script_abs = make_script_path_abs(st->opts[st->triggered_option].script);
-                assert(script_abs);
-                
-                // leave the critical section
-                if (pthread_mutex_unlock(&st->mutex) < 0) {
-                    // if we can't unlock the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
-                
-                if (strcmp(script_abs, SCANBD_NULL_STRING) != 0) {
-                    
-                    assert(timeout > 0);
-                    usleep(timeout * 1000); //ms
-                    
-                    pid_t cpid;
-                    if ((cpid = fork()) < 0) {
-                        slog(SLOG_ERROR, "Can't fork: %s", strerror(errno));
-                    }
-                    else if (cpid > 0) { // parent
-                        slog(SLOG_INFO, "waiting for child: %s", script_abs);
-                        int status;
-                        if (waitpid(cpid, &status, 0) < 0) {
-                            slog(SLOG_ERROR, "waitpid: %s", strerror(errno));
-                        }
-                        if (WIFEXITED(status)) {
-                            slog(SLOG_INFO, "child %s exited with status: %d",
-                                 script_abs, WEXITSTATUS(status));
-                        }
-                        if (WIFSIGNALED(status)) {
-                            slog(SLOG_INFO, "child %s signaled with signal: %d",
-                                 script_abs, WTERMSIG(status));
-                        }
-                    }
-                    else { // child
-                        slog(SLOG_DEBUG, "exec for %s", script_abs);
-                        if (execle(script_abs, script_abs, NULL, env) < 0) {
-                            slog(SLOG_ERROR, "execlp: %s", strerror(errno));
-                        }
-                        exit(EXIT_FAILURE); // not reached
-                    }
-                } // script_abs == SCANBD_NULL_STRING
-                
-                assert(script_abs != NULL);
-                free(script_abs);
-                script_abs = NULL;
-                
-                // free (last element is the sentinel!)
-                assert(env != NULL);
-                for(int e = 0; e < number_of_envs - 1; e += 1) {
-                    assert(env[e] != NULL);
-                    free(env[e]);
-                }
-                free(env);
-                
-                // enter the critical section
-                if (pthread_mutex_lock(&st->mutex) < 0) {
-                    // if we can't get the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
-                
-                st->triggered = false;
-                st->triggered_option = -1; // invalid
+        }
+        else {
+            slog(SLOG_WARN, "No script for option %s for device %s",
+                 name, st->dev->product);
+            continue;
+        }
+        assert(st->opts[si].rule->script != NULL);
+        assert(strlen(st->opts[si].rule->script) > 0);
+        
+        slog(SLOG_INFO, "checking option %s number %d (%d) for device %s",
+             name, st->opts[si].number, si,
+             st->dev->product);
+        
+        
+        unsigned long value = 0;
+        if (st->buttons != NULL) {
+            assert(st->opts[si].number > 0);
+            assert(st->opts[si].number <= st->num_of_options);
+            value = st->buttons[st->opts[si].number - 1] ? 1 : 0;
+        }
+        else if ((button > 0) && (button == st->opts[si].number)) {
+            value = 1;
+        }
+        
+        // the compiled trigger: ranges, debounce and hold (see
+        // predicate.h), only a pressed button fires
+        unsigned int cls = predicate_classify_num(&st->opts[si].rule->pred, value);
+        bool fired = predicate_eval(&st->opts[si].rule->pred, &st->opts[si].state, cls, &start);
+        if (value == 1) {
+            slog(SLOG_INFO, "button %d has been pressed.", st->opts[si].number);
+            if (fired) {
+                slog(SLOG_DEBUG, "value trigger: numerical");
+                st->triggered = true;
+                st->triggered_option = si;
                 // we need to trigger all waiting threads
                 if (pthread_cond_broadcast(&st->cv) < 0) {
                     slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
                 }
-                
-                // leave the critical section
-                if (pthread_mutex_unlock(&st->mutex) < 0) {
-                    // if we can't release the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
-                // sleep the timeout to settle devices, necessary?
-                usleep(timeout * 1000); //ms
-                
-                // send out the debus signal
-                dbus_send_signal(SCANBD_DBUS_SIGNAL_SCAN_END, st->dev->product);
-                
-                // enter the critical section
-                if (pthread_mutex_lock(&st->mutex) < 0) {
-                    // if we can't get the mutex, something is heavily wrong!
-                    slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-                    pthread_exit(NULL);
-                }
-                
-                slog(SLOG_DEBUG, "reopen device %s", st->dev->product);
-                
-                int ores = backend->scanbtnd_open((scanner_t*)st->dev);
-                if (ores != 0) {
-                    slog(SLOG_WARN, "scanbtnd_open failed, error code: %d", ores);
-                    slog(SLOG_WARN, "abandon polling of %s", st->dev->product);
-                    if (ores == -ENODEV) {
-                        slog(SLOG_WARN, "scanbtnd_open failed, no device -> canceling thread");
-                    }
-                    if (alarm(SCANBUTTOND_ALARM_TIMEOUT) > 0) {
-                        slog(SLOG_WARN, "alarm error, there was a pending alarm");
-                    }
-                    pthread_exit(NULL);
-                }
-            } // if triggered
-        } // foreach option
+            }
+        }
         
-        // release the mutex
+        if ((state_gen != 0) && (state_all || (st->opts[si].value.num_value != value))) {
+            dbus_send_state(st->name, name, (long)value, NULL);
+        }
+        st->opts[si].value.num_value = value;
         
-        // because pthread_cleanup_pop is a macro we can't use it here
-        //	 pthread_cleanup_pop(1);
+        // was there a value change?
+        if (st->triggered && (st->triggered_option >= 0)) {
+            activity = true;
+            scbtn_trigger(st);
+            // the device is released to the script, the remaining
+            // options are checked after the reopen
+            break;
+        }
+    } // foreach option
+    if (si == st->num_of_options_with_scripts) {
+        st->state_gen = state_gen;
+    }
+    return poll_interval_next(&st->interval, activity);
+}
+
+// the idle park (see poll_interval_t): a parked device is released,
+// so it can autosuspend, each heartbeat opens it for one poll cycle
+// this function can only be used in the critical region of *st
+static void scbtn_poll_park(scbtn_thread_t* st, bool idle) {
+    assert(st != NULL);
+    if (!st->interval.idle) {
+        if (idle) {
+            slog(SLOG_INFO, "device %s resumed", st->dev->product);
+            stats_record(st->stats, STATS_PARKED, stats_since(&st->interval.parked));
+        }
+        return;
+    }
+    if (!idle) {
+        slog(SLOG_INFO, "device %s idle for %d s, parked", st->dev->product,
+             st->interval.park_idle);
+    }
+    if (!st->released && !action_queue_busy(&st->actions)) {
+        backend->scanbtnd_close((scanner_t*)st->dev);
+        st->released = true;
+    }
+}
+
+// one polling cycle (see scbtn_poll_once()), records the poll jitter
+// this function can only be used in the critical region of *st
+static int scbtn_poll_cycle(scbtn_thread_t* st) {
+    assert(st != NULL);
+    bool idle = st->interval.idle;
+    if (idle && !st->parked) {
+        stats_record(st->stats, STATS_WAKEUP, stats_since(&st->interval.heartbeat));
+        stats_now(&st->interval.heartbeat);
+    }
+    else {
+        stats_poll_begin(st->stats, &st->due);
+    }
+    SCANBD_PROBE1(poll__start, st->dev->product);
+    int delay = scbtn_poll_once(st);
+    SCANBD_PROBE2(poll__end, st->dev->product, delay);
+    if (delay >= 0) {
+        scbtn_poll_park(st, idle);
+        stats_poll_end(&st->due, delay);
+        if (st->parked) {
+            status_state(st->status, STATUS_PARKED);
+        }
+        else {
+            status_polled(st->status, !st->released ? STATUS_OPEN :
+                          (st->interval.idle ? STATUS_IDLE : STATUS_RELEASED));
+        }
+    }
+    return delay;
+}
+
+// returns the usb device to wait on for interrupt events instead of
+// sleeping between two cycles, NULL if the device doesn't support it
+// or is released
+// this function can only be used in the critical region of *st
+static libusb_device_t* scbtn_interrupt_device(scbtn_thread_t* st) {
+    assert(st != NULL);
+    if (!st->interrupt_wakeup || st->released || (st->dev->connection != CONNECTION_LIBUSB)) {
+        return NULL;
+    }
+    libusb_device_t* usbdev = (libusb_device_t*)st->dev->internal_dev_ptr;
+    if ((usbdev == NULL) || (usbdev->intr_endpoint == 0)) {
+        return NULL;
+    }
+    return usbdev;
+}
+
+// sleeps delay ms or until an interrupt event of usbdev (if not NULL)
+// arrives: a short button press is sampled right after the event
+// instead of falling between two polls
+// returns true if woken by an event
+static bool scbtn_poll_wait(libusb_device_t* usbdev, int delay) {
+    if (usbdev != NULL) {
+        unsigned char event[64];
+        int n = libusb_interrupt_read(usbdev, event, sizeof(event), delay);
+        if (n > 0) {
+            slog(SLOG_DEBUG, "interrupt event (%d bytes) on %s", n, usbdev->location);
+            return true;
+        }
+        if (n == 0) {
+            // timeout
+            return false;
+        }
+        slog(SLOG_DEBUG, "can't wait for interrupt events on %s: %d", usbdev->location, n);
+    }
+    usleep(delay * 1000); //ms
+    return false;
+}
+
+// sleeps delay ms, a wake-up (see scbtn_wake()) ends the sleep early
+// this function can only be used in the critical region of *st, the
+// mutex is released while sleeping
+static void scbtn_poll_sleep(scbtn_thread_t* st, int delay) {
+    assert(st != NULL);
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += delay / 1000;
+    until.tv_nsec += (long)(delay % 1000) * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec += 1;
+        until.tv_nsec -= 1000000000L;
+    }
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (pthread_mutex_lock(&st->wake_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+    while(!st->woken && !atomic_load(&st->stop)) {
+        int ret = pthread_cond_timedwait(&st->wake_cv, &st->wake_mutex, &until);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_timedwait: %s", strerror(ret));
+            break;
+        }
+    }
+    st->woken = false;
+    if (pthread_mutex_unlock(&st->wake_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (pthread_mutex_lock(&st->mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+}
+
+// ends the sleep of the polling thread st (see scbtn_poll_sleep())
+static void scbtn_poll_rouse(scbtn_thread_t* st) {
+    assert(st != NULL);
+    if (pthread_mutex_lock(&st->wake_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    st->woken = true;
+    if (pthread_cond_broadcast(&st->wake_cv) < 0) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+    if (pthread_mutex_unlock(&st->wake_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// wakes the poller up after a remote trigger: the trigger is taken
+// now instead of after the poll interval, a parked device resumes (a
+// thread waiting for an interrupt event isn't woken up)
+// the registry calls this function (see registry_wake()), st can't
+// vanish meanwhile; it never waits for the mutex of st, which the
+// poller holds during its backend calls
+static void scbtn_wake(void* arg) {
+    scbtn_thread_t* st = (scbtn_thread_t*)arg;
+    assert(st != NULL);
+    // the interval is woken up by the next step
+    atomic_store(&st->wake, true);
+    if (st->scheduled) {
+        poll_scheduler_wake(&st->job);
+    }
+    else {
+        scbtn_poll_rouse(st);
+    }
+}
+
+// one step of the poller: the first step opens the device (unless a
+// script of the previous poller still uses it, see
+// action_queue_busy()), afterwards each step is one polling cycle
+// returns the number of ms until the next step is due or -1 if the
+// polling of this device should be abandoned
+// this function can only be used in the critical region of *st
+static int scbtn_poll_step(scbtn_thread_t* st) {
+    assert(st != NULL);
+    if (atomic_exchange(&st->wake, false) && poll_interval_wake(&st->interval)) {
+        slog(SLOG_DEBUG, "wake up of parked device %s", st->dev->product);
+    }
+    if (!st->opened) {
+        if (action_queue_busy(&st->actions)) {
+            slog(SLOG_DEBUG, "device %s still used by a script", st->dev->product);
+            return C_TIMEOUT_DEF;
+        }
+        if (!scbtn_poll_open(st)) {
+            return -1;
+        }
+        st->opened = true;
+        slog(SLOG_DEBUG, "Start the polling for device %s", st->dev->product);
+    }
+    slog(SLOG_DEBUG, "polling device %s", st->dev->product);
+    return scbtn_poll_cycle(st);
+}
+
+// the (stopped) poller st has ended its last cycle: a poller abandoned
+// meanwhile (see stop_scbtn_threads()) isn't stuck anymore
+static void scbtn_thread_ended(scbtn_thread_t* st) {
+    assert(st != NULL);
+    if (pthread_mutex_lock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    st->stopped = true;
+    if (st->abandoned) {
+        // the device list may be rescanned already: no name
+        scbtn_stuck -= 1;
+        slog(SLOG_INFO, "an abandoned poller has ended");
+        // its replacement has another record
+        status_device_put(st->status);
+        st->status = NULL;
+        stats_device_put(st->stats);
+        st->stats = NULL;
+    }
+    if (pthread_cond_broadcast(&scbtn_stop_cv)) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+    if (pthread_mutex_unlock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// thread start function
+// the thread ends cooperatively: a stop (see scbtn_thread_stop()) ends
+// the sleep, the actual cycle (or interrupt wait) is completed
+void* scbtn_poll(void* arg) {
+    scbtn_thread_t* st = (scbtn_thread_t*)arg;
+    assert(st != NULL);
+    slog(SLOG_DEBUG, "scbtn_poll");
+    // we only expect the main thread to handle signals
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    // this thread uses the device and the san_thread_t datastructure
+    // lock it, it is only released while sleeping
+    if (pthread_mutex_lock(&st->mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        goto stopped;
+    }
+
+    // the first step always places the thread: the policy is unset
+    cfg_priority_t priority = CFG_PRIORITY_NORMAL;
+    cpu_policy_t policy;
+    cpu_policy_init(&policy);
+    while(!atomic_load(&st->stop)) {
+        int delay = scbtn_poll_step(st);
+        if (delay < 0) {
+            break;
+        }
+        if ((st->priority != priority) || !cpu_policy_equal(&st->policy, &policy)) {
+            // matched (or reloaded) with another class or policy
+            priority = st->priority;
+            policy = st->policy;
+            poll_thread_priority(priority, &policy);
+        }
+        libusb_device_t* usbdev = scbtn_interrupt_device(st);
+        if (usbdev == NULL) {
+            // sleep the polling timeout (or until woken up or
+            // stopped), the mutex is released meanwhile
+            scbtn_poll_sleep(st, delay);
+            continue;
+        }
+        
+        // release the mutex
         if (pthread_mutex_unlock(&st->mutex) < 0) {
             // if we can't unlock the mutex, something is heavily wrong!
             slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-            pthread_exit(NULL);
+            goto stopped;
         }
         
-        // sleep the polling timeout
-        usleep(timeout * 1000); //ms
+        // sleep the polling timeout (or until an interrupt event)
+        bool interrupted = scbtn_poll_wait(usbdev, delay);
         
         // regain the mutex
-        // because pthread_cleanup_push is a macro we can't use it here
-        // pthread_cleanup_push(scbtn_thread_cleanup_mutex, ((void*)&st->mutex));
         if (pthread_mutex_lock(&st->mutex) < 0) {
             // if we can't get the mutex, something is heavily wrong!
             slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-            pthread_exit(NULL);
+            goto stopped;
+        }
+        st->interrupted = interrupted;
+    }
+    slog(SLOG_DEBUG, "polling thread for %s ends", st->dev->product);
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+stopped:
+    scbtn_thread_ended(st);
+    return NULL;
+}
+
+// job function of the poll scheduler: each run is one step of the
+// poller (see scbtn_poll_step())
+static int scbtn_poll_job(void* arg) {
+    scbtn_thread_t* st = (scbtn_thread_t*)arg;
+    assert(st != NULL);
+
+    if (pthread_mutex_lock(&st->mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return -1;
+    }
+    int delay = -1;
+    if (!atomic_load(&st->stop)) {
+        delay = scbtn_poll_step(st);
+        if (atomic_load(&st->stop)) {
+            // the job isn't run again
+            scbtn_thread_ended(st);
         }
     }
-    pthread_cleanup_pop(1); // release the mutex
-    pthread_exit(NULL);
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        return -1;
+    }
+    return delay;
+}
+
+// asks the poller st to end, all pollers are asked before the first
+// one is waited for (see scbtn_thread_join()), so they end in
+// parallel: a sleeping thread wakes up at once, the others end after
+// their actual cycle (or interrupt wait), a job isn't run again
+static void scbtn_thread_stop(scbtn_thread_t* st) {
+    assert(st != NULL);
+    // no wake-up reaches st anymore
+    registry_remove(st->name);
+    atomic_store(&st->stop, true);
+    if (st->scheduled) {
+        return;
+    }
+    slog(SLOG_DEBUG, "stopping poll thread for device %s", st->dev->product);
+    // a sleeping thread ends at once, a thread in a cycle (or stuck in
+    // a backend call) finds the flag before the next sleep
+    scbtn_poll_rouse(st);
+}
+
+// the poller st is stuck at its stop: it is counted until it ends (see
+// scbtn_thread_ended())
+static void scbtn_thread_abandon(scbtn_thread_t* st) {
+    assert(st != NULL);
+    if (pthread_mutex_lock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    // it may have ended right after the deadline
+    if (!st->stopped && !st->abandoned) {
+        st->abandoned = true;
+        scbtn_stuck += 1;
+    }
+    else if (st->stopped) {
+        status_device_put(st->status);
+        st->status = NULL;
+        stats_device_put(st->stats);
+        st->stats = NULL;
+    }
+    if (pthread_mutex_unlock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// the number of abandoned pollers still stuck in a backend call
+static int scbtn_stuck_pollers(void) {
+    if (pthread_mutex_lock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return 0;
+    }
+    int stuck = scbtn_stuck;
+    if (pthread_mutex_unlock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return stuck;
+}
+
+// waits until deadline for the (stopped) poller st to end
+// returns false if the poller is still running: it is stuck in a
+// backend call and abandoned
+static bool scbtn_thread_join(scbtn_thread_t* st, const struct timespec* deadline) {
+    assert(st != NULL);
+    assert(deadline != NULL);
+    if (st->scheduled) {
+        slog(SLOG_DEBUG, "removing poll job for device %s", st->dev->product);
+        return poll_scheduler_remove(&st->job, deadline);
+    }
+    slog(SLOG_DEBUG, "waiting for poll thread for device %s", st->dev->product);
+    // the thread may have checked the flag right before
+    // scbtn_thread_stop(): it sleeps now, the lock succeeds
+    if (pthread_mutex_timedlock(&st->mutex, deadline) == 0) {
+        if (pthread_cond_broadcast(&st->cv) < 0) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+        if (pthread_mutex_unlock(&st->mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+    }
+    if (pthread_mutex_lock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    while(!st->stopped) {
+        int ret = pthread_cond_timedwait(&scbtn_stop_cv, &scbtn_stop_mutex, deadline);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_timedwait: %s", strerror(ret));
+            break;
+        }
+    }
+    bool stopped = st->stopped;
+    if (pthread_mutex_unlock(&scbtn_stop_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    if (!stopped) {
+        if (pthread_detach(st->tid) != 0) {
+            slog(SLOG_ERROR, "pthread_detach: %s", strerror(errno));
+        }
+        return false;
+    }
+    // joining all threads to prevent memory leaks
+    if (pthread_join(st->tid, NULL) < 0) {
+        slog(SLOG_ERROR, "pthread_join: %s", strerror(errno));
+    }
+    st->tid = 0;
+    return true;
+}
+
+// starts the poll scheduler, if configured and not already running,
+// and the action executor
+static void scbtn_start_scheduler(void) {
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    int workers = cfg_getint(cfg_sec_global, C_POLL_WORKERS);
+    if (workers > 0) {
+        poll_scheduler_start(workers, cfg_getint(cfg_sec_global, C_SLOW_POLL),
+                             &cfg_rules->global.poll);
+    }
+    action_executor_start(cfg_getint(cfg_sec_global, C_ACTION_WORKERS),
+                          cfg_getint(cfg_sec_global, C_ACTION_QUEUE),
+                          &cfg_rules->global.script);
 }
 
 void start_scbtn_threads() {
@@ -836,7 +1205,8 @@ void start_scbtn_threads() {
         slog(SLOG_ERROR, "Can't allocate memory for polling threads");
         goto cleanup;
     }
-    // starting for each device a seperate thread
+    scbtn_start_scheduler();
+    // starting for each device a seperate thread (or job)
     slog(SLOG_DEBUG, "start the threads (%d)", num_devices);
     const scanner_t* dev = scbtn_device_list;
     for(int i = 0; i < num_devices && dev != NULL; i += 1, dev = dev->next) {
@@ -845,11 +1215,34 @@ void start_scbtn_threads() {
         scbtn_poll_threads[i].dev = dev;
         scbtn_poll_threads[i].opts = NULL;
         scbtn_poll_threads[i].functions = NULL;
+        scbtn_poll_threads[i].buttons = NULL;
+        scbtn_poll_threads[i].interrupted = false;
+        scbtn_poll_threads[i].state_gen = 0;
         scbtn_poll_threads[i].num_of_options = 0;
         scbtn_poll_threads[i].triggered = false;
         scbtn_poll_threads[i].triggered_option = -1;
         scbtn_poll_threads[i].num_of_options_with_scripts = 0;
         scbtn_poll_threads[i].num_of_options_with_functions = 0;
+        scbtn_poll_threads[i].scheduled = false;
+        scbtn_poll_threads[i].opened = false;
+        scbtn_poll_threads[i].released = false;
+        scbtn_poll_threads[i].parked = false;
+        scbtn_poll_threads[i].woken = false;
+        atomic_init(&scbtn_poll_threads[i].wake, false);
+        scbtn_poll_threads[i].priority = CFG_PRIORITY_NORMAL;
+        atomic_init(&scbtn_poll_threads[i].stop, false);
+        scbtn_poll_threads[i].stopped = false;
+        scbtn_poll_threads[i].abandoned = false;
+        scbtn_poll_threads[i].index = i;
+        scbtn_device_name(dev, i, scbtn_poll_threads[i].name,
+                          sizeof(scbtn_poll_threads[i].name));
+        // identical scanners share the product: the records are kept
+        // per registry name
+        scbtn_poll_threads[i].stats = stats_device(scbtn_poll_threads[i].name);
+        scbtn_poll_threads[i].status = status_device(scbtn_poll_threads[i].name);
+        // scan_end (and the script metrics) of the queued jobs carry
+        // the name of scan_begin
+        action_queue_init(&scbtn_poll_threads[i].actions, scbtn_poll_threads[i].name);
 
         if (pthread_mutex_init(&scbtn_poll_threads[i].mutex, NULL) < 0) {
             slog(SLOG_ERROR, "pthread_mutex_init: should not happen");
@@ -857,6 +1250,23 @@ void start_scbtn_threads() {
         if (pthread_cond_init(&scbtn_poll_threads[i].cv, NULL) < 0) {
             slog(SLOG_ERROR, "pthread_cond_init: should not happen");
         }
+        if (pthread_mutex_init(&scbtn_poll_threads[i].wake_mutex, NULL) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_init: should not happen");
+        }
+        if (pthread_cond_init(&scbtn_poll_threads[i].wake_cv, NULL) < 0) {
+            slog(SLOG_ERROR, "pthread_cond_init: should not happen");
+        }
+        // a remote trigger may wake the poller from now on
+        registry_add(scbtn_poll_threads[i].name, i, &scbtn_poll_threads[i],
+                     scbtn_wake, &scbtn_poll_threads[i].ref);
+        if (poll_scheduler_active()) {
+            // no own thread, the device is polled by the scheduler workers
+            scbtn_poll_threads[i].scheduled = true;
+            poll_scheduler_add(&scbtn_poll_threads[i].job, scbtn_poll_threads[i].name,
+                               scbtn_poll_job, (void*)&scbtn_poll_threads[i]);
+            slog(SLOG_DEBUG, "Job scheduled for device %s", dev->product);
+            continue;
+        }
         if (pthread_create(&scbtn_poll_threads[i].tid, NULL, scbtn_poll,
                            (void*)&scbtn_poll_threads[i]) < 0) {
             slog(SLOG_ERROR, "Can't start scbtn_poll_thread: %s", strerror(errno));
@@ -875,13 +1285,16 @@ cleanup:
     }
 }
 
-void stop_scbtn_threads() {
+// returns the number of abandoned pollers still stuck in a backend
+// call (of this and earlier stops): the backend can't be unloaded
+// (scbtn_shutdown()) and their devices aren't released yet
+int stop_scbtn_threads() {
     slog(SLOG_DEBUG, "stop_scbtn_threads");
 
     if (pthread_mutex_lock(&scbtn_mutex) < 0) {
         // if we can't get the mutex, something is heavily wrong!
         slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        return;
+        return scbtn_stuck_pollers();
     }
 
     if (scbtn_poll_threads == NULL) {
@@ -889,50 +1302,41 @@ void stop_scbtn_threads() {
         slog(SLOG_DEBUG, "stop_scbtn_threads: nothing to stop");
         goto cleanup;
     }
-    // sending cancel request to all threads
+    // one deadline for all pollers, they end in parallel
+    struct timespec deadline;
+    poll_stop_deadline(&deadline);
+    // sending the stop request to all threads
     const scanner_t* dev = scbtn_device_list;
     for(int i = 0; i < num_devices && dev != NULL; i += 1, dev = dev->next) {
-        if (pthread_mutex_lock(&scbtn_poll_threads[i].mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        }
-        while(scbtn_poll_threads[i].triggered == true) {
-            slog(SLOG_DEBUG, "stop_scbtn_threads: an action is active, waiting ...");
-
-            if (pthread_cond_wait(&scbtn_poll_threads[i].cv,
-                                  &scbtn_poll_threads[i].mutex) < 0) {
-                slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(errno));
-            }
-        }
-        if (pthread_mutex_unlock(&scbtn_poll_threads[i].mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        }
-
-        slog(SLOG_DEBUG, "stopping poll thread for device %s", dev->product);
-        if (pthread_cancel(scbtn_poll_threads[i].tid) < 0) {
-            if (errno == ESRCH) {
-                slog(SLOG_ERROR, "poll thread for device %s was already cancelled");
-            }
-            else {
-                slog(SLOG_ERROR, "unknown error from pthread_cancel: %s", strerror(errno));
-            }
-        }
-        slog(SLOG_INFO, "cancelled thread for device %s", dev->product);
+        scbtn_thread_stop(&scbtn_poll_threads[i]);
     }
     // waiting for all threads to vanish
     slog(SLOG_INFO, "waiting ...");
+    int abandoned = 0;
     dev = scbtn_device_list;
     for(int i = 0; i < num_devices && dev != NULL; i += 1, dev = dev->next) {
-        slog(SLOG_DEBUG, "waiting for poll thread for device %s",
-             dev->product);
-        // joining all threads to prevent memory leaks
-        if (pthread_join(scbtn_poll_threads[i].tid, NULL) < 0) {
-            slog(SLOG_ERROR, "pthread_join: %s", strerror(errno));
+        bool joined = scbtn_thread_join(&scbtn_poll_threads[i], &deadline);
+        // drop the pending actions, an active action goes on running
+        action_queue_remove(&scbtn_poll_threads[i].actions);
+        if (!joined) {
+            // the thread finds the stop flag after the backend call
+            slog(SLOG_WARN, "poller of device %s is stuck, abandoned",
+                 scbtn_poll_threads[i].dev->product);
+            scbtn_thread_abandon(&scbtn_poll_threads[i]);
+            abandoned += 1;
+            continue;
         }
-        scbtn_poll_threads[i].tid = 0;
         // close the associated device of the thread
         slog(SLOG_DEBUG, "closing device %s", scbtn_poll_threads[i].dev->product);
         assert(scbtn_poll_threads[i].dev);
-        backend->scanbtnd_close((scanner_t*)scbtn_poll_threads[i].dev);
+        if (!scbtn_poll_threads[i].released) {
+            backend->scanbtnd_close((scanner_t*)scbtn_poll_threads[i].dev);
+        }
+        // the poller has ended, so this is the only writer
+        status_device_put(scbtn_poll_threads[i].status);
+        scbtn_poll_threads[i].status = NULL;
+        stats_device_put(scbtn_poll_threads[i].stats);
+        scbtn_poll_threads[i].stats = NULL;
 
         if (scbtn_poll_threads[i].opts) {
             slog(SLOG_DEBUG, "freeing opt resources for device %s thread",
@@ -946,6 +1350,9 @@ void stop_scbtn_threads() {
             free(scbtn_poll_threads[i].opts);
             scbtn_poll_threads[i].opts = NULL;
         }
+        script_env_free(&scbtn_poll_threads[i].env);
+        free(scbtn_poll_threads[i].buttons);
+        scbtn_poll_threads[i].buttons = NULL;
         if (scbtn_poll_threads[i].functions) {
             slog(SLOG_DEBUG, "freeing function resources for device %s thread",
                  scbtn_poll_threads[i].dev->product);
@@ -959,10 +1366,21 @@ void stop_scbtn_threads() {
         if (pthread_mutex_destroy(&scbtn_poll_threads[i].mutex) < 0) {
             slog(SLOG_ERROR, "pthread_mutex_destroy: %s", strerror(errno));
         }
+        if (pthread_cond_destroy(&scbtn_poll_threads[i].wake_cv) < 0) {
+            slog(SLOG_ERROR, "pthread_cond_destroy: %s", strerror(errno));
+        }
+        if (pthread_mutex_destroy(&scbtn_poll_threads[i].wake_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_destroy: %s", strerror(errno));
+        }
+    }
+    // free the thread list, unless an abandoned poller still uses it
+    if (abandoned == 0) {
+        free(scbtn_poll_threads);
     }
-    // free the thread list
-    free(scbtn_poll_threads);
     scbtn_poll_threads = NULL;
+    // a reload may change the number of workers
+    poll_scheduler_stop(&deadline);
+    action_executor_stop();
     // no threads active anymore
     if (pthread_cond_broadcast(&scbtn_cv)) {
         slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
@@ -971,78 +1389,209 @@ cleanup:
     if (pthread_mutex_unlock(&scbtn_mutex) < 0) {
         // if we can't unlock the mutex, something is heavily wrong!
         slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
-        return;
     }
+    return scbtn_stuck_pollers();
 }
 
-void scbtn_trigger_action(int number_of_dev, int action) {
-    assert(number_of_dev >= 0);
-    assert(action >= 0);
-    slog(SLOG_DEBUG, "sane_trigger_action device=%d, action=%d", number_of_dev, action);
-
+// parks (acquire == true) or resumes the poller of the device with
+// the registry name (see scbtn_device_name()): a parked poller has
+// released its device (after a pending trigger was queued) for saned,
+// resumed it reopens the device in the next cycle
+// returns REGISTRY_PARK_NONE if no poller polls name
+static registry_park_t scbtn_park_device(const char* name, bool acquire) {
+    assert(name != NULL);
+    registry_park_t result = REGISTRY_PARK_NONE;
     if (pthread_mutex_lock(&scbtn_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
         slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        return;
+        return REGISTRY_PARK_NONE;
+    }
+    // the registry only holds running pollers, they can't vanish while
+    // the scbtn_mutex is held
+    scbtn_thread_t* st = (scbtn_thread_t*)registry_lookup(name, scbtn_wake, NULL);
+    if (st == NULL) {
+        goto cleanup;
+    }
+    // the poller holds its mutex during the backend calls of a cycle,
+    // the reactor doesn't wait for a stuck backend
+    struct timespec deadline;
+    poll_stop_deadline(&deadline);
+    int ret = pthread_mutex_timedlock(&st->mutex, &deadline);
+    if (ret != 0) {
+        if (ret != ETIMEDOUT) {
+            slog(SLOG_ERROR, "pthread_mutex_timedlock: %s", strerror(ret));
+        }
+        slog(SLOG_WARN, "poller of device %s is stuck, not %s", name,
+             acquire ? "parked" : "resumed");
+        result = REGISTRY_PARK_STUCK;
+        goto cleanup;
+    }
+    while(st->triggered == true) {
+        slog(SLOG_DEBUG, "scbtn_park_device: an action is active, waiting ...");
+        ret = pthread_cond_timedwait(&st->cv, &st->mutex, &deadline);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_timedwait: %s", strerror(ret));
+        }
+    }
+    if (st->triggered) {
+        slog(SLOG_WARN, "poller of device %s is stuck, not %s", name,
+             acquire ? "parked" : "resumed");
+        result = REGISTRY_PARK_STUCK;
     }
-    if (num_devices <= 0) {
-        slog(SLOG_WARN, "No devices at all");
-        goto cleanup_scbtn;
+    else {
+        st->parked = acquire;
+        if (!acquire) {
+            // an idle park ends with the release as well
+            poll_interval_wake(&st->interval);
+        }
+        if (acquire && st->opened && !st->released) {
+            backend->scanbtnd_close((scanner_t*)st->dev);
+            st->released = true;
+        }
+        slog(SLOG_INFO, "%s device %s", acquire ? "parked" : "resumed", name);
+        result = REGISTRY_PARK_DONE;
     }
-    if (number_of_dev >= num_devices) {
+    if (pthread_mutex_unlock(&st->mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+cleanup:
+    if (pthread_mutex_unlock(&scbtn_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return result;
+}
+
+registry_park_t scbtn_acquire_device(const char* name) {
+    slog(SLOG_DEBUG, "scbtn_acquire_device %s", name);
+    return scbtn_park_device(name, true);
+}
+
+registry_park_t scbtn_release_device(const char* name) {
+    slog(SLOG_DEBUG, "scbtn_release_device %s", name);
+    return scbtn_park_device(name, false);
+}
+
+// helper to trigger a specified action from another thread
+// (e.g. dbus) via an action number: posts the action to the trigger
+// mailbox of the device, the polling thread (or job) of the device
+// queues the script in its next cycle
+void scbtn_trigger_action(int number_of_dev, int action) {
+    // the numbers come from remote, trigger_mailbox_post() checks them
+    slog(SLOG_DEBUG, "scbtn_trigger_action device=%d, action=%d", number_of_dev, action);
+
+    registry_ref_t ref;
+    if (!registry_resolve(number_of_dev, &ref)) {
         slog(SLOG_WARN, "No such device number %d", number_of_dev);
-        goto cleanup_scbtn;
+        return;
+    }
+    if (!trigger_mailbox_post(ref.id, ref.generation, action)) {
+        slog(SLOG_WARN, "trigger of action %d for device number %d rejected",
+             action, number_of_dev);
+        return;
     }
+    registry_wake(&ref);
+}
 
-    while(scbtn_poll_threads== NULL) {
-        // no devices actually polling
-        slog(SLOG_WARN, "No polling at the moment, waiting ...");
-        if (pthread_cond_wait(&scbtn_cv, &scbtn_mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_cond_wait: ", strerror(errno));
-            goto cleanup_scbtn;
-        }
+// as scbtn_trigger_action(), but for the device name (the sane device
+// descriptor with the usb location, see scbtn_device_name())
+void scbtn_trigger_device(const char* name, int action) {
+    assert(name != NULL);
+    slog(SLOG_DEBUG, "scbtn_trigger_device device=%s, action=%d", name, action);
+
+    registry_ref_t ref;
+    if (registry_lookup(name, NULL, &ref) == NULL) {
+        slog(SLOG_WARN, "No such device %s", name);
+        return;
     }
-    assert(scbtn_poll_threads != NULL);
-    scbtn_thread_t* st = &scbtn_poll_threads[number_of_dev];
-    assert(st != NULL);
+    if (!trigger_mailbox_post(ref.id, ref.generation, action)) {
+        slog(SLOG_WARN, "trigger of action %d for device %s rejected", action, name);
+        return;
+    }
+    registry_wake(&ref);
+}
 
-    // this thread uses the device and the sane_thread_t datastructure
-    // lock it
-    if (pthread_mutex_lock(&st->mutex) < 0) {
+int scbtn_device_count(void) {
+    if (pthread_mutex_lock(&scbtn_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
         slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
-        goto cleanup_scbtn;
+        return 0;
     }
-
-    if (action >= st->num_of_options_with_scripts) {
-        slog(SLOG_WARN, "No such action %d for device number %d", action, number_of_dev);
-        goto cleanup_dev;
+    int count = num_devices;
+    if (pthread_mutex_unlock(&scbtn_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
     }
+    return count;
+}
 
-    while(st->triggered == true) {
-        slog(SLOG_DEBUG, "sane_trigger_action: an action is active, waiting ...");
-        if (pthread_cond_wait(&st->cv, &st->mutex) < 0) {
-            slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(errno));
-            goto cleanup_dev;
+// the usb location (bus:device) at the end of a device descriptor,
+// e.g. "001:004" of "epson:libusb:001:004", NULL if there is none
+static const char* scbtn_location(const char* name) {
+    const char* last = strrchr(name, ':');
+    if (last == NULL) {
+        return NULL;
+    }
+    for(const char* p = last - 1; p >= name; p -= 1) {
+        if (*p == ':') {
+            return p + 1;
         }
     }
+    return NULL;
+}
 
-    slog(SLOG_DEBUG, "sane_trigger_action: an action is active, waiting ...");
+// the backends of sane and scanbuttond name the same device with
+// their own prefix (e.g. "epson2:libusb:001:004" and
+// "epson:libusb:001:004"), only the usb location is compared
+bool scbtn_claims_device(const char* sane_name) {
+    assert(sane_name != NULL);
+    const char* location = scbtn_location(sane_name);
+    if (location == NULL) {
+        // not an usb device (e.g. a network scanner)
+        return false;
+    }
+    if (pthread_mutex_lock(&scbtn_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    bool claimed = false;
+    for(const scanner_t* dev = scbtn_device_list; (dev != NULL) && !claimed; dev = dev->next) {
+        const char* l = (dev->sane_device != NULL) ? scbtn_location(dev->sane_device) : NULL;
+        claimed = (l != NULL) && (strcmp(l, location) == 0);
+    }
+    if (pthread_mutex_unlock(&scbtn_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return claimed;
+}
 
-    st->triggered = true;
-    st->triggered_option = action;
-    // we need to trigger all waiting threads
-    if (pthread_cond_broadcast(&st->cv) < 0) {
-        slog(SLOG_ERROR, "pthread_cond_broadcats: this shouln't happen");
+// the backend is asked with a device of the ids only (backends
+// without scanbtnd_match_device() may drive any device)
+bool scbtn_match_usb(int vendor, int product) {
+    if (backend == NULL || backend->scanbtnd_match_device == NULL) {
+        return true;
     }
+    libusb_device_t device;
+    memset(&device, 0, sizeof(device));
+    device.vendorID = vendor;
+    device.productID = product;
 
-cleanup_dev:
-    if (pthread_mutex_unlock(&st->mutex) < 0) {
-        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    if (pthread_mutex_lock(&scbtn_mutex) < 0) {
+        // if we can't get the mutex, something is heavily wrong!
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return true;
     }
-cleanup_scbtn:
+    bool match = backend->scanbtnd_match_device(&device) != 0;
     if (pthread_mutex_unlock(&scbtn_mutex) < 0) {
+        // if we can't unlock the mutex, something is heavily wrong!
         slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
     }
-    return;
+    return match;
 }
 
 void scbtn_shutdown(void)
@@ -24,8 +24,9 @@
 #define SCANBUTTOND_WRAPPER_H
 
 #include "common.h"
+#include "registry.h"
 
-#ifndef USE_SANE
+#ifdef USE_SCANBUTTOND
 #include "scanbuttond_loader.h"
 
 extern backend_t* backend; // in scanbd.c
@@ -37,9 +38,22 @@ void scbtn_init_mutex();
 void get_scbtn_devices(void);
 const char* scanbtnd_button_name(const backend_t* backend, unsigned int button);
 void start_scbtn_threads(void);
-void stop_scbtn_threads(void);
+// returns the number of pollers still stuck in a backend call
+int stop_scbtn_threads(void);
 void scbtn_trigger_action(int number_of_dev, int action);
+// triggers the action of the device name (not of a device number)
+void scbtn_trigger_device(const char* name, int action);
+// only the poller of the device name stops / resumes (for saned)
+registry_park_t scbtn_acquire_device(const char* name);
+registry_park_t scbtn_release_device(const char* name);
 void scbtn_shutdown(void);
+// the backend drives usb devices with the vendor and product id
+bool scbtn_match_usb(int vendor, int product);
+// the number of discovered devices
+int scbtn_device_count(void);
+// a discovered device is at the usb location of the sane device name
+// (see SCANBD_HYBRID)
+bool scbtn_claims_device(const char* sane_name);
 
 #endif
 
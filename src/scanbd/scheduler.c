@@ -0,0 +1,907 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "scheduler.h"
+#include <stdint.h>
+#include <sched.h>
+
+// the scheduler mutex protects the heaps and the job states
+// (index, running, removed, due, priority)
+// the job function is always called without this mutex held, so the
+// job may lock its device specific mutex
+static pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signaled if the heap changes or the scheduler should stop
+static pthread_cond_t sched_cv;
+// signaled if a worker has finished a run of a job
+static pthread_cond_t sched_done_cv = PTHREAD_COND_INITIALIZER;
+// the watchdog sleeps on this one, so the wake-ups of the workers
+// don't reach it
+static pthread_cond_t sched_watch_cv;
+
+// a job in the slow lane returns after this many fast runs in a row
+#define SCHED_RECOVER_RUNS 3
+
+// min-heap of jobs ordered by due time
+struct sched_heap {
+    poll_job_t** jobs;
+    int size;
+    int capacity;
+};
+typedef struct sched_heap sched_heap_t;
+
+// the queued jobs of each priority class
+static sched_heap_t sched_heaps[CFG_PRIORITIES];
+// the queued jobs of the slow lane (all classes)
+static sched_heap_t sched_slow_heap;
+// the (not removed) jobs of each priority class
+static int sched_jobs[CFG_PRIORITIES];
+// the fast workers running a job (not counting the stalled ones)
+static int sched_busy = 0;
+// the jobs running on the fast workers (for the watchdog)
+static poll_job_t* sched_active = NULL;
+// the slow lane threshold in ms (0: no slow lane)
+static int sched_slow_ms = 0;
+// the cpus and scheduling of the workers (see C_POLL_CPUS)
+static cpu_policy_t sched_policy;
+// the workers which end after their (stalled) run: the watchdog has
+// started a replacement for each
+static int sched_surplus = 0;
+
+// the fast workers, then the slow worker and the watchdog (if any)
+static pthread_t* sched_workers = NULL;
+static int sched_num_workers = 0;
+static int sched_num_threads = 0;
+static bool sched_running = false;
+// the threads of the actual scheduler which haven't ended yet
+// (including the detached replacement workers)
+static int sched_live = 0;
+// each start begins a new generation: a worker abandoned by a stop
+// (stuck in a job) ends after its job, even if the scheduler was
+// restarted meanwhile
+static unsigned long sched_generation = 0;
+
+static bool ts_before(const struct timespec* a, const struct timespec* b) {
+    if (a->tv_sec != b->tv_sec) {
+        return a->tv_sec < b->tv_sec;
+    }
+    return a->tv_nsec < b->tv_nsec;
+}
+
+static void ts_add_ms(struct timespec* ts, int ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+static unsigned long ts_ms_since(const struct timespec* start, const struct timespec* now) {
+    long ms = (now->tv_sec - start->tv_sec) * 1000L
+        + (now->tv_nsec - start->tv_nsec) / 1000000L;
+    return (ms > 0) ? (unsigned long)ms : 0;
+}
+
+// the heap of the job: of its lane, in the fast lane of its class
+static sched_heap_t* heap_of(const poll_job_t* job) {
+    return job->slow ? &sched_slow_heap : &sched_heaps[job->priority];
+}
+
+static void heap_swap(sched_heap_t* h, int i, int k) {
+    poll_job_t* tmp = h->jobs[i];
+    h->jobs[i] = h->jobs[k];
+    h->jobs[k] = tmp;
+    h->jobs[i]->index = i;
+    h->jobs[k]->index = k;
+}
+
+static void heap_up(sched_heap_t* h, int i) {
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if (!ts_before(&h->jobs[i]->due, &h->jobs[parent]->due)) {
+            break;
+        }
+        heap_swap(h, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_down(sched_heap_t* h, int i) {
+    while(true) {
+        int min = i;
+        int l = 2 * i + 1;
+        int r = 2 * i + 2;
+        if ((l < h->size) && ts_before(&h->jobs[l]->due, &h->jobs[min]->due)) {
+            min = l;
+        }
+        if ((r < h->size) && ts_before(&h->jobs[r]->due, &h->jobs[min]->due)) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        heap_swap(h, i, min);
+        i = min;
+    }
+}
+
+// queues the job in the heap of its lane and class
+// must be called with the sched_mutex held
+static void heap_push(poll_job_t* job) {
+    assert(job->index < 0);
+    sched_heap_t* h = heap_of(job);
+    if (h->size == h->capacity) {
+        int capacity = (h->capacity > 0) ? 2 * h->capacity : 8;
+        poll_job_t** jobs = realloc(h->jobs, capacity * sizeof(poll_job_t*));
+        if (jobs == NULL) {
+            slog(SLOG_ERROR, "Can't allocate memory for the poll scheduler");
+            exit(EXIT_FAILURE);
+        }
+        h->jobs = jobs;
+        h->capacity = capacity;
+    }
+    job->index = h->size;
+    h->jobs[h->size] = job;
+    h->size += 1;
+    heap_up(h, job->index);
+}
+
+// must be called with the sched_mutex held
+static void heap_remove(poll_job_t* job) {
+    sched_heap_t* h = heap_of(job);
+    int i = job->index;
+    assert(i >= 0);
+    assert(i < h->size);
+    h->size -= 1;
+    if (i != h->size) {
+        h->jobs[i] = h->jobs[h->size];
+        h->jobs[i]->index = i;
+        heap_down(h, i);
+        heap_up(h, i);
+    }
+    job->index = -1;
+}
+
+// the number of workers the jobs of the class priority may occupy:
+// each more urgent class with jobs keeps one worker free, the last
+// worker is shared by the remaining classes
+// must be called with the sched_mutex held
+static int sched_slots(int priority) {
+    int slots = sched_num_workers;
+    for(int p = 0; p < priority; p += 1) {
+        if (sched_jobs[p] > 0) {
+            slots -= 1;
+        }
+    }
+    return (slots > 1) ? slots : 1;
+}
+
+// the job to run now: the first due job of the most urgent class with
+// a free worker, or NULL, then *pending tells if *due is the time the
+// next job of such a class gets due
+// the slow worker serves the slow lane in due order only
+// must be called with the sched_mutex held
+static poll_job_t* sched_next(bool slow, const struct timespec* now, struct timespec* due, bool* pending) {
+    *pending = false;
+    if (slow) {
+        if (sched_slow_heap.size == 0) {
+            return NULL;
+        }
+        poll_job_t* job = sched_slow_heap.jobs[0];
+        if (!ts_before(now, &job->due)) {
+            return job;
+        }
+        *due = job->due;
+        *pending = true;
+        return NULL;
+    }
+    for(int p = 0; p < CFG_PRIORITIES; p += 1) {
+        sched_heap_t* h = &sched_heaps[p];
+        if ((h->size == 0) || (sched_busy >= sched_slots(p))) {
+            continue;
+        }
+        poll_job_t* job = h->jobs[0];
+        if (!ts_before(now, &job->due)) {
+            return job;
+        }
+        if (!*pending || ts_before(&job->due, due)) {
+            *due = job->due;
+            *pending = true;
+        }
+    }
+    return NULL;
+}
+
+// must be called with the sched_mutex held
+static void sched_active_remove(poll_job_t* job) {
+    for(poll_job_t** p = &sched_active; *p != NULL; p = &(*p)->active_next) {
+        if (*p == job) {
+            *p = job->active_next;
+            break;
+        }
+    }
+    job->active_next = NULL;
+}
+
+// moves the job between the lanes after a run of ms
+// must be called with the sched_mutex held
+static void sched_lane(poll_job_t* job, unsigned long ms) {
+    if (sched_slow_ms <= 0) {
+        return;
+    }
+    if (ms >= (unsigned long)sched_slow_ms) {
+        if (!job->slow) {
+            slog(SLOG_WARN, "poll of %s took %lu ms, moved to the slow lane",
+                 job->name, ms);
+        }
+        job->slow = true;
+        job->fast_runs = 0;
+    }
+    else if (job->slow) {
+        job->fast_runs += 1;
+        if (job->fast_runs >= SCHED_RECOVER_RUNS) {
+            slog(SLOG_INFO, "poll of %s recovered, back to the fast lane",
+                 job->name);
+            job->slow = false;
+            job->fast_runs = 0;
+        }
+    }
+}
+
+// the worker argument: the generation and the lane
+static void* sched_worker_arg(bool slow) {
+    return (void*)(uintptr_t)((sched_generation << 1) | (slow ? 1 : 0));
+}
+
+static void* poll_worker(void* arg) {
+    unsigned long generation = (unsigned long)(uintptr_t)arg >> 1;
+    bool slow = ((uintptr_t)arg & 1) != 0;
+    slog(SLOG_DEBUG, "poll_worker%s", slow ? " (slow lane)" : "");
+    // we only expect the main thread to handle signals
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return NULL;
+    }
+    cpu_policy_thread(&sched_policy, "poll worker");
+    while(sched_running && (generation == sched_generation)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec due;
+        bool pending = false;
+        poll_job_t* job = sched_next(slow, &now, &due, &pending);
+        if (job == NULL) {
+            // wait until the first job is due (or the heaps or the
+            // busy workers change)
+            if (pending) {
+                pthread_cond_timedwait(&sched_cv, &sched_mutex, &due);
+            }
+            else if (pthread_cond_wait(&sched_cv, &sched_mutex) < 0) {
+                slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(errno));
+            }
+            continue;
+        }
+        heap_remove(job);
+        job->running = true;
+        job->started = now;
+        if (!slow) {
+            sched_busy += 1;
+            job->active_next = sched_active;
+            sched_active = job;
+        }
+        if (pthread_mutex_unlock(&sched_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+
+        int delay = job->func(job->arg);
+
+        if (pthread_mutex_lock(&sched_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+            return NULL;
+        }
+        if (generation != sched_generation) {
+            // abandoned by a stop: the condvars may be destroyed (or
+            // initialized again by a restart) and the heaps belong to
+            // another generation, nothing is touched anymore
+            slog(SLOG_DEBUG, "poll_worker: abandoned worker ends");
+            if (pthread_mutex_unlock(&sched_mutex) < 0) {
+                slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+            }
+            return NULL;
+        }
+        job->running = false;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        // the worker of a stalled run has been replaced: it ends now
+        bool surplus = false;
+        if (!slow) {
+            sched_active_remove(job);
+            if (!job->stalled) {
+                sched_busy -= 1;
+            }
+            else if (sched_surplus > 0) {
+                sched_surplus -= 1;
+                surplus = true;
+            }
+        }
+        sched_lane(job, ts_ms_since(&job->started, &now));
+        job->stalled = false;
+        if (!job->removed && (delay >= 0)) {
+            clock_gettime(CLOCK_MONOTONIC, &job->due);
+            if (!job->woken) {
+                ts_add_ms(&job->due, delay);
+            }
+            job->woken = false;
+            heap_push(job);
+        }
+        else if (delay < 0) {
+            slog(SLOG_DEBUG, "poll_worker: job abandoned");
+        }
+        // the job is queued again or a worker got free
+        if (pthread_cond_broadcast(&sched_cv)) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+        if (pthread_cond_broadcast(&sched_done_cv)) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+        if (surplus) {
+            break;
+        }
+    }
+    if (generation == sched_generation) {
+        sched_live -= 1;
+        if (pthread_cond_broadcast(&sched_done_cv)) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+    }
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return NULL;
+}
+
+// a run on a fast worker taking longer than the slow lane threshold
+// moves its job to the slow lane, and a replacement worker takes over
+// the fast lane: the stuck worker ends after the run
+static void* poll_watchdog(void* arg) {
+    unsigned long generation = (unsigned long)(uintptr_t)arg >> 1;
+    slog(SLOG_DEBUG, "poll_watchdog");
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return NULL;
+    }
+    cpu_policy_thread(&sched_policy, "poll watchdog");
+    while(sched_running && (generation == sched_generation)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for(poll_job_t* job = sched_active; job != NULL; job = job->active_next) {
+            unsigned long ms = ts_ms_since(&job->started, &now);
+            if (job->stalled || (ms < (unsigned long)sched_slow_ms)) {
+                continue;
+            }
+            // the replacement first: without it the run stays counted
+            // as a fast one and is tried again at the next check
+            pthread_t tid;
+            int ret = pthread_create(&tid, NULL, poll_worker, sched_worker_arg(false));
+            if (ret != 0) {
+                slog(SLOG_ERROR, "Can't start poll worker: %s", strerror(ret));
+                continue;
+            }
+            if ((ret = pthread_detach(tid)) != 0) {
+                slog(SLOG_ERROR, "pthread_detach: %s", strerror(ret));
+            }
+            slog(SLOG_WARN, "poll of %s is stuck for %lu ms, moved to the slow lane",
+                 job->name, ms);
+            job->stalled = true;
+            job->slow = true;
+            job->fast_runs = 0;
+            sched_busy -= 1;
+            sched_live += 1;
+            sched_surplus += 1;
+        }
+        // a stuck run is detected at most half a threshold late
+        struct timespec wake = now;
+        ts_add_ms(&wake, sched_slow_ms / 2 + 1);
+        pthread_cond_timedwait(&sched_watch_cv, &sched_mutex, &wake);
+    }
+    if (generation == sched_generation) {
+        sched_live -= 1;
+        if (pthread_cond_broadcast(&sched_done_cv)) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+    }
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return NULL;
+}
+
+void poll_scheduler_start(int workers, int slow_ms, const cpu_policy_t* policy) {
+    slog(SLOG_DEBUG, "poll_scheduler_start");
+    assert(workers > 0);
+    assert(policy != NULL);
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (sched_running) {
+        slog(SLOG_DEBUG, "poll scheduler already running");
+        goto cleanup;
+    }
+    pthread_condattr_t condattr;
+    if (pthread_condattr_init(&condattr) != 0) {
+        slog(SLOG_ERROR, "Can't initialize cond attr");
+        exit(EXIT_FAILURE);
+    }
+    if (pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC) != 0) {
+        slog(SLOG_ERROR, "Can't set cond attr clock");
+        exit(EXIT_FAILURE);
+    }
+    if ((pthread_cond_init(&sched_cv, &condattr) != 0) ||
+        (pthread_cond_init(&sched_watch_cv, &condattr) != 0)) {
+        slog(SLOG_ERROR, "pthread_cond_init: should not happen");
+        exit(EXIT_FAILURE);
+    }
+    pthread_condattr_destroy(&condattr);
+
+    // the slow lane has its own worker and the watchdog
+    int threads = workers + ((slow_ms > 0) ? 2 : 0);
+    sched_workers = (pthread_t*) calloc(threads, sizeof(pthread_t));
+    if (sched_workers == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for poll workers");
+        exit(EXIT_FAILURE);
+    }
+    sched_running = true;
+    sched_num_workers = workers;
+    sched_num_threads = threads;
+    sched_live = threads;
+    sched_busy = 0;
+    sched_active = NULL;
+    sched_surplus = 0;
+    sched_slow_ms = (slow_ms > 0) ? slow_ms : 0;
+    sched_policy = *policy;
+    sched_generation += 1;
+    for(int i = 0; i < threads; i += 1) {
+        void* (*func)(void*) = (i < workers + 1) ? poll_worker : poll_watchdog;
+        if (pthread_create(&sched_workers[i], NULL, func,
+                           sched_worker_arg(i >= workers)) != 0) {
+            slog(SLOG_ERROR, "Can't start poll worker: %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (sched_slow_ms > 0) {
+        slog(SLOG_INFO, "poll scheduler started with %d workers, slow lane above %d ms",
+             workers, sched_slow_ms);
+    }
+    else {
+        slog(SLOG_INFO, "poll scheduler started with %d workers", workers);
+    }
+cleanup:
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// the jobs should be removed before, otherwise queued jobs are
+// silently dropped
+// waits for the workers at most until deadline (NULL: no limit), a
+// worker still running an (abandoned) job is detached
+void poll_scheduler_stop(const struct timespec* deadline) {
+    slog(SLOG_DEBUG, "poll_scheduler_stop");
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (!sched_running) {
+        if (pthread_mutex_unlock(&sched_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+        return;
+    }
+    sched_running = false;
+    int ret = 0;
+    if ((ret = pthread_cond_broadcast(&sched_cv)) != 0) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(ret));
+    }
+    if ((ret = pthread_cond_broadcast(&sched_watch_cv)) != 0) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(ret));
+    }
+    while(sched_live > 0) {
+        ret = (deadline != NULL)
+            ? pthread_cond_timedwait(&sched_done_cv, &sched_mutex, deadline)
+            : pthread_cond_wait(&sched_done_cv, &sched_mutex);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(ret));
+            break;
+        }
+    }
+    int stuck = sched_live;
+    // the stuck workers don't touch the scheduler anymore
+    sched_generation += 1;
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+
+    if (stuck > 0) {
+        slog(SLOG_WARN, "poll scheduler: abandoning %d stuck workers", stuck);
+    }
+    for(int i = 0; i < sched_num_threads; i += 1) {
+        if (stuck > 0) {
+            // an ended worker is released by the detach as well
+            if (pthread_detach(sched_workers[i]) != 0) {
+                slog(SLOG_ERROR, "pthread_detach: %s", strerror(errno));
+            }
+        }
+        else if (pthread_join(sched_workers[i], NULL) < 0) {
+            slog(SLOG_ERROR, "pthread_join: %s", strerror(errno));
+        }
+    }
+    free(sched_workers);
+    sched_workers = NULL;
+    sched_num_workers = 0;
+    sched_num_threads = 0;
+    sched_active = NULL;
+
+    for(int p = 0; p < CFG_PRIORITIES; p += 1) {
+        sched_heap_t* h = &sched_heaps[p];
+        while(h->size > 0) {
+            slog(SLOG_WARN, "poll scheduler: dropping queued job");
+            heap_remove(h->jobs[0]);
+        }
+        free(h->jobs);
+        h->jobs = NULL;
+        h->capacity = 0;
+        sched_jobs[p] = 0;
+    }
+    while(sched_slow_heap.size > 0) {
+        slog(SLOG_WARN, "poll scheduler: dropping queued job");
+        heap_remove(sched_slow_heap.jobs[0]);
+    }
+    free(sched_slow_heap.jobs);
+    sched_slow_heap.jobs = NULL;
+    sched_slow_heap.capacity = 0;
+
+    if ((ret = pthread_cond_destroy(&sched_cv)) != 0) {
+        slog(SLOG_ERROR, "pthread_cond_destroy: %s", strerror(ret));
+    }
+    if ((ret = pthread_cond_destroy(&sched_watch_cv)) != 0) {
+        slog(SLOG_ERROR, "pthread_cond_destroy: %s", strerror(ret));
+    }
+    slog(SLOG_INFO, "poll scheduler stopped");
+}
+
+bool poll_scheduler_active(void) {
+    bool active = false;
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    active = sched_running;
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return active;
+}
+
+// queues the job, the first run is due immediately
+void poll_scheduler_add(poll_job_t* job, const char* name, poll_job_func_t func, void* arg) {
+    assert(job != NULL);
+    assert(func != NULL);
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (!sched_running) {
+        slog(SLOG_ERROR, "poll scheduler not running, can't add job");
+        goto cleanup;
+    }
+    job->func = func;
+    job->name = (name != NULL) ? name : SCANBD_NULL_STRING;
+    job->arg = arg;
+    job->index = -1;
+    job->running = false;
+    job->removed = false;
+    job->woken = false;
+    job->priority = CFG_PRIORITY_NORMAL;
+    job->slow = false;
+    job->stalled = false;
+    job->fast_runs = 0;
+    job->active_next = NULL;
+    sched_jobs[job->priority] += 1;
+    clock_gettime(CLOCK_MONOTONIC, &job->due);
+    heap_push(job);
+    if (pthread_cond_broadcast(&sched_cv)) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+cleanup:
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// dequeues the job and waits for an active run of it to finish, at
+// most until deadline (NULL: no limit)
+// returns true if no worker references the job anymore, false if the
+// run is still active: the job (and its arg) must not be freed then
+bool poll_scheduler_remove(poll_job_t* job, const struct timespec* deadline) {
+    assert(job != NULL);
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return false;
+    }
+    if (!job->removed) {
+        job->removed = true;
+        sched_jobs[job->priority] -= 1;
+    }
+    if (job->index >= 0) {
+        heap_remove(job);
+    }
+    while(job->running) {
+        slog(SLOG_DEBUG, "poll_scheduler_remove: job is running, waiting ...");
+        int ret = (deadline != NULL)
+            ? pthread_cond_timedwait(&sched_done_cv, &sched_mutex, deadline)
+            : pthread_cond_wait(&sched_done_cv, &sched_mutex);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+        if (ret != 0) {
+            slog(SLOG_ERROR, "pthread_cond_wait: %s", strerror(ret));
+            break;
+        }
+    }
+    bool removed = !job->running;
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return removed;
+}
+
+// the deadline (CLOCK_REALTIME) of a stop starting now (see
+// C_STOP_TIMEOUT)
+void poll_stop_deadline(struct timespec* deadline) {
+    assert(deadline != NULL);
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    int timeout = cfg_getint(cfg_sec_global, C_STOP_TIMEOUT);
+    if (timeout < 0) {
+        timeout = 0;
+    }
+    clock_gettime(CLOCK_REALTIME, deadline);
+    ts_add_ms(deadline, timeout);
+}
+
+// a queued job is moved to the top of the heap, a running one is
+// requeued as due after its run
+void poll_scheduler_wake(poll_job_t* job) {
+    assert(job != NULL);
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (job->removed) {
+        goto cleanup;
+    }
+    if (job->index >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &job->due);
+        heap_up(heap_of(job), job->index);
+        if (pthread_cond_broadcast(&sched_cv)) {
+            slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+        }
+    }
+    else if (job->running) {
+        job->woken = true;
+    }
+cleanup:
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// moves the job to the class priority (all jobs start as
+// CFG_PRIORITY_NORMAL), a queued job keeps its due time
+void poll_scheduler_priority(poll_job_t* job, cfg_priority_t priority) {
+    assert(job != NULL);
+    assert((priority >= 0) && (priority < CFG_PRIORITIES));
+
+    if (pthread_mutex_lock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    if (!sched_running || job->removed || (job->priority == priority)) {
+        goto cleanup;
+    }
+    sched_jobs[job->priority] -= 1;
+    sched_jobs[priority] += 1;
+    if (job->index >= 0) {
+        heap_remove(job);
+        job->priority = priority;
+        heap_push(job);
+    }
+    else {
+        job->priority = priority;
+    }
+    // the free workers of the classes have changed
+    if (pthread_cond_broadcast(&sched_cv)) {
+        slog(SLOG_ERROR, "pthread_cond_broadcast: %s", strerror(errno));
+    }
+cleanup:
+    if (pthread_mutex_unlock(&sched_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// interactive polling threads run with the real-time policy
+// (SCHED_FIFO, needs the privilege, otherwise a warning is logged and
+// the policy is kept), background ones with the idle policy (where
+// available), all others with the default policy
+void poll_thread_priority(cfg_priority_t priority, const cpu_policy_t* policy) {
+    assert(policy != NULL);
+    if (policy->rtprio > 0) {
+        // SCHED_FIFO with the configured priority
+        cpu_policy_thread(policy, "polling thread");
+        return;
+    }
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    int sched = SCHED_OTHER;
+    if (priority == CFG_PRIORITY_INTERACTIVE) {
+        sched = SCHED_FIFO;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    }
+#ifdef SCHED_IDLE
+    else if (priority == CFG_PRIORITY_BACKGROUND) {
+        sched = SCHED_IDLE;
+    }
+#endif
+    int ret = pthread_setschedparam(pthread_self(), sched, &param);
+    if (ret != 0) {
+        slog(SLOG_WARN, "Can't set the scheduling policy of the polling thread: %s",
+             strerror(ret));
+    }
+    cpu_policy_thread(policy, "polling thread");
+}
+
+// initializes the poll interval from the global section, the priority
+// class bounds the timeout (see C_PRIORITY_INTERACTIVE_TIMEOUT), an
+// interactive device doesn't back off and isn't parked when idle
+void poll_interval_init(poll_interval_t* pi, cfg_t* sec, cfg_priority_t priority) {
+    assert(pi != NULL);
+    assert(sec != NULL);
+    pi->timeout = cfg_getint(sec, C_TIMEOUT);
+    if (pi->timeout <= 0) {
+        pi->timeout = C_TIMEOUT_DEF;
+    }
+    pi->timeout_max = cfg_getint(sec, C_TIMEOUT_MAX);
+    pi->burst_timeout = cfg_getint(sec, C_BURST_TIMEOUT);
+    pi->burst_duration = cfg_getint(sec, C_BURST_DURATION);
+    pi->current = pi->timeout;
+    pi->burst_until.tv_sec = 0;
+    pi->burst_until.tv_nsec = 0;
+    pi->park_idle = cfg_getint(sec, C_PARK_IDLE);
+    pi->park_heartbeat = cfg_getint(sec, C_PARK_HEARTBEAT);
+    if (pi->park_heartbeat <= 0) {
+        pi->park_heartbeat = C_PARK_HEARTBEAT_DEF;
+    }
+    if (priority == CFG_PRIORITY_INTERACTIVE) {
+        if (pi->timeout > C_PRIORITY_INTERACTIVE_TIMEOUT) {
+            pi->timeout = C_PRIORITY_INTERACTIVE_TIMEOUT;
+        }
+        pi->timeout_max = 0;
+        pi->park_idle = 0;
+    }
+    else if (priority == CFG_PRIORITY_BACKGROUND) {
+        if (pi->timeout < C_PRIORITY_BACKGROUND_TIMEOUT) {
+            pi->timeout = C_PRIORITY_BACKGROUND_TIMEOUT;
+        }
+    }
+    pi->current = pi->timeout;
+    pi->idle = false;
+    clock_gettime(CLOCK_MONOTONIC, &pi->active);
+}
+
+// a device section overrides all values not set to -1 (the default)
+void poll_interval_override(poll_interval_t* pi, cfg_t* sec) {
+    assert(pi != NULL);
+    assert(sec != NULL);
+    int v = cfg_getint(sec, C_TIMEOUT);
+    if (v > 0) {
+        pi->timeout = v;
+    }
+    if ((v = cfg_getint(sec, C_TIMEOUT_MAX)) >= 0) {
+        pi->timeout_max = v;
+    }
+    if ((v = cfg_getint(sec, C_BURST_TIMEOUT)) >= 0) {
+        pi->burst_timeout = v;
+    }
+    if ((v = cfg_getint(sec, C_BURST_DURATION)) >= 0) {
+        pi->burst_duration = v;
+    }
+    if ((v = cfg_getint(sec, C_PARK_IDLE)) >= 0) {
+        pi->park_idle = v;
+    }
+    if ((v = cfg_getint(sec, C_PARK_HEARTBEAT)) > 0) {
+        pi->park_heartbeat = v;
+    }
+    pi->current = pi->timeout;
+}
+
+// returns the interval in ms until the next poll. activity is true if
+// an option value has changed or an action was triggered in the
+// last polling cycle
+int poll_interval_next(poll_interval_t* pi, bool activity) {
+    assert(pi != NULL);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (activity) {
+        pi->current = pi->timeout;
+        if (pi->burst_duration > 0) {
+            pi->burst_until = now;
+            pi->burst_until.tv_sec += pi->burst_duration;
+        }
+        pi->active = now;
+        pi->idle = false;
+    }
+    else if (!pi->idle && (pi->park_idle > 0) &&
+             (now.tv_sec - pi->active.tv_sec >= pi->park_idle)) {
+        pi->idle = true;
+        pi->parked = now;
+        pi->heartbeat = now;
+    }
+    if (pi->idle) {
+        return pi->park_heartbeat;
+    }
+    if (ts_before(&now, &pi->burst_until)) {
+        return (pi->burst_timeout > 0) ? pi->burst_timeout : pi->timeout;
+    }
+    if (!activity && (pi->timeout_max > pi->timeout)) {
+        pi->current *= 2;
+        if (pi->current > pi->timeout_max) {
+            pi->current = pi->timeout_max;
+        }
+    }
+    return pi->current;
+}
+
+// a wake-up counts as activity: the interval snaps back to timeout
+bool poll_interval_wake(poll_interval_t* pi) {
+    assert(pi != NULL);
+    bool idle = pi->idle;
+    pi->current = pi->timeout;
+    clock_gettime(CLOCK_MONOTONIC, &pi->active);
+    pi->idle = false;
+    return idle;
+}
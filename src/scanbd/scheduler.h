@@ -0,0 +1,115 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+#include "config.h"
+#include <confuse.h>
+
+// the poll scheduler: a small pool of worker threads serves all
+// devices instead of one polling thread per device. Every device is a
+// job in a min-heap ordered by the time its next poll is due, each
+// priority class has its own heap: a due job of a more urgent class
+// runs first, and the jobs of a class leave one worker free for each
+// more urgent class with jobs (see poll_scheduler_priority()).
+// A job whose run takes at least the slow_poll threshold (a hung
+// backend, a slow net: device) is moved to the slow lane: its own heap
+// served by a dedicated worker, so it can't occupy the workers of the
+// other devices. A watchdog moves a job stuck in a run on a fast
+// worker and starts a replacement worker. After SCHED_RECOVER_RUNS
+// fast runs in a row the job returns to the fast lane.
+
+// the job function polls the device once and returns the number of
+// ms until the next poll is due, or a negative value if polling of
+// this device should be abandoned
+typedef int (*poll_job_func_t)(void* arg);
+
+struct poll_job {
+    poll_job_func_t func;  // the poll function of this job
+    const char* name;      // the device (for the log), not owned
+    void* arg;             // the argument of func (the device thread data)
+    struct timespec due;   // next poll is due at (CLOCK_MONOTONIC)
+    int index;             // the position in the heap, -1 if not queued
+    bool running;          // a worker executes func at the moment
+    bool removed;          // don't requeue after the actual run
+    bool woken;            // woken during the actual run: requeue as due
+    cfg_priority_t priority; // the class (and heap) of the job
+    bool slow;             // the job is in the slow lane
+    bool stalled;          // the watchdog has replaced the worker of the run
+    int fast_runs;         // fast runs in a row in the slow lane
+    struct timespec started; // the actual run started (CLOCK_MONOTONIC)
+    struct poll_job* active_next; // the runs on the fast workers
+};
+typedef struct poll_job poll_job_t;
+
+// the adaptive poll interval of a device: while the option values
+// stay unchanged the interval backs off exponentially from timeout up
+// to timeout_max, after any value change or trigger it snaps back to
+// timeout, or to burst_timeout for burst_duration seconds
+// after park_idle seconds without activity the device is parked: the
+// poller closes it (so it can autosuspend) and only polls it every
+// park_heartbeat ms, until an activity or a wake-up (a remote
+// trigger, see poll_interval_wake()) resumes the polling
+struct poll_interval {
+    int timeout;                 // the (minimal) interval in ms
+    int timeout_max;             // the back-off bound in ms
+    int burst_timeout;           // the interval in ms in burst mode
+    int burst_duration;          // the length of the burst mode in s
+    int current;                 // the actual interval in ms
+    struct timespec burst_until; // burst mode ends (CLOCK_MONOTONIC)
+    int park_idle;               // parked after this many s without
+    // activity (0: never)
+    int park_heartbeat;          // the interval in ms while parked
+    bool idle;                   // the device is parked
+    struct timespec active;      // the last activity (CLOCK_MONOTONIC)
+    struct timespec parked;      // parked since (CLOCK_MONOTONIC)
+    struct timespec heartbeat;   // the last heartbeat poll (CLOCK_MONOTONIC)
+};
+typedef struct poll_interval poll_interval_t;
+
+extern void poll_interval_init(poll_interval_t* pi, cfg_t* sec, cfg_priority_t priority);
+extern void poll_interval_override(poll_interval_t* pi, cfg_t* sec);
+extern int poll_interval_next(poll_interval_t* pi, bool activity);
+// resumes a parked device, returns true if it was parked
+extern bool poll_interval_wake(poll_interval_t* pi);
+
+// slow_ms: the slow lane threshold, 0 disables the slow lane
+// policy: the cpus and scheduling of the workers (see cpu_policy.h)
+extern void poll_scheduler_start(int workers, int slow_ms, const cpu_policy_t* policy);
+extern void poll_scheduler_stop(const struct timespec* deadline);
+extern bool poll_scheduler_active(void);
+extern void poll_scheduler_add(poll_job_t* job, const char* name, poll_job_func_t func, void* arg);
+extern bool poll_scheduler_remove(poll_job_t* job, const struct timespec* deadline);
+// the next run of the job is due now
+extern void poll_scheduler_wake(poll_job_t* job);
+extern void poll_scheduler_priority(poll_job_t* job, cfg_priority_t priority);
+// the scheduling policy of the calling polling thread (without the
+// poll scheduler): the one of the priority class, unless the cpu
+// policy of the device sets SCHED_FIFO (see C_POLL_RTPRIO)
+extern void poll_thread_priority(cfg_priority_t priority, const cpu_policy_t* policy);
+// the deadline of a stop of the pollers starting now (see
+// C_STOP_TIMEOUT)
+extern void poll_stop_deadline(struct timespec* deadline);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,195 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "script_env.h"
+
+// appends "name=value" to the static entries (no length limit)
+static void script_env_append(script_env_t* se, const char* name, const char* value) {
+    assert(se != NULL);
+    assert(name != NULL);
+    assert(value != NULL);
+    size_t len = strlen(name) + 1 + strlen(value) + 1;
+    char* arena = realloc(se->arena, se->size + len);
+    if (arena == NULL) {
+        slog(SLOG_ERROR, "Can't allocate the script environment");
+        return;
+    }
+    se->arena = arena;
+    snprintf(se->arena + se->size, len, "%s=%s", name, value);
+    slog(SLOG_DEBUG, "setting env: %s", se->arena + se->size);
+    se->size += len;
+    se->count += 1;
+}
+
+// builds the static entries for the scripts of device and reserves
+// num_vars variable entries
+void script_env_init(script_env_t* se, const char* device, int num_vars) {
+    assert(se != NULL);
+    assert(num_vars >= 0);
+    memset(se, 0, sizeof(script_env_t));
+
+    const char* ev = "PATH";
+    if (getenv(ev) != NULL) {
+        script_env_append(se, ev, getenv(ev));
+    }
+    else {
+        slog(SLOG_DEBUG, "No PATH");
+        script_env_append(se, ev, "/usr/sbin:/usr/bin:/sbin:/bin");
+    }
+    ev = "PWD";
+    if (getenv(ev) != NULL) {
+        script_env_append(se, ev, getenv(ev));
+    }
+    else {
+        char buf[PATH_MAX+1];
+        char* ptr = getcwd(buf, PATH_MAX);
+        if (!ptr) {
+            slog(SLOG_ERROR, "can't get pwd");
+        }
+        else {
+            slog(SLOG_DEBUG, "No PWD");
+            script_env_append(se, ev, ptr);
+        }
+    }
+    struct passwd* pwd = NULL;
+    ev = "USER";
+    if (getenv(ev) != NULL) {
+        script_env_append(se, ev, getenv(ev));
+    }
+    else if ((pwd = getpwuid(geteuid())) != NULL) {
+        slog(SLOG_DEBUG, "No USER");
+        script_env_append(se, ev, pwd->pw_name);
+    }
+    ev = "HOME";
+    if (getenv(ev) != NULL) {
+        script_env_append(se, ev, getenv(ev));
+    }
+    else if ((pwd = getpwuid(geteuid())) != NULL) {
+        slog(SLOG_DEBUG, "No HOME");
+        script_env_append(se, ev, pwd->pw_dir);
+    }
+
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    cfg_t* global_envs = cfg_getsec(cfg_sec_global, C_ENVIRONMENT);
+    ev = cfg_getstr(global_envs, C_DEVICE);
+    if ((ev != NULL) && (device != NULL)) {
+        script_env_append(se, ev, device);
+    }
+    ev = cfg_getstr(global_envs, C_ACTION);
+    if (ev != NULL) {
+        se->action = strdup(ev);
+    }
+
+    if (num_vars > 0) {
+        se->vars = calloc(num_vars, sizeof(script_env_var_t));
+        if (se->vars != NULL) {
+            se->num_vars = num_vars;
+        }
+    }
+}
+
+void script_env_free(script_env_t* se) {
+    assert(se != NULL);
+    free(se->arena);
+    free(se->action);
+    free(se->vars);
+    memset(se, 0, sizeof(script_env_t));
+}
+
+void script_env_set(script_env_t* se, int index, const char* name,
+                    const char* str, unsigned long num) {
+    assert(se != NULL);
+    if ((index < 0) || (index >= se->num_vars)) {
+        return;
+    }
+    se->vars[index].name = name;
+    se->vars[index].str = str;
+    se->vars[index].num = num;
+}
+
+// returns the NULL terminated environment: the variable entries, the
+// static entries and the action (if given), all of it in one single
+// allocation (release it with free())
+char** script_env_build(const script_env_t* se, const char* action) {
+    assert(se != NULL);
+
+    int count = se->num_vars + se->count + 1 + 1;
+    size_t size = count * sizeof(char*) + se->size;
+    for(int i = 0; i < se->num_vars; i += 1) {
+        const script_env_var_t* v = &se->vars[i];
+        if (v->name == NULL) {
+            continue;
+        }
+        if (v->str != NULL) {
+            size += strlen(v->name) + 1 + strlen(v->str) + 1;
+        }
+        else {
+            size += snprintf(NULL, 0, "%s=%lu", v->name, v->num) + 1;
+        }
+    }
+    if ((se->action != NULL) && (action != NULL)) {
+        size += strlen(se->action) + 1 + strlen(action) + 1;
+    }
+
+    char** env = malloc(size);
+    if (env == NULL) {
+        slog(SLOG_ERROR, "Can't allocate the script environment");
+        return NULL;
+    }
+    char* p = (char*)(env + count);
+    char* end = (char*)env + size;
+    int e = 0;
+    for(int i = 0; i < se->num_vars; i += 1) {
+        const script_env_var_t* v = &se->vars[i];
+        if (v->name == NULL) {
+            continue;
+        }
+        int len = 0;
+        if (v->str != NULL) {
+            len = snprintf(p, end - p, "%s=%s", v->name, v->str);
+        }
+        else {
+            len = snprintf(p, end - p, "%s=%lu", v->name, v->num);
+        }
+        slog(SLOG_DEBUG, "setting env: %s", p);
+        env[e++] = p;
+        p += len + 1;
+    }
+    if (se->size > 0) {
+        memcpy(p, se->arena, se->size);
+    }
+    for(int i = 0; i < se->count; i += 1) {
+        env[e++] = p;
+        p += strlen(p) + 1;
+    }
+    if ((se->action != NULL) && (action != NULL)) {
+        int len = snprintf(p, end - p, "%s=%s", se->action, action);
+        slog(SLOG_DEBUG, "setting env: %s", p);
+        env[e++] = p;
+        p += len + 1;
+    }
+    env[e] = NULL;
+    assert(p <= end);
+    return env;
+}
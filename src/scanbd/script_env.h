@@ -0,0 +1,57 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SCRIPT_ENV_H
+#define SCRIPT_ENV_H
+
+#include "common.h"
+
+// the environment of the action and hook scripts: the static entries
+// (PATH, PWD, USER, HOME and the device) are built once when a poller
+// starts (and so again after a reload), only the function values and
+// the action are added for each trigger
+
+// a variable entry: the value is str, or num if str is NULL
+struct script_env_var {
+    const char* name;
+    const char* str;
+    unsigned long num;
+};
+typedef struct script_env_var script_env_var_t;
+
+struct script_env {
+    char* arena;            // the static entries "NAME=value\0NAME=value\0..."
+    size_t size;            // the used bytes of the arena
+    int count;              // the number of static entries
+    char* action;           // the env-var name for the action or NULL
+    script_env_var_t* vars; // the variable entries, set before each build
+    int num_vars;
+};
+typedef struct script_env script_env_t;
+
+extern void script_env_init(script_env_t* se, const char* device, int num_vars);
+extern void script_env_free(script_env_t* se);
+extern void script_env_set(script_env_t* se, int index, const char* name,
+                           const char* str, unsigned long num);
+extern char** script_env_build(const script_env_t* se, const char* action);
+
+#endif // SCRIPT_ENV_H
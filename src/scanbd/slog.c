@@ -22,6 +22,9 @@
 
 #include "common.h"
 #include "slog.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stddef.h>
 
 bool debug = false;
 unsigned int debug_level = 0;
@@ -29,13 +32,474 @@ unsigned int debug_level = 0;
 static char lpre[LINE_MAX+1] = "";
 static int isInitialized = 0;
 
+// the length modifiers of a conversion
+enum slog_length {
+    SLOG_LEN_NONE = 0, SLOG_LEN_HH, SLOG_LEN_H, SLOG_LEN_L, SLOG_LEN_LL,
+    SLOG_LEN_Z, SLOG_LEN_J, SLOG_LEN_T, SLOG_LEN_BIG_L
+};
+
+// a conversion of the format: %[flags][width][.precision][length]conv
+struct slog_spec {
+    const char* start;         // the '%'
+    const char* end;           // behind the conversion character
+    bool star_width;           // the width is an (int) argument
+    bool star_prec;            // the precision is an (int) argument
+    enum slog_length length;
+    char conv;
+};
+
+union slog_arg {
+    long long i;               // d i c and the * width / precision
+    unsigned long long u;      // u o x X
+    double d;                  // f F e E g G a A
+    const void* p;             // p
+    size_t s;                  // s: the offset of the copy in strings
+};
+
+// a binary record: the format is the literal of the caller, the
+// arguments are stored raw (in the order of the format)
+struct slog_record {
+    const char* format;
+    int num_args;
+    union slog_arg args[SLOG_RECORD_ARGS];
+    char strings[SLOG_RECORD_STRINGS]; // the copied %s arguments
+};
+
+// a single producer (the owning thread), single consumer (the drain
+// under the slog_drain_mutex) ring: the records from tail to head are
+// pending
+struct slog_ring {
+    atomic_bool used;            // owned by a thread
+    atomic_uint head;            // the next record to write
+    atomic_uint tail;            // the next record to drain
+    struct slog_record* records; // allocated by the first owner
+};
+
+static struct slog_ring slog_rings[SLOG_RINGS];
+
+// the ring of the calling thread
+static pthread_key_t slog_key;
+static pthread_once_t slog_once = PTHREAD_ONCE_INIT;
+
+static atomic_bool slog_running = false;
+static pthread_t slog_drain_tid;
+// serializes the consumers: the drain thread, errors, slog_flush()
+static pthread_mutex_t slog_drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+// the drain thread waits for records
+static pthread_mutex_t slog_cv_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slog_cv = PTHREAD_COND_INITIALIZER;
+// the drain thread wakes up at least every SLOG_DRAIN_INTERVAL ms
+// (a wakeup may get lost, the producers don't take the mutex)
+#define SLOG_DRAIN_INTERVAL 100
+
+static atomic_ulong slog_dropped = 0;
+static unsigned long slog_dropped_reported = 0;
+
 void slog_init(const char *string) {
     strncpy(lpre, string, LINE_MAX);
     isInitialized = 1;
 }
 
+static void slog_output(const char* text) {
+    if (debug) {
+        printf("%s: %s\n", lpre, text);
+        syslog(LOG_DAEMON | LOG_DEBUG, "%s: %s\n", lpre, text);
+    }
+    else {
+        syslog(LOG_DAEMON | LOG_DEBUG, "%s: %s\n", lpre, text);
+    }
+}
+
+// the thread owning the ring has ended, the pending records are still
+// drained, the next owner goes on at head
+static void slog_ring_release(void* arg) {
+    struct slog_ring* ring = (struct slog_ring*)arg;
+    atomic_store_explicit(&ring->used, false, memory_order_release);
+}
+
+static void slog_rings_init(void) {
+    for(int r = 0; r < SLOG_RINGS; r += 1) {
+        atomic_init(&slog_rings[r].used, false);
+        atomic_init(&slog_rings[r].head, 0);
+        atomic_init(&slog_rings[r].tail, 0);
+        slog_rings[r].records = NULL;
+    }
+    if (pthread_key_create(&slog_key, slog_ring_release) != 0) {
+        syslog(LOG_DAEMON | LOG_ERR, "%s: Can't create the log ring key", lpre);
+    }
+}
+
+// returns the ring of the calling thread, NULL if all are owned
+static struct slog_ring* slog_ring(void) {
+    struct slog_ring* ring = (struct slog_ring*)pthread_getspecific(slog_key);
+    if (ring != NULL) {
+        return ring;
+    }
+    for(int r = 0; r < SLOG_RINGS; r += 1) {
+        bool used = false;
+        if (!atomic_compare_exchange_strong_explicit(&slog_rings[r].used, &used, true,
+                                                     memory_order_acquire,
+                                                     memory_order_relaxed)) {
+            continue;
+        }
+        ring = &slog_rings[r];
+        if (ring->records == NULL) {
+            ring->records = (struct slog_record*) calloc(SLOG_RING_RECORDS,
+                                                         sizeof(struct slog_record));
+            if (ring->records == NULL) {
+                atomic_store_explicit(&ring->used, false, memory_order_release);
+                return NULL;
+            }
+        }
+        if (pthread_setspecific(slog_key, ring) != 0) {
+            atomic_store_explicit(&ring->used, false, memory_order_release);
+            return NULL;
+        }
+        return ring;
+    }
+    return NULL;
+}
+
+// parses the conversion at c (behind the '%')
+// returns false if the conversion isn't supported (%n, %1$d, ...)
+static bool slog_parse_spec(const char* c, struct slog_spec* spec) {
+    spec->start = c - 1;
+    spec->star_width = false;
+    spec->star_prec = false;
+    spec->length = SLOG_LEN_NONE;
+    while((*c != '\0') && (strchr("-+ #0'", *c) != NULL)) {
+        c += 1;
+    }
+    if (*c == '*') {
+        spec->star_width = true;
+        c += 1;
+    }
+    while(isdigit((unsigned char)*c)) {
+        c += 1;
+    }
+    if (*c == '.') {
+        c += 1;
+        if (*c == '*') {
+            spec->star_prec = true;
+            c += 1;
+        }
+        while(isdigit((unsigned char)*c)) {
+            c += 1;
+        }
+    }
+    switch(*c) {
+    case 'h':
+        spec->length = (c[1] == 'h') ? SLOG_LEN_HH : SLOG_LEN_H;
+        c += (c[1] == 'h') ? 2 : 1;
+        break;
+    case 'l':
+        spec->length = (c[1] == 'l') ? SLOG_LEN_LL : SLOG_LEN_L;
+        c += (c[1] == 'l') ? 2 : 1;
+        break;
+    case 'z':
+        spec->length = SLOG_LEN_Z;
+        c += 1;
+        break;
+    case 'j':
+        spec->length = SLOG_LEN_J;
+        c += 1;
+        break;
+    case 't':
+        spec->length = SLOG_LEN_T;
+        c += 1;
+        break;
+    case 'L':
+        spec->length = SLOG_LEN_BIG_L;
+        c += 1;
+        break;
+    default:
+        break;
+    }
+    if ((*c == '\0') || (strchr("diouxXcspfFeEgGaA", *c) == NULL)) {
+        return false;
+    }
+    if ((spec->length == SLOG_LEN_BIG_L) || ((*c == 'p') && (spec->length != SLOG_LEN_NONE))) {
+        return false;
+    }
+    spec->conv = *c;
+    spec->end = c + 1;
+    return true;
+}
+
+// stores the arguments of format into rec
+// returns false if the record can't be stored binary
+static bool slog_encode(struct slog_record* rec, const char* format, va_list ap) {
+    size_t used = 0;
+    rec->format = format;
+    rec->num_args = 0;
+    for(const char* c = format; *c != '\0'; c += 1) {
+        if (*c != '%') {
+            continue;
+        }
+        if (c[1] == '%') {
+            c += 1;
+            continue;
+        }
+        struct slog_spec spec;
+        if (!slog_parse_spec(c + 1, &spec)) {
+            return false;
+        }
+        c = spec.end - 1;
+        int needed = 1 + (spec.star_width ? 1 : 0) + (spec.star_prec ? 1 : 0);
+        if (rec->num_args + needed > SLOG_RECORD_ARGS) {
+            return false;
+        }
+        if (spec.star_width) {
+            rec->args[rec->num_args++].i = va_arg(ap, int);
+        }
+        if (spec.star_prec) {
+            rec->args[rec->num_args++].i = va_arg(ap, int);
+        }
+        union slog_arg* arg = &rec->args[rec->num_args++];
+        switch(spec.conv) {
+        case 'd':
+        case 'i':
+            switch(spec.length) {
+            case SLOG_LEN_L:  arg->i = va_arg(ap, long); break;
+            case SLOG_LEN_LL: arg->i = va_arg(ap, long long); break;
+            case SLOG_LEN_Z:  arg->i = va_arg(ap, ssize_t); break;
+            case SLOG_LEN_J:  arg->i = va_arg(ap, intmax_t); break;
+            case SLOG_LEN_T:  arg->i = va_arg(ap, ptrdiff_t); break;
+            default:          arg->i = va_arg(ap, int); break;
+            }
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch(spec.length) {
+            case SLOG_LEN_L:  arg->u = va_arg(ap, unsigned long); break;
+            case SLOG_LEN_LL: arg->u = va_arg(ap, unsigned long long); break;
+            case SLOG_LEN_Z:  arg->u = va_arg(ap, size_t); break;
+            case SLOG_LEN_J:  arg->u = va_arg(ap, uintmax_t); break;
+            case SLOG_LEN_T:  arg->u = (unsigned long long)va_arg(ap, ptrdiff_t); break;
+            default:          arg->u = va_arg(ap, unsigned int); break;
+            }
+            break;
+        case 'c':
+            if (spec.length != SLOG_LEN_NONE) {
+                return false; // wint_t
+            }
+            arg->i = va_arg(ap, int);
+            break;
+        case 's': {
+            if (spec.length != SLOG_LEN_NONE) {
+                return false; // wchar_t*
+            }
+            const char* str = va_arg(ap, const char*);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            size_t len = strlen(str);
+            if (used + len + 1 > SLOG_RECORD_STRINGS) {
+                return false;
+            }
+            memcpy(&rec->strings[used], str, len + 1);
+            arg->s = used;
+            used += len + 1;
+            break;
+        }
+        case 'p':
+            arg->p = va_arg(ap, void*);
+            break;
+        default:
+            arg->d = va_arg(ap, double);
+            break;
+        }
+    }
+    return true;
+}
+
+// formats one conversion of a record with the stored arguments
+#define SLOG_PRINT(out, size, sub, spec, w, p, v)                       \
+    ((spec).star_width ?                                                \
+     ((spec).star_prec ? snprintf(out, size, sub, w, p, v) :           \
+      snprintf(out, size, sub, w, v)) :                                 \
+     ((spec).star_prec ? snprintf(out, size, sub, p, v) :              \
+      snprintf(out, size, sub, v)))
+
+// formats the binary record into buffer (of size bytes)
+static void slog_decode(const struct slog_record* rec, char* buffer, size_t size) {
+    size_t pos = 0;
+    int a = 0;
+    for(const char* c = rec->format; (*c != '\0') && (pos + 1 < size); c += 1) {
+        if (*c != '%') {
+            buffer[pos++] = *c;
+            continue;
+        }
+        if (c[1] == '%') {
+            buffer[pos++] = '%';
+            c += 1;
+            continue;
+        }
+        struct slog_spec spec;
+        if (!slog_parse_spec(c + 1, &spec)) {
+            break; // can't happen, the record was encoded
+        }
+        c = spec.end - 1;
+        char sub[32];
+        size_t sub_len = (size_t)(spec.end - spec.start);
+        if (sub_len >= sizeof(sub)) {
+            break;
+        }
+        memcpy(sub, spec.start, sub_len);
+        sub[sub_len] = '\0';
+        int w = spec.star_width ? (int)rec->args[a++].i : 0;
+        int p = spec.star_prec ? (int)rec->args[a++].i : 0;
+        const union slog_arg* arg = &rec->args[a++];
+        char* out = &buffer[pos];
+        size_t rest = size - pos;
+        int n = 0;
+        switch(spec.conv) {
+        case 'd':
+        case 'i':
+            switch(spec.length) {
+            case SLOG_LEN_L:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (long)arg->i); break;
+            case SLOG_LEN_LL: n = SLOG_PRINT(out, rest, sub, spec, w, p, (long long)arg->i); break;
+            case SLOG_LEN_Z:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (ssize_t)arg->i); break;
+            case SLOG_LEN_J:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (intmax_t)arg->i); break;
+            case SLOG_LEN_T:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (ptrdiff_t)arg->i); break;
+            default:          n = SLOG_PRINT(out, rest, sub, spec, w, p, (int)arg->i); break;
+            }
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch(spec.length) {
+            case SLOG_LEN_L:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (unsigned long)arg->u); break;
+            case SLOG_LEN_LL: n = SLOG_PRINT(out, rest, sub, spec, w, p, (unsigned long long)arg->u); break;
+            case SLOG_LEN_Z:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (size_t)arg->u); break;
+            case SLOG_LEN_J:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (uintmax_t)arg->u); break;
+            case SLOG_LEN_T:  n = SLOG_PRINT(out, rest, sub, spec, w, p, (ptrdiff_t)arg->u); break;
+            default:          n = SLOG_PRINT(out, rest, sub, spec, w, p, (unsigned int)arg->u); break;
+            }
+            break;
+        case 'c':
+            n = SLOG_PRINT(out, rest, sub, spec, w, p, (int)arg->i);
+            break;
+        case 's':
+            n = SLOG_PRINT(out, rest, sub, spec, w, p, &rec->strings[arg->s]);
+            break;
+        case 'p':
+            n = SLOG_PRINT(out, rest, sub, spec, w, p, arg->p);
+            break;
+        default:
+            n = SLOG_PRINT(out, rest, sub, spec, w, p, arg->d);
+            break;
+        }
+        if (n < 0) {
+            break;
+        }
+        pos = ((size_t)n < rest) ? pos + (size_t)n : size - 1;
+    }
+    buffer[pos] = '\0';
+}
+
+// stores the record into the ring of the calling thread
+// returns false if the record has to be written synchronously
+static bool slog_post(const char* format, va_list ap) {
+    struct slog_ring* ring = slog_ring();
+    if (ring == NULL) {
+        return false;
+    }
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= SLOG_RING_RECORDS) {
+        // the drain can't keep up
+        atomic_fetch_add_explicit(&slog_dropped, 1, memory_order_relaxed);
+        return true;
+    }
+    struct slog_record* rec = &ring->records[head % SLOG_RING_RECORDS];
+    if (!slog_encode(rec, format, ap)) {
+        return false;
+    }
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    if (head == tail) {
+        // the ring was empty
+        pthread_cond_signal(&slog_cv);
+    }
+    return true;
+}
+
+// must be called with the slog_drain_mutex held
+static void slog_drain(void) {
+    for(int r = 0; r < SLOG_RINGS; r += 1) {
+        struct slog_ring* ring = &slog_rings[r];
+        unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while(tail != head) {
+            char buffer[LINE_MAX+1] = "";
+            slog_decode(&ring->records[tail % SLOG_RING_RECORDS], buffer, sizeof(buffer));
+            slog_output(buffer);
+            tail += 1;
+            atomic_store_explicit(&ring->tail, tail, memory_order_release);
+        }
+    }
+    unsigned long dropped = atomic_load_explicit(&slog_dropped, memory_order_relaxed);
+    if (dropped != slog_dropped_reported) {
+        char buffer[LINE_MAX+1] = "";
+        snprintf(buffer, LINE_MAX, "%lu log records dropped", dropped - slog_dropped_reported);
+        slog_output(buffer);
+        slog_dropped_reported = dropped;
+    }
+}
+
+void slog_flush(void) {
+    if (!atomic_load(&slog_running)) {
+        return;
+    }
+    pthread_mutex_lock(&slog_drain_mutex);
+    slog_drain();
+    pthread_mutex_unlock(&slog_drain_mutex);
+}
+
+static void* slog_drain_thread(void* arg) {
+    (void)arg;
+    // we only expect the main thread to handle signals
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    while(true) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += SLOG_DRAIN_INTERVAL * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec += 1;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&slog_cv_mutex);
+        pthread_cond_timedwait(&slog_cv, &slog_cv_mutex, &until);
+        pthread_mutex_unlock(&slog_cv_mutex);
+
+        slog_flush();
+    }
+    return NULL;
+}
+
+void slog_start(void) {
+    pthread_once(&slog_once, slog_rings_init);
+    if (atomic_load(&slog_running)) {
+        return;
+    }
+    atomic_store(&slog_running, true);
+    if (pthread_create(&slog_drain_tid, NULL, slog_drain_thread, NULL) != 0) {
+        atomic_store(&slog_running, false);
+        syslog(LOG_DAEMON | LOG_ERR, "%s: Can't start the log drain thread", lpre);
+        return;
+    }
+    // the records pending at exit()
+    atexit(slog_flush);
+}
+
 void
-slog(unsigned int level, const char *format, ...) {
+slog_defer(unsigned int level, const char *format, ...) {
     va_list	ap;
     char	buffer[LINE_MAX+1] = "";
 
@@ -43,18 +507,48 @@ slog(unsigned int level, const char *format, ...) {
         slog_init("");
         isInitialized = 1;
     }
-    if (!(level <= debug_level))
+    if (!(level <= debug_level) || (level > SLOG_MIN_LEVEL))
         return;
+
+    bool running = atomic_load_explicit(&slog_running, memory_order_acquire);
+    if (running && (level > SLOG_ERROR)) {
+        va_start(ap, format);
+        bool posted = slog_post(format, ap);
+        va_end(ap);
+        if (posted) {
+            return;
+        }
+    }
     
     va_start(ap, format);
     vsnprintf(buffer, LINE_MAX, format, ap);
     va_end(ap);
 
-    if (debug) {
-        printf("%s: %s\n", lpre, buffer);
-        syslog(LOG_DAEMON | LOG_DEBUG, "%s: %s\n", lpre, buffer);
+    if (running) {
+        // keep the order: the pending records first
+        pthread_mutex_lock(&slog_drain_mutex);
+        slog_drain();
+        slog_output(buffer);
+        pthread_mutex_unlock(&slog_drain_mutex);
     }
     else {
-        syslog(LOG_DAEMON | LOG_DEBUG, "%s: %s\n", lpre, buffer);
+        slog_output(buffer);
     }
 }
+
+void
+(slog)(unsigned int level, const char *format, ...) {
+    va_list	ap;
+    char	buffer[LINE_MAX+1] = "";
+
+    if (!(level <= debug_level) || (level > SLOG_MIN_LEVEL))
+        return;
+
+    va_start(ap, format);
+    vsnprintf(buffer, LINE_MAX, format, ap);
+    va_end(ap);
+
+    // the format may not survive the record (a backend may be
+    // unloaded), only the text is stored
+    slog_defer(level, "%s", buffer);
+}
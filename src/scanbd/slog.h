@@ -33,7 +33,45 @@
 extern bool debug;
 extern unsigned int debug_level;
 
-void slog(unsigned int level, const char *format, ...);
+// the levels above SLOG_MIN_LEVEL (the least important level kept)
+// are compiled out of the callers (configure --with-slog-min-level,
+// Makefile.conf SLOG_MIN_LEVEL), by default nothing is compiled out
+#ifndef SLOG_MIN_LEVEL
+# define SLOG_MIN_LEVEL 7
+#endif
+
+// the records of each thread are stored into a lock-free ring of this
+// thread as binary records (the format and the raw arguments, the
+// strings are copied), a drain thread (see slog_start()) formats them
+// and writes them to syslog, so the pollers neither format nor wait
+// for syslog. Records of a full ring are dropped (and counted), errors
+// are written at once (after the pending records)
+// the number of threads with an own ring (others log synchronously)
+#define SLOG_RINGS 32
+// the number of records per ring (a power of 2)
+#define SLOG_RING_RECORDS 64
+// records with more arguments or longer strings are formatted at once
+#define SLOG_RECORD_ARGS 8
+#define SLOG_RECORD_STRINGS 176
+
+// formats the record at once (the backends call this for syslog())
+void (slog)(unsigned int level, const char *format, ...);
+// the format must be a literal: the record is formatted later
+void slog_defer(unsigned int level, const char *format, ...);
 void slog_init(const char *string);
+// starts the drain thread (after the daemon has forked), before all
+// records are written synchronously
+void slog_start(void);
+// writes all pending records
+void slog_flush(void);
+
+// the level is checked before the arguments are evaluated
+#define slog(level, ...)                                        \
+    do {                                                        \
+        if (((level) <= SLOG_MIN_LEVEL) &&                      \
+            ((unsigned int)(level) <= debug_level)) {           \
+            slog_defer((level), __VA_ARGS__);                   \
+        }                                                       \
+    } while(0)
 
 #endif
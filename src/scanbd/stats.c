@@ -0,0 +1,460 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include "scanbd.h"
+#include "stats.h"
+#include <stdatomic.h>
+
+// the buckets: values 0 .. 3 have an own bucket, above each power of
+// two range [2^e, 2^(e+1)) is split into 4 buckets of equal width,
+// values beyond the last range are counted in the last bucket
+#define STATS_SUB_BUCKETS 4
+#define STATS_BUCKETS (STATS_SUB_BUCKETS + (SCANBD_STATS_RANGES - 2) * STATS_SUB_BUCKETS)
+
+struct stats_histogram {
+    atomic_ulong buckets[STATS_BUCKETS];
+    atomic_ulong count;
+    atomic_ulong sum;
+    atomic_ulong max;
+};
+typedef struct stats_histogram stats_histogram_t;
+
+struct stats_device {
+    char* name;        // the device name (a copy, freed on reuse)
+    int refs;          // the holders (see stats_device_put())
+    stats_histogram_t histograms[STATS_KINDS];
+};
+
+static stats_device_t stats_devices[SCANBD_STATS_DEVICES];
+// the registered devices, a device is published after its name is set
+static atomic_int stats_num_devices = 0;
+// serializes the registration and the reports (a record may be reused),
+// recording is lock-free
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// the rescans and the values of unknown devices
+static stats_device_t stats_global;
+
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+
+static const char* stats_names[STATS_KINDS] = {
+    "poll", "jitter", "latency", "runtime", "reopen", "wakeup", "parked", "rescan",
+    "reconfigure"
+};
+
+static const char* stats_help[STATS_KINDS] = {
+    "Duration of one backend query",
+    "Delay of the poll behind the scheduled time",
+    "Detection of a trigger to the exec of the script",
+    "Runtime of the action script",
+    "Reopen of the device after the scripts",
+    "Time between the heartbeat polls of a parked device",
+    "Time a device was parked until it resumed",
+    "Rescan of the devices",
+    "Reconfiguration on SIGHUP"
+};
+
+// the bucket limits of the exported histograms: the powers of two
+// 2^0 .. 2^(STATS_OPENMETRICS_RANGES - 1) us (about 33 s), the values
+// beyond are only counted in +Inf
+#define STATS_OPENMETRICS_RANGES 26
+
+static void stats_histogram_init(stats_histogram_t* h) {
+    for(int b = 0; b < STATS_BUCKETS; b += 1) {
+        atomic_init(&h->buckets[b], 0);
+    }
+    atomic_init(&h->count, 0);
+    atomic_init(&h->sum, 0);
+    atomic_init(&h->max, 0);
+}
+
+static void stats_init(void) {
+    for(int d = 0; d < SCANBD_STATS_DEVICES; d += 1) {
+        stats_devices[d].name = NULL;
+        stats_devices[d].refs = 0;
+        for(int k = 0; k < STATS_KINDS; k += 1) {
+            stats_histogram_init(&stats_devices[d].histograms[k]);
+        }
+    }
+    stats_global.name = "global";
+    for(int k = 0; k < STATS_KINDS; k += 1) {
+        stats_histogram_init(&stats_global.histograms[k]);
+    }
+}
+
+static int stats_bucket(unsigned long usec) {
+    if (usec < STATS_SUB_BUCKETS) {
+        return (int)usec;
+    }
+    int e = 0; // the power of two range of usec
+    for(unsigned long v = usec; v > 1; v >>= 1) {
+        e += 1;
+    }
+    if (e >= SCANBD_STATS_RANGES) {
+        return STATS_BUCKETS - 1;
+    }
+    int sub = (int)((usec >> (e - 2)) & (STATS_SUB_BUCKETS - 1));
+    return STATS_SUB_BUCKETS + (e - 2) * STATS_SUB_BUCKETS + sub;
+}
+
+// the largest value counted in bucket b
+static unsigned long stats_bucket_limit(int b) {
+    if (b < STATS_SUB_BUCKETS) {
+        return (unsigned long)b;
+    }
+    int e = (b - STATS_SUB_BUCKETS) / STATS_SUB_BUCKETS + 2;
+    int sub = (b - STATS_SUB_BUCKETS) % STATS_SUB_BUCKETS;
+    unsigned long width = 1UL << (e - 2);
+    return (unsigned long)(STATS_SUB_BUCKETS + sub) * width + width - 1;
+}
+
+stats_device_t* stats_device(const char* name) {
+    assert(name != NULL);
+    pthread_once(&stats_once, stats_init);
+    stats_device_t* sd = NULL;
+    if (pthread_mutex_lock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return NULL;
+    }
+    int n = atomic_load(&stats_num_devices);
+    for(int d = 0; d < n; d += 1) {
+        if (strcmp(stats_devices[d].name, name) == 0) {
+            sd = &stats_devices[d];
+            sd->refs += 1;
+            goto cleanup;
+        }
+    }
+    if (n < SCANBD_STATS_DEVICES) {
+        if ((stats_devices[n].name = strdup(name)) == NULL) {
+            slog(SLOG_ERROR, "Can't allocate memory for device statistics");
+            goto cleanup;
+        }
+        sd = &stats_devices[n];
+        sd->refs = 1;
+        atomic_store(&stats_num_devices, n + 1);
+        goto cleanup;
+    }
+    // all records are taken (e.g. a USB device replugged at new bus
+    // addresses): a device nobody holds anymore gives its record away
+    for(int d = 0; d < n; d += 1) {
+        if (stats_devices[d].refs == 0) {
+            char* copy = strdup(name);
+            if (copy == NULL) {
+                slog(SLOG_ERROR, "Can't allocate memory for device statistics");
+                goto cleanup;
+            }
+            sd = &stats_devices[d];
+            slog(SLOG_DEBUG, "statistics of device %s reused for device %s",
+                 sd->name, name);
+            free(sd->name);
+            sd->name = copy;
+            sd->refs = 1;
+            for(int k = 0; k < STATS_KINDS; k += 1) {
+                stats_histogram_init(&sd->histograms[k]);
+            }
+            goto cleanup;
+        }
+    }
+    slog(SLOG_WARN, "No statistics for device %s (max %d devices)",
+         name, SCANBD_STATS_DEVICES);
+cleanup:
+    if (pthread_mutex_unlock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return sd;
+}
+
+stats_device_t* stats_device_get(stats_device_t* sd) {
+    if (sd == NULL) {
+        return NULL;
+    }
+    if (pthread_mutex_lock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return NULL;
+    }
+    sd->refs += 1;
+    if (pthread_mutex_unlock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return sd;
+}
+
+void stats_device_put(stats_device_t* sd) {
+    if (sd == NULL) {
+        return;
+    }
+    if (pthread_mutex_lock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    assert(sd->refs > 0);
+    sd->refs -= 1;
+    if (pthread_mutex_unlock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void stats_record(stats_device_t* sd, stats_kind_t kind, unsigned long usec) {
+    assert((kind >= 0) && (kind < STATS_KINDS));
+    pthread_once(&stats_once, stats_init);
+    if (sd == NULL) {
+        sd = &stats_global;
+    }
+    stats_histogram_t* h = &sd->histograms[kind];
+    atomic_fetch_add_explicit(&h->buckets[stats_bucket(usec)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum, usec, memory_order_relaxed);
+    unsigned long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    while((usec > max) &&
+          !atomic_compare_exchange_weak_explicit(&h->max, &max, usec,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed)) {
+        // max was reloaded by the failed exchange
+    }
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+}
+
+void stats_now(struct timespec* ts) {
+    assert(ts != NULL);
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+unsigned long stats_since(const struct timespec* start) {
+    assert(start != NULL);
+    struct timespec now;
+    stats_now(&now);
+    long usec = (now.tv_sec - start->tv_sec) * 1000000L +
+                (now.tv_nsec - start->tv_nsec) / 1000L;
+    return (usec > 0) ? (unsigned long)usec : 0;
+}
+
+void stats_poll_begin(stats_device_t* sd, const struct timespec* due) {
+    assert(due != NULL);
+    if ((due->tv_sec == 0) && (due->tv_nsec == 0)) {
+        return;
+    }
+    stats_record(sd, STATS_JITTER, stats_since(due));
+}
+
+void stats_poll_end(struct timespec* due, int delay) {
+    assert(due != NULL);
+    stats_now(due);
+    due->tv_sec += delay / 1000;
+    due->tv_nsec += (long)(delay % 1000) * 1000000L;
+    if (due->tv_nsec >= 1000000000L) {
+        due->tv_sec += 1;
+        due->tv_nsec -= 1000000000L;
+    }
+}
+
+// the value below which the fraction q of the counted values lies
+// (the limit of its bucket, at most the max)
+static unsigned long stats_percentile(const unsigned long* buckets, unsigned long total,
+                                      unsigned long max, double q) {
+    unsigned long rank = (unsigned long)(q * total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    unsigned long seen = 0;
+    for(int b = 0; b < STATS_BUCKETS; b += 1) {
+        seen += buckets[b];
+        if ((seen >= rank) && (b < STATS_BUCKETS - 1)) {
+            unsigned long limit = stats_bucket_limit(b);
+            return (limit < max) ? limit : max;
+        }
+    }
+    return max;
+}
+
+static void stats_report_device(FILE* f, const stats_device_t* sd) {
+    fprintf(f, "device %s\n", sd->name);
+    for(int k = 0; k < STATS_KINDS; k += 1) {
+        const stats_histogram_t* h = &sd->histograms[k];
+        if (atomic_load(&h->count) == 0) {
+            continue;
+        }
+        // the buckets are read one by one while the pollers go on
+        // recording: the total is the sum of the buckets read
+        unsigned long buckets[STATS_BUCKETS];
+        unsigned long total = 0;
+        for(int b = 0; b < STATS_BUCKETS; b += 1) {
+            buckets[b] = atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+            total += buckets[b];
+        }
+        if (total == 0) {
+            continue;
+        }
+        unsigned long max = atomic_load(&h->max);
+        unsigned long sum = atomic_load(&h->sum);
+        fprintf(f, "  %-8s count %lu mean %lu p50 %lu p90 %lu p99 %lu max %lu (us)\n",
+                stats_names[k], total, sum / total,
+                stats_percentile(buckets, total, max, 0.50),
+                stats_percentile(buckets, total, max, 0.90),
+                stats_percentile(buckets, total, max, 0.99),
+                max);
+    }
+}
+
+char* stats_report(void) {
+    pthread_once(&stats_once, stats_init);
+    char* report = NULL;
+    size_t size = 0;
+    FILE* f = NULL;
+    if ((f = open_memstream(&report, &size)) == NULL) {
+        slog(SLOG_ERROR, "Can't create the statistics report: %s", strerror(errno));
+        return NULL;
+    }
+    // the names of the devices are stable under the mutex
+    if (pthread_mutex_lock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+    else {
+        int n = atomic_load(&stats_num_devices);
+        for(int d = 0; d < n; d += 1) {
+            stats_report_device(f, &stats_devices[d]);
+        }
+        if (pthread_mutex_unlock(&stats_mutex) < 0) {
+            slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+        }
+    }
+    stats_report_device(f, &stats_global);
+    if (fclose(f) != 0) {
+        slog(SLOG_ERROR, "Can't create the statistics report: %s", strerror(errno));
+        free(report);
+        return NULL;
+    }
+    return report;
+}
+
+bool stats_dump(const char* file) {
+    assert(file != NULL);
+    char* report = stats_report();
+    if (report == NULL) {
+        return false;
+    }
+    bool ok = false;
+    FILE* f = NULL;
+    if ((f = fopen(file, "w")) == NULL) {
+        slog(SLOG_WARN, "Can't open the stats file %s: %s", file, strerror(errno));
+        goto cleanup;
+    }
+    if (fputs(report, f) == EOF) {
+        slog(SLOG_WARN, "Can't write the stats file %s: %s", file, strerror(errno));
+        fclose(f);
+        goto cleanup;
+    }
+    if (fclose(f) != 0) {
+        slog(SLOG_WARN, "Can't write the stats file %s: %s", file, strerror(errno));
+        goto cleanup;
+    }
+    slog(SLOG_INFO, "statistics written to %s", file);
+    ok = true;
+cleanup:
+    free(report);
+    return ok;
+}
+
+void stats_label(FILE* f, const char* value) {
+    assert(f != NULL);
+    fputc('"', f);
+    for(const char* c = (value != NULL) ? value : ""; *c != '\0'; c += 1) {
+        switch(*c) {
+        case '"':
+            fputs("\\\"", f);
+            break;
+        case '\\':
+            fputs("\\\\", f);
+            break;
+        case '\n':
+            fputs("\\n", f);
+            break;
+        default:
+            fputc(*c, f);
+            break;
+        }
+    }
+    fputc('"', f);
+}
+
+// one histogram of the family scanbd_<kind>_seconds
+static void stats_openmetrics_histogram(FILE* f, const stats_device_t* sd, int k) {
+    const stats_histogram_t* h = &sd->histograms[k];
+    if (atomic_load(&h->count) == 0) {
+        return;
+    }
+    unsigned long buckets[STATS_BUCKETS];
+    unsigned long total = 0;
+    for(int b = 0; b < STATS_BUCKETS; b += 1) {
+        buckets[b] = atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        total += buckets[b];
+    }
+    if (total == 0) {
+        return;
+    }
+    // a power of two is the lower limit of a range: the bucket le
+    // 2^e counts the values below 2^e us exactly
+    int b = 0;
+    unsigned long below = 0;
+    for(int e = 0; e < STATS_OPENMETRICS_RANGES; e += 1) {
+        unsigned long limit = 1UL << e;
+        while((b < STATS_BUCKETS - 1) && (stats_bucket_limit(b) < limit)) {
+            below += buckets[b];
+            b += 1;
+        }
+        fprintf(f, "scanbd_%s_seconds_bucket{device=", stats_names[k]);
+        stats_label(f, sd->name);
+        fprintf(f, ",le=\"%g\"} %lu\n", (double)limit / 1e6, below);
+    }
+    fprintf(f, "scanbd_%s_seconds_bucket{device=", stats_names[k]);
+    stats_label(f, sd->name);
+    fprintf(f, ",le=\"+Inf\"} %lu\n", total);
+    fprintf(f, "scanbd_%s_seconds_count{device=", stats_names[k]);
+    stats_label(f, sd->name);
+    fprintf(f, "} %lu\n", total);
+    fprintf(f, "scanbd_%s_seconds_sum{device=", stats_names[k]);
+    stats_label(f, sd->name);
+    fprintf(f, "} %g\n", (double)atomic_load(&h->sum) / 1e6);
+}
+
+void stats_openmetrics(FILE* f) {
+    assert(f != NULL);
+    pthread_once(&stats_once, stats_init);
+    // the names of the devices are stable under the mutex
+    bool locked = true;
+    if (pthread_mutex_lock(&stats_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        locked = false;
+    }
+    int n = locked ? atomic_load(&stats_num_devices) : 0;
+    // the samples of a family must not be interleaved with others
+    for(int k = 0; k < STATS_KINDS; k += 1) {
+        fprintf(f, "# TYPE scanbd_%s_seconds histogram\n", stats_names[k]);
+        fprintf(f, "# UNIT scanbd_%s_seconds seconds\n", stats_names[k]);
+        fprintf(f, "# HELP scanbd_%s_seconds %s.\n", stats_names[k], stats_help[k]);
+        for(int d = 0; d < n; d += 1) {
+            stats_openmetrics_histogram(f, &stats_devices[d], k);
+        }
+        stats_openmetrics_histogram(f, &stats_global, k);
+    }
+    if (locked && (pthread_mutex_unlock(&stats_mutex) < 0)) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+
+// the latency statistics: each device has a set of log-linear
+// histograms (4 sub-buckets per power of two, values in us) of the
+// poll call duration, the poll jitter, the latency from the detection
+// of a trigger to the exec of the script, the script runtime, the
+// reopen time and the heartbeats and park times of the idle park
+// (see poll_interval_t). All counters are updated lock-free, the devices are
+// registered by name and keep their histograms over rescans and
+// restarts of the pollers; the histograms of a device nobody holds
+// anymore are reused when all records are taken. The rescan and reconfiguration times are
+// recorded globally.
+
+// the number of devices with statistics
+#define SCANBD_STATS_DEVICES 32
+// the power of two bucket ranges: values up to 2^SCANBD_STATS_RANGES us
+#define SCANBD_STATS_RANGES 36
+
+// the stats file is written on this signal
+#ifdef SIGINFO
+# define SCANBD_STATS_SIGNAL SIGINFO
+#else
+# define SCANBD_STATS_SIGNAL SIGRTMIN
+#endif
+
+enum stats_kind {
+    STATS_POLL = 0,    // duration of one backend query (value / buttons)
+    STATS_JITTER,      // delay of the poll behind the scheduled time
+    STATS_LATENCY,     // detection of a trigger to the exec of the script
+    STATS_RUNTIME,     // runtime of the script (launch to waitpid)
+    STATS_REOPEN,      // reopen of the device after the scripts
+    STATS_WAKEUP,      // a heartbeat poll of a parked device (the time
+                       // since the previous one)
+    STATS_PARKED,      // the time a device was parked until it resumed
+    STATS_RESCAN,      // rescan of the devices (global only)
+    STATS_RECONFIGURE, // reconfiguration on SIGHUP (global only)
+    STATS_KINDS
+};
+typedef enum stats_kind stats_kind_t;
+
+typedef struct stats_device stats_device_t;
+
+// returns the statistics of the device name (registers it), NULL if
+// there are too many devices. The caller holds the record until
+// stats_device_put()
+extern stats_device_t* stats_device(const char* name);
+// one more holder of sd (e.g. a job of the device), returns sd
+extern stats_device_t* stats_device_get(stats_device_t* sd);
+// the holder doesn't record to sd anymore (accepts NULL)
+extern void stats_device_put(stats_device_t* sd);
+// records the value usec of kind, a NULL device records globally
+extern void stats_record(stats_device_t* sd, stats_kind_t kind, unsigned long usec);
+
+// the actual time (CLOCK_MONOTONIC)
+extern void stats_now(struct timespec* ts);
+// the us elapsed since start
+extern unsigned long stats_since(const struct timespec* start);
+
+// the jitter of a poller: records how late the poll due at *due
+// starts (nothing if *due is zero) and sets *due to the time the next
+// poll is due after delay ms
+extern void stats_poll_begin(stats_device_t* sd, const struct timespec* due);
+extern void stats_poll_end(struct timespec* due, int delay);
+
+// returns the report of all histograms (count, p50, p90, p99, max),
+// must be freed by the caller, NULL on error
+extern char* stats_report(void);
+// writes the report to file, returns false on error
+extern bool stats_dump(const char* file);
+
+// writes the histograms as OpenMetrics histogram families
+// scanbd_<kind>_seconds{device=...} (see metrics.h)
+extern void stats_openmetrics(FILE* f);
+// writes value as a quoted OpenMetrics label value
+extern void stats_label(FILE* f, const char* value);
+
+#endif // STATS_H
@@ -0,0 +1,284 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "status_page.h"
+
+#include <sys/mman.h>
+#include <libgen.h>
+
+// the mapped status page, NULL if there is none
+static status_page_t* status_page = NULL;
+// the name of the status page (for the unlink)
+static char* status_page_path = NULL;
+
+// guards the registration of the devices
+static pthread_mutex_t status_mutex = PTHREAD_MUTEX_INITIALIZER;
+// the records held by a poller (see status_device_put()), a free
+// record is reused
+static bool status_used[STATUS_PAGE_DEVICES];
+
+static int64_t status_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the directory of path, created if missing
+static bool status_page_dir(const char* path, uid_t uid, gid_t gid) {
+    char* copy = strdup(path);
+    if (copy == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the status page");
+        return false;
+    }
+    const char* dir = dirname(copy);
+    bool ok = true;
+    if (mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0) {
+        // the (unprivileged) daemon removes the page at the exit
+        if (chown(dir, uid, gid) < 0) {
+            slog(SLOG_WARN, "Can't chown %s: %s", dir, strerror(errno));
+        }
+    }
+    else if (errno != EEXIST) {
+        slog(SLOG_ERROR, "Can't create directory %s: %s", dir, strerror(errno));
+        ok = false;
+    }
+    free(copy);
+    return ok;
+}
+
+bool status_page_open(const char* path, uid_t uid, gid_t gid) {
+    assert(path != NULL);
+    assert(status_page == NULL);
+    if (!status_page_dir(path, uid, gid)) {
+        return false;
+    }
+    // the page is built under a temporary name and renamed, so a
+    // reader never maps a partial one
+    size_t len = strlen(path) + 8;
+    char* tmp = malloc(len);
+    status_page_path = strdup(path);
+    if ((tmp == NULL) || (status_page_path == NULL)) {
+        slog(SLOG_ERROR, "Can't allocate memory for the status page");
+        goto error;
+    }
+    snprintf(tmp, len, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        slog(SLOG_ERROR, "Can't create status page %s: %s", tmp, strerror(errno));
+        goto error;
+    }
+    void* p = MAP_FAILED;
+    if ((fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) < 0) ||
+        (fchown(fd, uid, gid) < 0) ||
+        (ftruncate(fd, sizeof(status_page_t)) < 0) ||
+        ((p = mmap(NULL, sizeof(status_page_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0)) == MAP_FAILED)) {
+        slog(SLOG_ERROR, "Can't map status page %s: %s", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        goto error;
+    }
+    // the mapping stays valid
+    close(fd);
+
+    status_page_t* sp = p;
+    sp->magic = STATUS_PAGE_MAGIC;
+    sp->version = STATUS_PAGE_VERSION;
+    sp->size = sizeof(status_page_t);
+    atomic_store(&sp->num_devices, 0);
+    memset(status_used, 0, sizeof(status_used));
+    sp->started = status_time();
+    sp->pid = (uint32_t)getpid();
+    if (rename(tmp, path) < 0) {
+        slog(SLOG_ERROR, "Can't rename status page %s: %s", tmp, strerror(errno));
+        munmap(p, sizeof(status_page_t));
+        unlink(tmp);
+        goto error;
+    }
+    free(tmp);
+    status_page = sp;
+    slog(SLOG_INFO, "status page %s", path);
+    return true;
+error:
+    free(tmp);
+    free(status_page_path);
+    status_page_path = NULL;
+    return false;
+}
+
+void status_page_close(bool unmap) {
+    if (status_page == NULL) {
+        return;
+    }
+    status_page_t* sp = status_page;
+    status_page = NULL;
+    if (unlink(status_page_path) < 0) {
+        slog(SLOG_WARN, "Can't unlink status page %s: %s", status_page_path, strerror(errno));
+    }
+    // the pollers have ended, the records aren't used anymore
+    if (unmap) {
+        munmap(sp, sizeof(status_page_t));
+    }
+    free(status_page_path);
+    status_page_path = NULL;
+}
+
+// the seqlock of the (single) writer
+static void status_write_begin(status_device_t* sd) {
+    unsigned int s = atomic_load_explicit(&sd->seq, memory_order_relaxed);
+    atomic_store_explicit(&sd->seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void status_write_end(status_device_t* sd) {
+    unsigned int s = atomic_load_explicit(&sd->seq, memory_order_relaxed);
+    atomic_store_explicit(&sd->seq, s + 1, memory_order_release);
+}
+
+status_device_t* status_device(const char* name) {
+    assert(name != NULL);
+    status_page_t* sp = status_page;
+    if (sp == NULL) {
+        return NULL;
+    }
+    status_device_t* sd = NULL;
+    if (pthread_mutex_lock(&status_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return NULL;
+    }
+    // the free record of the device keeps its counters, a record still
+    // held (by an abandoned poller) isn't shared: the replacement gets
+    // another one
+    unsigned int n = atomic_load(&sp->num_devices);
+    for(unsigned int d = 0; d < n; d += 1) {
+        if (!status_used[d] &&
+            (strncmp(sp->devices[d].name, name, STATUS_PAGE_NAME - 1) == 0)) {
+            status_used[d] = true;
+            sd = &sp->devices[d];
+            goto cleanup;
+        }
+    }
+    if (n < STATUS_PAGE_DEVICES) {
+        sd = &sp->devices[n];
+        memset(sd, 0, sizeof(status_device_t));
+        strncpy(sd->name, name, STATUS_PAGE_NAME - 1);
+        status_used[n] = true;
+        // the record is complete before a reader sees it
+        atomic_store_explicit(&sp->num_devices, n + 1, memory_order_release);
+        goto cleanup;
+    }
+    // the page is full (e.g. a USB device replugged at new bus
+    // addresses): a stopped device gives its record away
+    for(unsigned int d = 0; d < n; d += 1) {
+        if (!status_used[d]) {
+            status_used[d] = true;
+            sd = &sp->devices[d];
+            slog(SLOG_DEBUG, "status record of device %s reused for device %s",
+                 sd->name, name);
+            // no poller writes it, the seqlock keeps the readers out
+            status_write_begin(sd);
+            sd->state = STATUS_UNKNOWN;
+            sd->polls = 0;
+            sd->triggers = 0;
+            sd->reopens = 0;
+            sd->last_poll = 0;
+            sd->last_trigger = 0;
+            memset(sd->name, 0, STATUS_PAGE_NAME);
+            strncpy(sd->name, name, STATUS_PAGE_NAME - 1);
+            memset(sd->action, 0, STATUS_PAGE_ACTION);
+            status_write_end(sd);
+            goto cleanup;
+        }
+    }
+    slog(SLOG_WARN, "No status record for device %s (max %d devices)",
+         name, STATUS_PAGE_DEVICES);
+cleanup:
+    if (pthread_mutex_unlock(&status_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+    return sd;
+}
+
+void status_device_put(status_device_t* sd) {
+    if (sd == NULL) {
+        return;
+    }
+    // the last write of the ended poller
+    status_state(sd, STATUS_STOPPED);
+    if (pthread_mutex_lock(&status_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return;
+    }
+    // the page of an abandoned poller may be closed meanwhile
+    status_page_t* sp = status_page;
+    if ((sp != NULL) && (sd >= sp->devices) && (sd < sp->devices + STATUS_PAGE_DEVICES)) {
+        status_used[sd - sp->devices] = false;
+    }
+    if (pthread_mutex_unlock(&status_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+void status_polled(status_device_t* sd, status_state_t state) {
+    if (sd == NULL) {
+        return;
+    }
+    status_write_begin(sd);
+    sd->state = state;
+    sd->polls += 1;
+    sd->last_poll = status_time();
+    status_write_end(sd);
+}
+
+void status_state(status_device_t* sd, status_state_t state) {
+    if ((sd == NULL) || (sd->state == (uint32_t)state)) {
+        return;
+    }
+    status_write_begin(sd);
+    sd->state = state;
+    status_write_end(sd);
+}
+
+void status_triggered(status_device_t* sd, const char* action) {
+    if (sd == NULL) {
+        return;
+    }
+    status_write_begin(sd);
+    sd->triggers += 1;
+    sd->last_trigger = status_time();
+    memset(sd->action, 0, STATUS_PAGE_ACTION);
+    if (action != NULL) {
+        strncpy(sd->action, action, STATUS_PAGE_ACTION - 1);
+    }
+    status_write_end(sd);
+}
+
+void status_reopened(status_device_t* sd) {
+    if (sd == NULL) {
+        return;
+    }
+    status_write_begin(sd);
+    sd->reopens += 1;
+    status_write_end(sd);
+}
@@ -0,0 +1,124 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef STATUS_PAGE_H
+#define STATUS_PAGE_H
+
+#include "common.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// the status page: a small file (see C_STATUS_PAGE) mapped by scanbd
+// and by the readers (monitoring agents), holding the state and the
+// counters of each device. The pollers update their record without a
+// lock and without a syscall, the readers sample it without disturbing
+// them. The devices are registered by name (like the statistics) and
+// keep their record over rescans and restarts of the pollers; the
+// record of an ended poller is reused when the page is full.
+//
+// each record is a seqlock: seq is odd while the poller writes it. A
+// reader copies the record between two loads of seq and retries if
+// they differ or are odd:
+//
+//     do {
+//         s = atomic_load_explicit(&d->seq, memory_order_acquire);
+//         copy = *d;
+//         atomic_thread_fence(memory_order_acquire);
+//     } while((s & 1) || (s != atomic_load_explicit(&d->seq, memory_order_relaxed)));
+//
+// the layout is fixed (version), all times are CLOCK_REALTIME ns
+
+#define STATUS_PAGE_MAGIC 0x53424453u // "SBDS"
+#define STATUS_PAGE_VERSION 1
+
+// the number of device records
+#define STATUS_PAGE_DEVICES 32
+#define STATUS_PAGE_NAME 128
+#define STATUS_PAGE_ACTION 64
+
+enum status_state {
+    STATUS_UNKNOWN = 0, // registered, not polled yet
+    STATUS_OPEN,        // the device is opened and polled
+    STATUS_RELEASED,    // closed for the action scripts
+    STATUS_IDLE,        // closed by the idle park, heartbeat polls
+    STATUS_PARKED,      // used by saned, not polled
+    STATUS_STOPPED      // the poller has ended (e.g. unplugged)
+};
+typedef enum status_state status_state_t;
+
+struct status_device {
+    atomic_uint seq;                 // the seqlock
+    uint32_t state;                  // status_state_t
+    uint64_t polls;                  // the poll cycles
+    uint64_t triggers;               // the triggered actions
+    uint64_t reopens;                // the reopens of the device
+    int64_t last_poll;               // the time of the last poll cycle
+    int64_t last_trigger;            // the time of the last trigger
+    char name[STATUS_PAGE_NAME];     // the device (set at registration)
+    char action[STATUS_PAGE_ACTION]; // the last triggered action
+};
+typedef struct status_device status_device_t;
+
+struct status_page {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                   // of the status page
+    atomic_uint num_devices;         // the registered records
+    int64_t started;                 // the start of scanbd
+    uint32_t pid;                    // of scanbd
+    uint32_t reserved;
+    status_device_t devices[STATUS_PAGE_DEVICES];
+};
+typedef struct status_page status_page_t;
+
+// creates (replaces) the status page path (and its directory), owned
+// by uid / gid, returns false on errors (there is no status page then)
+// must be called before the pollers are started
+extern bool status_page_open(const char* path, uid_t uid, gid_t gid);
+// removes the status page, the mapping is kept if a poller may still
+// write its record (unmap == false: an abandoned poller, see
+// stop_sane_threads())
+extern void status_page_close(bool unmap);
+
+// returns the record of the device name (registers it) for its
+// poller, NULL if there is no status page or too many devices: all
+// updates accept NULL
+// a record is held by one poller only: while an abandoned poller holds
+// the record of name, its replacement gets another one
+extern status_device_t* status_device(const char* name);
+// the poller of sd has ended (or was never started): sd is marked
+// stopped and may be reused for another device
+extern void status_device_put(status_device_t* sd);
+
+// the updates: only the poller of the device writes its record
+// a poll cycle has ended with the device in state
+extern void status_polled(status_device_t* sd, status_state_t state);
+// the device is in state (without a poll)
+extern void status_state(status_device_t* sd, status_state_t state);
+// the action was triggered
+extern void status_triggered(status_device_t* sd, const char* action);
+// the device was reopened
+extern void status_reopened(status_device_t* sd);
+
+#endif // STATUS_PAGE_H
@@ -0,0 +1,214 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "scanbd.h"
+#include "trigger_batch.h"
+#include "evloop.h"
+#include "mailbox.h"
+#include "registry.h"
+#include "stats.h"
+
+struct trigger_batch {
+    struct trigger_batch* next;
+    int number;             // the device number (-1: by name)
+    int action;
+    unsigned int count;
+    unsigned int rate;      // triggers per second (0: unpaced)
+    unsigned int posted;
+    unsigned int held;      // ticks held back by a full mailbox
+    struct timespec start;
+    char device[];          // the device as given
+};
+typedef struct trigger_batch trigger_batch_t;
+
+static pthread_mutex_t trigger_batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static trigger_batch_t* trigger_batches = NULL;
+static int trigger_batch_num = 0;
+static bool trigger_batch_timer = false;
+
+static void trigger_batch_lock(void) {
+    if (pthread_mutex_lock(&trigger_batch_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_lock: %s", strerror(errno));
+    }
+}
+
+static void trigger_batch_unlock(void) {
+    if (pthread_mutex_unlock(&trigger_batch_mutex) < 0) {
+        slog(SLOG_ERROR, "pthread_mutex_unlock: %s", strerror(errno));
+    }
+}
+
+// the registration of the device of b, looked up at each tick: a
+// rediscovery may have renumbered or removed it
+static bool trigger_batch_resolve(const trigger_batch_t* b, registry_ref_t* ref) {
+    if (b->number >= 0) {
+        return registry_resolve(b->number, ref);
+    }
+    return registry_lookup(b->device, NULL, ref) != NULL;
+}
+
+// the number of triggers of b due by now: the first one at once, then
+// rate per second
+static unsigned int trigger_batch_due(const trigger_batch_t* b) {
+    if (b->rate == 0) {
+        return b->count;
+    }
+    unsigned long long due = (unsigned long long)stats_since(&b->start) * b->rate / 1000000ULL + 1;
+    return (due < b->count) ? (unsigned int)due : b->count;
+}
+
+static void trigger_batch_done(const trigger_batch_t* b) {
+    unsigned long usec = stats_since(&b->start);
+    unsigned long per_sec = (usec > 0) ? (unsigned long)((unsigned long long)b->posted * 1000000ULL / usec) : 0;
+    slog(SLOG_INFO, "trigger batch: %u triggers of action %d for device %s in %lu ms (%lu/s), held back %u times",
+         b->posted, b->action, b->device, usec / 1000, per_sec, b->held);
+}
+
+// the timer of the batches in the reactor: posts the triggers due,
+// as many as the mailbox has room for
+static void trigger_batch_tick(void* arg) {
+    (void)arg;
+    trigger_batch_lock();
+    trigger_batch_t** link = &trigger_batches;
+    while(*link != NULL) {
+        trigger_batch_t* b = *link;
+        registry_ref_t ref;
+        if (!trigger_batch_resolve(b, &ref)) {
+            slog(SLOG_WARN, "trigger batch: device %s is gone, %u of %u triggers posted",
+                 b->device, b->posted, b->count);
+            *link = b->next;
+            trigger_batch_num -= 1;
+            free(b);
+            continue;
+        }
+        unsigned int due = trigger_batch_due(b);
+        unsigned int room = SCANBD_MAILBOX_SLOTS - trigger_mailbox_pending(ref.id);
+        unsigned int posted = 0;
+        while((b->posted < due) && (posted < room)) {
+            if (!trigger_mailbox_post(ref.id, ref.generation, b->action)) {
+                break;
+            }
+            b->posted += 1;
+            posted += 1;
+        }
+        if (b->posted < due) {
+            b->held += 1;
+        }
+        if (posted > 0) {
+            registry_wake(&ref);
+        }
+        if (b->posted >= b->count) {
+            trigger_batch_done(b);
+            *link = b->next;
+            trigger_batch_num -= 1;
+            free(b);
+            continue;
+        }
+        link = &b->next;
+    }
+    if ((trigger_batches == NULL) && trigger_batch_timer) {
+        evloop_set_timer(&trigger_batch_timer, TRIGGER_BATCH_TICK, false);
+    }
+    trigger_batch_unlock();
+}
+
+bool trigger_batch_add(const char* device, int action,
+                       unsigned int count, unsigned int rate) {
+    assert(device != NULL);
+    if ((count == 0) || (action < 0)) {
+        slog(SLOG_WARN, "trigger batch: nothing to trigger for device %s", device);
+        return false;
+    }
+    char* end = NULL;
+    long number = strtol(device, &end, 10);
+    if ((end == device) || (*end != '\0') || (number < 0) || (number > INT_MAX)) {
+        number = -1;
+    }
+
+    trigger_batch_t* b = calloc(1, sizeof(trigger_batch_t) + strlen(device) + 1);
+    if (b == NULL) {
+        slog(SLOG_ERROR, "Can't allocate memory for the trigger batch");
+        return false;
+    }
+    strcpy(b->device, device);
+    b->number = (int)number;
+    b->action = action;
+    b->count = count;
+    b->rate = rate;
+    stats_now(&b->start);
+
+    registry_ref_t ref;
+    if (!trigger_batch_resolve(b, &ref)) {
+        slog(SLOG_WARN, "trigger batch: no such device %s", device);
+        free(b);
+        return false;
+    }
+
+    trigger_batch_lock();
+    if (trigger_batch_num >= TRIGGER_BATCH_MAX) {
+        trigger_batch_unlock();
+        slog(SLOG_WARN, "trigger batch: too many batches running, batch for device %s rejected", device);
+        free(b);
+        return false;
+    }
+    if (!trigger_batch_timer) {
+        trigger_batch_timer = evloop_add_timer(TRIGGER_BATCH_TICK, false, trigger_batch_tick,
+                                               &trigger_batch_timer);
+        if (!trigger_batch_timer) {
+            trigger_batch_unlock();
+            slog(SLOG_WARN, "trigger batch: can't add the timer");
+            free(b);
+            return false;
+        }
+    }
+    // appended: the batches are served in the order of their arrival
+    trigger_batch_t** link = &trigger_batches;
+    while(*link != NULL) {
+        link = &(*link)->next;
+    }
+    *link = b;
+    trigger_batch_num += 1;
+    evloop_set_timer(&trigger_batch_timer, TRIGGER_BATCH_TICK, true);
+    trigger_batch_unlock();
+    slog(SLOG_INFO, "trigger batch: %u triggers of action %d for device %s at %u/s",
+         count, action, device, rate);
+    return true;
+}
+
+void trigger_batch_exit(void) {
+    trigger_batch_lock();
+    while(trigger_batches != NULL) {
+        trigger_batch_t* b = trigger_batches;
+        trigger_batches = b->next;
+        slog(SLOG_INFO, "trigger batch: dropping the batch for device %s, %u of %u triggers posted",
+             b->device, b->posted, b->count);
+        free(b);
+    }
+    trigger_batch_num = 0;
+    if (trigger_batch_timer) {
+        evloop_remove_timer(&trigger_batch_timer);
+        trigger_batch_timer = false;
+    }
+    trigger_batch_unlock();
+}
@@ -0,0 +1,51 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef TRIGGER_BATCH_H
+#define TRIGGER_BATCH_H
+
+#include "common.h"
+
+// the batch triggers for load tests of the action pipeline (trigger,
+// environment, executor queue, spawn, script): a batch posts count
+// remote triggers of an action to the mailbox of a device, paced at
+// rate triggers per second (0: as fast as the poller takes them). A
+// full mailbox holds the batch back until the poller has taken the
+// pending triggers, so no trigger of a batch is lost. The batches are
+// paced by a timer of the reactor (see evloop.h), the throughput of a
+// finished batch is logged.
+
+// the pacing interval (ms)
+#define TRIGGER_BATCH_TICK 10
+// the number of batches running at the same time
+#define TRIGGER_BATCH_MAX 16
+
+// starts a batch for the device (the name or the decimal device
+// number), returns false if there is no such device or too many
+// batches are running
+extern bool trigger_batch_add(const char* device, int action,
+                              unsigned int count, unsigned int rate);
+// drops the running batches
+extern void trigger_batch_exit(void);
+
+#endif // TRIGGER_BATCH_H
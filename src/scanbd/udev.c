@@ -26,12 +26,152 @@
 #endif
 
 #include "udev.h"
+#include "evloop.h"
+#include "hotplug.h"
+#include "probe.h"
+#include "scanbuttond_wrapper.h"
 
 #ifdef USE_LIBUDEV
 
-static pthread_t udev_tid = 0;
 static struct udev* udev = NULL;
 static struct udev_monitor* mon = NULL;
+// the monitor is served by the reactor
+static bool udev_in_evloop = false;
+
+// the usb ids of the known scanners: learned from the sane device list
+// or matched by the scanbuttond backends. The ids are only used in the
+// reactor.
+struct udev_usb_id {
+    int vendor;
+    int product;
+};
+static struct udev_usb_id udev_ids[UDEV_MAX_IDS];
+static int udev_num_ids = 0;
+// the events of other usb devices are ignored (see C_UDEV_FILTER)
+static bool udev_filter = true;
+
+static bool udev_known_id(int vendor, int product) {
+    for(int i = 0; i < udev_num_ids; i += 1) {
+        if ((udev_ids[i].vendor == vendor) && (udev_ids[i].product == product)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void udev_add_id(int vendor, int product) {
+    if (udev_known_id(vendor, product)) {
+        return;
+    }
+    if (udev_num_ids >= UDEV_MAX_IDS) {
+        // better wake up for every usb device than miss a scanner
+        slog(SLOG_WARN, "too many usb ids of scanners, udev events are no longer filtered");
+        udev_filter = false;
+        return;
+    }
+    slog(SLOG_DEBUG, "udev filter: scanner %04x:%04x", vendor, product);
+    udev_ids[udev_num_ids].vendor = vendor;
+    udev_ids[udev_num_ids].product = product;
+    udev_num_ids += 1;
+}
+
+// the scanner of the ids is gone: an identical scanner still present
+// is learned again after the update of the pollers (see
+// udev_devices_changed())
+static void udev_remove_id(int vendor, int product) {
+    for(int i = 0; i < udev_num_ids; i += 1) {
+        if ((udev_ids[i].vendor == vendor) && (udev_ids[i].product == product)) {
+            slog(SLOG_DEBUG, "udev filter: scanner %04x:%04x removed", vendor, product);
+            udev_num_ids -= 1;
+            udev_ids[i] = udev_ids[udev_num_ids];
+            return;
+        }
+    }
+}
+
+// the ids of the usb device from its uevent (PRODUCT=vendor/product/bcd),
+// present in the remove events as well
+static bool udev_usb_ids(struct udev_device* device, int* vendor, int* product) {
+    const char* s = udev_device_get_property_value(device, "PRODUCT");
+    return (s != NULL) && (sscanf(s, "%x/%x", vendor, product) == 2);
+}
+
+// learns the ids of the present scanners: the usb devices at the location
+// of a device of the sane device list (the scanbuttond backends are asked
+// for each device instead)
+static void udev_learn_ids(void) {
+#ifdef USE_SANE
+    assert(udev);
+    struct udev_enumerate* e = udev_enumerate_new(udev);
+    if (!e) {
+        slog(SLOG_DEBUG, "Can't create udev enumeration");
+        return;
+    }
+    udev_enumerate_add_match_subsystem(e, UDEV_SUBSYSTEM);
+    udev_enumerate_add_match_property(e, "DEVTYPE", UDEV_DEVICE_TYPE);
+    if (udev_enumerate_scan_devices(e) < 0) {
+        slog(SLOG_DEBUG, "Can't enumerate the usb devices");
+        goto cleanup;
+    }
+    struct udev_list_entry* entry = NULL;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+        struct udev_device* device = udev_device_new_from_syspath(udev, udev_list_entry_get_name(entry));
+        if (!device) {
+            continue;
+        }
+        int vendor = 0;
+        int product = 0;
+        const char* busnum = udev_device_get_property_value(device, "BUSNUM");
+        const char* devnum = udev_device_get_property_value(device, "DEVNUM");
+        if (busnum && devnum && udev_usb_ids(device, &vendor, &product) &&
+            sane_usb_device(atoi(busnum), atoi(devnum))) {
+            udev_add_id(vendor, product);
+        }
+        udev_device_unref(device);
+    }
+cleanup:
+    udev_enumerate_unref(e);
+#endif
+}
+
+// the event of the usb device concerns a scanner: a known one, one the
+// udev rules of sane-backends have matched or one of the scanbuttond
+// backends (devices without ids can't be told apart)
+static bool udev_is_scanner(struct udev_device* device) {
+    if (!udev_filter) {
+        return true;
+    }
+    int vendor = 0;
+    int product = 0;
+    if (!udev_usb_ids(device, &vendor, &product)) {
+        return true;
+    }
+    if (udev_known_id(vendor, product)) {
+        return true;
+    }
+    bool scanner = false;
+#ifdef USE_SANE
+    const char* s = udev_device_get_property_value(device, "libsane_matched");
+    scanner = (s != NULL) && (strcmp(s, "yes") == 0);
+#endif
+#ifdef USE_SCANBUTTOND
+    // in hybrid mode a device of either backend
+    scanner = scanner || scbtn_match_usb(vendor, product);
+#endif
+    if (!scanner) {
+        slog(SLOG_DEBUG, "udev filter: ignoring usb device %04x:%04x", vendor, product);
+        return false;
+    }
+    udev_add_id(vendor, product);
+    return true;
+}
+
+// applies the coalesced events (see hotplug.h), the ids of the scanners
+// found are learned
+static void udev_devices_changed(int added, int removed) {
+    dbus_signal_devices_changed(added, removed);
+    udev_learn_ids();
+}
 
 static int udev_init() {
     slog(SLOG_DEBUG, "udev init");
@@ -47,15 +187,32 @@ static int udev_init() {
         return -1;
     }
 
+    // the kernel (the socket filter of the monitor) drops the events of
+    // the usb interfaces and of all other subsystems, the daemon only
+    // wakes up for usb devices (with the tag, if configured)
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    if (udev_monitor_filter_add_match_subsystem_devtype(mon, UDEV_SUBSYSTEM, UDEV_DEVICE_TYPE) < 0) {
+        slog(SLOG_WARN, "Can't filter the udev events by subsystem");
+    }
+    const char* tag = cfg_getstr(cfg_sec_global, C_UDEV_TAG);
+    if (tag && (strlen(tag) > 0)) {
+        slog(SLOG_DEBUG, "udev filter: tag %s", tag);
+        if (udev_monitor_filter_add_match_tag(mon, tag) < 0) {
+            slog(SLOG_WARN, "Can't filter the udev events by the tag %s", tag);
+        }
+    }
+    udev_filter = cfg_getbool(cfg_sec_global, C_UDEV_FILTER);
+    udev_num_ids = 0;
+
     if (udev_monitor_enable_receiving(mon) < 0) {
         slog(SLOG_DEBUG, "Can't enable udev receiving");
         return -1;
     }
 
-    // check to see if the udev file-descriptor is blocking. This is necessary
-    // for a blocking udev_monitor_receive_device() later on!
-    // The behaviour of libudev changed in this resprect some times ago. And changed
-    // again back... So be explicit here!
+    // the monitor is served by the reactor, which must never block:
+    // make sure the fd is non-blocking (the default of libudev changed
+    // in this respect some times)
 
     int fd = -1;
     if ((fd = udev_monitor_get_fd(mon)) < 0) {
@@ -68,11 +225,11 @@ static int udev_init() {
         slog(SLOG_DEBUG, "Can't get flags of udev fd: %s", strerror(errno));
         return -1;
     }
-    if (flags & O_NONBLOCK) {
-        slog(SLOG_INFO, "udev fd is non-blocking, now setting to blocking mode");
-        flags &= ~O_NONBLOCK;
+    if (!(flags & O_NONBLOCK)) {
+        slog(SLOG_INFO, "udev fd is blocking, now setting to non-blocking mode");
+        flags |= O_NONBLOCK;
         if (fcntl(fd, F_SETFL, flags) < 0) {
-            slog(SLOG_DEBUG, "Can't set udev fd to blocking mode: %s", strerror(errno));
+            slog(SLOG_DEBUG, "Can't set udev fd to non-blocking mode: %s", strerror(errno));
             return -1;
         }
     }
@@ -93,101 +250,109 @@ static int udev_close() {
     return 0;
 }
 
-static void udev_thread_cleanup(void* arg) {
-    slog(SLOG_DEBUG, "cleanup device handler");
-    struct udev_device* device = *((struct udev_device**)arg);
-    if (device) {
-        slog(SLOG_DEBUG, "cleanup device");
-        udev_device_unref(device);
-    }
-}
-
-static void* udev_thread(void* arg)
-{
-    slog(SLOG_DEBUG, "udev thread started");
-    (void)arg;
-    // we only expect the main thread to handle signals
-    sigset_t mask;
-    sigfillset(&mask);
-    pthread_sigmask(SIG_BLOCK, &mask, NULL);
-
-    while(true) {
-        assert(mon);
-
-        struct udev_device* device = 0;
-        pthread_cleanup_push(udev_thread_cleanup, &device);
-        device = udev_monitor_receive_device(mon);
-
-        pthread_testcancel();
-
-        if (!device) {
-            slog(SLOG_WARN, "no device from udev, sleeping 1000ms");
-            usleep(1000 * UDEV_SLEEP_IF_NO_DEVICE);
-        }
-        else {
-            assert(device);
-            slog(SLOG_INFO, "new device");
-            const char* s = 0;
-            s = udev_device_get_devtype(device);
+// handles an event of the monitor
+static void udev_handle_device(struct udev_device* device) {
+    assert(device);
+    slog(SLOG_INFO, "new device");
+    const char* s = 0;
+    s = udev_device_get_devtype(device);
+    if (s) {
+        slog(SLOG_INFO, "udev device type: %s", s);
+        // the kernel filter may be missing (old libudev)
+        if ((strcmp(s, UDEV_DEVICE_TYPE) == 0) && udev_is_scanner(device)) {
+            s = udev_device_get_action(device);
             if (s) {
-                slog(SLOG_INFO, "udev device type: %s", s);
-                if (strcmp(s, UDEV_DEVICE_TYPE) == 0) {
-                    s = udev_device_get_action(device);
-                    if (s) {
-                        slog(SLOG_INFO, "udev device action: %s", s);
-                        if (strcmp(s, UDEV_ADD_ACTION) == 0) {
-                            dbus_signal_device_added();
-                        }
-                        if (strcmp(s, UDEV_REMOVE_ACTION) == 0) {
-                            dbus_signal_device_removed();
-                        }
+                slog(SLOG_INFO, "udev device action: %s", s);
+                if (strcmp(s, UDEV_ADD_ACTION) == 0) {
+#ifdef USE_SCANBUTTOND
+                    libusb_bus_changed();
+#endif
+                    // the burst of a hub reset is applied at once
+                    hotplug_event(true);
+                }
+                if (strcmp(s, UDEV_REMOVE_ACTION) == 0) {
+#ifdef USE_SCANBUTTOND
+                    libusb_bus_changed();
+#endif
+                    hotplug_event(false);
+                    int vendor = 0;
+                    int product = 0;
+                    if (udev_usb_ids(device, &vendor, &product)) {
+                        udev_remove_id(vendor, product);
                     }
                 }
             }
-            udev_device_unref(device);
-            device = 0;
         }
-        pthread_cleanup_pop(0);
     }
-    pthread_exit(NULL);
 }
 
+// the monitor fd in the reactor
+static void udev_monitor_io(int fd, short revents, void* arg) {
+    (void)fd;
+    (void)arg;
+    assert(mon);
+    if (!(revents & POLLIN)) {
+        slog(SLOG_WARN, "udev monitor error (revents=%d)", revents);
+        return;
+    }
+    struct udev_device* device = NULL;
+    while((device = udev_monitor_receive_device(mon)) != NULL) {
+        SCANBD_PROBE2(udev__receive, udev_device_get_action(device),
+                      udev_device_get_devnode(device));
+        udev_handle_device(device);
+        udev_device_unref(device);
+    }
+}
+
+// adds the monitor to the reactor of the main thread
 void udev_start_udev_thread(void)
 {
+    if (udev_in_evloop) {
+        slog(SLOG_DEBUG, "udev monitor already running");
+        return;
+    }
     if (udev_init() < 0) {
         slog(SLOG_ERROR, "Can't init udev");
         return;
     }
-    slog(SLOG_DEBUG, "start udev thread");
-    if (udev_tid != 0) {
-        slog(SLOG_DEBUG, "udev thread already running");
+    slog(SLOG_DEBUG, "adding udev monitor to the reactor");
+    if (!evloop_add_io(udev_monitor_get_fd(mon), POLLIN, true, udev_monitor_io, mon)) {
+        slog(SLOG_ERROR, "Can't add the udev monitor to the reactor");
         return;
     }
-    if (pthread_create(&udev_tid, NULL, udev_thread, NULL) < 0){
-        slog(SLOG_ERROR, "Can't create udev thread: %s", strerror(errno));
+    udev_in_evloop = true;
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    hotplug_init(cfg_getint(cfg_sec_global, C_HOTPLUG_SETTLE), udev_devices_changed);
+    udev_learn_ids();
+#ifdef USE_SCANBUTTOND
+    // the backends don't need to rescan the usb busses at each open,
+    // the monitor reports the changes
+    libusb_set_hotplug_notified(1);
+#endif
+}
+
+void udev_reload(void) {
+    if (!udev_in_evloop) {
         return;
     }
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    hotplug_reload(cfg_getint(cfg_sec_global, C_HOTPLUG_SETTLE));
 }
 
 void udev_stop_udev_thread(void) {
-    slog(SLOG_DEBUG, "stop udev thread");
-    if (udev_tid == 0) {
-        slog(SLOG_DEBUG, "no udev thread to stop");
+    slog(SLOG_DEBUG, "stop udev monitor");
+    if (!udev_in_evloop) {
+        slog(SLOG_DEBUG, "no udev monitor to stop");
         return;
     }
-    if (pthread_cancel(udev_tid) < 0) {
-        if (errno == ESRCH) {
-            slog(SLOG_WARN, "udev thread was already cancelled");
-        }
-        else {
-            slog(SLOG_WARN, "unknown error from pthread_cancel: %s", strerror(errno));
-        }
-    }
-    slog(SLOG_DEBUG, "join udev thread");
-    if (pthread_join(udev_tid, NULL) < 0) {
-        slog(SLOG_ERROR, "pthread_join: %s", strerror(errno));
-    }
-    udev_tid = 0;
+    evloop_remove_io(mon);
+    udev_in_evloop = false;
+    hotplug_exit();
+#ifdef USE_SCANBUTTOND
+    libusb_set_hotplug_notified(0);
+#endif
     if (udev_close() < 0) {
         slog(SLOG_ERROR, "Can't close udev");
     }
@@ -29,11 +29,15 @@
 # include <libudev.h>
 # define UDEV_ADD_ACTION "add"
 # define UDEV_REMOVE_ACTION "remove"
+# define UDEV_SUBSYSTEM "usb"
 # define UDEV_DEVICE_TYPE "usb_device"
-# define UDEV_SLEEP_IF_NO_DEVICE 1000
+// the usb ids of the scanners the monitor knows (further events are ignored)
+# define UDEV_MAX_IDS 64
 
 extern void udev_start_udev_thread(void);
 extern void udev_stop_udev_thread(void);
+// the config was reread (SIGHUP)
+extern void udev_reload(void);
 
 #endif
 #endif // UDEV_H
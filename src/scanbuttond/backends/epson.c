@@ -160,6 +160,12 @@ const char* scanbtnd_get_backend_name(void)
 }
 
 
+int scanbtnd_match_device(libusb_device_t* device)
+{
+	return epson_match_libusb_scanner(device) >= 0;
+}
+
+
 int scanbtnd_init(void)
 {
 	epson_scanners = NULL;
@@ -137,6 +137,12 @@ const char* scanbtnd_get_backend_name(void)
 }
 
 
+int scanbtnd_match_device(libusb_device_t* device)
+{
+   return genesys_match_libusb_scanner(device) >= 0;
+}
+
+
 int scanbtnd_init(void)
 {
    genesys_scanners = NULL;
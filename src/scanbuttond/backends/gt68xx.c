@@ -127,6 +127,12 @@ const char* scanbtnd_get_backend_name(void)
 }
 
 
+int scanbtnd_match_device(libusb_device_t* device)
+{
+	return gt68xx_match_libusb_scanner(device) >= 0;
+}
+
+
 int scanbtnd_init(void)
 {
 	gt68xx_scanners = NULL;
@@ -155,6 +155,13 @@ scanbtnd_get_backend_name (void)
        return backend_name;
 }
 
+
+int
+scanbtnd_match_device (libusb_device_t* device)
+{
+       return hp5590_match_libusb_scanner (device) >= 0;
+}
+
 int
 scanbtnd_init (void)
 {
@@ -530,16 +537,25 @@ hp5590_cmd (scanner_t *scanner, unsigned int flags,
        return ret;
 }
 
-int
-scanbtnd_get_button(scanner_t* scanner)
+/* The button flags in the order of the button numbers */
+static const u_int16_t button_flags[] = {
+       BUTTON_FLAG_SCAN,
+       BUTTON_FLAG_COLLECT,
+       BUTTON_FLAG_FILE,
+       BUTTON_FLAG_EMAIL,
+       BUTTON_FLAG_COPY
+};
+
+#define NUM_BUTTON_FLAGS (int) (sizeof (button_flags) / sizeof (button_flags[0]))
+
+/* One query returns the flags of all buttons, a failed query reports no
+ * button pressed (like the button read of the other backends) */
+static u_int16_t
+hp5590_get_button_status (scanner_t* scanner)
 {
-       int             button = 0;
        u_int16_t       button_status;
        int                     ret;
 
-       if (!scanner->is_open)
-               return -EINVAL;
-       
        ret = hp5590_cmd (scanner, CMD_IN | CMD_VERIFY,
                                          CMD_BUTTON_STATUS,
                                          (unsigned char *) &button_status,
@@ -550,26 +566,52 @@ scanbtnd_get_button(scanner_t* scanner)
        }
 
        /* Network order */
-       button_status = ntohs (button_status);
-
-       if (button_status & BUTTON_FLAG_SCAN)
-               button = 1;
+       return ntohs (button_status);
+}
 
-       if (button_status & BUTTON_FLAG_COLLECT)
-               button = 2;
+int
+scanbtnd_get_button(scanner_t* scanner)
+{
+       int             button = 0;
+       u_int16_t       button_status;
+       int                     i;
 
-       if (button_status & BUTTON_FLAG_FILE)
-               button = 3;
+       if (!scanner->is_open)
+               return -EINVAL;
 
-       if (button_status & BUTTON_FLAG_EMAIL)
-               button = 4;
+       button_status = hp5590_get_button_status (scanner);
 
-       if (button_status & BUTTON_FLAG_COPY)
-               button = 5;
+       /* The highest pressed button wins */
+       for (i = 0; i < NUM_BUTTON_FLAGS; i++)
+               if (button_status & button_flags[i])
+                       button = i + 1;
 
        return button;
 }
 
+int
+scanbtnd_get_buttons(scanner_t* scanner, int* buttons, int num_buttons)
+{
+       u_int16_t       button_status;
+       int                     pressed = 0;
+       int                     i;
+
+       if (!scanner->is_open)
+               return -EINVAL;
+
+       for (i = 0; i < num_buttons; i++)
+               buttons[i] = 0;
+
+       button_status = hp5590_get_button_status (scanner);
+       for (i = 0; i < NUM_BUTTON_FLAGS && i < num_buttons; i++) {
+               if (button_status & button_flags[i]) {
+                       buttons[i] = 1;
+                       pressed++;
+               }
+       }
+       return pressed;
+}
+
 const char*
 scanbtnd_get_sane_device_descriptor (scanner_t* scanner)
 {
@@ -0,0 +1,41 @@
+#!/bin/sh
+# $Id$
+#
+#  scanbd - KMUX scanner button daemon
+#
+#  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+#
+
+# writes the index of the usb vendor/product ids supported by the
+# backends (usage: meta-index.sh srcdir backend...) to stdout, the meta
+# backend only loads a backend of meta.conf listed in the index if one
+# of its devices is present
+
+srcdir="$1"
+shift
+
+echo "# generated by meta-index.sh: vendor product backend"
+for backend in "$@"; do
+    awk -v backend="$backend" '
+        /supported_usb_devices\[.*=/ { table = 1 }
+        table && /^[ \t]*\{[ \t]*0x/ {
+            gsub(/[{},]/, " ")
+            printf "%s %s %s\n", tolower($1), tolower($2), backend
+        }
+        table && /^[ \t]*};/ { table = 0 }
+    ' "$srcdir/$backend.c"
+done | sort -u
@@ -31,13 +31,31 @@
 #define MAX_CONFIG_LINE 255
 #define MAX_SCANNERS_PER_BACKEND 16
 #define CONFIG_FILE "meta.conf"
+#define INDEX_FILE "meta.idx"
+
+// an entry of the usb id index generated by meta-index.sh
+typedef struct meta_index {
+	int vendorID;
+	int productID;
+	char* backend;
+	struct meta_index* next;
+} meta_index_t;
+
+// a backend of meta.conf not loaded until one of its devices appears
+typedef struct meta_pending {
+	char* backend;
+	struct meta_pending* next;
+} meta_pending_t;
 
 static char* backend_name = "Dynamic Module Loader";
 static char config_file[PATH_MAX] = "(null)";
+static char index_file[PATH_MAX] = "(null)";
 
 static libusb_handle_t* libusb_handle;
 static scanner_t* meta_scanners = NULL;
 static backend_t* meta_backends = NULL;
+static meta_index_t* meta_index = NULL;
+static meta_pending_t* meta_pending = NULL;
 
 
 const char* scanbtnd_get_backend_name(void)
@@ -74,6 +92,16 @@ static char *get_config_file(void)
 	return config_file;
 }
 
+static char *get_index_file(void)
+{
+#ifdef HAVE_SCANBTND_GET_LIB_DIR
+	snprintf(index_file, PATH_MAX, "%s/%s", scanbtnd_get_lib_dir(), INDEX_FILE);
+#else
+	snprintf(index_file, PATH_MAX, "%s/%s", SCANBUTTOND_LIB_DIR, INDEX_FILE);
+#endif
+	return index_file;
+}
+
 void meta_attach_scanners(scanner_t* devices, backend_t* backend)
 {
 	scanner_t* dev = devices;
@@ -113,6 +141,37 @@ void meta_detach_scanners(void)
 }
 
 
+// returns 1 if the backend may drive one of the usb devices found by
+// the single enumeration of the meta backend (or can't tell)
+int meta_probe_backend(backend_t* backend)
+{
+	if (backend->scanbtnd_match_device == NULL) return 1;
+	libusb_device_t* device = libusb_get_devices(libusb_handle);
+	while (device != NULL) {
+		if (backend->scanbtnd_match_device(device)) return 1;
+		device = device->next;
+	}
+	return 0;
+}
+
+
+// initializes the backend if it has a device: backends without one
+// are initialized at a later rescan
+// returns 1 if the backend is initialized
+int meta_init_backend(backend_t* backend)
+{
+	if (backend->initialized) return 1;
+	if (!meta_probe_backend(backend)) {
+		syslog(LOG_INFO, "meta-backend: no device for backend %s",
+			   backend->scanbtnd_get_backend_name());
+		return 0;
+	}
+	backend->scanbtnd_init();
+	backend->initialized = 1;
+	return 1;
+}
+
+
 int meta_attach_backend(backend_t* backend)
 {
 	// don't load another meta backend
@@ -124,7 +183,7 @@ int meta_attach_backend(backend_t* backend)
 		   backend->scanbtnd_get_backend_name());
 	backend->next = meta_backends;
 	meta_backends = backend;
-	backend->scanbtnd_init();
+	backend->initialized = 0;
 	return 0;
 }
 
@@ -137,7 +196,8 @@ void meta_detach_backend(backend_t* backend, backend_t* prev_backend)
 		meta_backends = backend->next;
 	else
 		syslog(LOG_WARNING, "meta-backend: detach backend: invalid arguments!");
-	backend->scanbtnd_exit();
+	if (backend->initialized)
+		backend->scanbtnd_exit();
 	scanbtnd_unload_backend(backend);
 }
 
@@ -165,11 +225,139 @@ void meta_strip_newline(char* str)
 }
 
 
+// without the index all backends of meta.conf are loaded
+void meta_load_index(void)
+{
+	char line[MAX_CONFIG_LINE];
+	char name[MAX_CONFIG_LINE];
+	int vendorID, productID;
+	FILE* f = fopen(get_index_file(), "r");
+	if (f == NULL) {
+		syslog(LOG_INFO, "meta-backend: no index \"%s\", loading all backends",
+			   get_index_file());
+		return;
+	}
+	while (fgets(line, MAX_CONFIG_LINE, f)) {
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%x %x %254s", &vendorID, &productID, name) != 3) continue;
+		meta_index_t* entry = (meta_index_t*)malloc(sizeof(meta_index_t));
+		entry->vendorID = vendorID;
+		entry->productID = productID;
+		entry->backend = strdup(name);
+		entry->next = meta_index;
+		meta_index = entry;
+	}
+	fclose(f);
+}
+
+
+void meta_free_index(void)
+{
+	while (meta_index != NULL) {
+		meta_index_t* next = meta_index->next;
+		free(meta_index->backend);
+		free(meta_index);
+		meta_index = next;
+	}
+}
+
+
+// returns 1 if the backend is listed in the index
+int meta_indexed(const char* lib)
+{
+	meta_index_t* entry = meta_index;
+	while (entry != NULL) {
+		if (strcmp(entry->backend, lib) == 0) return 1;
+		entry = entry->next;
+	}
+	return 0;
+}
+
+
+// returns 1 if one of the usb devices is listed for the backend
+int meta_index_match(const char* lib)
+{
+	libusb_device_t* device = libusb_get_devices(libusb_handle);
+	while (device != NULL) {
+		meta_index_t* entry = meta_index;
+		while (entry != NULL) {
+			if (entry->vendorID == device->vendorID &&
+				entry->productID == device->productID &&
+				strcmp(entry->backend, lib) == 0)
+				return 1;
+			entry = entry->next;
+		}
+		device = device->next;
+	}
+	return 0;
+}
+
+
+void meta_defer_backend(const char* lib)
+{
+	syslog(LOG_INFO, "meta-backend: no device for '%s', not loaded", lib);
+	meta_pending_t* pending = (meta_pending_t*)malloc(sizeof(meta_pending_t));
+	pending->backend = strdup(lib);
+	pending->next = meta_pending;
+	meta_pending = pending;
+}
+
+
+void meta_free_pending(void)
+{
+	while (meta_pending != NULL) {
+		meta_pending_t* next = meta_pending->next;
+		free(meta_pending->backend);
+		free(meta_pending);
+		meta_pending = next;
+	}
+}
+
+
+void meta_load_backend(const char* lib)
+{
+	backend_t* backend = scanbtnd_load_backend(lib);
+	if (backend == NULL) {
+		syslog(LOG_ERR, "meta-backend: could not load '%s'", lib);
+	} else if (meta_attach_backend(backend)==0 &&
+			   meta_init_backend(backend)) {
+		meta_attach_scanners(
+			backend->scanbtnd_get_supported_devices(),
+			backend);
+	}
+}
+
+
+// loads the pending backends whose devices have appeared
+void meta_load_pending(void)
+{
+	meta_pending_t* pending = meta_pending;
+	meta_pending_t* prev = NULL;
+	while (pending != NULL) {
+		meta_pending_t* next = pending->next;
+		if (meta_index_match(pending->backend)) {
+			if (prev != NULL)
+				prev->next = next;
+			else
+				meta_pending = next;
+			meta_load_backend(pending->backend);
+			free(pending->backend);
+			free(pending);
+		} else {
+			prev = pending;
+		}
+		pending = next;
+	}
+}
+
+
 int scanbtnd_init(void)
 {
 	int error;
 	meta_scanners = NULL;
 	meta_backends = NULL;
+	meta_index = NULL;
+	meta_pending = NULL;
 
 	syslog(LOG_INFO, "meta-backend: init");
 	error = scanbtnd_loader_init();
@@ -177,20 +365,26 @@ int scanbtnd_init(void)
 		syslog(LOG_ERR, "meta-backend: could not init module loader!");
 		return error;
 	}
+	// the busses are enumerated once here, the backends only get
+	// initialized for their devices and share this enumeration
+	libusb_probe_begin();
 	libusb_handle = libusb_init();
 	if (!libusb_handle) {
 		syslog(LOG_ERR, "meta-backend: could not init libusb!");
+		libusb_probe_end();
 		scanbtnd_loader_exit();
 		return 1;
 	}
 
+	meta_load_index();
+
 	// read config file
 	char lib[MAX_CONFIG_LINE];
-	backend_t* backend;
 	FILE* f = fopen(get_config_file(), "r");
 	if (f == NULL) {
 		syslog(LOG_ERR, "meta-backend: config file \"%s\" not found.",
 			   get_config_file());
+		libusb_probe_end();
 		return -1;
 	}
 	while (fgets(lib, MAX_CONFIG_LINE, f)) {
@@ -204,16 +398,14 @@ int scanbtnd_init(void)
 		backend = load_backend(libpath);
 		free(libpath);
 		*/
-		backend = scanbtnd_load_backend(lib);
-		if (backend == NULL) {
-			syslog(LOG_ERR, "meta-backend: could not load '%s'", lib);
-		} else if (meta_attach_backend(backend)==0) {
-			meta_attach_scanners(
-				backend->scanbtnd_get_supported_devices(),
-				backend);
-		}
+		// the backends of the index are only loaded for their devices
+		if (meta_indexed(lib) && !meta_index_match(lib))
+			meta_defer_backend(lib);
+		else
+			meta_load_backend(lib);
 	}
 	fclose(f);
+	libusb_probe_end();
 
 	return 0;
 }
@@ -226,18 +418,56 @@ int scanbtnd_rescan(void)
 	meta_detach_scanners();
 	meta_scanners = NULL;
 
+	libusb_probe_begin();
+	libusb_rescan(libusb_handle);
 	backend = meta_backends;
 	while (backend != NULL) {
-		backend->scanbtnd_rescan();
+		if (backend->initialized) {
+			backend->scanbtnd_rescan();
+		} else if (!meta_init_backend(backend)) {
+			// still no device for it
+			backend = backend->next;
+			continue;
+		}
 		meta_attach_scanners(backend->scanbtnd_get_supported_devices(),
 							 backend);
 		backend = backend->next;
 	}
+	meta_load_pending();
+	libusb_probe_end();
 
 	return 0;
 }
 
 
+// a device is supported by a loaded backend (backends without
+// scanbtnd_match_device() may support any device) or, by the index, by
+// a pending one
+int scanbtnd_match_device(libusb_device_t* device)
+{
+	backend_t* backend = meta_backends;
+	while (backend != NULL) {
+		if (backend->scanbtnd_match_device == NULL ||
+			backend->scanbtnd_match_device(device))
+			return 1;
+		backend = backend->next;
+	}
+	meta_pending_t* pending = meta_pending;
+	while (pending != NULL) {
+		meta_index_t* entry = meta_index;
+		while (entry != NULL) {
+			if (entry->vendorID == device->vendorID &&
+				entry->productID == device->productID &&
+				strcmp(entry->backend, pending->backend) == 0)
+				return 1;
+			entry = entry->next;
+		}
+		pending = pending->next;
+	}
+	return 0;
+}
+
+
 const scanner_t* scanbtnd_get_supported_devices(void)
 {
 	return meta_scanners;
@@ -273,6 +503,15 @@ int scanbtnd_get_button(scanner_t* scanner)
 }
 
 
+int scanbtnd_get_buttons(scanner_t* scanner, int* buttons, int num_buttons)
+{
+	backend_t* backend = meta_lookup_backend(scanner);
+	if (backend == NULL) return -ENODEV;
+	if (backend->scanbtnd_get_buttons == NULL) return -ENOSYS;
+	return backend->scanbtnd_get_buttons(scanner, buttons, num_buttons);
+}
+
+
 const char* scanbtnd_get_sane_device_descriptor(scanner_t* scanner)
 {
 	backend_t* backend = meta_lookup_backend(scanner);
@@ -286,6 +525,8 @@ int scanbtnd_exit(void)
 	syslog(LOG_INFO, "meta-backend: exit");
 	meta_detach_scanners();
 	meta_detach_backends();
+	meta_free_pending();
+	meta_free_index();
 	libusb_exit(libusb_handle);
 	scanbtnd_loader_exit();
 	return 0;
@@ -21,6 +21,8 @@
 
 #include "scanbuttond/scanbuttond.h"
 
+struct libusb_device;
+
 /**
  * \file backend.h
  * \brief Backend function specification.
@@ -98,6 +100,31 @@ int scanbtnd_close(scanner_t* scanner);
  */
 int scanbtnd_get_button(scanner_t* scanner);
 
+/**
+ * Queries the status of all buttons of the scanner in one round trip.
+ * This function is optional: backends whose hardware reports all buttons at
+ * once should provide it, so that simultaneous presses are not lost.
+ * \param scanner the scanner device
+ * \param buttons receives the button states: buttons[n-1] is non-zero if button
+ *        n is currently pressed
+ * \param num_buttons the number of elements of buttons
+ * \return the number of currently pressed buttons, or <0 if there was an error.
+ * \retval -EINVAL if the scanner device has not been opened before
+ * \retval -ENOSYS if the backend can only report a single button (use
+ *         scanbtnd_get_button() then)
+ */
+int scanbtnd_get_buttons(scanner_t* scanner, int* buttons, int num_buttons);
+
+/**
+ * Checks if a usb device is driven by this backend.
+ * This function is optional: the meta backend enumerates the usb busses once
+ * and initializes only the backends with a matching device (the others at a
+ * later rescan, when a matching device has been plugged in).
+ * \param device the usb device (see libusbi.h)
+ * \return non-zero if the backend supports the vendor and product id of device
+ */
+int scanbtnd_match_device(struct libusb_device* device);
+
 /**
  * Gets the SANE device name of this scanner.
  * The returned string should look like "epson:libusb:003:017".
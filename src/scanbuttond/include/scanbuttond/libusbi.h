@@ -40,6 +40,7 @@ struct libusb_device {
 	int interface;
 	int out_endpoint;
 	int in_endpoint;
+	int intr_endpoint; // interrupt in endpoint, 0 if there is none
 	libusb_device_t* next;
 };
 
@@ -48,18 +49,62 @@ typedef struct libusb_handle libusb_handle_t;
 
 struct libusb_handle {
 	libusb_device_t* devices;
-	// rescanning info, timestamps???
+	unsigned long generation; // the topology generation of devices
 };
 
+// a transport replaces the usb calls of libusbi, e.g. the fake
+// transport of the benchmarks (src/test/fake_usb.c). rescan() adds
+// the present devices to the (emptied) device list of the handle
+// (nodes and locations allocated with malloc, libusbi frees them),
+// changed() returns the number of changes like usb_find_devices(),
+// the other functions are called by their libusb_* counterparts
+struct libusb_transport;
+typedef struct libusb_transport libusb_transport_t;
+
+struct libusb_transport {
+	void (*rescan)(libusb_handle_t* handle);
+	int (*changed)(void);
+	int (*open)(libusb_device_t* device);
+	int (*close)(libusb_device_t* device);
+	int (*read)(libusb_device_t* device, void* buffer, int bytecount);
+	int (*write)(libusb_device_t* device, void* buffer, int bytecount);
+	int (*interrupt_read)(libusb_device_t* device, void* buffer, int bytecount, int timeout);
+	void (*flush)(libusb_device_t* device);
+	int (*control_msg)(libusb_device_t* device, int requesttype,
+					   int request, int value, int index, void* bytes, int size);
+};
+
+// installs the transport (NULL: the usb busses), before libusb_init()
+void libusb_set_transport(const libusb_transport_t* transport);
+
 libusb_handle_t* libusb_init(void);
 
 // GLOBAL number of changed devices (does not require a handle!)
+// rescans all busses, in hotplug notified mode only after a
+// libusb_bus_changed() (otherwise 0 is returned)
 int libusb_get_changed_device_count(void);
 
+// enables (1) or disables (0) the hotplug notified mode: the caller
+// gets hotplug events (e.g. udev) and reports them with
+// libusb_bus_changed(), which bumps the topology generation
+void libusb_set_hotplug_notified(int enabled);
+
+void libusb_bus_changed(void);
+
+// updates the device list of the handle: the nodes of devices still
+// present are kept, in hotplug notified mode the busses are only
+// rescanned if the topology generation changed
 void libusb_rescan(libusb_handle_t* handle);
 
 libusb_device_t* libusb_get_devices(libusb_handle_t* handle);
 
+// a probe session (the meta backend initializing or rescanning all
+// backends): the busses are enumerated at most once, the handles
+// rescanned within the session share this enumeration
+void libusb_probe_begin(void);
+
+void libusb_probe_end(void);
+
 // returns 0 on success, -EBUSY if the scanner is currently in use,
 // or -ENODEV if the scanner does no longer exist
 int libusb_open(libusb_device_t* device);
@@ -70,6 +115,11 @@ int libusb_read(libusb_device_t* device, void* buffer, int bytecount);
 
 int libusb_write(libusb_device_t* device, void* buffer, int bytecount);
 
+// waits up to timeout ms for an event on the interrupt endpoint:
+// returns the number of bytes read, 0 if there was no event, -ENOSYS
+// if the device has no interrupt endpoint or <0 on other errors
+int libusb_interrupt_read(libusb_device_t* device, void* buffer, int bytecount, int timeout);
+
 // flush bulk read queue
 void libusb_flush(libusb_device_t* device);
 
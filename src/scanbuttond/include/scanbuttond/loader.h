@@ -28,6 +28,8 @@
 struct backend;
 typedef struct backend backend_t;
 
+struct libusb_device;
+
 struct backend {
 	char* (*scanbtnd_get_backend_name)(void);
 	int (*scanbtnd_init)(void);
@@ -38,6 +40,9 @@ struct backend {
 	int (*scanbtnd_get_button)(scanner_t* scanner);
 	char* (*scanbtnd_get_sane_device_descriptor)(scanner_t* scanner);
 	int (*scanbtnd_exit)(void);
+	int (*scanbtnd_get_buttons)(scanner_t* scanner, int* buttons, int num_buttons); // optional, may be NULL
+	int (*scanbtnd_match_device)(struct libusb_device* device); // optional, may be NULL
+	int initialized; // meta: scanbtnd_init() of the backend has been called
 	void* handle;  // handle for dlopen/dlsym/dlclose
 
 	backend_t* next;
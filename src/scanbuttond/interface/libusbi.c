@@ -35,6 +35,24 @@
 
 int invocation_count = 0;
 
+// the generation of the usb topology, bumped by libusb_bus_changed():
+// in hotplug notified mode the busses are only rescanned if it changed
+static volatile int hotplug_notified = 0;
+static volatile unsigned long bus_generation = 1;
+// the generation seen by libusb_get_changed_device_count()
+static unsigned long counted_generation = 0;
+// in a probe session the first rescan enumerates the busses
+static int probing = 0;
+static int probe_scanned = 0;
+// the transport replacing the usb calls, NULL if none
+static const libusb_transport_t* transport = NULL;
+
+
+void libusb_set_transport(const libusb_transport_t* t)
+{
+	transport = t;
+}
+
 
 libusb_handle_t* libusb_init(void)
 {
@@ -42,10 +60,12 @@ libusb_handle_t* libusb_init(void)
 	invocation_count++;
 	if (invocation_count == 1) {
 		syslog(LOG_INFO, "libusbi: initializing...");
-		usb_init();
+		if (!transport)
+			usb_init();
 	}
 	handle = (libusb_handle_t*)malloc(sizeof(libusb_handle_t));
 	handle->devices = NULL;
+	handle->generation = 0;
 	libusb_rescan(handle);
 	return handle;
 }
@@ -142,17 +162,76 @@ static int libusb_search_out_endpoint(struct usb_device* device)
 }
 
 
-static void libusb_attach_device(struct usb_device* device, libusb_handle_t* handle)
+// returns the interrupt in endpoint or 0 if the device has none
+// (some scanners report their buttons there)
+static int libusb_search_intr_endpoint(struct usb_device* device)
 {
-	libusb_device_t* libusb_device = (libusb_device_t*)malloc(sizeof(libusb_device_t));
-	libusb_device->vendorID = device->descriptor.idVendor;
-	libusb_device->productID = device->descriptor.idProduct;
+	struct usb_interface_descriptor *interface;
+	interface = &device->config[0].interface->altsetting[0];
+
+	int num;
+	for (num = 0; num < interface->bNumEndpoints; num++) {
+		struct usb_endpoint_descriptor *endpoint;
+		int direction, transfer_type;
+
+		endpoint = &interface->endpoint[num];
+		direction = endpoint->bEndpointAddress & USB_ENDPOINT_DIR_MASK;
+		transfer_type = endpoint->bmAttributes & USB_ENDPOINT_TYPE_MASK;
+
+		if (transfer_type == USB_ENDPOINT_TYPE_INTERRUPT && direction)
+			return endpoint->bEndpointAddress;
+	}
+	return 0;
+}
+
+
+// removes the cached node of device from the list cached: the
+// node must have the same location and ids, NULL if there is none
+static libusb_device_t* libusb_take_cached(libusb_device_t** cached,
+										   struct usb_device* device, const char* location)
+{
+	libusb_device_t** prev = cached;
+	while (*prev != NULL) {
+		libusb_device_t* libusb_device = *prev;
+		if (strcmp(libusb_device->location, location) == 0 &&
+			libusb_device->vendorID == device->descriptor.idVendor &&
+			libusb_device->productID == device->descriptor.idProduct) {
+			*prev = libusb_device->next;
+			libusb_device->next = NULL;
+			return libusb_device;
+		}
+		prev = &libusb_device->next;
+	}
+	return NULL;
+}
+
+
+static void libusb_attach_device(struct usb_device* device, libusb_handle_t* handle,
+								 libusb_device_t** cached)
+{
+	libusb_device_t* libusb_device;
+	char* location;
 
 	// the location string consists of bus number, followed by a colon (":"), and the device number
-	libusb_device->location = (char*)malloc(strlen(device->bus->dirname) + strlen(device->filename) + 2);
-	strcpy(libusb_device->location, device->bus->dirname);
-	strcat(libusb_device->location, ":");
-	strcat(libusb_device->location, device->filename);
+	location = (char*)malloc(strlen(device->bus->dirname) + strlen(device->filename) + 2);
+	strcpy(location, device->bus->dirname);
+	strcat(location, ":");
+	strcat(location, device->filename);
+
+	libusb_device = libusb_take_cached(cached, device, location);
+	if (libusb_device != NULL) {
+		// still present: interface and endpoints are known already
+		free(location);
+		libusb_device->device = device;
+		libusb_device->next = handle->devices;
+		handle->devices = libusb_device;
+		return;
+	}
+
+	libusb_device = (libusb_device_t*)malloc(sizeof(libusb_device_t));
+	libusb_device->vendorID = device->descriptor.idVendor;
+	libusb_device->productID = device->descriptor.idProduct;
+	libusb_device->location = location;
 
 	libusb_device->device = device;
 	libusb_device->handle = NULL;
@@ -174,64 +253,126 @@ static void libusb_attach_device(struct usb_device* device, libusb_handle_t* han
 		free(libusb_device);
 		return;
 	}
+	libusb_device->intr_endpoint = libusb_search_intr_endpoint(device);
 	libusb_device->next = handle->devices;
 	handle->devices = libusb_device;
 }
 
 
-static void libusb_detach_devices(libusb_handle_t* handle)
+static void libusb_free_devices(libusb_device_t* devices)
 {
 	libusb_device_t* next;
-	while (handle->devices != NULL) {
-		next = handle->devices->next;
-		free(handle->devices->location);
-		free(handle->devices);
-		handle->devices = next;
+	while (devices != NULL) {
+		next = devices->next;
+		free(devices->location);
+		free(devices);
+		devices = next;
 	}
 }
 
 
+static void libusb_detach_devices(libusb_handle_t* handle)
+{
+	libusb_free_devices(handle->devices);
+	handle->devices = NULL;
+}
+
+
 void libusb_rescan(libusb_handle_t* handle)
 {
 	struct usb_bus *bus;
 	struct usb_device *device;
+	libusb_device_t* cached;
+	unsigned long generation = bus_generation;
 
-	libusb_detach_devices(handle);
+	if (hotplug_notified && handle->generation == generation) {
+		// no hotplug event since the last scan
+		return;
+	}
+	handle->generation = generation;
 
-	usb_find_busses();
-	usb_find_devices();
+	if (transport) {
+		libusb_detach_devices(handle);
+		transport->rescan(handle);
+		return;
+	}
+
+	if (!probing || !probe_scanned) {
+		usb_find_busses();
+		usb_find_devices();
+		probe_scanned = probing;
+	}
+
+	// the nodes of the devices still present are reused, the
+	// remaining ones belong to removed devices
+	cached = handle->devices;
 	handle->devices = NULL;
 
 	bus = usb_busses;
 	while (bus != NULL) {
 		device = bus->devices;
 		while (device != NULL) {
-			libusb_attach_device(device, handle);
+			libusb_attach_device(device, handle, &cached);
 			device = device->next;
 		}
 		bus = bus->next;
 	}
-
+	libusb_free_devices(cached);
 }
 
 
 int libusb_get_changed_device_count(void)
 {
+	unsigned long generation = bus_generation;
+	if (hotplug_notified && counted_generation == generation)
+		return 0;
+	counted_generation = generation;
+	if (transport)
+		return transport->changed();
 	usb_find_busses();
 	return usb_find_devices();
 }
 
 
+void libusb_set_hotplug_notified(int enabled)
+{
+	hotplug_notified = enabled;
+	bus_generation++;
+}
+
+
+void libusb_bus_changed(void)
+{
+	bus_generation++;
+}
+
+
 libusb_device_t* libusb_get_devices(libusb_handle_t* handle)
 {
 	return handle->devices;
 }
 
 
+void libusb_probe_begin(void)
+{
+	probing = 1;
+	probe_scanned = 0;
+}
+
+
+void libusb_probe_end(void)
+{
+	probing = 0;
+	probe_scanned = 0;
+}
+
+
 int libusb_open(libusb_device_t* device)
 {
 	int result;
 
+	if (transport && device)
+		return transport->open(device);
 	if (!device || !device->device)
 		return -ENODEV;
 
@@ -274,6 +415,8 @@ int libusb_open(libusb_device_t* device)
 int libusb_close(libusb_device_t* device)
 {
 	int result;
+	if (transport)
+		return transport->close(device);
 	result = usb_release_interface(device->handle, device->interface);
 	if (result < 0) {
 		syslog(LOG_ERR, "libusbi: could not release interface, error code=%d, device=%s",
@@ -292,6 +435,8 @@ int libusb_close(libusb_device_t* device)
 
 int libusb_read(libusb_device_t* device, void* buffer, int bytecount)
 {
+	if (transport)
+		return transport->read(device, buffer, bytecount);
 	int num_bytes = usb_bulk_read(device->handle, device->in_endpoint,
 								  buffer, bytecount, TIMEOUT);
 	if (num_bytes<0) {
@@ -304,6 +449,8 @@ int libusb_read(libusb_device_t* device, void* buffer, int bytecount)
 
 int libusb_write(libusb_device_t* device, void* buffer, int bytecount)
 {
+	if (transport)
+		return transport->write(device, buffer, bytecount);
 	int num_bytes = usb_bulk_write(device->handle, device->out_endpoint,
 								   buffer, bytecount, TIMEOUT);
 	if (num_bytes<0) {
@@ -314,9 +461,31 @@ int libusb_write(libusb_device_t* device, void* buffer, int bytecount)
 }
 
 
+int libusb_interrupt_read(libusb_device_t* device, void* buffer, int bytecount, int timeout)
+{
+	if (transport)
+		return transport->interrupt_read(device, buffer, bytecount, timeout);
+	if (!device->intr_endpoint)
+		return -ENOSYS;
+	int num_bytes = usb_interrupt_read(device->handle, device->intr_endpoint,
+									   buffer, bytecount, timeout);
+	if (num_bytes<0) {
+		// no event within timeout is the normal case
+		if (num_bytes == -ETIMEDOUT)
+			return 0;
+		usb_clear_halt(device->handle, device->intr_endpoint);
+	}
+	return num_bytes;
+}
+
+
 void libusb_flush(libusb_device_t* device)
 {
 	char buffer[16];
+	if (transport) {
+		transport->flush(device);
+		return;
+	}
 	while (usb_bulk_read(device->handle, device->in_endpoint, buffer, 16, 500) > 0) {};
 }
 
@@ -324,6 +493,8 @@ void libusb_flush(libusb_device_t* device)
 int libusb_control_msg(libusb_device_t* device, int requesttype, int request,
 					   int value, int index, void* bytes, int size)
 {
+	if (transport)
+		return transport->control_msg(device, requesttype, request, value, index, bytes, size);
 	int num_bytes = usb_control_msg(device->handle, requesttype, request, value,
 									index, bytes, size, TIMEOUT);
 	if (num_bytes<0) {
@@ -0,0 +1,354 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+// the hotplug storm benchmark: replays a recorded sequence of udev
+// events (the output of "udevadm monitor --udev --subsystem-match=usb",
+// see hotplug/*.log) against the pollers of scanbd and the mock SANE
+// backend (see mock_sane.h) and measures the time until the pollers of
+// all present devices poll again after the last event. The events are
+// coalesced like the udev monitor of scanbd does (see hotplug.h), -S 0
+// applies every event at once, -F restarts all pollers per update
+// (stop, SANE_REINIT_TIMEOUT, start: the scanbuttond path).
+// The usb devices of the recording are the scanners, except the hubs
+// (the devices with children), every usb device event is applied.
+//
+// bench_hotplug [-S settle-ms] [-F] [-d discovery-ms] [-l latency-us]
+//               [-p timeout-ms] [-w poll-workers] [-x speed] [-T timeout-s]
+//               recording
+
+#include "scanbd.h"
+#include "hotplug.h"
+#include "evloop.h"
+#include "stats.h"
+#include "mock_sane.h"
+
+#define BENCH_MAX_EVENTS 4096
+#define BENCH_MAX_DEVICES 128
+
+// the symbols of scanbd.c and dbus.c used by the pollers
+cfg_t* cfg = NULL;
+
+void dbus_send_signal(const char* name, const char* arg) {
+    (void)name;
+    (void)arg;
+}
+
+void dbus_send_signal_argv(const char* name, char** argv) {
+    (void)name;
+    (void)argv;
+}
+
+struct bench_event {
+    unsigned long time;          // us since the first event
+    bool added;
+    int path;                    // the index of the usb device path
+};
+
+static struct bench_event bench_events[BENCH_MAX_EVENTS];
+static int bench_num_events = 0;
+static char* bench_paths[BENCH_MAX_DEVICES];
+static int bench_num_paths = 0;
+// the mock device of each path, -1 for hubs
+static int bench_device[BENCH_MAX_DEVICES];
+
+static bool bench_full_restart = false;
+static unsigned long bench_updates = 0;
+static unsigned long bench_update_time = 0;
+
+static int bench_path(const char* path) {
+    for(int i = 0; i < bench_num_paths; i += 1) {
+        if (strcmp(bench_paths[i], path) == 0) {
+            return i;
+        }
+    }
+    if (bench_num_paths == BENCH_MAX_DEVICES) {
+        fprintf(stderr, "too many usb devices in the recording\n");
+        exit(EXIT_FAILURE);
+    }
+    bench_paths[bench_num_paths] = strdup(path);
+    return bench_num_paths++;
+}
+
+// reads the usb device events of the recording, returns the number
+// of scanners
+static int bench_read(const char* file) {
+    FILE* f = fopen(file, "r");
+    if (f == NULL) {
+        perror(file);
+        exit(EXIT_FAILURE);
+    }
+    char line[1024];
+    double first = -1.0;
+    while(fgets(line, sizeof(line), f) != NULL) {
+        double t = 0.0;
+        char action[16];
+        char path[512];
+        char subsystem[32];
+        if (sscanf(line, "%*s [%lf] %15s %511s (%31[^)])", &t, action, path, subsystem) != 4) {
+            continue;
+        }
+        // only the usb devices (not their interfaces)
+        const char* name = strrchr(path, '/');
+        if ((strcmp(subsystem, "usb") != 0) || (name == NULL) || (strchr(name, ':') != NULL)) {
+            continue;
+        }
+        bool added = (strcmp(action, "add") == 0);
+        if (!added && (strcmp(action, "remove") != 0)) {
+            continue;
+        }
+        if (bench_num_events == BENCH_MAX_EVENTS) {
+            fprintf(stderr, "too many events in the recording\n");
+            exit(EXIT_FAILURE);
+        }
+        if (first < 0.0) {
+            first = t;
+        }
+        struct bench_event* e = &bench_events[bench_num_events++];
+        e->time = (unsigned long)((t - first) * 1e6);
+        e->added = added;
+        e->path = bench_path(path);
+    }
+    fclose(f);
+
+    // the hubs have children
+    int scanners = 0;
+    for(int i = 0; i < bench_num_paths; i += 1) {
+        size_t len = strlen(bench_paths[i]);
+        bench_device[i] = scanners;
+        for(int k = 0; k < bench_num_paths; k += 1) {
+            if ((k != i) && (strncmp(bench_paths[k], bench_paths[i], len) == 0) &&
+                (bench_paths[k][len] == '/')) {
+                bench_device[i] = -1;
+                break;
+            }
+        }
+        if (bench_device[i] >= 0) {
+            scanners += 1;
+        }
+    }
+    return scanners;
+}
+
+// writes the config of the benchmark to a temporary file, returns its name
+static char* bench_config(int timeout, int workers) {
+    static char name[] = "/tmp/scanbd-bench.XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    FILE* f = fdopen(fd, "w");
+    assert(f != NULL);
+    fprintf(f,
+            "global {\n"
+            "    debug = false\n"
+            "    debug-level = 1\n"
+            "    timeout = %d\n"
+            "    poll_workers = %d\n"
+            "    action scan {\n"
+            "        filter = \"^scan-.*\"\n"
+            "        numerical-trigger {\n"
+            "            from-value = 0\n"
+            "            to-value = 1\n"
+            "        }\n"
+            "        script = \"/bin/true\"\n"
+            "    }\n"
+            "}\n",
+            timeout, workers);
+    fclose(f);
+    return name;
+}
+
+// applies the (coalesced) events like dbus_signal_devices_changed()
+static void bench_apply(int added, int removed) {
+    (void)added;
+    (void)removed;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (bench_full_restart) {
+        stop_sane_threads();
+        sleep(SANE_REINIT_TIMEOUT);
+        get_sane_devices();
+        start_sane_threads();
+    }
+    else {
+        update_sane_threads();
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bench_updates += 1;
+    bench_update_time += (unsigned long)(now.tv_sec - start.tv_sec) * 1000000UL +
+        (unsigned long)((now.tv_nsec - start.tv_nsec) / 1000);
+}
+
+static void* bench_reactor(void* arg) {
+    (void)arg;
+    evloop_run();
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    mock_sane_config_t config = {
+        .devices = 1, .options = 16, .buttons = 1, .rate = 0.0, .press = 0, .latency = 100,
+        .discovery = 200
+    };
+    int settle = C_HOTPLUG_SETTLE_DEF;
+    int timeout = 100;
+    int workers = 0;
+    double speed = 1.0;
+    int deadline = 60;
+
+    int c;
+    while((c = getopt(argc, argv, "S:Fd:l:p:w:x:T:")) != -1) {
+        switch(c) {
+        case 'S': settle = atoi(optarg); break;
+        case 'F': bench_full_restart = true; break;
+        case 'd': config.discovery = atoi(optarg); break;
+        case 'l': config.latency = atoi(optarg); break;
+        case 'p': timeout = atoi(optarg); break;
+        case 'w': workers = atoi(optarg); break;
+        case 'x': speed = atof(optarg); break;
+        case 'T': deadline = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-S settle-ms] [-F] [-d discovery-ms] [-l latency-us] "
+                    "[-p timeout-ms] [-w poll-workers] [-x speed] [-T timeout-s] recording\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((optind != argc - 1) || (speed <= 0.0) || (deadline < 1)) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int scanners = bench_read(argv[optind]);
+    if ((bench_num_events == 0) || (scanners == 0)) {
+        fprintf(stderr, "%s: no usb device events in %s\n", argv[0], argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    slog_init("scanbd-bench");
+    config.devices = scanners;
+    mock_sane_setup(&config);
+    // a scanner whose first event is an add isn't present at the start
+    for(int i = 0; i < bench_num_paths; i += 1) {
+        if (bench_device[i] < 0) {
+            continue;
+        }
+        for(int e = 0; e < bench_num_events; e += 1) {
+            if (bench_events[e].path == i) {
+                if (bench_events[e].added) {
+                    mock_sane_plug(bench_device[i], false);
+                }
+                break;
+            }
+        }
+    }
+    char* config_file = bench_config(timeout, workers);
+    cfg_do_parse(config_file);
+    unlink(config_file);
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    debug = cfg_getbool(cfg_sec_global, C_DEBUG);
+    debug_level = cfg_getint(cfg_sec_global, C_DEBUG_LEVEL);
+
+#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+    sane_init_mutex();
+#endif
+    sane_init(NULL, NULL);
+    get_sane_devices();
+    start_sane_threads();
+
+    pthread_t reactor;
+    if (pthread_create(&reactor, NULL, bench_reactor, NULL) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    hotplug_init(settle, bench_apply);
+
+    // all pollers run before the replay
+    unsigned long now = mock_sane_now();
+    while(!mock_sane_ready(now)) {
+        usleep(1000);
+    }
+
+    // the replay: the device changes, then the events like the
+    // udev monitor reports them
+    unsigned long start = mock_sane_now();
+    for(int e = 0; e < bench_num_events; e += 1) {
+        const struct bench_event* ev = &bench_events[e];
+        unsigned long due = start + (unsigned long)(ev->time / speed);
+        now = mock_sane_now();
+        if (due > now) {
+            usleep(due - now);
+        }
+        if (bench_device[ev->path] >= 0) {
+            mock_sane_plug(bench_device[ev->path], ev->added);
+        }
+        hotplug_event(ev->added);
+    }
+    unsigned long last = mock_sane_now();
+
+    // the time until all pollers of the present devices poll again
+    bool ready = false;
+    unsigned long limit = last + (unsigned long)deadline * 1000000UL;
+    while(!(ready = mock_sane_ready(last)) && (mock_sane_now() < limit)) {
+        usleep(1000);
+    }
+    unsigned long done = mock_sane_now();
+
+    hotplug_exit();
+    stop_sane_threads();
+    sane_exit();
+
+    int present = 0;
+    for(int d = 0; d < scanners; d += 1) {
+        for(int e = bench_num_events - 1; e >= 0; e -= 1) {
+            if (bench_device[bench_events[e].path] == d) {
+                present += bench_events[e].added ? 1 : 0;
+                break;
+            }
+        }
+    }
+    printf("recording %s: %d events, %d usb devices, %d scanners (%d present at the end)\n",
+           argv[optind], bench_num_events, bench_num_paths, scanners, present);
+    printf("settle %d ms%s, discovery %d ms, latency %d us, timeout %d ms, poll workers %d, "
+           "speed %.2f\n", settle, bench_full_restart ? ", full restart" : "",
+           config.discovery, config.latency, timeout, workers, speed);
+    printf("replay %.3f s, updates %lu (%.3f s)\n",
+           (double)(last - start) / 1e6, bench_updates, (double)bench_update_time / 1e6);
+    if (ready) {
+        printf("all pollers ready %.3f s after the last event, %.3f s after the first\n",
+               (double)(done - last) / 1e6, (double)(done - start) / 1e6);
+    }
+    else {
+        printf("pollers not ready %d s after the last event\n", deadline);
+    }
+
+    char* report = stats_report();
+    if (report != NULL) {
+        fputs(report, stdout);
+        free(report);
+    }
+    return ready ? EXIT_SUCCESS : EXIT_FAILURE;
+}
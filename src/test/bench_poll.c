@@ -0,0 +1,397 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+// the benchmark of the sane polling loop: runs the pollers (threads
+// or the poll scheduler) of scanbd against the mock SANE backend (see
+// mock_sane.h) and reports the CPU time per device and second, the
+// detection latency percentiles of the presses, the allocations per
+// poll cycle and the latency statistics of scanbd (see stats.h)
+// with -I the idle devices are parked (park_idle, polled every -H ms),
+// the "wakeup" statistics count their heartbeats
+// the time of the final stop of the pollers is reported as well: with
+// a long running -s script or a large -l latency (a stuck backend) it
+// is bounded by the -S stop timeout
+// with -T a remote trigger (see sane_trigger_action()) is sent -T times
+// per second to a device, the time the call takes is reported: it
+// mustn't wait for the backend calls of the poller
+// with -L all devices but mock:0 take -L us per backend call (slow
+// network backends), with -i mock:0 is an interactive device and the
+// others are background devices (see C_PRIORITY): the poll jitter of
+// mock:0 shows if it waits for the slow devices
+// -D sets the slow lane threshold of the poll scheduler (slow_poll, 0:
+// no slow lane): with -L and -w the slow devices move to the slow lane
+// with -X the devices are polled by helper processes (poll_helper, the
+// bench runs itself as the helper): the mock counters and the press
+// latencies stay in the helpers, the scanbd statistics are reported
+//
+// bench_poll [-n devices] [-o options] [-b buttons] [-r presses/s]
+//            [-P press-ms] [-l latency-us] [-p timeout-ms] [-w poll-workers]
+//            [-k] [-s script] [-I park-idle-s] [-H heartbeat-ms]
+//            [-S stop-timeout-ms] [-T triggers/s] [-L slow-latency-us] [-i]
+//            [-D slow-poll-ms] [-X] [-W warmup-s] [-t seconds]
+
+#include "scanbd.h"
+#include "stats.h"
+#include "mock_sane.h"
+#include "poll_helper.h"
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+// the allocations are counted by interposing malloc (glibc only)
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static atomic_ulong bench_allocs;
+
+void* malloc(size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+# define BENCH_ALLOCS() atomic_load(&bench_allocs)
+#else
+# define BENCH_ALLOCS() 0UL
+#endif
+
+// the symbols of scanbd.c and dbus.c used by the pollers
+cfg_t* cfg = NULL;
+
+void dbus_send_signal(const char* name, const char* arg) {
+    (void)name;
+    (void)arg;
+}
+
+void dbus_send_signal_argv(const char* name, char** argv) {
+    (void)name;
+    (void)argv;
+}
+
+static double bench_cpu(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+        (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static unsigned long bench_percentile(const unsigned long* samples, int n, int p) {
+    if (n <= 0) {
+        return 0;
+    }
+    int i = (int)(((long)n * p) / 100);
+    if (i >= n) {
+        i = n - 1;
+    }
+    return samples[i];
+}
+
+static int bench_compare(const void* a, const void* b) {
+    unsigned long x = *(const unsigned long*)a;
+    unsigned long y = *(const unsigned long*)b;
+    return (x > y) - (x < y);
+}
+
+// the remote triggers (see -T)
+#define BENCH_TRIGGERS_MAX 100000
+
+static struct {
+    double rate;                     // triggers per second
+    int devices;                     // sent round robin to the devices
+    atomic_bool stop;
+    unsigned long samples[BENCH_TRIGGERS_MAX]; // the call times in us
+    int n;
+} bench_triggers;
+
+static void* bench_trigger(void* arg) {
+    (void)arg;
+    struct timespec wait = {
+        (time_t)(1.0 / bench_triggers.rate),
+        (long)((1.0 / bench_triggers.rate - (time_t)(1.0 / bench_triggers.rate)) * 1e9)
+    };
+    int dev = 0;
+    while(!atomic_load(&bench_triggers.stop) && (bench_triggers.n < BENCH_TRIGGERS_MAX)) {
+        struct timespec start;
+        stats_now(&start);
+        sane_trigger_action(dev, 0);
+        bench_triggers.samples[bench_triggers.n] = stats_since(&start);
+        bench_triggers.n += 1;
+        dev = (dev + 1) % bench_triggers.devices;
+        nanosleep(&wait, NULL);
+    }
+    return NULL;
+}
+
+// writes the config of the benchmark to a temporary file, returns its name
+static char* bench_config(int timeout, int workers, bool keep_open, int park_idle,
+                          int park_heartbeat, int stop_timeout, int slow_poll,
+                          bool helper, const char* script, bool interactive) {
+    static char name[] = "/tmp/scanbd-bench.XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    FILE* f = fdopen(fd, "w");
+    assert(f != NULL);
+    fprintf(f,
+            "global {\n"
+            "    debug = false\n"
+            "    debug-level = 1\n"
+            "    timeout = %d\n"
+            "    poll_workers = %d\n"
+            "    keep_open = %s\n"
+            "    park_idle = %d\n"
+            "    park_heartbeat = %d\n"
+            "    stop_timeout = %d\n"
+            "    slow_poll = %d\n"
+            "    poll_helper = %s\n"
+            "    environment {\n"
+            "        device = \"SCANBD_DEVICE\"\n"
+            "        action = \"SCANBD_ACTION\"\n"
+            "    }\n"
+            "    function function_mode {\n"
+            "        filter = \"^mode$\"\n"
+            "        env = \"SCANBD_FUNCTION_MODE\"\n"
+            "    }\n"
+            "    action scan {\n"
+            "        filter = \"^scan-.*\"\n"
+            "        numerical-trigger {\n"
+            "            from-value = 0\n"
+            "            to-value = 1\n"
+            "        }\n"
+            "        script = \"%s\"\n"
+            "    }\n"
+            "}\n",
+            timeout, workers, keep_open ? "true" : "false", park_idle, park_heartbeat,
+            stop_timeout, slow_poll, helper ? "true" : "false", script);
+    if (interactive) {
+        fprintf(f,
+                "device interactive {\n"
+                "    filter = \"^mock:0$\"\n"
+                "    priority = interactive\n"
+                "}\n"
+                "device background {\n"
+                "    filter = \"^mock:[1-9]\"\n"
+                "    priority = background\n"
+                "}\n");
+    }
+    fclose(f);
+    return name;
+}
+
+// the bench as the poll helper of a device: the mock devices of the
+// parent (see -X)
+static int bench_helper(const char* device) {
+    mock_sane_config_t config;
+    memset(&config, 0, sizeof(config));
+    const char* mock = getenv("SCANBD_BENCH_MOCK");
+    if ((mock == NULL) ||
+        (sscanf(mock, "%d %d %d %lf %d %d %d", &config.devices, &config.options,
+                &config.buttons, &config.rate, &config.press, &config.latency,
+                &config.slow_latency) != 7)) {
+        fprintf(stderr, "bench helper: no mock config\n");
+        return EXIT_FAILURE;
+    }
+    mock_sane_setup(&config);
+    return poll_helper_main(device);
+}
+
+int main(int argc, char** argv) {
+    if ((argc >= 3) && (strcmp(argv[1], "--poll-helper") == 0)) {
+        return bench_helper(argv[2]);
+    }
+    mock_sane_config_t config = {
+        .devices = 1, .options = 64, .buttons = 4, .rate = 0.2, .press = 300, .latency = 100
+    };
+    int timeout = 100;
+    int workers = 0;
+    bool keep_open = false;
+    int park_idle = 0;
+    int park_heartbeat = C_PARK_HEARTBEAT_DEF;
+    int stop_timeout = C_STOP_TIMEOUT_DEF;
+    int slow_poll = C_SLOW_POLL_DEF;
+    bool helper = false;
+    double triggers = 0.0;
+    bool interactive = false;
+    const char* script = "/bin/true";
+    int warmup = 2;
+    int seconds = 10;
+
+    int c;
+    while((c = getopt(argc, argv, "n:o:b:r:P:l:p:w:ks:I:H:S:T:L:iD:XW:t:")) != -1) {
+        switch(c) {
+        case 'n': config.devices = atoi(optarg); break;
+        case 'o': config.options = atoi(optarg); break;
+        case 'b': config.buttons = atoi(optarg); break;
+        case 'r': config.rate = atof(optarg); break;
+        case 'P': config.press = atoi(optarg); break;
+        case 'l': config.latency = atoi(optarg); break;
+        case 'p': timeout = atoi(optarg); break;
+        case 'w': workers = atoi(optarg); break;
+        case 'k': keep_open = true; break;
+        case 's': script = optarg; break;
+        case 'I': park_idle = atoi(optarg); break;
+        case 'H': park_heartbeat = atoi(optarg); break;
+        case 'S': stop_timeout = atoi(optarg); break;
+        case 'T': triggers = atof(optarg); break;
+        case 'L': config.slow_latency = atoi(optarg); break;
+        case 'i': interactive = true; break;
+        case 'D': slow_poll = atoi(optarg); break;
+        case 'X': helper = true; break;
+        case 'W': warmup = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n devices] [-o options] [-b buttons] [-r presses/s] "
+                    "[-P press-ms] [-l latency-us] [-p timeout-ms] [-w poll-workers] [-k] "
+                    "[-s script] [-I park-idle-s] [-H heartbeat-ms] [-S stop-timeout-ms] "
+                    "[-T triggers/s] [-L slow-latency-us] [-i] [-D slow-poll-ms] [-X] "
+                    "[-W warmup-s] [-t seconds]\n",
+                    argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((config.devices < 1) || (config.buttons < 1) || (seconds < 1) || (warmup < 0) ||
+        (triggers < 0.0)) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    slog_init("scanbd-bench");
+    mock_sane_setup(&config);
+    if (helper) {
+        char mock[256];
+        snprintf(mock, sizeof(mock), "%d %d %d %f %d %d %d", config.devices, config.options,
+                 config.buttons, config.rate, config.press, config.latency,
+                 config.slow_latency);
+        setenv("SCANBD_BENCH_MOCK", mock, 1);
+        poll_helper_setup(argv[0]);
+    }
+    char* config_file = bench_config(timeout, workers, keep_open, park_idle,
+                                     park_heartbeat, stop_timeout, slow_poll, helper,
+                                     script, interactive);
+    cfg_do_parse(config_file);
+    unlink(config_file);
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    debug = cfg_getbool(cfg_sec_global, C_DEBUG);
+    debug_level = cfg_getint(cfg_sec_global, C_DEBUG_LEVEL);
+
+#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+    sane_init_mutex();
+#endif
+    sane_init(NULL, NULL);
+    get_sane_devices();
+    start_sane_threads();
+
+    sleep(warmup);
+    mock_sane_reset();
+    unsigned long allocs = BENCH_ALLOCS();
+    double cpu = bench_cpu();
+    struct timespec start;
+    stats_now(&start);
+    pthread_t trigger_tid;
+    if (triggers > 0.0) {
+        bench_triggers.rate = triggers;
+        bench_triggers.devices = config.devices;
+        if (pthread_create(&trigger_tid, NULL, bench_trigger, NULL) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sleep(seconds);
+
+    if (triggers > 0.0) {
+        atomic_store(&bench_triggers.stop, true);
+        pthread_join(trigger_tid, NULL);
+    }
+
+    double elapsed = (double)stats_since(&start) / 1e6;
+    cpu = bench_cpu() - cpu;
+    allocs = BENCH_ALLOCS() - allocs;
+    mock_sane_counters_t counters;
+    mock_sane_counters(&counters);
+
+    struct timespec stop;
+    stats_now(&stop);
+    stop_sane_threads();
+    double stop_ms = (double)stats_since(&stop) / 1e3;
+    sane_exit();
+
+    const unsigned long* samples = NULL;
+    int n = mock_sane_latencies(&samples);
+
+    printf("devices %d, options %d, buttons %d, %.2f presses/s, press %d ms, "
+           "latency %d us, timeout %d ms, poll workers %d%s\n",
+           config.devices, config.options, config.buttons, config.rate, config.press,
+           config.latency, timeout, workers, keep_open ? ", keep open" : "");
+    if (config.slow_latency > 0) {
+        printf("latency of all devices but mock:0 %d us\n", config.slow_latency);
+    }
+    if (interactive) {
+        printf("mock:0 interactive, all other devices background\n");
+    }
+    if (helper) {
+        printf("polled by helper processes\n");
+    }
+    if (park_idle > 0) {
+        printf("parked after %d s idle, heartbeat %d ms\n", park_idle, park_heartbeat);
+    }
+    printf("elapsed %.2f s, cycles %lu (%.1f/s per device), backend calls %lu, opens %lu\n",
+           elapsed, counters.cycles, (double)counters.cycles / elapsed / config.devices,
+           counters.calls, counters.opens);
+    printf("cpu %.3f s: %.3f ms per device and second\n",
+           cpu, cpu * 1000.0 / elapsed / config.devices);
+    printf("allocations %lu: %.2f per cycle\n",
+           allocs, counters.cycles ? (double)allocs / counters.cycles : 0.0);
+    printf("presses %lu, detection latency us: p50 %lu, p90 %lu, p99 %lu, max %lu\n",
+           counters.presses, bench_percentile(samples, n, 50), bench_percentile(samples, n, 90),
+           bench_percentile(samples, n, 99), (n > 0) ? samples[n - 1] : 0UL);
+    if (triggers > 0.0) {
+        qsort(bench_triggers.samples, bench_triggers.n, sizeof(unsigned long), bench_compare);
+        int t = bench_triggers.n;
+        printf("remote triggers %d, call time us: p50 %lu, p90 %lu, p99 %lu, max %lu\n", t,
+               bench_percentile(bench_triggers.samples, t, 50),
+               bench_percentile(bench_triggers.samples, t, 90),
+               bench_percentile(bench_triggers.samples, t, 99),
+               (t > 0) ? bench_triggers.samples[t - 1] : 0UL);
+    }
+    printf("stop %.1f ms (stop timeout %d ms)\n", stop_ms, stop_timeout);
+
+    char* report = stats_report();
+    if (report != NULL) {
+        fputs(report, stdout);
+        free(report);
+    }
+    return EXIT_SUCCESS;
+}
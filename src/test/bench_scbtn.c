@@ -0,0 +1,307 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+
+// the benchmark of the scanbuttond polling loop: runs the pollers
+// (threads or the poll scheduler) of scanbd against the mock backend
+// (mock.so, see mock_backend.c) and the fake usb transport (see
+// fake_usb.h) and reports the CPU time per device and second, the
+// detection latency percentiles of the presses, the injected errors,
+// the reconfigurations (the SIGALRM retry of a failed open, see
+// SCANBUTTOND_ALARM_TIMEOUT) and the latency statistics of scanbd
+// (see stats.h)
+//
+// bench_scbtn [-n devices] [-b buttons] [-r presses/s] [-P press-ms]
+//             [-l latency-us] [-B busy-probability] [-U unplug-probability]
+//             [-R replug-ms] [-p timeout-ms] [-w poll-workers] [-k] [-1]
+//             [-s script] [-L backends-dir] [-W warmup-s] [-t seconds]
+//
+// The backends dir must contain meta.so, mock.so and a meta.conf
+// listing "mock" (make scbtn-backends).
+
+#include "scanbd.h"
+#include "scanbuttond_loader.h"
+#include "scanbuttond_wrapper.h"
+#include "stats.h"
+#include "fake_usb.h"
+#include <sys/resource.h>
+
+// the symbols of scanbd.c and dbus.c used by the pollers
+cfg_t* cfg = NULL;
+backend_t* backend = NULL;
+
+void dbus_send_signal(const char* name, const char* arg) {
+    (void)name;
+    (void)arg;
+}
+
+void dbus_send_signal_argv(const char* name, char** argv) {
+    (void)name;
+    (void)argv;
+}
+
+static char* connection_names[NUM_CONNECTIONS] = { "none", "libusb" };
+
+char* scanbtnd_get_connection_name(int connection) {
+    return connection_names[connection];
+}
+
+// set by SIGALRM: a poller couldn't open its device
+static volatile sig_atomic_t bench_alarm = 0;
+
+static void bench_alarm_handler(int signal) {
+    (void)signal;
+    bench_alarm = 1;
+}
+
+static double bench_cpu(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+        (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static unsigned long bench_percentile(const unsigned long* samples, int n, int p) {
+    if (n <= 0) {
+        return 0;
+    }
+    int i = (int)(((long)n * p) / 100);
+    if (i >= n) {
+        i = n - 1;
+    }
+    return samples[i];
+}
+
+// writes the config of the benchmark to a temporary file, returns its name
+static char* bench_config(int timeout, int workers, bool keep_open, const char* script,
+                          const char* backends_dir) {
+    static char name[] = "/tmp/scanbd-bench.XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    FILE* f = fdopen(fd, "w");
+    assert(f != NULL);
+    fprintf(f,
+            "global {\n"
+            "    debug = false\n"
+            "    debug-level = 1\n"
+            "    timeout = %d\n"
+            "    poll_workers = %d\n"
+            "    keep_open = %s\n"
+            "    scanbuttond_backends_dir = \"%s\"\n"
+            "    environment {\n"
+            "        device = \"SCANBD_DEVICE\"\n"
+            "        action = \"SCANBD_ACTION\"\n"
+            "    }\n"
+            "    action button {\n"
+            "        filter = \"^(scan|copy|email|pdf|stop|default)$\"\n"
+            "        numerical-trigger {\n"
+            "            from-value = 0\n"
+            "            to-value = 1\n"
+            "        }\n"
+            "        script = \"%s\"\n"
+            "    }\n"
+            "}\n",
+            timeout, workers, keep_open ? "true" : "false", backends_dir, script);
+    fclose(f);
+    return name;
+}
+
+// the SIGALRM retry of scanbd (see sig_hup_handler()): restarts the
+// pollers with a new device list, returns its duration (us)
+static unsigned long bench_reconfigure(void) {
+    struct timespec start;
+    stats_now(&start);
+    stop_scbtn_threads();
+    scbtn_shutdown();
+    if (scanbtnd_init() < 0) {
+        fprintf(stderr, "Could not initialize scanbuttond modules!\n");
+        exit(EXIT_FAILURE);
+    }
+    assert(backend);
+    get_scbtn_devices();
+    start_scbtn_threads();
+    return stats_since(&start);
+}
+
+int main(int argc, char** argv) {
+    fake_usb_config_t config = {
+        .devices = 1, .buttons = 4, .rate = 0.2, .press = 300, .latency = 100,
+        .busy = 0.0, .unplug = 0.0, .replug = 1000
+    };
+    int timeout = 100;
+    int workers = 0;
+    bool keep_open = false;
+    bool single = false;
+    const char* script = "/bin/true";
+    const char* backends_dir = "scbtn-backends";
+    int warmup = 2;
+    int seconds = 10;
+
+    int c;
+    while((c = getopt(argc, argv, "n:b:r:P:l:B:U:R:p:w:k1s:L:W:t:")) != -1) {
+        switch(c) {
+        case 'n': config.devices = atoi(optarg); break;
+        case 'b': config.buttons = atoi(optarg); break;
+        case 'r': config.rate = atof(optarg); break;
+        case 'P': config.press = atoi(optarg); break;
+        case 'l': config.latency = atoi(optarg); break;
+        case 'B': config.busy = atof(optarg); break;
+        case 'U': config.unplug = atof(optarg); break;
+        case 'R': config.replug = atoi(optarg); break;
+        case 'p': timeout = atoi(optarg); break;
+        case 'w': workers = atoi(optarg); break;
+        case 'k': keep_open = true; break;
+        case '1': single = true; break;
+        case 's': script = optarg; break;
+        case 'L': backends_dir = optarg; break;
+        case 'W': warmup = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n devices] [-b buttons] [-r presses/s] [-P press-ms] "
+                    "[-l latency-us] [-B busy-probability] [-U unplug-probability] "
+                    "[-R replug-ms] [-p timeout-ms] [-w poll-workers] [-k] [-1] "
+                    "[-s script] [-L backends-dir] [-W warmup-s] [-t seconds]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((config.devices < 1) || (config.buttons < 1) || (config.buttons > FAKE_USB_MAX_BUTTONS) ||
+        (seconds < 1) || (warmup < 0)) {
+        fprintf(stderr, "%s: invalid arguments\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    // a relative backends dir would be taken relative to SCANBD_CFG_DIR
+    char backends_path[PATH_MAX];
+    if (realpath(backends_dir, backends_path) == NULL) {
+        fprintf(stderr, "%s: %s: %s\n", argv[0], backends_dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // the settings of the mock backend
+    char buttons[16];
+    snprintf(buttons, sizeof(buttons), "%d", config.buttons);
+    setenv("SCANBD_MOCK_BUTTONS", buttons, 1);
+    if (single) {
+        setenv("SCANBD_MOCK_SINGLE_BUTTON", "1", 1);
+    }
+
+    slog_init("scanbd-bench");
+    fake_usb_setup(&config);
+    char* config_file = bench_config(timeout, workers, keep_open, script, backends_path);
+    cfg_do_parse(config_file);
+    unlink(config_file);
+    cfg_t* cfg_sec_global = cfg_getsec(cfg, C_GLOBAL);
+    assert(cfg_sec_global);
+    debug = cfg_getbool(cfg_sec_global, C_DEBUG);
+    debug_level = cfg_getint(cfg_sec_global, C_DEBUG_LEVEL);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = bench_alarm_handler;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGALRM, &sa, NULL) < 0) {
+        perror("sigaction");
+        exit(EXIT_FAILURE);
+    }
+
+#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+    scbtn_init_mutex();
+#endif
+    if (scanbtnd_init() < 0) {
+        fprintf(stderr, "Could not initialize scanbuttond modules!\n");
+        exit(EXIT_FAILURE);
+    }
+    assert(backend);
+    get_scbtn_devices();
+    start_scbtn_threads();
+    // the meta backend attaches at most MAX_SCANNERS_PER_BACKEND
+    int attached = 0;
+    for(const scanner_t* dev = backend->scanbtnd_get_supported_devices(); dev != NULL; dev = dev->next) {
+        attached += 1;
+    }
+
+    sleep(warmup);
+    fake_usb_reset();
+    double cpu = bench_cpu();
+    struct timespec start;
+    stats_now(&start);
+
+    // the main thread handles the SIGALRM retry like scanbd
+    unsigned long reconfigurations = 0;
+    unsigned long reconfigure_total = 0;
+    unsigned long reconfigure_max = 0;
+    while (stats_since(&start) < (unsigned long)seconds * 1000000UL) {
+        if (bench_alarm) {
+            bench_alarm = 0;
+            unsigned long usec = bench_reconfigure();
+            reconfigurations += 1;
+            reconfigure_total += usec;
+            if (usec > reconfigure_max) {
+                reconfigure_max = usec;
+            }
+            continue;
+        }
+        usleep(10000);
+    }
+
+    double elapsed = (double)stats_since(&start) / 1e6;
+    cpu = bench_cpu() - cpu;
+    fake_usb_counters_t counters;
+    fake_usb_counters(&counters);
+
+    alarm(0);
+    stop_scbtn_threads();
+    scbtn_shutdown();
+
+    const unsigned long* samples = NULL;
+    int n = fake_usb_latencies(&samples);
+
+    printf("devices %d, buttons %d, %.2f presses/s, press %d ms, latency %d us, "
+           "busy %.4f, unplug %.6f, replug %d ms, timeout %d ms, poll workers %d%s%s\n",
+           config.devices, config.buttons, config.rate, config.press, config.latency,
+           config.busy, config.unplug, config.replug, timeout, workers,
+           keep_open ? ", keep open" : "", single ? ", single button" : "");
+    printf("attached %d devices\n", attached);
+    printf("elapsed %.2f s, queries %lu (%.1f/s per device), transfers %lu, opens %lu, rescans %lu\n",
+           elapsed, counters.queries, (double)counters.queries / elapsed / (attached ? attached : 1),
+           counters.transfers, counters.opens, counters.rescans);
+    printf("cpu %.3f s: %.3f ms per device and second\n",
+           cpu, cpu * 1000.0 / elapsed / (attached ? attached : 1));
+    printf("errors: busy %lu, nodev %lu, unplugs %lu\n",
+           counters.busy, counters.nodev, counters.unplugs);
+    printf("reconfigurations %lu, duration us: mean %lu, max %lu\n",
+           reconfigurations, reconfigurations ? reconfigure_total / reconfigurations : 0UL,
+           reconfigure_max);
+    printf("presses %lu, detection latency us: p50 %lu, p90 %lu, p99 %lu, max %lu\n",
+           counters.presses, bench_percentile(samples, n, 50), bench_percentile(samples, n, 90),
+           bench_percentile(samples, n, 99), (n > 0) ? samples[n - 1] : 0UL);
+
+    char* report = stats_report();
+    if (report != NULL) {
+        fputs(report, stdout);
+        free(report);
+    }
+    return EXIT_SUCCESS;
+}
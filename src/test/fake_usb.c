@@ -0,0 +1,369 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "common.h"
+#include "scanbuttond/libusbi.h"
+#include "fake_usb.h"
+#include <stdatomic.h>
+
+// the number of detection latencies recorded (further ones are dropped)
+#define FAKE_USB_SAMPLES (1 << 20)
+
+struct fake_usb_device {
+    int number;                  // the device number of the location (1 ...)
+    atomic_bool present;
+    atomic_ulong replug_at;      // the time the unplugged device is back (us)
+    int command;                 // the command written, read next
+    unsigned long detected;      // the last press seen (+1)
+};
+typedef struct fake_usb_device fake_usb_device_t;
+
+static fake_usb_config_t fake_config;
+static fake_usb_device_t* fake_devices = NULL;
+static struct timespec fake_start;
+
+static atomic_ullong fake_seed;
+static atomic_int fake_changes;
+static atomic_ulong fake_transfers;
+static atomic_ulong fake_queries;
+static atomic_ulong fake_opens;
+static atomic_ulong fake_busy;
+static atomic_ulong fake_nodev;
+static atomic_ulong fake_unplugs;
+static atomic_ulong fake_rescans;
+static atomic_ulong fake_presses;
+static unsigned long* fake_samples = NULL;
+static atomic_int fake_num_samples;
+
+static unsigned long fake_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)(now.tv_sec - fake_start.tv_sec) * 1000000UL +
+        (unsigned long)((now.tv_nsec - fake_start.tv_nsec) / 1000);
+}
+
+// the duration of the transfer
+static void fake_latency(void) {
+    if (fake_config.latency > 0) {
+        struct timespec ts = {fake_config.latency / 1000000,
+                              (long)(fake_config.latency % 1000000) * 1000L};
+        nanosleep(&ts, NULL);
+    }
+}
+
+// returns true with the probability p (splitmix64 of a shared sequence)
+static bool fake_chance(double p) {
+    if (p <= 0.0) {
+        return false;
+    }
+    unsigned long long z = atomic_fetch_add_explicit(&fake_seed, 0x9e3779b97f4a7c15ULL,
+                                                     memory_order_relaxed);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (double)(z >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+static void fake_record(unsigned long usec) {
+    int n = atomic_fetch_add_explicit(&fake_num_samples, 1, memory_order_relaxed);
+    if (n < FAKE_USB_SAMPLES) {
+        fake_samples[n] = usec;
+    }
+}
+
+// the device at the location of device, NULL if there is none
+static fake_usb_device_t* fake_device(const libusb_device_t* device) {
+    int bus = -1;
+    int number = -1;
+    if ((device == NULL) || (device->location == NULL) ||
+        (sscanf(device->location, "%d:%d", &bus, &number) != 2) ||
+        (bus != 0) || (number < 1) || (number > fake_config.devices)) {
+        return NULL;
+    }
+    return &fake_devices[number - 1];
+}
+
+// plugs in the unplugged devices whose replug time has come
+static void fake_replug(void) {
+    unsigned long now = fake_now();
+    for(int i = 0; i < fake_config.devices; i += 1) {
+        fake_usb_device_t* d = &fake_devices[i];
+        if (!atomic_load(&d->present) && (atomic_load(&d->replug_at) <= now)) {
+            bool expected = false;
+            if (atomic_compare_exchange_strong(&d->present, &expected, true)) {
+                atomic_fetch_add(&fake_changes, 1);
+            }
+        }
+    }
+}
+
+static void fake_unplug(fake_usb_device_t* d) {
+    atomic_store(&d->replug_at, fake_now() + (unsigned long)fake_config.replug * 1000UL);
+    bool expected = true;
+    if (atomic_compare_exchange_strong(&d->present, &expected, false)) {
+        atomic_fetch_add(&fake_changes, 1);
+        atomic_fetch_add_explicit(&fake_unplugs, 1, memory_order_relaxed);
+    }
+}
+
+// the start of a transfer: its duration and the injected unplug
+// returns the device or NULL if it isn't present (-ENODEV)
+static fake_usb_device_t* fake_transfer(const libusb_device_t* device) {
+    atomic_fetch_add_explicit(&fake_transfers, 1, memory_order_relaxed);
+    fake_latency();
+    fake_usb_device_t* d = fake_device(device);
+    if ((d != NULL) && atomic_load(&d->present) && fake_chance(fake_config.unplug)) {
+        fake_unplug(d);
+    }
+    if ((d == NULL) || !atomic_load(&d->present)) {
+        atomic_fetch_add_explicit(&fake_nodev, 1, memory_order_relaxed);
+        return NULL;
+    }
+    return d;
+}
+
+// the mask of the pressed buttons of d at the actual time
+static unsigned int fake_buttons(fake_usb_device_t* d) {
+    atomic_fetch_add_explicit(&fake_queries, 1, memory_order_relaxed);
+    if (fake_config.rate <= 0) {
+        return 0;
+    }
+    unsigned long period = (unsigned long)(1000000.0 / fake_config.rate);
+    if (period == 0) {
+        period = 1;
+    }
+    unsigned long phase = ((unsigned long)d->number * 7919UL) % period;
+    unsigned long now = fake_now();
+    if (now < phase) {
+        return 0;
+    }
+    unsigned long t = now - phase;
+    unsigned long press = t / period;
+    unsigned long since = t % period;
+    if (since >= (unsigned long)fake_config.press * 1000UL) {
+        return 0;
+    }
+    // a device is queried by one poller at a time
+    if (d->detected != press + 1) {
+        d->detected = press + 1;
+        atomic_fetch_add_explicit(&fake_presses, 1, memory_order_relaxed);
+        fake_record(since);
+    }
+    return 1U << (press % (unsigned long)fake_config.buttons);
+}
+
+// the transport
+
+static void fake_rescan(libusb_handle_t* handle) {
+    atomic_fetch_add_explicit(&fake_rescans, 1, memory_order_relaxed);
+    fake_replug();
+    for(int i = fake_config.devices - 1; i >= 0; i -= 1) {
+        fake_usb_device_t* d = &fake_devices[i];
+        if (!atomic_load(&d->present)) {
+            continue;
+        }
+        libusb_device_t* device = (libusb_device_t*)malloc(sizeof(libusb_device_t));
+        char* location = (char*)malloc(16);
+        assert((device != NULL) && (location != NULL));
+        snprintf(location, 16, "000:%03d", d->number);
+        device->vendorID = FAKE_USB_VENDOR;
+        device->productID = FAKE_USB_PRODUCT;
+        device->location = location;
+        device->device = NULL;
+        device->handle = NULL;
+        device->interface = 0;
+        device->out_endpoint = 0x01;
+        device->in_endpoint = 0x82;
+        device->intr_endpoint = 0;
+        device->next = handle->devices;
+        handle->devices = device;
+    }
+}
+
+static int fake_changed(void) {
+    fake_replug();
+    return atomic_exchange(&fake_changes, 0);
+}
+
+static int fake_open(libusb_device_t* device) {
+    atomic_fetch_add_explicit(&fake_opens, 1, memory_order_relaxed);
+    fake_latency();
+    fake_usb_device_t* d = fake_device(device);
+    if ((d == NULL) || !atomic_load(&d->present)) {
+        atomic_fetch_add_explicit(&fake_nodev, 1, memory_order_relaxed);
+        return -ENODEV;
+    }
+    if (fake_chance(fake_config.busy)) {
+        atomic_fetch_add_explicit(&fake_busy, 1, memory_order_relaxed);
+        return -EBUSY;
+    }
+    d->command = 0;
+    return 0;
+}
+
+static int fake_close(libusb_device_t* device) {
+    (void)device;
+    return 0;
+}
+
+static int fake_read(libusb_device_t* device, void* buffer, int bytecount) {
+    fake_usb_device_t* d = fake_transfer(device);
+    if (d == NULL) {
+        return -ENODEV;
+    }
+    int command = d->command;
+    d->command = 0;
+    if ((command != FAKE_USB_CMD_BUTTON) || (bytecount < 1)) {
+        return 0;
+    }
+    unsigned int mask = fake_buttons(d);
+    unsigned char button = 0;
+    for(int b = 0; b < fake_config.buttons; b += 1) {
+        if (mask & (1U << b)) {
+            button = (unsigned char)(b + 1);
+        }
+    }
+    *(unsigned char*)buffer = button;
+    return 1;
+}
+
+static int fake_write(libusb_device_t* device, void* buffer, int bytecount) {
+    fake_usb_device_t* d = fake_transfer(device);
+    if (d == NULL) {
+        return -ENODEV;
+    }
+    if (bytecount < 1) {
+        return 0;
+    }
+    d->command = *(unsigned char*)buffer;
+    return bytecount;
+}
+
+static int fake_interrupt_read(libusb_device_t* device, void* buffer, int bytecount, int timeout) {
+    (void)device;
+    (void)buffer;
+    (void)bytecount;
+    (void)timeout;
+    // no interrupt endpoint
+    return -ENOSYS;
+}
+
+static void fake_flush(libusb_device_t* device) {
+    fake_usb_device_t* d = fake_device(device);
+    if (d != NULL) {
+        d->command = 0;
+    }
+}
+
+static int fake_control_msg(libusb_device_t* device, int requesttype, int request,
+                            int value, int index, void* bytes, int size) {
+    (void)requesttype;
+    (void)value;
+    (void)index;
+    fake_usb_device_t* d = fake_transfer(device);
+    if (d == NULL) {
+        return -ENODEV;
+    }
+    if ((request != FAKE_USB_REQ_BUTTONS) || (size < 4)) {
+        return 0;
+    }
+    unsigned int mask = fake_buttons(d);
+    unsigned char* b = (unsigned char*)bytes;
+    b[0] = mask & 0xff;
+    b[1] = (mask >> 8) & 0xff;
+    b[2] = (mask >> 16) & 0xff;
+    b[3] = (mask >> 24) & 0xff;
+    return 4;
+}
+
+static const libusb_transport_t fake_transport = {
+    .rescan = fake_rescan,
+    .changed = fake_changed,
+    .open = fake_open,
+    .close = fake_close,
+    .read = fake_read,
+    .write = fake_write,
+    .interrupt_read = fake_interrupt_read,
+    .flush = fake_flush,
+    .control_msg = fake_control_msg
+};
+
+void fake_usb_setup(const fake_usb_config_t* config) {
+    assert(config != NULL);
+    assert(config->devices > 0);
+    assert((config->buttons > 0) && (config->buttons <= FAKE_USB_MAX_BUTTONS));
+    fake_config = *config;
+
+    fake_devices = calloc(fake_config.devices, sizeof(fake_usb_device_t));
+    fake_samples = calloc(FAKE_USB_SAMPLES, sizeof(unsigned long));
+    assert((fake_devices != NULL) && (fake_samples != NULL));
+    for(int i = 0; i < fake_config.devices; i += 1) {
+        fake_devices[i].number = i + 1;
+        atomic_init(&fake_devices[i].present, true);
+        atomic_init(&fake_devices[i].replug_at, 0);
+    }
+    atomic_store(&fake_seed, 0x5eedULL);
+    clock_gettime(CLOCK_MONOTONIC, &fake_start);
+    libusb_set_transport(&fake_transport);
+}
+
+void fake_usb_counters(fake_usb_counters_t* counters) {
+    assert(counters != NULL);
+    counters->transfers = atomic_load(&fake_transfers);
+    counters->queries = atomic_load(&fake_queries);
+    counters->opens = atomic_load(&fake_opens);
+    counters->busy = atomic_load(&fake_busy);
+    counters->nodev = atomic_load(&fake_nodev);
+    counters->unplugs = atomic_load(&fake_unplugs);
+    counters->rescans = atomic_load(&fake_rescans);
+    counters->presses = atomic_load(&fake_presses);
+}
+
+void fake_usb_reset(void) {
+    atomic_store(&fake_transfers, 0);
+    atomic_store(&fake_queries, 0);
+    atomic_store(&fake_opens, 0);
+    atomic_store(&fake_busy, 0);
+    atomic_store(&fake_nodev, 0);
+    atomic_store(&fake_unplugs, 0);
+    atomic_store(&fake_rescans, 0);
+    atomic_store(&fake_presses, 0);
+    atomic_store(&fake_num_samples, 0);
+}
+
+static int fake_compare(const void* a, const void* b) {
+    unsigned long x = *(const unsigned long*)a;
+    unsigned long y = *(const unsigned long*)b;
+    return (x > y) - (x < y);
+}
+
+int fake_usb_latencies(const unsigned long** samples) {
+    assert(samples != NULL);
+    int n = atomic_load(&fake_num_samples);
+    if (n > FAKE_USB_SAMPLES) {
+        n = FAKE_USB_SAMPLES;
+    }
+    qsort(fake_samples, n, sizeof(unsigned long), fake_compare);
+    *samples = fake_samples;
+    return n;
+}
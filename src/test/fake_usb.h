@@ -0,0 +1,85 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef FAKE_USB_H
+#define FAKE_USB_H
+
+// a fake usb transport of libusbi (see libusb_set_transport()) for the
+// benchmark of the scanbuttond polling loop: it simulates a number of
+// scanners (vendor FAKE_USB_VENDOR) at the locations "000:001",
+// "000:002", ... spoken to by the mock backend (mock_backend.c):
+//   control_msg(FAKE_USB_REQ_BUTTONS)  the mask of the pressed buttons
+//                                      (4 bytes, little endian)
+//   write(FAKE_USB_CMD_BUTTON), read   the (highest) pressed button
+//                                      (1 byte, 0 if none)
+// The buttons of a device are pressed in sequence (1, 2, ... buttons,
+// 1, ...) rate times per second for press ms each (with a fixed phase
+// per device). Each transfer and open takes latency us, an open fails
+// with -EBUSY with the probability busy, a transfer unplugs the device
+// with the probability unplug (-ENODEV until it is plugged in again
+// after replug ms, both are reported as changes). The first query
+// that sees a press records the detection latency.
+
+#define FAKE_USB_VENDOR 0xfeed
+#define FAKE_USB_PRODUCT 0x0001
+#define FAKE_USB_MAX_BUTTONS 32
+
+#define FAKE_USB_REQ_BUTTONS 0x01
+#define FAKE_USB_CMD_BUTTON 0x42
+
+struct fake_usb_config {
+    int devices;                 // the number of devices
+    int buttons;                 // the buttons per device (1 .. FAKE_USB_MAX_BUTTONS)
+    double rate;                 // the presses per second and device
+    int press;                   // the duration of a press (ms)
+    int latency;                 // the duration of each transfer and open (us)
+    double busy;                 // the probability of -EBUSY per open
+    double unplug;               // the probability of an unplug per transfer
+    int replug;                  // the time until an unplugged device is back (ms)
+};
+typedef struct fake_usb_config fake_usb_config_t;
+
+struct fake_usb_counters {
+    unsigned long transfers;     // transfers (read, write, control_msg)
+    unsigned long queries;       // button queries (one per poll cycle)
+    unsigned long opens;         // libusb_open() calls
+    unsigned long busy;          // opens failed with -EBUSY
+    unsigned long nodev;         // calls failed with -ENODEV
+    unsigned long unplugs;       // unplugged devices
+    unsigned long rescans;       // rescans of the device list
+    unsigned long presses;       // presses seen by a query
+};
+typedef struct fake_usb_counters fake_usb_counters_t;
+
+// sets up the devices and installs the transport, must be called
+// before libusb_init()
+extern void fake_usb_setup(const fake_usb_config_t* config);
+// the counters since the last reset
+extern void fake_usb_counters(fake_usb_counters_t* counters);
+// resets the counters and the recorded detection latencies
+extern void fake_usb_reset(void);
+// sorts the recorded detection latencies (us) and returns them in
+// *samples, returns their number
+extern int fake_usb_latencies(const unsigned long** samples);
+
+#endif // FAKE_USB_H
@@ -0,0 +1,231 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+// the mock backend of the benchmark of the scanbuttond polling loop
+// (built as mock.so, loaded by the meta backend): it drives the
+// scanners of the fake usb transport (see fake_usb.h), all buttons
+// are reported in one control message, the single button query is a
+// write and a read like the epson backend does
+// With SCANBD_MOCK_SINGLE_BUTTON set in the environment the backend
+// only reports single buttons (scanbtnd_get_buttons() is -ENOSYS).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include "scanbuttond/scanbuttond.h"
+#include "scanbuttond/libusbi.h"
+#include "scanbuttond/backend.h"
+#include "fake_usb.h"
+
+static char* backend_name = "Mock";
+
+static libusb_handle_t* libusb_handle;
+static scanner_t* mock_scanners = NULL;
+static int mock_single_button = 0;
+
+
+int scanbtnd_match_device(libusb_device_t* device)
+{
+    return (device->vendorID == FAKE_USB_VENDOR) && (device->productID == FAKE_USB_PRODUCT);
+}
+
+
+static void mock_attach_libusb_scanner(libusb_device_t* device)
+{
+    const char* descriptor_prefix = "mock:libusb:";
+    scanner_t* scanner = (scanner_t*)malloc(sizeof(scanner_t));
+    scanner->vendor = "scanbd";
+    scanner->product = "mock";
+    scanner->connection = CONNECTION_LIBUSB;
+    scanner->internal_dev_ptr = (void*)device;
+    scanner->lastbutton = 0;
+    scanner->sane_device = (char*)malloc(strlen(device->location) +
+                                         strlen(descriptor_prefix) + 1);
+    strcpy(scanner->sane_device, descriptor_prefix);
+    strcat(scanner->sane_device, device->location);
+    // the number of buttons is only known to the transport
+    const char* buttons = getenv("SCANBD_MOCK_BUTTONS");
+    scanner->num_buttons = buttons ? atoi(buttons) : 4;
+    if ((scanner->num_buttons < 1) || (scanner->num_buttons > FAKE_USB_MAX_BUTTONS))
+        scanner->num_buttons = 4;
+    scanner->is_open = 0;
+    scanner->next = mock_scanners;
+    mock_scanners = scanner;
+}
+
+
+static void mock_detach_scanners(void)
+{
+    scanner_t* next;
+    while (mock_scanners != NULL) {
+        next = mock_scanners->next;
+        free(mock_scanners->sane_device);
+        free(mock_scanners);
+        mock_scanners = next;
+    }
+}
+
+
+static void mock_scan_devices(libusb_device_t* devices)
+{
+    libusb_device_t* device = devices;
+    while (device != NULL) {
+        if (scanbtnd_match_device(device))
+            mock_attach_libusb_scanner(device);
+        device = device->next;
+    }
+}
+
+
+const char* scanbtnd_get_backend_name(void)
+{
+    return backend_name;
+}
+
+
+int scanbtnd_init(void)
+{
+    mock_scanners = NULL;
+    mock_single_button = (getenv("SCANBD_MOCK_SINGLE_BUTTON") != NULL);
+
+    syslog(LOG_INFO, "mock-backend: init");
+    libusb_handle = libusb_init();
+    mock_scan_devices(libusb_get_devices(libusb_handle));
+    return 0;
+}
+
+
+int scanbtnd_rescan(void)
+{
+    mock_detach_scanners();
+    libusb_rescan(libusb_handle);
+    mock_scan_devices(libusb_get_devices(libusb_handle));
+    return 0;
+}
+
+
+const scanner_t* scanbtnd_get_supported_devices(void)
+{
+    return mock_scanners;
+}
+
+
+int scanbtnd_open(scanner_t* scanner)
+{
+    int result;
+    if (scanner->is_open)
+        return -EINVAL;
+    // if devices have been added/removed, return -ENODEV to
+    // make scanbd update its device list
+    if (libusb_get_changed_device_count() != 0)
+        return -ENODEV;
+    result = libusb_open((libusb_device_t*)scanner->internal_dev_ptr);
+    if (result == 0)
+        scanner->is_open = 1;
+    return result;
+}
+
+
+int scanbtnd_close(scanner_t* scanner)
+{
+    int result;
+    if (!scanner->is_open)
+        return -EINVAL;
+    result = libusb_close((libusb_device_t*)scanner->internal_dev_ptr);
+    if (result == 0)
+        scanner->is_open = 0;
+    return result;
+}
+
+
+int scanbtnd_get_button(scanner_t* scanner)
+{
+    libusb_device_t* device = (libusb_device_t*)scanner->internal_dev_ptr;
+    unsigned char bytes[1];
+    int num_bytes;
+
+    if (!scanner->is_open)
+        return -EINVAL;
+
+    bytes[0] = FAKE_USB_CMD_BUTTON;
+    num_bytes = libusb_write(device, (void*)bytes, 1);
+    if (num_bytes != 1) {
+        syslog(LOG_WARNING, "mock-backend: communication error: "
+               "write length:%d (expected:%d)", num_bytes, 1);
+        libusb_flush(device);
+        return (num_bytes < 0) ? num_bytes : 0;
+    }
+    num_bytes = libusb_read(device, (void*)bytes, 1);
+    if (num_bytes != 1) {
+        syslog(LOG_WARNING, "mock-backend: communication error: "
+               "read length:%d (expected:%d)", num_bytes, 1);
+        libusb_flush(device);
+        return (num_bytes < 0) ? num_bytes : 0;
+    }
+    return bytes[0];
+}
+
+
+int scanbtnd_get_buttons(scanner_t* scanner, int* buttons, int num_buttons)
+{
+    unsigned char bytes[4];
+    int num_bytes;
+    int pressed = 0;
+
+    if (mock_single_button)
+        return -ENOSYS;
+    if (!scanner->is_open)
+        return -EINVAL;
+
+    num_bytes = libusb_control_msg((libusb_device_t*)scanner->internal_dev_ptr,
+                                   0xc0, FAKE_USB_REQ_BUTTONS, 0, 0, (void*)bytes, 4);
+    if (num_bytes != 4) {
+        syslog(LOG_WARNING, "mock-backend: communication error: "
+               "read length:%d (expected:%d)", num_bytes, 4);
+        return (num_bytes < 0) ? num_bytes : -EIO;
+    }
+    unsigned int mask = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) |
+        ((unsigned int)bytes[3] << 24);
+    for (int b = 0; b < num_buttons; b++) {
+        buttons[b] = (b < FAKE_USB_MAX_BUTTONS) && (mask & (1U << b));
+        pressed += buttons[b] ? 1 : 0;
+    }
+    return pressed;
+}
+
+
+const char* scanbtnd_get_sane_device_descriptor(scanner_t* scanner)
+{
+    return scanner->sane_device;
+}
+
+
+int scanbtnd_exit(void)
+{
+    syslog(LOG_INFO, "mock-backend: exit");
+    mock_detach_scanners();
+    libusb_exit(libusb_handle);
+    return 0;
+}
@@ -0,0 +1,366 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#include "common.h"
+#include "mock_sane.h"
+#include <stdatomic.h>
+
+// the number of detection latencies recorded (further ones are dropped)
+#define MOCK_SANE_SAMPLES (1 << 20)
+
+#define MOCK_SANE_MODE "Color"
+
+struct mock_sane_device;
+
+// a device plugged in: each plug is a SANE device of its own (with
+// its own name), the handle of the opened device
+struct mock_sane_plug {
+    SANE_Device device;
+    char name[32];
+    struct mock_sane_device* dev;
+    unsigned int generation;
+};
+typedef struct mock_sane_plug mock_sane_plug_t;
+
+struct mock_sane_device {
+    int number;
+    unsigned long* detected;     // the last press seen per button (+1)
+    mock_sane_plug_t* plug;      // the last plug
+    atomic_bool present;
+    atomic_uint generation;      // the generation of the last plug
+    atomic_ulong plugged;        // the time of the last plug (us)
+    atomic_ulong queried;        // the time of the last poll cycle (us)
+};
+typedef struct mock_sane_device mock_sane_device_t;
+
+static mock_sane_config_t mock_config;
+static mock_sane_device_t* mock_devices = NULL;
+static const SANE_Device** mock_device_list = NULL;
+static SANE_Option_Descriptor* mock_descs = NULL;
+static char (*mock_names)[32] = NULL;
+static struct timespec mock_start;
+// protects the plugs and the device list
+static pthread_mutex_t mock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_ulong mock_calls;
+static atomic_ulong mock_cycles;
+static atomic_ulong mock_opens;
+static atomic_ulong mock_presses;
+static unsigned long* mock_samples = NULL;
+static atomic_int mock_num_samples;
+
+unsigned long mock_sane_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)(now.tv_sec - mock_start.tv_sec) * 1000000UL +
+        (unsigned long)((now.tv_nsec - mock_start.tv_nsec) / 1000);
+}
+
+// the duration of the backend call of the device number d
+static void mock_latency(int d) {
+    int latency = ((d > 0) && (mock_config.slow_latency > 0))
+        ? mock_config.slow_latency : mock_config.latency;
+    if (latency > 0) {
+        struct timespec ts = {latency / 1000000, (long)(latency % 1000000) * 1000L};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void mock_record(unsigned long usec) {
+    int n = atomic_fetch_add_explicit(&mock_num_samples, 1, memory_order_relaxed);
+    if (n < MOCK_SANE_SAMPLES) {
+        mock_samples[n] = usec;
+    }
+}
+
+// a new plug of d (with the mutex)
+static void mock_plug(mock_sane_device_t* d, unsigned int generation) {
+    mock_sane_plug_t* plug = calloc(1, sizeof(mock_sane_plug_t));
+    assert(plug != NULL);
+    if (generation == 0) {
+        snprintf(plug->name, sizeof(plug->name), "mock:%d", d->number);
+    }
+    else {
+        snprintf(plug->name, sizeof(plug->name), "mock:%d.%u", d->number, generation);
+    }
+    plug->dev = d;
+    plug->generation = generation;
+    plug->device.name = plug->name;
+    plug->device.vendor = "scanbd";
+    plug->device.model = "mock";
+    plug->device.type = "virtual device";
+    // the old plugs stay valid for the pollers still using them
+    d->plug = plug;
+    atomic_store(&d->generation, generation);
+    atomic_store(&d->plugged, mock_sane_now());
+    atomic_store(&d->present, true);
+}
+
+// the value of button b (0 ...) of device d at the actual time
+static SANE_Word mock_button(mock_sane_device_t* d, int b) {
+    if (mock_config.rate <= 0) {
+        return 0;
+    }
+    unsigned long period = (unsigned long)(1000000.0 / mock_config.rate);
+    if (period == 0) {
+        period = 1;
+    }
+    unsigned long phase = ((unsigned long)d->number * 7919UL + (unsigned long)b * 104729UL) % period;
+    unsigned long now = mock_sane_now();
+    if (now < phase) {
+        return 0;
+    }
+    unsigned long t = now - phase;
+    unsigned long press = t / period;
+    unsigned long since = t % period;
+    if (since >= (unsigned long)mock_config.press * 1000UL) {
+        return 0;
+    }
+    // a device is queried by one poller at a time
+    if (d->detected[b] != press + 1) {
+        d->detected[b] = press + 1;
+        atomic_fetch_add_explicit(&mock_presses, 1, memory_order_relaxed);
+        mock_record(since);
+    }
+    return 1;
+}
+
+void mock_sane_setup(const mock_sane_config_t* config) {
+    assert(config != NULL);
+    assert(config->devices > 0);
+    assert(config->buttons > 0);
+    mock_config = *config;
+    if (mock_config.options < mock_config.buttons + 2) {
+        mock_config.options = mock_config.buttons + 2;
+    }
+
+    mock_descs = calloc(mock_config.options, sizeof(SANE_Option_Descriptor));
+    mock_names = calloc(mock_config.options, sizeof(*mock_names));
+    assert((mock_descs != NULL) && (mock_names != NULL));
+    for(int o = 0; o < mock_config.options; o += 1) {
+        SANE_Option_Descriptor* desc = &mock_descs[o];
+        desc->type = SANE_TYPE_INT;
+        desc->size = sizeof(SANE_Word);
+        desc->cap = SANE_CAP_SOFT_SELECT | SANE_CAP_SOFT_DETECT;
+        if (o == 0) {
+            snprintf(mock_names[o], sizeof(mock_names[o]), "%s", "");
+            desc->cap = SANE_CAP_SOFT_DETECT;
+        }
+        else if (o <= mock_config.buttons) {
+            snprintf(mock_names[o], sizeof(mock_names[o]), "scan-%d", o);
+            desc->type = SANE_TYPE_BOOL;
+            desc->cap = SANE_CAP_HARD_SELECT | SANE_CAP_SOFT_DETECT;
+        }
+        else if (o == mock_config.buttons + 1) {
+            snprintf(mock_names[o], sizeof(mock_names[o]), "%s", "mode");
+            desc->type = SANE_TYPE_STRING;
+            desc->size = 16;
+        }
+        else {
+            snprintf(mock_names[o], sizeof(mock_names[o]), "opt-%d", o);
+        }
+        desc->name = mock_names[o];
+        desc->title = mock_names[o];
+        desc->desc = mock_names[o];
+    }
+
+    mock_devices = calloc(mock_config.devices, sizeof(mock_sane_device_t));
+    mock_device_list = calloc(mock_config.devices + 1, sizeof(SANE_Device*));
+    mock_samples = calloc(MOCK_SANE_SAMPLES, sizeof(unsigned long));
+    assert((mock_devices != NULL) && (mock_device_list != NULL) && (mock_samples != NULL));
+    clock_gettime(CLOCK_MONOTONIC, &mock_start);
+    for(int d = 0; d < mock_config.devices; d += 1) {
+        mock_sane_device_t* dev = &mock_devices[d];
+        dev->number = d;
+        dev->detected = calloc(mock_config.buttons, sizeof(unsigned long));
+        assert(dev->detected != NULL);
+        mock_plug(dev, 0);
+    }
+}
+
+void mock_sane_plug(int device, bool present) {
+    assert((device >= 0) && (device < mock_config.devices));
+    mock_sane_device_t* d = &mock_devices[device];
+    pthread_mutex_lock(&mock_mutex);
+    if (present && !atomic_load(&d->present)) {
+        mock_plug(d, atomic_load(&d->generation) + 1);
+    }
+    else if (!present) {
+        atomic_store(&d->present, false);
+    }
+    pthread_mutex_unlock(&mock_mutex);
+}
+
+bool mock_sane_ready(unsigned long since) {
+    for(int i = 0; i < mock_config.devices; i += 1) {
+        mock_sane_device_t* d = &mock_devices[i];
+        if (!atomic_load(&d->present)) {
+            continue;
+        }
+        unsigned long queried = atomic_load(&d->queried);
+        if ((queried <= since) || (queried <= atomic_load(&d->plugged))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void mock_sane_counters(mock_sane_counters_t* counters) {
+    assert(counters != NULL);
+    counters->calls = atomic_load(&mock_calls);
+    counters->cycles = atomic_load(&mock_cycles);
+    counters->opens = atomic_load(&mock_opens);
+    counters->presses = atomic_load(&mock_presses);
+}
+
+void mock_sane_reset(void) {
+    atomic_store(&mock_calls, 0);
+    atomic_store(&mock_cycles, 0);
+    atomic_store(&mock_opens, 0);
+    atomic_store(&mock_presses, 0);
+    atomic_store(&mock_num_samples, 0);
+}
+
+static int mock_compare(const void* a, const void* b) {
+    unsigned long x = *(const unsigned long*)a;
+    unsigned long y = *(const unsigned long*)b;
+    return (x > y) - (x < y);
+}
+
+int mock_sane_latencies(const unsigned long** samples) {
+    assert(samples != NULL);
+    int n = atomic_load(&mock_num_samples);
+    if (n > MOCK_SANE_SAMPLES) {
+        n = MOCK_SANE_SAMPLES;
+    }
+    qsort(mock_samples, n, sizeof(unsigned long), mock_compare);
+    *samples = mock_samples;
+    return n;
+}
+
+// the SANE API used by scanbd
+
+SANE_Status sane_init(SANE_Int* version_code, SANE_Auth_Callback authorize) {
+    (void)authorize;
+    if (version_code != NULL) {
+        *version_code = SANE_VERSION_CODE(SANE_CURRENT_MAJOR, 0, 0);
+    }
+    return (mock_devices != NULL) ? SANE_STATUS_GOOD : SANE_STATUS_INVAL;
+}
+
+void sane_exit(void) {
+}
+
+SANE_Status sane_get_devices(const SANE_Device*** device_list, SANE_Bool local_only) {
+    (void)local_only;
+    assert(device_list != NULL);
+    if (mock_config.discovery > 0) {
+        struct timespec ts = {mock_config.discovery / 1000,
+                              (long)(mock_config.discovery % 1000) * 1000000L};
+        nanosleep(&ts, NULL);
+    }
+    // the list of the present devices, valid until the next call
+    int n = 0;
+    pthread_mutex_lock(&mock_mutex);
+    for(int d = 0; d < mock_config.devices; d += 1) {
+        if (atomic_load(&mock_devices[d].present)) {
+            mock_device_list[n++] = &mock_devices[d].plug->device;
+        }
+    }
+    mock_device_list[n] = NULL;
+    pthread_mutex_unlock(&mock_mutex);
+    *device_list = mock_device_list;
+    return SANE_STATUS_GOOD;
+}
+
+SANE_Status sane_open(SANE_String_Const devicename, SANE_Handle* handle) {
+    assert(handle != NULL);
+    atomic_fetch_add_explicit(&mock_opens, 1, memory_order_relaxed);
+    int d = -1;
+    if ((sscanf(devicename, "mock:%d", &d) != 1) || (d < 0) || (d >= mock_config.devices)) {
+        mock_latency(0);
+        return SANE_STATUS_INVAL;
+    }
+    mock_latency(d);
+    // only the name of the actual plug can be opened
+    SANE_Status status = SANE_STATUS_INVAL;
+    pthread_mutex_lock(&mock_mutex);
+    mock_sane_device_t* dev = &mock_devices[d];
+    if (atomic_load(&dev->present) && (strcmp(dev->plug->name, devicename) == 0)) {
+        *handle = dev->plug;
+        status = SANE_STATUS_GOOD;
+    }
+    pthread_mutex_unlock(&mock_mutex);
+    return status;
+}
+
+void sane_close(SANE_Handle handle) {
+    (void)handle;
+}
+
+const SANE_Option_Descriptor* sane_get_option_descriptor(SANE_Handle handle, SANE_Int option) {
+    if ((handle == NULL) || (option < 0) || (option >= mock_config.options)) {
+        return NULL;
+    }
+    return &mock_descs[option];
+}
+
+SANE_Status sane_control_option(SANE_Handle handle, SANE_Int option, SANE_Action action,
+                                void* value, SANE_Int* info) {
+    mock_sane_plug_t* plug = (mock_sane_plug_t*)handle;
+    if (info != NULL) {
+        *info = 0;
+    }
+    if ((plug == NULL) || (option < 0) || (option >= mock_config.options) ||
+        (action != SANE_ACTION_GET_VALUE) || (value == NULL)) {
+        return SANE_STATUS_INVAL;
+    }
+    mock_sane_device_t* d = plug->dev;
+    atomic_fetch_add_explicit(&mock_calls, 1, memory_order_relaxed);
+    mock_latency(d->number);
+    // the handle of an unplugged device (or of an older plug) is dead
+    if (!atomic_load(&d->present) || (atomic_load(&d->generation) != plug->generation)) {
+        return SANE_STATUS_IO_ERROR;
+    }
+    if (option == 0) {
+        *(SANE_Word*)value = mock_config.options;
+    }
+    else if (option <= mock_config.buttons) {
+        if (option == 1) {
+            atomic_fetch_add_explicit(&mock_cycles, 1, memory_order_relaxed);
+            atomic_store(&d->queried, mock_sane_now());
+        }
+        *(SANE_Word*)value = mock_button(d, option - 1);
+    }
+    else if (option == mock_config.buttons + 1) {
+        snprintf((char*)value, mock_descs[option].size, "%s", MOCK_SANE_MODE);
+    }
+    else {
+        *(SANE_Word*)value = option;
+    }
+    return SANE_STATUS_GOOD;
+}
+
+SANE_String_Const sane_strstatus(SANE_Status status) {
+    return (status == SANE_STATUS_GOOD) ? "Success" : "Error";
+}
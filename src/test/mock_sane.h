@@ -0,0 +1,84 @@
+/*
+ * $Id$
+ *
+ *  scanbd - KMUX scanner button daemon
+ *
+ *  Copyright (C) 2008 - 2017 Wilhelm Meier (wilhelm.wm.meier@googlemail.com)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef MOCK_SANE_H
+#define MOCK_SANE_H
+
+#include <stdbool.h>
+#include <sane/sane.h>
+
+// a mock SANE backend for the benchmark of the polling loop: it
+// replaces libsane and simulates a number of devices "mock:0",
+// "mock:1", ... with these options:
+//   0                     the number of options
+//   1 .. buttons          "scan-N" (BOOL), pressed periodically
+//   buttons + 1           "mode" (STRING, "Color")
+//   buttons + 2 ..        "opt-N" (INT), never change
+// Each button is pressed rate times per second for press ms (with a
+// fixed phase per device and button), each query and open takes
+// latency us (the devices but the first slow_latency us, if set, like
+// slow network backends). The first query that sees a press records the
+// detection latency (the time since the start of the press).
+// A device may be unplugged and plugged in again (see mock_sane_plug()),
+// like a usb device it gets a new name then ("mock:N.generation"),
+// the handles of the old name fail with SANE_STATUS_IO_ERROR.
+
+struct mock_sane_config {
+    int devices;                 // the number of devices
+    int options;                 // the options per device (including 0)
+    int buttons;                 // the button options per device (>= 1)
+    double rate;                 // the presses per second and button
+    int press;                   // the duration of a press (ms)
+    int latency;                 // the duration of each backend call (us)
+    int slow_latency;            // the duration of the calls of all
+    // devices but the first (us, 0: latency)
+    int discovery;               // the duration of sane_get_devices() (ms)
+};
+typedef struct mock_sane_config mock_sane_config_t;
+
+struct mock_sane_counters {
+    unsigned long calls;         // sane_control_option() calls
+    unsigned long cycles;        // queries of the first button (one per poll cycle)
+    unsigned long opens;         // sane_open() calls
+    unsigned long presses;       // presses seen by a query
+};
+typedef struct mock_sane_counters mock_sane_counters_t;
+
+// sets up the devices, must be called before sane_init()
+extern void mock_sane_setup(const mock_sane_config_t* config);
+// the counters since the last reset
+extern void mock_sane_counters(mock_sane_counters_t* counters);
+// resets the counters and the recorded detection latencies
+extern void mock_sane_reset(void);
+// sorts the recorded detection latencies (us) and returns them in
+// *samples, returns their number
+extern int mock_sane_latencies(const unsigned long** samples);
+// unplugs (present == false) or plugs in the device number
+extern void mock_sane_plug(int device, bool present);
+// the time since mock_sane_setup() (us)
+extern unsigned long mock_sane_now(void);
+// returns true if all present devices have been queried after since
+// (us, see mock_sane_now()) and after they have been plugged in
+extern bool mock_sane_ready(unsigned long since);
+
+#endif // MOCK_SANE_H